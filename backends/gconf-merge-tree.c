@@ -24,6 +24,19 @@
 #include <locale.h>
 
 #include "markup-tree.c"
+#include "gconf/gconf-locale.h"
+
+typedef struct
+{
+  guint       dirs;
+  guint       entries;
+  guint       schemas;
+  guint       descs;
+  GHashTable *locales;
+  guint64     bytes;
+  guint64     locale_bytes;
+  gdouble     load_time;
+} TreeStats;
 
 guint
 _gconf_mode_t_to_mode (mode_t orig)
@@ -39,14 +52,333 @@ _gconf_mode_t_to_mode (mode_t orig)
   return mode;
 }
 
+static guint64
+file_size (const char *dir,
+           const char *name)
+{
+  struct stat statbuf;
+  char *path;
+  guint64 size = 0;
+
+  path = g_build_filename (dir, name, NULL);
+  if (g_stat (path, &statbuf) == 0)
+    size = statbuf.st_size;
+  g_free (path);
+
+  return size;
+}
+
+/* Sizes of the files a load of the tree would parse, following the
+ * same rules as load_subtree() and load_subdirs()
+ */
+static void
+measure_files (const char *fs_dir,
+               TreeStats  *stats)
+{
+  GDir *dp;
+  const char *dent;
+  char *path;
+
+  dp = g_dir_open (fs_dir, 0, NULL);
+  if (dp == NULL)
+    return;
+
+  path = g_build_filename (fs_dir, "%gconf-tree.xml", NULL);
+  if (g_file_test (path, G_FILE_TEST_EXISTS))
+    {
+      stats->bytes += file_size (fs_dir, "%gconf-tree.xml");
+
+      while ((dent = g_dir_read_name (dp)) != NULL)
+        if (g_str_has_prefix (dent, "%gconf-tree-") &&
+            g_str_has_suffix (dent, ".xml"))
+          stats->locale_bytes += file_size (fs_dir, dent);
+
+      g_free (path);
+      g_dir_close (dp);
+      return;
+    }
+  g_free (path);
+
+  stats->bytes += file_size (fs_dir, "%gconf.xml");
+
+  while ((dent = g_dir_read_name (dp)) != NULL)
+    {
+      char *subdir;
+
+      if (dent[0] == '.' || dent[0] == '%')
+        continue;
+
+      subdir = g_build_filename (fs_dir, dent, NULL);
+      if (g_file_test (subdir, G_FILE_TEST_IS_DIR))
+        measure_files (subdir, stats);
+      g_free (subdir);
+    }
+
+  g_dir_close (dp);
+}
+
+static void
+count_tree (MarkupDir *dir,
+            TreeStats *stats)
+{
+  GSList *tmp;
+
+  stats->dirs += 1;
+
+  for (tmp = dir->entries; tmp != NULL; tmp = tmp->next)
+    {
+      MarkupEntry *entry = tmp->data;
+      GSList *l;
+
+      stats->entries += 1;
+
+      if (entry->value != NULL && entry->value->type == GCONF_VALUE_SCHEMA)
+        stats->schemas += 1;
+
+      for (l = entry->local_schemas; l != NULL; l = l->next)
+        {
+          LocalSchemaInfo *local_schema = l->data;
+
+          stats->descs += 1;
+          g_hash_table_replace (stats->locales,
+                                g_strdup (local_schema->locale), NULL);
+        }
+    }
+
+  for (tmp = dir->subdirs; tmp != NULL; tmp = tmp->next)
+    count_tree (tmp->data, stats);
+}
+
+static void
+load_all_local_descs (MarkupDir *dir)
+{
+  GSList *tmp;
+
+  if (dir->subtree_root == dir && !dir->all_local_descs_loaded)
+    {
+      g_hash_table_foreach (dir->available_local_descs,
+                            (GHFunc) load_schema_descs_foreach,
+                            dir);
+      dir->all_local_descs_loaded = TRUE;
+    }
+
+  for (tmp = dir->subdirs; tmp != NULL; tmp = tmp->next)
+    load_all_local_descs (tmp->data);
+}
+
+/* Loads the whole tree, timing the part every reader pays for:
+ * values and whatever descriptions live in the same files.
+ */
+static MarkupTree *
+load_tree (const char *root_dir,
+           guint       dir_mode,
+           guint       file_mode,
+           TreeStats  *stats)
+{
+  MarkupTree *tree;
+  GTimer *timer;
+
+  tree = markup_tree_get (root_dir, dir_mode, file_mode, TRUE, FALSE);
+
+  timer = g_timer_new ();
+  recursively_load_subtree (tree->root);
+  if (stats)
+    stats->load_time = g_timer_elapsed (timer, NULL);
+  g_timer_destroy (timer);
+
+  load_all_local_descs (tree->root);
+
+  if (stats)
+    {
+      count_tree (tree->root, stats);
+      measure_files (root_dir, stats);
+    }
+
+  return tree;
+}
+
+static void
+print_stats (const char *label,
+             TreeStats  *stats)
+{
+  printf (_("%s: %u dirs, %u entries (%u schemas), %u descriptions in %u locales\n"),
+          label, stats->dirs, stats->entries, stats->schemas, stats->descs,
+          g_hash_table_size (stats->locales));
+  printf (_("  %" G_GUINT64_FORMAT " bytes loaded in %.3f s, "
+            "%" G_GUINT64_FORMAT " bytes of translations in separate files\n"),
+          stats->bytes, stats->load_time, stats->locale_bytes);
+}
+
 static gboolean
-merge_tree (const char *root_dir)
+local_schemas_equal (LocalSchemaInfo *a,
+                     LocalSchemaInfo *b)
+{
+  if (g_strcmp0 (a->short_desc, b->short_desc) != 0 ||
+      g_strcmp0 (a->long_desc, b->long_desc) != 0)
+    return FALSE;
+
+  if (a->default_value == NULL || b->default_value == NULL)
+    return a->default_value == b->default_value;
+
+  return gconf_value_compare (a->default_value, b->default_value) == 0;
+}
+
+static LocalSchemaInfo *
+find_local_schema (GSList     *local_schemas,
+                   const char *locale)
+{
+  for (; local_schemas != NULL; local_schemas = local_schemas->next)
+    {
+      LocalSchemaInfo *local_schema = local_schemas->data;
+
+      if (strcmp (local_schema->locale, locale) == 0)
+        return local_schema;
+    }
+
+  return NULL;
+}
+
+/* Drop translations that say exactly what a lookup for that locale
+ * would fall back to anyway
+ */
+static void
+dedupe_local_schemas (MarkupEntry *entry)
+{
+  GSList *tmp;
+  GSList *kept;
+
+  kept = NULL;
+
+  for (tmp = entry->local_schemas; tmp != NULL; tmp = tmp->next)
+    {
+      LocalSchemaInfo *local_schema = tmp->data;
+      LocalSchemaInfo *fallback;
+      char **variants;
+      int i;
+
+      fallback = NULL;
+
+      if (strcmp (local_schema->locale, "C") != 0)
+        {
+          variants = gconf_split_locale (local_schema->locale);
+
+          for (i = 0; variants[i] != NULL && fallback == NULL; i++)
+            {
+              if (strcmp (variants[i], local_schema->locale) == 0)
+                continue;
+
+              fallback = find_local_schema (kept, variants[i]);
+              if (fallback == NULL)
+                fallback = find_local_schema (tmp->next, variants[i]);
+            }
+
+          g_strfreev (variants);
+        }
+
+      if (fallback != NULL && local_schemas_equal (local_schema, fallback))
+        local_schema_info_free (local_schema);
+      else
+        kept = g_slist_prepend (kept, local_schema);
+    }
+
+  g_slist_free (entry->local_schemas);
+  entry->local_schemas = g_slist_reverse (kept);
+}
+
+static int
+compare_entries (gconstpointer a,
+                 gconstpointer b)
+{
+  return strcmp (((MarkupEntry *) a)->name, ((MarkupEntry *) b)->name);
+}
+
+static int
+compare_dirs (gconstpointer a,
+              gconstpointer b)
+{
+  return strcmp (((MarkupDir *) a)->name, ((MarkupDir *) b)->name);
+}
+
+static void
+optimize_dir (MarkupDir *dir)
+{
+  GSList *tmp;
+
+  for (tmp = dir->entries; tmp != NULL; tmp = tmp->next)
+    dedupe_local_schemas (tmp->data);
+
+  dir->entries = g_slist_sort (dir->entries, compare_entries);
+  dir->subdirs = g_slist_sort (dir->subdirs, compare_dirs);
+
+  for (tmp = dir->subdirs; tmp != NULL; tmp = tmp->next)
+    optimize_dir (tmp->data);
+}
+
+static void
+optimize_tree (MarkupTree *tree)
+{
+  clean_old_local_schemas_recurse (tree->root, TRUE);
+  optimize_dir (tree->root);
+  delete_useless_entries_recurse (tree->root);
+  delete_useless_subdirs_recurse (tree->root);
+}
+
+static void
+collect_desc_locales (MarkupDir  *dir,
+                      GHashTable *locales)
+{
+  GSList *tmp;
+
+  for (tmp = dir->entries; tmp != NULL; tmp = tmp->next)
+    get_non_c_desc_locales (tmp->data, locales);
+
+  for (tmp = dir->subdirs; tmp != NULL; tmp = tmp->next)
+    collect_desc_locales (tmp->data, locales);
+}
+
+/* save_tree() only rewrites the locale files it has something for;
+ * remove the ones that optimizing emptied so they don't come back
+ */
+static void
+remove_stale_locale_files (MarkupDir *root)
+{
+  GHashTable *written;
+  GHashTableIter iter;
+  gpointer locale;
+
+  written = g_hash_table_new (g_str_hash, g_str_equal);
+  collect_desc_locales (root, written);
+
+  g_hash_table_iter_init (&iter, root->available_local_descs);
+  while (g_hash_table_iter_next (&iter, &locale, NULL))
+    {
+      char *markup_file;
+
+      if (g_hash_table_lookup (written, locale))
+        continue;
+
+      markup_file = markup_dir_build_file_path (root, TRUE, locale);
+      if (g_unlink (markup_file) < 0 && errno != ENOENT)
+        fprintf (stderr, _("Could not remove \"%s\": %s\n"),
+                 markup_file, g_strerror (errno));
+      g_free (markup_file);
+    }
+
+  g_hash_table_destroy (written);
+}
+
+static gboolean
+merge_tree (const char *root_dir,
+            gboolean    optimize,
+            gboolean    stats)
 {
   struct stat statbuf;
   guint dir_mode;
   guint file_mode;
   MarkupTree *tree;
   GError *error;
+  TreeStats before;
+  TreeStats after;
 
   if (g_stat (root_dir, &statbuf) == 0)
     {
@@ -61,9 +393,13 @@ merge_tree (const char *root_dir)
 
     }
 
-  tree = markup_tree_get (root_dir, dir_mode, file_mode, TRUE);
+  memset (&before, 0, sizeof (before));
+  before.locales = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
 
-  recursively_load_subtree (tree->root);
+  tree = load_tree (root_dir, dir_mode, file_mode, stats ? &before : NULL);
+
+  if (optimize)
+    optimize_tree (tree);
 
   error = NULL;
   save_tree (tree->root, TRUE, file_mode, &error);
@@ -78,42 +414,89 @@ merge_tree (const char *root_dir)
       g_error_free (error);
       g_free (markup_file);
       markup_tree_unref (tree);
+      g_hash_table_destroy (before.locales);
       return FALSE;
     }
 
+  if (optimize)
+    remove_stale_locale_files (tree->root);
+
   tree->root->entries_need_save = FALSE;
   tree->root->some_subdir_needs_sync = FALSE;
 
   markup_tree_unref (tree);
 
+  if (stats)
+    {
+      memset (&after, 0, sizeof (after));
+      after.locales = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+      tree = load_tree (root_dir, dir_mode, file_mode, &after);
+      markup_tree_unref (tree);
+
+      print_stats (_("Before"), &before);
+      print_stats (_("After"), &after);
+
+      g_hash_table_destroy (after.locales);
+    }
+
+  g_hash_table_destroy (before.locales);
+
   return TRUE;
 }
 
 int
 main (int argc, char **argv)
 {
+  const char *root_dir = NULL;
+  gboolean optimize = FALSE;
+  gboolean stats = FALSE;
+  int i;
+
   setlocale (LC_ALL, "");
   _gconf_init_i18n ();
   textdomain (GETTEXT_PACKAGE);
 
-  if (argc != 2)
+  for (i = 1; i < argc; i++)
     {
-      fprintf (stderr, _("Usage: %s <dir>\n"), argv [0]);
-      return 1;
+      if (!strcmp (argv [i], "--help"))
+        {
+          printf (_("Usage: %s [--optimize] [--stats] <dir>\n"
+                    "  Merges a markup backend filesystem hierarchy like:\n"
+                    "    dir/%%gconf.xml\n"
+                    "        subdir1/%%gconf.xml\n"
+                    "        subdir2/%%gconf.xml\n"
+                    "  to:\n"
+                    "    dir/%%gconf-tree.xml\n"
+                    "  with schema descriptions for each locale in\n"
+                    "    dir/%%gconf-tree-$(locale).xml\n"
+                    "\n"
+                    "  --optimize  drop empty directories and entries, and\n"
+                    "              translations identical to their fallback;\n"
+                    "              write entries and directories sorted by name\n"
+                    "  --stats     print sizes, counts and load times before\n"
+                    "              and after\n"), argv [0]);
+          return 0;
+        }
+      else if (!strcmp (argv [i], "--optimize"))
+        optimize = TRUE;
+      else if (!strcmp (argv [i], "--stats"))
+        stats = TRUE;
+      else if (root_dir == NULL && argv [i][0] != '-')
+        root_dir = argv [i];
+      else
+        {
+          root_dir = NULL;
+          break;
+        }
     }
 
-  if (!strcmp (argv [1], "--help"))
+  if (root_dir == NULL)
     {
-      printf (_("Usage: %s <dir>\n"
-		"  Merges a markup backend filesystem hierarchy like:\n"
-		"    dir/%%gconf.xml\n"
-		"        subdir1/%%gconf.xml\n"
-		"        subdir2/%%gconf.xml\n"
-		"  to:\n"
-		"    dir/%%gconf-tree.xml\n"), argv [0]);
-      return 0;
+      fprintf (stderr, _("Usage: %s [--optimize] [--stats] <dir>\n"), argv [0]);
+      return 1;
     }
 
-  return !merge_tree (argv [1]);
+  return !merge_tree (root_dir, optimize, stats);
 }
 
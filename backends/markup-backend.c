@@ -64,12 +64,14 @@ typedef struct
   guint dir_mode;
   guint file_mode;
   guint merged : 1;
+  guint lazy : 1;
 } MarkupSource;
 
 static MarkupSource* ms_new     (const char   *root_dir,
                                  guint         dir_mode,
                                  guint         file_mode,
                                  gboolean      merged,
+                                 gboolean      lazy,
                                  GConfLock    *lock);
 static void          ms_destroy (MarkupSource *source);
 
@@ -129,6 +131,7 @@ static gboolean       sync_all        (GConfSource       *source,
 static void           destroy_source  (GConfSource       *source);
 static void           clear_cache     (GConfSource       *source);
 static void           blow_away_locks (const char        *address);
+static gsize          cache_size      (GConfSource       *source);
 
 
 static GConfBackendVTable markup_vtable = {
@@ -154,7 +157,8 @@ static GConfBackendVTable markup_vtable = {
   blow_away_locks,
   NULL, /* set_notify_func */
   NULL, /* add_listener    */
-  NULL  /* remove_listener */
+  NULL, /* remove_listener */
+  cache_size
 };
 
 static void          
@@ -263,31 +267,15 @@ resolve_address (const char *address,
   char** iter;
   gboolean force_readonly;
   gboolean merged;
+  gboolean lazy;
 
   root_dir = get_dir_from_address (address, err);
   if (root_dir == NULL)
     return NULL;
 
-  if (g_stat (root_dir, &statbuf) == 0)
-    {
-      /* Already exists, base our dir_mode on it */
-      dir_mode = _gconf_mode_t_to_mode (statbuf.st_mode);
-
-      /* dir_mode without search bits */
-      file_mode = dir_mode & (~0111);
-    }
-  else if (g_mkdir (root_dir, dir_mode) < 0)
-    {
-      /* Error out even on EEXIST - shouldn't happen anyway */
-      gconf_set_error (err, GCONF_ERROR_FAILED,
-		       _("Could not make directory `%s': %s"),
-		       root_dir, g_strerror (errno));
-      g_free (root_dir);
-      return NULL;
-    }
-
   force_readonly = FALSE;
   merged = FALSE;
+  lazy = FALSE;
   
   address_flags = gconf_address_flags (address);  
   if (address_flags)
@@ -303,6 +291,10 @@ resolve_address (const char *address,
             {
               merged = TRUE;
             }
+          else if (strcmp (*iter, "lazy") == 0)
+            {
+              lazy = TRUE;
+            }
 
           ++iter;
         }
@@ -310,6 +302,36 @@ resolve_address (const char *address,
 
   g_strfreev (address_flags);
 
+  /* Lazy parsing is only safe when nothing gets written back */
+  if (!force_readonly)
+    lazy = FALSE;
+
+  if (g_stat (root_dir, &statbuf) == 0)
+    {
+      /* Already exists, base our dir_mode on it */
+      dir_mode = _gconf_mode_t_to_mode (statbuf.st_mode);
+
+      /* dir_mode without search bits */
+      file_mode = dir_mode & (~0111);
+    }
+  else if (lazy)
+    {
+      /* A one-off read; don't leave an empty source behind */
+      gconf_set_error (err, GCONF_ERROR_BAD_ADDRESS,
+		       _("No XML root directory `%s'"), root_dir);
+      g_free (root_dir);
+      return NULL;
+    }
+  else if (g_mkdir (root_dir, dir_mode) < 0)
+    {
+      /* Error out even on EEXIST - shouldn't happen anyway */
+      gconf_set_error (err, GCONF_ERROR_FAILED,
+		       _("Could not make directory `%s': %s"),
+		       root_dir, g_strerror (errno));
+      g_free (root_dir);
+      return NULL;
+    }
+
   {
     /* See if we're writable */
     gboolean writable;
@@ -397,7 +419,7 @@ resolve_address (const char *address,
   
   /* Create the new source */
 
-  xsource = ms_new (root_dir, dir_mode, file_mode, merged, lock);
+  xsource = ms_new (root_dir, dir_mode, file_mode, merged, lazy, lock);
 
   gconf_log (GCL_DEBUG,
              _("Directory/file permissions for XML source at root %s are: %o/%o"),
@@ -418,11 +440,13 @@ tree_lookup_entry (MarkupTree *tree,
                    gboolean    create_if_not_found,
                    GError    **err)
 {
-  char* parent;
+  const char *parent;
+  char buf[GCONF_KEY_BUF_SIZE];
+  char *to_free;
   MarkupDir *dir;
   GError* error = NULL;
 
-  parent = gconf_key_directory (key);
+  parent = gconf_key_directory_r (key, buf, sizeof (buf), &to_free);
   
   g_assert (parent != NULL);
 
@@ -431,7 +455,7 @@ tree_lookup_entry (MarkupTree *tree,
   else
     dir = markup_tree_lookup_dir (tree, parent, &error);
 
-  g_free (parent);
+  g_free (to_free);
   parent = NULL;
   
   if (error != NULL)
@@ -801,6 +825,14 @@ clear_cache (GConfSource *source)
   markup_tree_rebuild (ms->tree);
 }
 
+static gsize
+cache_size (GConfSource *source)
+{
+  MarkupSource* ms = (MarkupSource*)source;
+
+  return markup_tree_get_cache_size (ms->tree);
+}
+
 static void
 blow_away_locks (const char *address)
 {
@@ -881,6 +913,7 @@ ms_new (const char* root_dir,
         guint       dir_mode,
         guint       file_mode,
         gboolean    merged,
+        gboolean    lazy,
         GConfLock  *lock)
 {
   MarkupSource* ms;
@@ -896,11 +929,13 @@ ms_new (const char* root_dir,
   ms->dir_mode = dir_mode;
   ms->file_mode = file_mode;
   ms->merged = merged != FALSE;
+  ms->lazy = lazy != FALSE;
   
   ms->tree = markup_tree_get (ms->root_dir,
                               ms->dir_mode,
                               ms->file_mode,
-                              ms->merged);
+                              ms->merged,
+                              ms->lazy);
   
   return ms;
 }
@@ -115,6 +115,7 @@ static void         markup_entry_free (MarkupEntry *entry);
 static void parse_tree (MarkupDir   *root,
 			gboolean     parse_subtree,
                         const char  *locale,
+                        MarkupDir   *lazy_target,
 			GError     **err);
 static void save_tree  (MarkupDir   *root,
 			gboolean     save_as_subtree,
@@ -133,6 +134,15 @@ struct _MarkupTree
   guint refcount;
 
   guint merged : 1;
+
+  /* Components markup_tree_get_dir_internal() has yet to look up
+   * while it walks the tree, so that a lazy parse can load the
+   * directories along them in the same pass
+   */
+  char **lazy_path;
+
+  /* Read-only; parse subtree files one directory at a time */
+  guint lazy : 1;
 };
 
 static GHashTable *trees_by_root_dir = NULL;
@@ -141,7 +151,8 @@ MarkupTree*
 markup_tree_get (const char *root_dir,
                  guint       dir_mode,
                  guint       file_mode,
-                 gboolean    merged)
+                 gboolean    merged,
+                 gboolean    lazy)
 {
   MarkupTree *tree = NULL;
 
@@ -155,6 +166,11 @@ markup_tree_get (const char *root_dir,
       tree->refcount += 1;
       if (merged && !tree->merged)
         tree->merged = TRUE;
+      /* Directories already parsed lazily stay that way until a
+       * sync needs them.
+       */
+      if (!lazy)
+        tree->lazy = FALSE;
       return tree;
     }
 
@@ -164,6 +180,7 @@ markup_tree_get (const char *root_dir,
   tree->dir_mode = dir_mode;
   tree->file_mode = file_mode;
   tree->merged = merged != FALSE;
+  tree->lazy = lazy != FALSE;
 
   tree->root = markup_dir_new (tree, NULL, "/");  
 
@@ -210,6 +227,95 @@ markup_tree_rebuild (MarkupTree *tree)
   tree->root = markup_dir_new (tree, NULL, "/");  
 }
 
+static gsize
+approximate_value_size (const GConfValue *value)
+{
+  gsize size = sizeof (GConfValue);
+
+  switch (value->type)
+    {
+    case GCONF_VALUE_STRING:
+      if (gconf_value_get_string (value))
+        size += strlen (gconf_value_get_string (value)) + 1;
+      break;
+
+    case GCONF_VALUE_LIST:
+      {
+        GSList *tmp;
+
+        for (tmp = gconf_value_peek_list (value); tmp; tmp = tmp->next)
+          size += sizeof (GSList) + approximate_value_size (tmp->data);
+      }
+      break;
+
+    case GCONF_VALUE_PAIR:
+      if (gconf_value_peek_car (value))
+        size += approximate_value_size (gconf_value_peek_car (value));
+      if (gconf_value_peek_cdr (value))
+        size += approximate_value_size (gconf_value_peek_cdr (value));
+      break;
+
+    case GCONF_VALUE_SCHEMA:
+      {
+        GConfSchema *schema = gconf_value_peek_schema (value);
+        const char *s;
+
+        size += 128;
+        if ((s = gconf_schema_get_short_desc (schema)) != NULL)
+          size += strlen (s);
+        if ((s = gconf_schema_get_long_desc (schema)) != NULL)
+          size += strlen (s);
+        if (gconf_schema_get_default_value (schema))
+          size += approximate_value_size (gconf_schema_get_default_value (schema));
+      }
+      break;
+
+    default:
+      break;
+    }
+
+  return size;
+}
+
+static gsize
+markup_dir_get_cache_size (MarkupDir *dir)
+{
+  gsize size = 0;
+  GSList *tmp;
+
+  if (dir->entries_loaded || dir->subdirs_loaded)
+    size += sizeof (MarkupDir) + strlen (dir->name) + 1;
+
+  for (tmp = dir->entries; tmp; tmp = tmp->next)
+    {
+      MarkupEntry *entry = tmp->data;
+
+      size += sizeof (GSList) + sizeof (MarkupEntry) + strlen (entry->name) + 1;
+      if (entry->value)
+        size += approximate_value_size (entry->value);
+      if (entry->schema_name)
+        size += strlen (entry->schema_name) + 1;
+      if (entry->mod_user)
+        size += strlen (entry->mod_user) + 1;
+      size += g_slist_length (entry->local_schemas) *
+        (sizeof (GSList) + sizeof (LocalSchemaInfo) + 64);
+    }
+
+  for (tmp = dir->subdirs; tmp; tmp = tmp->next)
+    size += sizeof (GSList) + markup_dir_get_cache_size (tmp->data);
+
+  return size;
+}
+
+/* Estimate of the memory held by the loaded part of the tree; an
+ * unloaded or freshly rebuilt tree counts as empty.
+ */
+gsize
+markup_tree_get_cache_size (MarkupTree *tree)
+{
+  return markup_dir_get_cache_size (tree->root);
+}
+
 struct _MarkupDir
 {
   MarkupTree *tree;
@@ -253,6 +359,11 @@ struct _MarkupDir
 
   /* Temporary flag used only when writing */
   guint is_dir_empty : 1;
+
+  /* Inside a subtree file of a lazy tree and not parsed yet; loading
+   * either entries or subdirs parses both
+   */
+  guint lazy_stub : 1;
 };
 
 static MarkupDir*
@@ -374,6 +485,8 @@ markup_tree_get_dir_internal (MarkupTree *tree,
 
           tmp_err = NULL;
 
+          tree->lazy_path = components + i;
+
           if (create_if_not_found)
             subdir = markup_dir_ensure_subdir (dir, components[i], &tmp_err);
           else
@@ -402,6 +515,7 @@ markup_tree_get_dir_internal (MarkupTree *tree,
     }
 
  out:
+  tree->lazy_path = NULL;
   g_strfreev (components);
 
   return dir;
@@ -548,7 +662,7 @@ load_subtree (MarkupDir *dir)
   markup_dir_setup_as_subtree_root (dir);
   markup_dir_list_available_local_descs (dir);
 
-  parse_tree (dir, TRUE, NULL, &tmp_err);
+  parse_tree (dir, TRUE, NULL, dir->tree->lazy ? dir : NULL, &tmp_err);
   if (tmp_err)
     {
       /* note that tmp_err may be a G_MARKUP_ERROR while only
@@ -570,11 +684,65 @@ load_subtree (MarkupDir *dir)
   return TRUE;
 }
 
+static void
+load_lazy_descs_foreach (const char *locale,
+                         gpointer    value,
+                         MarkupDir  *dir)
+{
+  GError *tmp_err = NULL;
+
+  if (value == NULL)
+    return; /* not loaded for the rest of the subtree either */
+
+  parse_tree (dir->subtree_root, TRUE, locale, dir, &tmp_err);
+  if (tmp_err)
+    {
+      gconf_log (GCL_DEBUG, "Failed to load %s descriptions for \"%s\": %s",
+                 locale, dir->name, tmp_err->message);
+      g_error_free (tmp_err);
+    }
+}
+
+static void
+load_lazy_dir (MarkupDir *dir)
+{
+  GError *tmp_err = NULL;
+
+  dir->lazy_stub = FALSE;
+  dir->entries_loaded = TRUE;
+  dir->subdirs_loaded = TRUE;
+
+  parse_tree (dir->subtree_root, TRUE, NULL, dir, &tmp_err);
+  if (tmp_err)
+    {
+      char *markup_file;
+
+      markup_file = markup_dir_build_file_path (dir->subtree_root, TRUE, NULL);
+      gconf_log (GCL_DEBUG,
+                 "Failed to load file \"%s\": %s",
+                 markup_file, tmp_err->message);
+      g_error_free (tmp_err);
+      g_free (markup_file);
+      return;
+    }
+
+  /* Catch up with the descriptions the rest of the subtree has */
+  g_hash_table_foreach (dir->subtree_root->available_local_descs,
+                        (GHFunc) load_lazy_descs_foreach,
+                        dir);
+}
+
 static gboolean
 load_entries (MarkupDir *dir)
 {
   /* Load the entries in this directory */
   
+  if (dir->lazy_stub)
+    {
+      load_lazy_dir (dir);
+      return TRUE;
+    }
+
   if (dir->entries_loaded)
     return TRUE;
 
@@ -590,7 +758,7 @@ load_entries (MarkupDir *dir)
     {
       GError *tmp_err = NULL;
 
-      parse_tree (dir, FALSE, NULL, &tmp_err);
+      parse_tree (dir, FALSE, NULL, NULL, &tmp_err);
       if (tmp_err)
 	{
 	  char *markup_file;
@@ -627,6 +795,12 @@ load_subdirs (MarkupDir *dir)
   guint subdir_len;
   char *markup_dir;
   
+  if (dir->lazy_stub)
+    {
+      load_lazy_dir (dir);
+      return TRUE;
+    }
+
   if (dir->subdirs_loaded)
     return TRUE;
   
@@ -893,8 +1067,8 @@ clean_old_local_schemas (MarkupEntry *entry)
         dead = TRUE;
       else if (local_schema->default_value &&
                entry->value &&
-               gconf_value_get_schema (entry->value) &&
-               gconf_schema_get_type (gconf_value_get_schema (entry->value)) !=
+               gconf_value_peek_schema (entry->value) &&
+               gconf_schema_get_type (gconf_value_peek_schema (entry->value)) !=
                local_schema->default_value->type)
         {
           dead = TRUE;
@@ -1135,6 +1309,21 @@ recursively_load_subtree (MarkupDir *dir)
     }
 }
 
+static gboolean
+markup_dir_has_lazy_stubs (MarkupDir *dir)
+{
+  GSList *tmp;
+
+  if (dir->lazy_stub)
+    return TRUE;
+
+  for (tmp = dir->subdirs; tmp != NULL; tmp = tmp->next)
+    if (markup_dir_has_lazy_stubs (tmp->data))
+      return TRUE;
+
+  return FALSE;
+}
+
 static gboolean
 markup_dir_sync (MarkupDir *dir)
 {
@@ -1163,6 +1352,13 @@ markup_dir_sync (MarkupDir *dir)
       dir->save_as_subtree = TRUE;
       recursively_load_subtree (dir);
     }
+  else if (dir->save_as_subtree && markup_dir_has_lazy_stubs (dir))
+    {
+      /* A lazy tree that's now written to; don't drop what we
+       * never parsed
+       */
+      recursively_load_subtree (dir);
+    }
   
   fs_dirname = markup_dir_build_dir_path (dir, TRUE);
   fs_filename = markup_dir_build_file_path (dir, FALSE, NULL);
@@ -1405,7 +1601,7 @@ load_schema_descs_for_locale (MarkupDir  *dir,
   GError *error;
 
   error = NULL;
-  parse_tree (dir, TRUE, locale, &error);
+  parse_tree (dir, TRUE, locale, NULL, &error);
   if (error != NULL)
     {
       char *markup_file;
@@ -1543,7 +1739,7 @@ markup_entry_set_value (MarkupEntry       *entry,
       GConfSchema *current_schema;
       GConfValue *def_value;
 
-      schema = gconf_value_get_schema (value);
+      schema = gconf_value_peek_schema (value);
       g_assert (schema);
 
       locale = gconf_schema_get_locale (schema);
@@ -1611,7 +1807,7 @@ markup_entry_set_value (MarkupEntry       *entry,
         }
       else
         {
-          current_schema = gconf_value_get_schema (entry->value);
+          current_schema = gconf_value_get_schema_writable (entry->value);
         }
 
       /* Don't save localized info in the main schema */
@@ -1769,7 +1965,7 @@ markup_entry_get_value (MarkupEntry *entry,
       int i;
 
       retval = gconf_value_copy (entry->value);
-      schema = gconf_value_get_schema (retval);
+      schema = gconf_value_get_schema_writable (retval);
       g_return_val_if_fail (schema != NULL, NULL);
 
       /* Find the best local schema */
@@ -1948,6 +2144,17 @@ typedef struct
 
   char        *locale;
 
+  /* When set, only this directory is parsed; the path down to it is
+   * followed and everything else skipped, @skip_depth deep.  Its
+   * subdirectories become stubs, except the one named by the first of
+   * @lazy_path, which is parsed too and becomes the target in turn.
+   * @lazy_root is where the parse started.
+   */
+  MarkupDir   *lazy_target;
+  MarkupDir   *lazy_root;
+  char       **lazy_path;
+  int          skip_depth;
+
   guint        allow_subdirs : 1;
   guint        parsing_local_descs : 1;
 } ParseInfo;
@@ -2013,7 +2220,8 @@ static void
 parse_info_init (ParseInfo  *info,
                  MarkupDir  *root,
                  gboolean    allow_subdirs,
-                 const char *locale)
+                 const char *locale,
+                 MarkupDir  *lazy_target)
 {
   info->states = g_slist_prepend (NULL, GINT_TO_POINTER (STATE_START));
 
@@ -2028,6 +2236,11 @@ parse_info_init (ParseInfo  *info,
 
   info->locale = g_strdup (locale);
 
+  info->lazy_target = lazy_target;
+  info->lazy_root = lazy_target;
+  info->lazy_path = lazy_target ? lazy_target->tree->lazy_path : NULL;
+  info->skip_depth = 0;
+
   info->allow_subdirs = allow_subdirs != FALSE;
   info->parsing_local_descs = info->locale != NULL;
 
@@ -3072,7 +3285,7 @@ parse_car_or_cdr_element (GMarkupParseContext  *context,
     {
       if (current_state == STATE_CAR)
         {
-          if (gconf_value_get_car (pair) == NULL)
+          if (gconf_value_peek_car (pair) == NULL)
             {
               gconf_value_set_car_nocopy (pair, value);
               value_stack_push (info, value, FALSE); /* pair owns it */
@@ -3086,7 +3299,7 @@ parse_car_or_cdr_element (GMarkupParseContext  *context,
         }
       else
         {
-          if (gconf_value_get_cdr (pair) == NULL)
+          if (gconf_value_peek_cdr (pair) == NULL)
             {
               gconf_value_set_cdr_nocopy (pair, value);
               value_stack_push (info, value, FALSE); /* pair owns it */
@@ -3288,6 +3501,113 @@ parse_value_child_element (GMarkupParseContext  *context,
     }
 }
 
+/* Returns TRUE if the lazy parse has dealt with the element */
+static gboolean
+lazy_filter_element (GMarkupParseContext  *context,
+                     const gchar          *element_name,
+                     const gchar         **attribute_names,
+                     const gchar         **attribute_values,
+                     ParseInfo            *info)
+{
+  MarkupDir  *parent;
+  MarkupDir  *dir;
+  const char *name;
+  int         i;
+
+  parent = dir_stack_peek (info);
+
+  if (ELEMENT_IS ("entry"))
+    {
+      if (parent == info->lazy_target)
+        return FALSE;
+
+      info->skip_depth = 1;
+      return TRUE;
+    }
+
+  if (!ELEMENT_IS ("dir") || !info->allow_subdirs)
+    return FALSE;
+
+  name = NULL;
+  for (i = 0; attribute_names[i] != NULL; i++)
+    if (strcmp (attribute_names[i], "name") == 0)
+      name = attribute_values[i];
+
+  if (name == NULL)
+    return FALSE; /* let the normal parser complain */
+
+  if (parent == info->lazy_target)
+    {
+      if (info->lazy_path != NULL && info->lazy_path[0] != NULL &&
+          strcmp (info->lazy_path[0], name) == 0)
+        {
+          /* Looked up next anyway; load it now rather than leave a
+           * stub that parses the whole file again
+           */
+          dir = NULL;
+
+          if (!info->parsing_local_descs)
+            {
+              dir = markup_dir_new (info->root->tree, parent, name);
+
+              dir->not_in_filesystem = TRUE;
+              dir->entries_loaded    = TRUE;
+              dir->subdirs_loaded    = TRUE;
+            }
+          else
+            {
+              GSList *tmp;
+
+              for (tmp = parent->subdirs; tmp != NULL; tmp = tmp->next)
+                {
+                  MarkupDir *subdir = tmp->data;
+
+                  if (!subdir->lazy_stub && strcmp (subdir->name, name) == 0)
+                    {
+                      dir = subdir;
+                      break;
+                    }
+                }
+            }
+
+          if (dir != NULL)
+            {
+              push_state (info, STATE_DIR);
+              dir_stack_push (info, dir);
+
+              info->lazy_target = dir;
+              info->lazy_path += 1;
+
+              return TRUE;
+            }
+        }
+      else if (!info->parsing_local_descs)
+        {
+          dir = markup_dir_new (info->root->tree, parent, name);
+
+          dir->not_in_filesystem = TRUE;
+          dir->lazy_stub         = TRUE;
+        }
+
+      info->skip_depth = 1;
+      return TRUE;
+    }
+
+  /* parent is above the target; only follow the path down to it */
+  for (dir = info->lazy_root; dir != NULL && dir->parent != parent; dir = dir->parent)
+    ;
+
+  if (dir != NULL && strcmp (dir->name, name) == 0)
+    {
+      push_state (info, STATE_DIR);
+      dir_stack_push (info, dir);
+    }
+  else
+    info->skip_depth = 1;
+
+  return TRUE;
+}
+
 static void
 start_element_handler (GMarkupParseContext *context,
                        const gchar         *element_name,
@@ -3299,6 +3619,12 @@ start_element_handler (GMarkupParseContext *context,
   ParseInfo *info = user_data;
   ParseState current_state;
 
+  if (info->skip_depth > 0)
+    {
+      info->skip_depth += 1;
+      return;
+    }
+
   current_state = peek_state (info);
 
   switch (current_state)
@@ -3321,6 +3647,12 @@ start_element_handler (GMarkupParseContext *context,
 
     case STATE_GCONF:
     case STATE_DIR:      
+      if (info->lazy_target != NULL &&
+          lazy_filter_element (context, element_name,
+                               attribute_names, attribute_values,
+                               info))
+        break;
+
       if (ELEMENT_IS ("entry"))
         {
           parse_entry_element (context, element_name,
@@ -3376,6 +3708,12 @@ end_element_handler (GMarkupParseContext *context,
 {
   ParseInfo *info = user_data;
 
+  if (info->skip_depth > 0)
+    {
+      info->skip_depth -= 1;
+      return;
+    }
+
   switch (peek_state (info))
     {
     case STATE_START:
@@ -3483,7 +3821,9 @@ end_element_handler (GMarkupParseContext *context,
       
 	dir = dir_stack_pop (info);
 
-        if (!info->parsing_local_descs)
+        /* On a lazy parse only the targets got new children */
+        if (!info->parsing_local_descs &&
+            (info->lazy_target == NULL || dir == info->lazy_target))
           {
             dir->entries = g_slist_reverse (dir->entries);
             dir->subdirs = g_slist_reverse (dir->subdirs);
@@ -3494,6 +3834,14 @@ end_element_handler (GMarkupParseContext *context,
             markup_dir_free (dir);
           }
 
+        /* Back out of a directory loaded along the path */
+        if (info->lazy_target != NULL &&
+            dir == info->lazy_target && dir != info->lazy_root)
+          {
+            info->lazy_target = dir->parent;
+            info->lazy_path -= 1;
+          }
+
 	pop_state (info);
       }
       break;
@@ -3537,6 +3885,9 @@ text_handler (GMarkupParseContext *context,
 {
   ParseInfo *info = user_data;
 
+  if (info->skip_depth > 0)
+    return;
+
   if (all_whitespace (text, text_len))
     return;
 
@@ -3600,6 +3951,7 @@ static void
 parse_tree (MarkupDir   *root,
             gboolean     parse_subtree,
             const char  *locale,
+            MarkupDir   *lazy_target,
             GError     **err)
 {
   GMarkupParseContext *context = NULL;
@@ -3613,7 +3965,7 @@ parse_tree (MarkupDir   *root,
 
   filename = markup_dir_build_file_path (root, parse_subtree, locale);
   
-  parse_info_init (&info, root, parse_subtree, locale);
+  parse_info_init (&info, root, parse_subtree, locale, lazy_target);
 
   error = NULL;
 
@@ -3742,7 +4094,7 @@ write_value_element (GConfValue *value,
         GConfValueType stype;
         const char *owner;
         
-        schema = gconf_value_get_schema (value);
+        schema = gconf_value_peek_schema (value);
 
         stype = gconf_schema_get_type (schema);
         
@@ -3905,7 +4257,7 @@ write_list_children (GConfValue  *value,
   GSList *tmp;
   gboolean retval = FALSE;
 
-  tmp = gconf_value_get_list (value);
+  tmp = gconf_value_peek_list (value);
   while (tmp != NULL)
     {
       GConfValue *li = tmp->data;
@@ -3937,7 +4289,7 @@ write_pair_children (GConfValue  *value,
   GConfValue *child;
   gboolean retval = FALSE;
 
-  child = gconf_value_get_car (value);
+  child = gconf_value_peek_car (value);
 
   if (child != NULL)
     {
@@ -3951,7 +4303,7 @@ write_pair_children (GConfValue  *value,
 	goto out;
     }
 
-  child = gconf_value_get_cdr (value);
+  child = gconf_value_peek_cdr (value);
 
   if (child != NULL)
     {
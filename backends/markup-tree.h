@@ -32,9 +32,11 @@ typedef struct _MarkupEntry MarkupEntry;
 MarkupTree* markup_tree_get        (const char *root_dir,
                                     guint       dir_mode,
                                     guint       file_mode,
-                                    gboolean    merged);
+                                    gboolean    merged,
+                                    gboolean    lazy);
 void        markup_tree_unref      (MarkupTree *tree);
 void        markup_tree_rebuild    (MarkupTree *tree);
+gsize       markup_tree_get_cache_size (MarkupTree *tree);
 MarkupDir*  markup_tree_lookup_dir (MarkupTree *tree,
                                     const char *full_key,
                                     GError    **err);
@@ -118,7 +118,7 @@ entry_get_value(Entry* e, const gchar** locales, GError** err)
 
   g_assert(e->cached_value->type == GCONF_VALUE_SCHEMA);
 
-  sl = gconf_schema_get_locale(gconf_value_get_schema(e->cached_value));
+  sl = gconf_schema_get_locale(gconf_value_peek_schema(e->cached_value));
 
   gconf_log (GCL_DEBUG, "Cached schema value has locale \"%s\", looking for %s",
              sl ? sl : "null",
@@ -442,7 +442,7 @@ node_set_schema_value(xmlNodePtr node,
   const gchar* type;
   xmlNodePtr found = NULL;
 
-  sc = gconf_value_get_schema (value);
+  sc = gconf_value_peek_schema (value);
 
   /* Set the types */
   if (gconf_schema_get_list_type (sc) != GCONF_VALUE_INVALID)
@@ -564,7 +564,7 @@ node_set_value(xmlNodePtr node, GConfValue* value)
                       gconf_value_type_to_string(gconf_value_get_list_type(value)));
         
         /* Add a new child for each node */
-        list = gconf_value_get_list(value);
+        list = gconf_value_peek_list(value);
 
         while (list != NULL)
           {
@@ -590,11 +590,11 @@ node_set_value(xmlNodePtr node, GConfValue* value)
         car = xmlNewChild(node, NULL, (xmlChar *)"car", NULL);
         cdr = xmlNewChild(node, NULL, (xmlChar *)"cdr", NULL);
 
-        g_return_if_fail(gconf_value_get_car(value) != NULL);
-        g_return_if_fail(gconf_value_get_cdr(value) != NULL);
+        g_return_if_fail(gconf_value_peek_car(value) != NULL);
+        g_return_if_fail(gconf_value_peek_cdr(value) != NULL);
         
-        node_set_value(car, gconf_value_get_car(value));
-        node_set_value(cdr, gconf_value_get_cdr(value));
+        node_set_value(car, gconf_value_peek_car(value));
+        node_set_value(cdr, gconf_value_peek_cdr(value));
       }
       break;
       
@@ -166,6 +166,35 @@ gconf_address_flags(const gchar* address)
     return split_flags;
 }
 
+gchar*
+gconf_address_add_flags(const gchar* address, const gchar* flags)
+{
+  const gchar* start;
+  const gchar* end;
+
+  g_return_val_if_fail(address != NULL, NULL);
+  g_return_val_if_fail(flags != NULL, NULL);
+
+  start = strchr(address, ':');
+
+  if (start == NULL)
+    return g_strdup(address);
+
+  ++start;
+
+  end = strchr(start, ':');
+
+  if (end == NULL)
+    return g_strdup(address);
+
+  if (start == end)
+    return g_strdup_printf("%.*s%s%s", (int) (start - address), address,
+                           flags, end);
+  else
+    return g_strdup_printf("%.*s,%s%s", (int) (end - address), address,
+                           flags, end);
+}
+
 gchar*       
 gconf_backend_file(const gchar* address)
 {
@@ -144,6 +144,12 @@ struct _GConfBackendVTable {
 
   void                (* remove_listener) (GConfSource           *source,
 					   guint                  id);
+
+  /* Rough number of bytes held in memory for data that clear_cache
+   * would drop and the source could read back from storage.  Used
+   * by gconfd to pick what to drop under its memory budget.
+   */
+  gsize               (* cache_size)      (GConfSource           *source);
 };
 
 struct _GConfBackend {
@@ -161,6 +167,9 @@ gchar*        gconf_address_backend(const gchar* address);
 gchar*        gconf_address_resource(const gchar* address);
 /* Get the backend flags */
 gchar**       gconf_address_flags(const gchar* address);
+/* Copy of the address with comma-separated flags added */
+gchar*        gconf_address_add_flags(const gchar* address,
+                                      const gchar* flags);
 
 gchar*        gconf_backend_file(const gchar* address);
 
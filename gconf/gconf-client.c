@@ -103,10 +103,77 @@ static Listener* listener_new(GConfClientNotifyFunc func,
 
 static void listener_destroy(Listener* l);
 
+/*
+ * Cache index: cached entries grouped by the directory they live in,
+ * so listing or dropping a directory doesn't walk the whole cache.
+ */
+
+typedef struct _CacheDir CacheDir;
+
+struct _CacheDir {
+  gchar* name;
+  /* key -> GConfEntry, both owned by cache_hash */
+  GHashTable* entries;
+  /* name -> CacheDir, owned by cache_index */
+  GHashTable* subdirs;
+  CacheDir* parent;
+  /* approximate memory held by the entries */
+  gsize size;
+  /* position in cache_lru, only while there are entries */
+  GList* lru_link;
+};
+
+static void cache_dir_free (CacheDir* cd);
+
+static CacheDir* cache_index_lookup        (GConfClient *client,
+                                            const gchar *dir);
+static void      cache_index_add           (GConfClient *client,
+                                            GConfEntry  *entry,
+                                            GConfEntry  *old_entry);
+static void      cache_remove_entry        (GConfClient *client,
+                                            const gchar *key);
+static void      cache_remove_subtree      (GConfClient *client,
+                                            const gchar *dir);
+static void      cache_index_touch         (GConfClient *client,
+                                            CacheDir    *cd);
+static CacheDir* cache_index_lookup_parent (GConfClient *client,
+                                            const gchar *key);
+static void      cache_index_unlink        (GConfClient *client,
+                                            CacheDir    *cd);
+static void      cache_enforce_limit       (GConfClient *client,
+                                            CacheDir    *keep);
+
 /*
  * GConfClient proper
  */
 
+/* State added after GConfClient went public; kept out of the
+ * installed struct so its layout doesn't change.
+ */
+typedef struct _GConfClientPrivate GConfClientPrivate;
+
+struct _GConfClientPrivate {
+  gboolean pipeline_writes;
+  /* dir name -> CacheDir */
+  GHashTable* cache_index;
+  /* CacheDirs holding entries, most recently used first */
+  GQueue* cache_lru;
+  gsize cache_size;
+  gsize cache_limit;
+  guint cache_hits;
+  guint cache_misses;
+  guint cache_evictions;
+  /* keys in notify_list, so each is queued at most once */
+  GHashTable* notify_hash;
+  /* key -> origin of a tagged unset whose notification hasn't been
+   * dispatched yet
+   */
+  GHashTable* unset_origins;
+};
+
+#define GCONF_CLIENT_GET_PRIVATE(client) \
+  (G_TYPE_INSTANCE_GET_PRIVATE ((client), GCONF_TYPE_CLIENT, GConfClientPrivate))
+
 #define PUSH_USE_ENGINE(client) do { if ((client)->engine) gconf_engine_push_owner_usage ((client)->engine, client); } while (0)
 #define POP_USE_ENGINE(client) do { if ((client)->engine) gconf_engine_pop_owner_usage ((client)->engine, client); } while (0)
 
@@ -135,6 +202,9 @@ static gboolean gconf_client_cache          (GConfClient *client,
 static gboolean gconf_client_lookup         (GConfClient *client,
                                              const char  *key,
                                              GConfEntry **entryp);
+static gboolean gconf_client_lookup_value   (GConfClient       *client,
+                                             const char        *key,
+                                             const GConfValue **valuep);
 
 static void gconf_client_real_remove_dir    (GConfClient* client,
                                              Dir* d,
@@ -193,6 +263,8 @@ gconf_client_class_init (GConfClientClass *class)
 
   parent_class = g_type_class_peek_parent (class);
 
+  g_type_class_add_private (class, sizeof (GConfClientPrivate));
+
   client_signals[VALUE_CHANGED] =
     g_signal_new ("value_changed",
                   G_TYPE_FROM_CLASS (object_class),
@@ -233,6 +305,8 @@ gconf_client_class_init (GConfClientClass *class)
 static void
 gconf_client_init (GConfClient *client)
 {
+  GConfClientPrivate *priv = GCONF_CLIENT_GET_PRIVATE (client);
+
   client->engine = NULL;
   client->error_mode = GCONF_CLIENT_HANDLE_UNRETURNED;
   client->dir_hash = g_hash_table_new (g_str_hash, g_str_equal);
@@ -241,10 +315,21 @@ gconf_client_init (GConfClient *client)
 					      g_free, NULL);
   client->cache_recursive_dirs = g_hash_table_new_full (g_str_hash, g_str_equal,
                                                         g_free, NULL);
+  priv->cache_index = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                               NULL,
+                                               (GDestroyNotify) cache_dir_free);
+  priv->cache_lru = g_queue_new ();
+  priv->cache_size = 0;
+  priv->cache_limit = 0;
   /* We create the listeners only if they're actually used */
   client->listeners = NULL;
   client->notify_list = NULL;
+  /* keys in notify_list, so each is queued at most once */
+  priv->notify_hash = g_hash_table_new (g_str_hash, g_str_equal);
+  priv->unset_origins = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                               g_free, g_free);
   client->notify_handler = 0;
+  priv->pipeline_writes = FALSE;
 }
 
 static gboolean
@@ -298,8 +383,15 @@ static void
 gconf_client_finalize (GObject* object)
 {
   GConfClient* client = GCONF_CLIENT(object);
+  GConfClientPrivate *priv = GCONF_CLIENT_GET_PRIVATE (client);
 
   gconf_client_unqueue_notifies (client);
+
+  g_hash_table_destroy (priv->notify_hash);
+  priv->notify_hash = NULL;
+
+  g_hash_table_destroy (priv->unset_origins);
+  priv->unset_origins = NULL;
   
   g_hash_table_foreach_remove (client->dir_hash,
                                destroy_dir_foreach_remove, client);
@@ -324,6 +416,12 @@ gconf_client_finalize (GObject* object)
   g_hash_table_destroy (client->cache_dirs);
   client->cache_dirs = NULL;
 
+  g_hash_table_destroy (priv->cache_index);
+  priv->cache_index = NULL;
+
+  g_queue_free (priv->cache_lru);
+  priv->cache_lru = NULL;
+
   unregister_client (client);
 
   set_engine (client, NULL);
@@ -684,18 +782,6 @@ foreach_add_notifies(gpointer key, gpointer value, gpointer user_data)
     }
 }
 
-static gboolean
-clear_dir_cache_foreach (char* key, GConfEntry* entry, char *dir)
-{
-  if (gconf_key_is_below (dir, key))
-    {
-      gconf_entry_free (entry);
-      return TRUE;
-    }
-  else
-    return FALSE;
-}
-
 static gboolean
 clear_cache_dirs_foreach (char *key, gpointer value, char *dir)
 {
@@ -732,9 +818,7 @@ gconf_client_real_remove_dir    (GConfClient* client,
       d->notify_id = 0;
     }
   
-  g_hash_table_foreach_remove (client->cache_hash,
-                               (GHRFunc)clear_dir_cache_foreach,
-                               d->name);
+  cache_remove_subtree (client, d->name);
   g_hash_table_foreach_remove (client->cache_dirs,
                                (GHRFunc)clear_cache_dirs_foreach,
                                d->name);
@@ -864,13 +948,20 @@ clear_cache_foreach (char* key, GConfEntry* entry, GConfClient* client)
 void
 gconf_client_clear_cache(GConfClient* client)
 {
+  GConfClientPrivate *priv;
+
   g_return_if_fail(client != NULL);
   g_return_if_fail(GCONF_IS_CLIENT(client));
 
+  priv = GCONF_CLIENT_GET_PRIVATE (client);
+
   trace ("Clearing cache");
   
   g_hash_table_foreach_remove (client->cache_hash, (GHRFunc)clear_cache_foreach,
                                client);
+  g_queue_clear (priv->cache_lru);
+  g_hash_table_remove_all (priv->cache_index);
+  priv->cache_size = 0;
 
   g_hash_table_remove_all (client->cache_dirs);
 }
@@ -987,6 +1078,61 @@ cache_pairs_in_dir(GConfClient* client, const gchar* dir, gboolean recursive)
     g_hash_table_insert (client->cache_recursive_dirs, g_strdup (dir), GINT_TO_POINTER (1));
 }
 
+/* Caches everything below dir with a single prefix search on the
+ * server.  Returns FALSE if the engine can't search, in which case
+ * the caller has to walk the tree itself; a failed search is only
+ * reported, as walking would fail the same way.
+ */
+static gboolean
+cache_tree_by_search (GConfClient *client, const gchar *dir)
+{
+  GSList *entries;
+  GError *error = NULL;
+  gchar *prefix;
+  gboolean searched;
+
+  /* Keys below "/apps" start with "/apps/", but not all keys
+   * starting with "/apps" are below it.
+   */
+  if (strcmp (dir, "/") == 0)
+    prefix = g_strdup (dir);
+  else
+    prefix = g_strconcat (dir, "/", NULL);
+
+  trace ("REMOTE: Searching for everything below '%s'", dir);
+
+  PUSH_USE_ENGINE (client);
+  searched = gconf_engine_search (client->engine, dir, GCONF_SEARCH_PREFIX,
+                                  prefix, &entries, &error);
+  POP_USE_ENGINE (client);
+
+  g_free (prefix);
+
+  if (error != NULL)
+    {
+      g_printerr (_("GConf warning: failure listing pairs below `%s': %s"),
+                  dir, error->message);
+      g_error_free (error);
+      return TRUE;
+    }
+
+  if (!searched)
+    return FALSE;
+
+  /* Misses in subdirectories are answered by walking up to a
+   * recursively cached parent, so marking dir covers the whole tree.
+   * Mark before caching: if the size limit evicts anything below dir
+   * on the way, the eviction takes the mark away again.
+   */
+  trace ("Mark '%s' as fully cached", dir);
+  g_hash_table_insert (client->cache_dirs, g_strdup (dir), GINT_TO_POINTER (1));
+  g_hash_table_insert (client->cache_recursive_dirs, g_strdup (dir), GINT_TO_POINTER (1));
+
+  cache_entry_list_destructively (client, entries);
+
+  return TRUE;
+}
+
 void
 gconf_client_preload    (GConfClient* client,
                          const gchar* dirname,
@@ -1026,6 +1172,9 @@ gconf_client_preload    (GConfClient* client,
         GSList* subdirs;
 
         trace ("Recursive preload of '%s'", dirname);
+
+        if (cache_tree_by_search (client, dirname))
+          break;
         
 	trace ("REMOTE: All dirs at '%s'", dirname);
         PUSH_USE_ENGINE (client);
@@ -1051,52 +1200,6 @@ gconf_client_preload    (GConfClient* client,
  * D-BUS environment we update the internal cache when changes happen to
  * ensure a consistent state
  */
-static gboolean
-remove_key_from_cache_foreach (const gchar *cached_key,
-                               GConfEntry  *entry,
-                               const gchar *key)
-{
-  if (strcmp (cached_key, key) == 0)
-    {
-      gconf_entry_free (entry);
-      return TRUE;
-    }
-
-  return FALSE;
-}
-
-static gboolean
-remove_key_from_cache_recursively_foreach (const gchar *cached_key,
-                                           GConfEntry  *entry,
-                                           const gchar *key)
-{
-  if (gconf_key_is_below (cached_key, key) == 0 || strcmp (cached_key, key) == 0)
-    {
-      /* Not sure why a null entry would be in the cache, but it happens
-       * sometimes, workaround for now to avoid crashing.
-       */
-      if (entry)
-        gconf_entry_free (entry);
-      return TRUE;
-    }
-
-  return FALSE;
-}
-
-static gboolean
-remove_dir_from_cache_foreach (char     *cached_dir,
-                               gpointer  value,
-                               char     *dir)
-{
-  if (strcmp (dir, cached_dir) == 0)
-    {
-      trace ("'%s' no longer fully cached", dir);
-      return TRUE;
-    }
-
-  return FALSE;
-}
-
 /* The dbus version cleans the cache after modifying a value. So we will
  * remove current dir (where the key is in) from the cache_dirs
  * when removing the key from the cache_hash.
@@ -1105,25 +1208,24 @@ remove_dir_from_cache_foreach (char     *cached_dir,
 static void remove_dir_from_cache (GConfClient *client,
                                    const gchar *key)
 {
-  char *dir, *last_slash;
-  dir = g_strdup (key);
-  last_slash = strrchr (dir, '/');
+  const char *last_slash;
+  char *dir, *to_free;
+  char buf[GCONF_KEY_BUF_SIZE];
+
+  last_slash = strrchr (key, '/');
   g_assert (last_slash != NULL);
-  *last_slash = 0;
+  dir = gconf_strndup_r (key, last_slash - key, buf, sizeof (buf), &to_free);
   trace ("Remove dir '%s' from cache since one of keys is changed", dir);
-  g_hash_table_foreach_remove (client->cache_dirs,
-                               (GHRFunc) remove_dir_from_cache_foreach,
-                               dir);
-  g_free (dir);
+  if (g_hash_table_remove (client->cache_dirs, dir))
+    trace ("'%s' no longer fully cached", dir);
+  g_free (to_free);
 }
 
 static void
 remove_key_from_cache (GConfClient *client,
                        const gchar *key)
 {
-  g_hash_table_foreach_remove (client->cache_hash,
-                               (GHRFunc) remove_key_from_cache_foreach,
-                               (char *) key);
+  cache_remove_entry (client, key);
   remove_dir_from_cache (client, key);
 }
 
@@ -1131,9 +1233,7 @@ static void
 remove_key_from_cache_recursively (GConfClient *client,
                                    const gchar *key)
 {
-  g_hash_table_foreach_remove (client->cache_hash,
-                               (GHRFunc) remove_key_from_cache_recursively_foreach,
-                               (char *) key);
+  cache_remove_subtree (client, key);
   remove_dir_from_cache (client, key);
 }
 
@@ -1164,6 +1264,63 @@ cache_key_value_and_notify (GConfClient *client,
     gconf_value_free (val);
 }
 
+static void
+pipelined_set_done (GConfEngine *engine,
+                    const gchar *key,
+                    GError      *error,
+                    gpointer     user_data)
+{
+  GConfClient *client = user_data;
+
+  if (error == NULL)
+    return;
+
+  trace ("Pipelined set of '%s' failed", key);
+
+  /* The value we cached optimistically never made it; drop it so the
+   * next read goes to the server, and let listeners catch up.
+   */
+  remove_key_from_cache (client, key);
+
+  if (key_being_monitored (client, key))
+    gconf_client_queue_notify (client, key);
+
+  handle_error (client, error, NULL);
+}
+
+static gboolean
+set_pipelined (GConfClient *client,
+               const gchar *key,
+               GConfValue  *val,
+               gboolean     free_value,
+               GError     **err)
+{
+  GError *error = NULL;
+  gboolean result;
+
+  trace ("REMOTE: Pipelined set of '%s'", key);
+  PUSH_USE_ENGINE (client);
+  result = gconf_engine_set_async (client->engine, key, val,
+                                   pipelined_set_done,
+                                   g_object_ref (client),
+                                   g_object_unref,
+                                   &error);
+  POP_USE_ENGINE (client);
+
+  if (result)
+    {
+      cache_key_value_and_notify (client, key, val, free_value);
+      return TRUE;
+    }
+
+  if (free_value)
+    gconf_value_free (val);
+
+  handle_error (client, error, err);
+
+  return FALSE;
+}
+
 #endif
 
 /*
@@ -1178,6 +1335,14 @@ gconf_client_set             (GConfClient* client,
 {
   GError* error = NULL;
 
+#ifdef HAVE_DBUS
+  if (GCONF_CLIENT_GET_PRIVATE (client)->pipeline_writes)
+    {
+      set_pipelined (client, key, (GConfValue *) val, FALSE, err);
+      return;
+    }
+#endif
+
   trace ("REMOTE: Setting value of '%s'", key);
   PUSH_USE_ENGINE (client);
   gconf_engine_set (client->engine, key, val, &error);
@@ -1285,25 +1450,25 @@ gconf_client_all_entries    (GConfClient* client,
 {
   GError *error = NULL;
   GSList *retval;
-  int dirlen;
 
   if (g_hash_table_lookup (client->cache_dirs, dir))
     {
-      GHashTableIter iter;
-      gpointer key, value;
+      CacheDir *cd;
 
       trace ("CACHED: Getting all values in '%s'", dir);
 
-      dirlen = strlen (dir);
       retval = NULL;
-      g_hash_table_iter_init (&iter, client->cache_hash);
-      while (g_hash_table_iter_next (&iter, &key, &value))
+      cd = cache_index_lookup (client, dir);
+      if (cd != NULL)
         {
-          const gchar *id = key;
-          GConfEntry *entry = value;
-          if (g_str_has_prefix (id, dir) &&
-              id + dirlen == strrchr (id, '/'))
-            retval = g_slist_prepend (retval, gconf_entry_copy (entry));
+          GHashTableIter iter;
+          gpointer value;
+
+          cache_index_touch (client, cd);
+
+          g_hash_table_iter_init (&iter, cd->entries);
+          while (g_hash_table_iter_next (&iter, NULL, &value))
+            retval = g_slist_prepend (retval, gconf_entry_copy (value));
         }
 
       return retval;
@@ -1442,7 +1607,7 @@ gconf_client_key_is_writable (GConfClient* client,
 }
 
 static gboolean
-check_type(const gchar* key, GConfValue* val, GConfValueType t, GError** err)
+check_type(const gchar* key, const GConfValue* val, GConfValueType t, GError** err)
 {
   if (val->type != t)
     {
@@ -1667,9 +1832,22 @@ gconf_client_get_float (GConfClient* client, const gchar* key,
   static const gdouble def = 0.0;
   GError* error = NULL;
   GConfValue *val;
+  const GConfValue *cached;
 
   g_return_val_if_fail (err == NULL || *err == NULL, 0.0);
 
+  if (gconf_client_lookup_value (client, key, &cached))
+    {
+      if (cached == NULL)
+        return def;
+
+      if (check_type (key, cached, GCONF_VALUE_FLOAT, &error))
+        return gconf_value_get_float (cached);
+
+      handle_error (client, error, err);
+      return def;
+    }
+
   val = gconf_client_get (client, key, &error);
 
   if (val != NULL)
@@ -1702,9 +1880,22 @@ gconf_client_get_int   (GConfClient* client, const gchar* key,
   static const gint def = 0;
   GError* error = NULL;
   GConfValue* val;
+  const GConfValue *cached;
 
   g_return_val_if_fail (err == NULL || *err == NULL, 0);
 
+  if (gconf_client_lookup_value (client, key, &cached))
+    {
+      if (cached == NULL)
+        return def;
+
+      if (check_type (key, cached, GCONF_VALUE_INT, &error))
+        return gconf_value_get_int (cached);
+
+      handle_error (client, error, err);
+      return def;
+    }
+
   val = gconf_client_get (client, key, &error);
 
   if (val != NULL)
@@ -1736,9 +1927,22 @@ gconf_client_get_string(GConfClient* client, const gchar* key,
 {
   GError* error = NULL;
   GConfValue* val;
+  const GConfValue *cached;
 
   g_return_val_if_fail (err == NULL || *err == NULL, NULL);
 
+  if (gconf_client_lookup_value (client, key, &cached))
+    {
+      if (cached == NULL)
+        return NULL;
+
+      if (check_type (key, cached, GCONF_VALUE_STRING, &error))
+        return g_strdup (gconf_value_get_string (cached));
+
+      handle_error (client, error, err);
+      return NULL;
+    }
+
   val = gconf_client_get (client, key, &error);
 
   if (val != NULL)
@@ -1772,9 +1976,22 @@ gconf_client_get_bool  (GConfClient* client, const gchar* key,
   static const gboolean def = FALSE;
   GError* error = NULL;
   GConfValue* val;
+  const GConfValue *cached;
 
   g_return_val_if_fail (err == NULL || *err == NULL, FALSE);
 
+  if (gconf_client_lookup_value (client, key, &cached))
+    {
+      if (cached == NULL)
+        return def;
+
+      if (check_type (key, cached, GCONF_VALUE_BOOL, &error))
+        return gconf_value_get_bool (cached);
+
+      handle_error (client, error, err);
+      return def;
+    }
+
   val = gconf_client_get (client, key, &error);
 
   if (val != NULL)
@@ -2008,6 +2225,14 @@ gconf_client_set_float   (GConfClient* client, const gchar* key,
   g_return_val_if_fail(GCONF_IS_CLIENT(client), FALSE);  
   g_return_val_if_fail(key != NULL, FALSE);
 
+#ifdef HAVE_DBUS
+  if (GCONF_CLIENT_GET_PRIVATE (client)->pipeline_writes)
+    {
+      MAKE_VALUE (v, FLOAT, float, val);
+      return set_pipelined (client, key, v, TRUE, err);
+    }
+#endif
+
   trace ("REMOTE: Setting float '%s'", key);
   PUSH_USE_ENGINE (client);
   result = gconf_engine_set_float (client->engine, key, val, &error);
@@ -2041,6 +2266,14 @@ gconf_client_set_int     (GConfClient* client, const gchar* key,
   g_return_val_if_fail(GCONF_IS_CLIENT(client), FALSE);  
   g_return_val_if_fail(key != NULL, FALSE);
 
+#ifdef HAVE_DBUS
+  if (GCONF_CLIENT_GET_PRIVATE (client)->pipeline_writes)
+    {
+      MAKE_VALUE (v, INT, int, val);
+      return set_pipelined (client, key, v, TRUE, err);
+    }
+#endif
+
   trace ("REMOTE: Setting int '%s'", key);
   PUSH_USE_ENGINE (client);
   result = gconf_engine_set_int (client->engine, key, val, &error);
@@ -2075,6 +2308,14 @@ gconf_client_set_string  (GConfClient* client, const gchar* key,
   g_return_val_if_fail(key != NULL, FALSE);
   g_return_val_if_fail(val != NULL, FALSE);
 
+#ifdef HAVE_DBUS
+  if (GCONF_CLIENT_GET_PRIVATE (client)->pipeline_writes)
+    {
+      MAKE_VALUE (v, STRING, string, val);
+      return set_pipelined (client, key, v, TRUE, err);
+    }
+#endif
+
   trace ("REMOTE: Setting string '%s'", key);
   PUSH_USE_ENGINE (client);
   result = gconf_engine_set_string(client->engine, key, val, &error);
@@ -2108,6 +2349,14 @@ gconf_client_set_bool    (GConfClient* client, const gchar* key,
   g_return_val_if_fail(GCONF_IS_CLIENT(client), FALSE);  
   g_return_val_if_fail(key != NULL, FALSE);
 
+#ifdef HAVE_DBUS
+  if (GCONF_CLIENT_GET_PRIVATE (client)->pipeline_writes)
+    {
+      MAKE_VALUE (v, BOOL, bool, val);
+      return set_pipelined (client, key, v, TRUE, err);
+    }
+#endif
+
   trace ("REMOTE: Setting bool '%s'", key);
   PUSH_USE_ENGINE (client);
   result = gconf_engine_set_bool (client->engine, key, val, &error);
@@ -2142,6 +2391,14 @@ gconf_client_set_schema  (GConfClient* client, const gchar* key,
   g_return_val_if_fail(key != NULL, FALSE);
   g_return_val_if_fail(val != NULL, FALSE);
 
+#ifdef HAVE_DBUS
+  if (GCONF_CLIENT_GET_PRIVATE (client)->pipeline_writes)
+    {
+      MAKE_VALUE (v, SCHEMA, schema, val);
+      return set_pipelined (client, key, v, TRUE, err);
+    }
+#endif
+
   trace ("REMOTE: Setting schema '%s'", key);
   PUSH_USE_ENGINE (client);
   result = gconf_engine_set_schema(client->engine, key, val, &error);
@@ -2177,6 +2434,20 @@ gconf_client_set_list    (GConfClient* client, const gchar* key,
   g_return_val_if_fail(GCONF_IS_CLIENT(client), FALSE);  
   g_return_val_if_fail(key != NULL, FALSE);
 
+#ifdef HAVE_DBUS
+  if (GCONF_CLIENT_GET_PRIVATE (client)->pipeline_writes)
+    {
+      GConfValue *v = gconf_value_list_from_primitive_list (list_type, list, &error);
+      if (!v)
+        {
+          handle_error (client, error, err);
+          return FALSE;
+        }
+
+      return set_pipelined (client, key, v, TRUE, err);
+    }
+#endif
+
   trace ("REMOTE: Setting list '%s'", key);
   PUSH_USE_ENGINE (client);
   result = gconf_engine_set_list(client->engine, key, list_type, list, &error);
@@ -2213,6 +2484,20 @@ gconf_client_set_pair    (GConfClient* client, const gchar* key,
   g_return_val_if_fail(GCONF_IS_CLIENT(client), FALSE);  
   g_return_val_if_fail(key != NULL, FALSE);
 
+#ifdef HAVE_DBUS
+  if (GCONF_CLIENT_GET_PRIVATE (client)->pipeline_writes)
+    {
+      GConfValue *v = gconf_value_pair_from_primitive_pair (car_type, cdr_type, address_of_car, address_of_cdr, &error);
+      if (!v)
+        {
+          handle_error (client, error, err);
+          return FALSE;
+        }
+
+      return set_pipelined (client, key, v, TRUE, err);
+    }
+#endif
+
   trace ("REMOTE: Setting pair '%s'", key);
   PUSH_USE_ENGINE (client);
   result = gconf_engine_set_pair (client->engine, key, car_type, cdr_type,
@@ -2243,28 +2528,124 @@ gconf_client_set_pair    (GConfClient* client, const gchar* key,
 }
 
 
-/*
- * Functions to emit signals
+/**
+ * gconf_client_set_pipelined_writes:
+ * @client: a #GConfClient.
+ * @setting: whether to pipeline writes.
+ *
+ * When enabled, the gconf_client_set() family updates the client-side
+ * cache immediately and sends the change to the server without waiting
+ * for the reply. An error reported later by the server is emitted
+ * through the unreturned_error signal, and the cached value is
+ * dropped. gconf_client_suggest_sync() blocks until all outstanding
+ * writes have been acknowledged.
  */
-
 void
-gconf_client_error                  (GConfClient* client, GError* error)
+gconf_client_set_pipelined_writes (GConfClient *client,
+                                   gboolean     setting)
 {
-  g_return_if_fail(client != NULL);
-  g_return_if_fail(GCONF_IS_CLIENT(client));
-  
-  g_signal_emit (G_OBJECT(client), client_signals[ERROR], 0,
-                 error);
+  GConfClientPrivate *priv;
+
+  g_return_if_fail (client != NULL);
+  g_return_if_fail (GCONF_IS_CLIENT (client));
+
+  priv = GCONF_CLIENT_GET_PRIVATE (client);
+
+  trace ("%s pipelined writes", setting ? "Enabling" : "Disabling");
+
+  if (!setting && priv->pipeline_writes)
+    {
+      PUSH_USE_ENGINE (client);
+      gconf_engine_flush_pending_sets (client->engine);
+      POP_USE_ENGINE (client);
+    }
+
+  priv->pipeline_writes = setting != FALSE;
 }
 
+/**
+ * gconf_client_set_cache_limit:
+ * @client: a #GConfClient.
+ * @max_bytes: approximate upper bound for cached values, or 0 for no limit.
+ *
+ * Bounds the memory @client spends on cached values. When the cache
+ * grows beyond @max_bytes, the values of the least recently used
+ * directories are dropped and read from the server again when needed.
+ * Such directories are no longer considered fully cached. There is no
+ * limit by default.
+ */
 void
-gconf_client_unreturned_error       (GConfClient* client, GError* error)
+gconf_client_set_cache_limit (GConfClient *client,
+                              gsize        max_bytes)
 {
-  g_return_if_fail(client != NULL);
-  g_return_if_fail(GCONF_IS_CLIENT(client));
+  g_return_if_fail (client != NULL);
+  g_return_if_fail (GCONF_IS_CLIENT (client));
 
-  g_signal_emit (G_OBJECT(client), client_signals[UNRETURNED_ERROR], 0,
-                 error);
+  trace ("Setting cache limit to %" G_GSIZE_FORMAT " bytes", max_bytes);
+
+  GCONF_CLIENT_GET_PRIVATE (client)->cache_limit = max_bytes;
+
+  cache_enforce_limit (client, NULL);
+}
+
+/**
+ * gconf_client_get_cache_stats:
+ * @client: a #GConfClient.
+ * @hits: (out) (allow-none): return location for the number of lookups answered from the cache.
+ * @misses: (out) (allow-none): return location for the number of lookups that went to the server.
+ * @evictions: (out) (allow-none): return location for the number of directories evicted.
+ * @size: (out) (allow-none): return location for the approximate size of the cache in bytes.
+ *
+ * Reports how well the client-side cache is doing, e.g. to tune
+ * gconf_client_set_cache_limit(). Negative hits (keys known not to
+ * exist) count as hits.
+ */
+void
+gconf_client_get_cache_stats (GConfClient *client,
+                              guint       *hits,
+                              guint       *misses,
+                              guint       *evictions,
+                              gsize       *size)
+{
+  GConfClientPrivate *priv;
+
+  g_return_if_fail (client != NULL);
+  g_return_if_fail (GCONF_IS_CLIENT (client));
+
+  priv = GCONF_CLIENT_GET_PRIVATE (client);
+
+  if (hits)
+    *hits = priv->cache_hits;
+  if (misses)
+    *misses = priv->cache_misses;
+  if (evictions)
+    *evictions = priv->cache_evictions;
+  if (size)
+    *size = priv->cache_size;
+}
+
+/*
+ * Functions to emit signals
+ */
+
+void
+gconf_client_error                  (GConfClient* client, GError* error)
+{
+  g_return_if_fail(client != NULL);
+  g_return_if_fail(GCONF_IS_CLIENT(client));
+  
+  g_signal_emit (G_OBJECT(client), client_signals[ERROR], 0,
+                 error);
+}
+
+void
+gconf_client_unreturned_error       (GConfClient* client, GError* error)
+{
+  g_return_if_fail(client != NULL);
+  g_return_if_fail(GCONF_IS_CLIENT(client));
+
+  g_signal_emit (G_OBJECT(client), client_signals[UNRETURNED_ERROR], 0,
+                 error);
 }
 
 void
@@ -2317,9 +2698,13 @@ gconf_client_cache (GConfClient *client,
           g_hash_table_replace (client->cache_hash,
                                 new_entry->key,
                                 new_entry);
+          cache_index_add (client, new_entry, entry);
 
           /* oldkey is inside entry */
           gconf_entry_free (entry);
+
+          cache_enforce_limit (client,
+                               cache_index_lookup_parent (client, new_entry->key));
         }
       else
         {
@@ -2339,9 +2724,13 @@ gconf_client_cache (GConfClient *client,
         new_entry = gconf_entry_copy (new_entry);
       
       g_hash_table_insert (client->cache_hash, new_entry->key, new_entry);
+      cache_index_add (client, new_entry, NULL);
       trace ("Added value of '%s' to the cache",
              new_entry->key);
 
+      cache_enforce_limit (client,
+                           cache_index_lookup_parent (client, new_entry->key));
+
       return TRUE; /* changed */
     }
 }
@@ -2351,6 +2740,7 @@ gconf_client_lookup (GConfClient *client,
                      const char  *key,
                      GConfEntry **entryp)
 {
+  GConfClientPrivate *priv = GCONF_CLIENT_GET_PRIVATE (client);
   GConfEntry *entry;
 
   g_return_val_if_fail (entryp != NULL, FALSE);
@@ -2360,19 +2750,25 @@ gconf_client_lookup (GConfClient *client,
 
   *entryp = entry;
 
-  if (!entry)
+  if (entry)
+    {
+      cache_index_touch (client, cache_index_lookup_parent (client, key));
+      priv->cache_hits += 1;
+    }
+  else
   {
-    char *dir, *last_slash;
+    char *dir, *last_slash, *to_free;
+    char buf[GCONF_KEY_BUF_SIZE];
 
-    dir = g_strdup (key);
-    last_slash = strrchr (dir, '/');
+    last_slash = strrchr (key, '/');
     g_assert (last_slash != NULL);
-    *last_slash = 0;
+    dir = gconf_strndup_r (key, last_slash - key, buf, sizeof (buf), &to_free);
 
     if (g_hash_table_lookup (client->cache_dirs, dir))
       {
-        g_free (dir);
+        g_free (to_free);
         trace ("Negative cache hit on %s", key);
+        priv->cache_hits += 1;
         return TRUE;
       }
     else 
@@ -2387,19 +2783,52 @@ gconf_client_lookup (GConfClient *client,
               *last_slash = 0;
             if (g_hash_table_lookup (client->cache_recursive_dirs, dir))
               {
-                g_free (dir);
+                g_free (to_free);
                 trace ("Non-existing dir for %s", key);
+                priv->cache_hits += 1;
                 return TRUE;
               }
             not_cached = TRUE;
           }
       }
-    g_free (dir);
+    g_free (to_free);
+
+    priv->cache_misses += 1;
   }
 
   return entry != NULL;
 }
 
+/* Fast path for the typed getters: looks @key up in the cache without
+ * copying anything.  Returns FALSE if the cache has no entry for @key;
+ * otherwise *valuep is the cached value, NULL if the key is unset, and
+ * only valid until the cache next changes.
+ */
+static gboolean
+gconf_client_lookup_value (GConfClient       *client,
+                           const char        *key,
+                           const GConfValue **valuep)
+{
+  GConfEntry *entry;
+
+  g_return_val_if_fail (GCONF_IS_CLIENT (client), FALSE);
+  g_return_val_if_fail (key != NULL, FALSE);
+
+  entry = g_hash_table_lookup (client->cache_hash, key);
+
+  if (entry == NULL)
+    return FALSE;
+
+  cache_index_touch (client, cache_index_lookup_parent (client, key));
+  GCONF_CLIENT_GET_PRIVATE (client)->cache_hits += 1;
+
+  trace ("CACHED: Query for '%s'", key);
+
+  *valuep = gconf_entry_get_value (entry);
+
+  return TRUE;
+}
+
 /*
  * Dir
  */
@@ -2459,6 +2888,406 @@ listener_destroy(Listener* l)
   g_free(l);
 }
 
+/*
+ * Cache index
+ */
+
+static void
+cache_dir_free (CacheDir* cd)
+{
+  g_hash_table_destroy (cd->entries);
+  g_hash_table_destroy (cd->subdirs);
+  g_free (cd->name);
+  g_free (cd);
+}
+
+static CacheDir*
+cache_index_lookup (GConfClient *client,
+                    const gchar *dir)
+{
+  return g_hash_table_lookup (GCONF_CLIENT_GET_PRIVATE (client)->cache_index, dir);
+}
+
+static CacheDir*
+cache_index_ensure (GConfClient *client,
+                    const gchar *dir)
+{
+  CacheDir *cd;
+
+  cd = cache_index_lookup (client, dir);
+  if (cd != NULL)
+    return cd;
+
+  cd = g_new0 (CacheDir, 1);
+  cd->name = g_strdup (dir);
+  cd->entries = g_hash_table_new (g_str_hash, g_str_equal);
+  cd->subdirs = g_hash_table_new (g_str_hash, g_str_equal);
+
+  g_hash_table_insert (GCONF_CLIENT_GET_PRIVATE (client)->cache_index, cd->name, cd);
+
+  if (strcmp (dir, "/") != 0)
+    {
+      gchar buf[GCONF_KEY_BUF_SIZE];
+      gchar *to_free;
+
+      cd->parent = cache_index_ensure (client,
+                                       gconf_key_directory_r (dir, buf, sizeof (buf),
+                                                              &to_free));
+      g_free (to_free);
+
+      g_hash_table_insert (cd->parent->subdirs, cd->name, cd);
+    }
+
+  return cd;
+}
+
+/* Drop directories that no longer hold anything, walking up */
+static void
+cache_index_prune (GConfClient *client,
+                   CacheDir    *cd)
+{
+  while (cd != NULL &&
+         g_hash_table_size (cd->entries) == 0 &&
+         g_hash_table_size (cd->subdirs) == 0)
+    {
+      CacheDir *parent = cd->parent;
+
+      if (parent != NULL)
+        g_hash_table_remove (parent->subdirs, cd->name);
+
+      cache_index_unlink (client, cd);
+      g_hash_table_remove (GCONF_CLIENT_GET_PRIVATE (client)->cache_index, cd->name);
+
+      cd = parent;
+    }
+}
+
+static gsize
+cache_value_size (const GConfValue *value)
+{
+  gsize size = sizeof (GConfValue);
+
+  switch (value->type)
+    {
+    case GCONF_VALUE_STRING:
+      if (gconf_value_get_string (value))
+        size += strlen (gconf_value_get_string (value)) + 1;
+      break;
+
+    case GCONF_VALUE_LIST:
+      {
+        GSList *tmp;
+
+        for (tmp = gconf_value_peek_list (value); tmp != NULL; tmp = tmp->next)
+          size += sizeof (GSList) + cache_value_size (tmp->data);
+      }
+      break;
+
+    case GCONF_VALUE_PAIR:
+      if (gconf_value_peek_car (value))
+        size += cache_value_size (gconf_value_peek_car (value));
+      if (gconf_value_peek_cdr (value))
+        size += cache_value_size (gconf_value_peek_cdr (value));
+      break;
+
+    case GCONF_VALUE_SCHEMA:
+      {
+        GConfSchema *sc = gconf_value_peek_schema (value);
+
+        if (sc == NULL)
+          break;
+
+        /* GConfSchema is opaque; a few pointers and enums */
+        size += 8 * sizeof (gpointer);
+        if (gconf_schema_get_locale (sc))
+          size += strlen (gconf_schema_get_locale (sc)) + 1;
+        if (gconf_schema_get_short_desc (sc))
+          size += strlen (gconf_schema_get_short_desc (sc)) + 1;
+        if (gconf_schema_get_long_desc (sc))
+          size += strlen (gconf_schema_get_long_desc (sc)) + 1;
+        if (gconf_schema_get_owner (sc))
+          size += strlen (gconf_schema_get_owner (sc)) + 1;
+        if (gconf_schema_get_default_value (sc))
+          size += cache_value_size (gconf_schema_get_default_value (sc));
+      }
+      break;
+
+    default:
+      break;
+    }
+
+  return size;
+}
+
+/* An estimate of what the cache spends on one entry */
+static gsize
+cache_entry_size (const GConfEntry *entry)
+{
+  gsize size;
+
+  size = sizeof (GConfEntry) + strlen (entry->key) + 1;
+
+  if (gconf_entry_get_schema_name (entry))
+    size += strlen (gconf_entry_get_schema_name (entry)) + 1;
+
+  if (entry->value)
+    size += cache_value_size (entry->value);
+
+  return size;
+}
+
+static void
+cache_index_touch (GConfClient *client,
+                   CacheDir    *cd)
+{
+  GConfClientPrivate *priv = GCONF_CLIENT_GET_PRIVATE (client);
+
+  if (cd == NULL || cd->lru_link == NULL)
+    return;
+
+  g_queue_unlink (priv->cache_lru, cd->lru_link);
+  g_queue_push_head_link (priv->cache_lru, cd->lru_link);
+}
+
+/* Adds entry to its directory, replacing old_entry (which may have a
+ * different key pointer) if that is non-NULL.
+ */
+static void
+cache_index_add (GConfClient *client,
+                 GConfEntry  *entry,
+                 GConfEntry  *old_entry)
+{
+  GConfClientPrivate *priv = GCONF_CLIENT_GET_PRIVATE (client);
+  gchar buf[GCONF_KEY_BUF_SIZE];
+  gchar *to_free;
+  CacheDir *cd;
+  gsize size;
+
+  cd = cache_index_ensure (client,
+                           gconf_key_directory_r (entry->key, buf, sizeof (buf),
+                                                  &to_free));
+  g_free (to_free);
+
+  if (old_entry != NULL)
+    {
+      size = cache_entry_size (old_entry);
+      cd->size -= size;
+      priv->cache_size -= size;
+    }
+
+  g_hash_table_replace (cd->entries, entry->key, entry);
+
+  size = cache_entry_size (entry);
+  cd->size += size;
+  priv->cache_size += size;
+
+  if (cd->lru_link == NULL)
+    {
+      g_queue_push_head (priv->cache_lru, cd);
+      cd->lru_link = g_queue_peek_head_link (priv->cache_lru);
+    }
+  else
+    cache_index_touch (client, cd);
+}
+
+static CacheDir*
+cache_index_lookup_parent (GConfClient *client,
+                           const gchar *key)
+{
+  gchar buf[GCONF_KEY_BUF_SIZE];
+  gchar *to_free;
+  const gchar *dir;
+  CacheDir *cd;
+
+  dir = gconf_key_directory_r (key, buf, sizeof (buf), &to_free);
+  g_assert (dir != NULL);
+
+  cd = cache_index_lookup (client, dir);
+  g_free (to_free);
+
+  return cd;
+}
+
+static void
+cache_index_unlink (GConfClient *client,
+                    CacheDir    *cd)
+{
+  if (cd->lru_link != NULL)
+    {
+      g_queue_delete_link (GCONF_CLIENT_GET_PRIVATE (client)->cache_lru, cd->lru_link);
+      cd->lru_link = NULL;
+    }
+}
+
+static void
+cache_remove_entry (GConfClient *client,
+                    const gchar *key)
+{
+  GConfEntry *entry;
+  CacheDir *cd;
+
+  entry = g_hash_table_lookup (client->cache_hash, key);
+  if (entry == NULL)
+    return;
+
+  cd = cache_index_lookup_parent (client, key);
+
+  if (cd != NULL)
+    {
+      gsize size = cache_entry_size (entry);
+
+      cd->size -= size;
+      GCONF_CLIENT_GET_PRIVATE (client)->cache_size -= size;
+
+      g_hash_table_remove (cd->entries, entry->key);
+      if (g_hash_table_size (cd->entries) == 0)
+        cache_index_unlink (client, cd);
+
+      cache_index_prune (client, cd);
+    }
+
+  /* key may point into entry */
+  g_hash_table_remove (client->cache_hash, entry->key);
+  gconf_entry_free (entry);
+}
+
+static void
+cache_dir_collect (CacheDir  *cd,
+                   GSList   **entries,
+                   GSList   **dirs)
+{
+  GHashTableIter iter;
+  gpointer value;
+
+  g_hash_table_iter_init (&iter, cd->entries);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    *entries = g_slist_prepend (*entries, value);
+
+  g_hash_table_iter_init (&iter, cd->subdirs);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    cache_dir_collect (value, entries, dirs);
+
+  *dirs = g_slist_prepend (*dirs, cd);
+}
+
+/* Removes the entry named dir, if any, and everything below dir */
+static void
+cache_remove_subtree (GConfClient *client,
+                      const gchar *dir)
+{
+  GConfClientPrivate *priv = GCONF_CLIENT_GET_PRIVATE (client);
+  GSList *entries = NULL;
+  GSList *dirs = NULL;
+  GSList *tmp;
+  CacheDir *cd;
+  CacheDir *parent;
+
+  cache_remove_entry (client, dir);
+
+  cd = cache_index_lookup (client, dir);
+  if (cd == NULL)
+    return;
+
+  cache_dir_collect (cd, &entries, &dirs);
+
+  for (tmp = entries; tmp != NULL; tmp = tmp->next)
+    {
+      GConfEntry *entry = tmp->data;
+
+      g_hash_table_remove (client->cache_hash, entry->key);
+      gconf_entry_free (entry);
+    }
+
+  parent = cd->parent;
+  if (parent != NULL)
+    g_hash_table_remove (parent->subdirs, cd->name);
+
+  /* frees the CacheDirs */
+  for (tmp = dirs; tmp != NULL; tmp = tmp->next)
+    {
+      CacheDir *sub = tmp->data;
+
+      priv->cache_size -= sub->size;
+      cache_index_unlink (client, sub);
+      g_hash_table_remove (priv->cache_index, sub->name);
+    }
+
+  cache_index_prune (client, parent);
+
+  g_slist_free (entries);
+  g_slist_free (dirs);
+}
+
+static gboolean
+clear_recursive_dirs_foreach (char *cached_dir, gpointer value, char *dir)
+{
+  if (gconf_key_is_below (cached_dir, dir))
+    {
+      trace ("'%s' no longer recursively cached", cached_dir);
+      return TRUE;
+    }
+
+  return FALSE;
+}
+
+/* Drops the values cached directly in cd */
+static void
+cache_evict_dir (GConfClient *client,
+                 CacheDir    *cd)
+{
+  GConfClientPrivate *priv = GCONF_CLIENT_GET_PRIVATE (client);
+  GHashTableIter iter;
+  gpointer value;
+
+  trace ("Evicting values in '%s' from the cache", cd->name);
+
+  g_hash_table_iter_init (&iter, cd->entries);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      GConfEntry *entry = value;
+
+      g_hash_table_iter_remove (&iter);
+      g_hash_table_remove (client->cache_hash, entry->key);
+      gconf_entry_free (entry);
+    }
+
+  priv->cache_size -= cd->size;
+  cd->size = 0;
+
+  /* Neither this dir nor anything above it is complete any more,
+   * or lookups would return false negatives.
+   */
+  if (g_hash_table_remove (client->cache_dirs, cd->name))
+    trace ("'%s' no longer fully cached", cd->name);
+  g_hash_table_foreach_remove (client->cache_recursive_dirs,
+                               (GHRFunc) clear_recursive_dirs_foreach,
+                               cd->name);
+
+  cache_index_unlink (client, cd);
+  priv->cache_evictions += 1;
+
+  cache_index_prune (client, cd);
+}
+
+/* Evicts least recently used directories until we're within the
+ * limit, but never keep itself.
+ */
+static void
+cache_enforce_limit (GConfClient *client,
+                     CacheDir    *keep)
+{
+  GConfClientPrivate *priv = GCONF_CLIENT_GET_PRIVATE (client);
+  CacheDir *cd;
+
+  if (priv->cache_limit == 0)
+    return;
+
+  while (priv->cache_size > priv->cache_limit &&
+         (cd = g_queue_peek_tail (priv->cache_lru)) != NULL &&
+         cd != keep)
+    cache_evict_dir (client, cd);
+}
+
 /*
  * Change sets
  */
@@ -2558,6 +3387,125 @@ gconf_client_commit_change_set   (GConfClient* client,
     }
 }
 
+static void
+collect_change_foreach (GConfChangeSet *cs,
+                        const gchar    *key,
+                        GConfValue     *value,
+                        gpointer        user_data)
+{
+  GSList **entries = user_data;
+
+  *entries = g_slist_prepend (*entries, gconf_entry_new (key, value));
+}
+
+/* For servers that can't commit atomically: commit key by key, and
+ * put back what was committed if one of them fails.
+ */
+static gboolean
+commit_change_set_one_by_one (GConfClient    *client,
+                              GConfChangeSet *cs,
+                              GError        **err)
+{
+  GConfChangeSet *reversed;
+  gboolean success;
+
+  reversed = gconf_client_reverse_change_set (client, cs, NULL);
+  success = gconf_client_commit_change_set (client, cs, FALSE, err);
+
+  if (!success && reversed != NULL)
+    gconf_client_commit_change_set (client, reversed, FALSE, NULL);
+
+  if (reversed != NULL)
+    gconf_change_set_unref (reversed);
+
+  return success;
+}
+
+gboolean
+gconf_client_commit_change_set_with_origin (GConfClient    *client,
+                                            GConfChangeSet *cs,
+                                            const gchar    *origin,
+                                            gboolean       *tagged,
+                                            GError        **err)
+{
+  GSList *entries = NULL;
+#ifdef HAVE_DBUS
+  GSList *tmp;
+#endif
+  GError *error = NULL;
+  gboolean committed;
+
+  g_return_val_if_fail (GCONF_IS_CLIENT (client), FALSE);
+  g_return_val_if_fail (cs != NULL, FALSE);
+  g_return_val_if_fail (err == NULL || *err == NULL, FALSE);
+
+  if (tagged != NULL)
+    *tagged = FALSE;
+
+  gconf_change_set_foreach (cs, collect_change_foreach, &entries);
+
+  trace ("REMOTE: Committing %u changes", g_slist_length (entries));
+  PUSH_USE_ENGINE (client);
+  committed = gconf_engine_commit (client->engine, entries, origin, &error);
+  POP_USE_ENGINE (client);
+
+  if (error != NULL)
+    {
+      g_slist_foreach (entries, (GFunc) gconf_entry_free, NULL);
+      g_slist_free (entries);
+
+      handle_error (client, error, err);
+
+      return FALSE;
+    }
+
+  if (!committed)
+    {
+      /* Notifications for these changes don't know their origin */
+      g_slist_foreach (entries, (GFunc) gconf_entry_free, NULL);
+      g_slist_free (entries);
+
+      return commit_change_set_one_by_one (client, cs, err);
+    }
+
+  if (tagged != NULL)
+    *tagged = TRUE;
+
+#ifdef HAVE_DBUS
+  /* As with gconf_client_set(), keep the cache current; entries we
+   * cache remember where the change came from, for the listeners.
+   */
+  for (tmp = entries; tmp != NULL; tmp = tmp->next)
+    {
+      GConfEntry *entry = tmp->data;
+
+      if (gconf_entry_get_value (entry) == NULL)
+        {
+          remove_key_from_cache (client, entry->key);
+
+          /* The notification is fetched again once it's dispatched,
+           * and what the server returns then doesn't know the origin.
+           */
+          if (origin != NULL && key_being_monitored (client, entry->key))
+            g_hash_table_replace (GCONF_CLIENT_GET_PRIVATE (client)->unset_origins,
+                                  g_strdup (entry->key), g_strdup (origin));
+          continue;
+        }
+
+      gconf_entry_set_origin (entry, origin);
+
+      if (gconf_client_cache (client, FALSE, entry, TRUE) &&
+          key_being_monitored (client, entry->key))
+        gconf_client_queue_notify (client, entry->key);
+    }
+#endif
+
+  g_slist_foreach (entries, (GFunc) gconf_entry_free, NULL);
+  g_slist_free (entries);
+
+  return TRUE;
+}
+
 struct RevertData {
   GConfClient* client;
   GError* error;
@@ -2759,6 +3707,11 @@ unregister_client (GConfClient *client)
  * Notification
  */
 
+/* How long one flush may spend dispatching before the rest of the
+ * queue is left for the next main loop iteration.
+ */
+#define NOTIFY_FLUSH_BUDGET_USEC (10 * 1000)
+
 static gboolean
 notify_idle_callback (gpointer data)
 {
@@ -2776,13 +3729,28 @@ static void
 gconf_client_queue_notify (GConfClient *client,
                            const char  *key)
 {
+  GConfClientPrivate *priv = GCONF_CLIENT_GET_PRIVATE (client);
+  char *copy;
+
+  /* The value is looked up when the notify is dispatched, so a key
+   * queued again just gets the latest value once.
+   */
+  if (g_hash_table_lookup (priv->notify_hash, key) != NULL)
+    {
+      trace ("Notify on '%s' already queued", key);
+      return;
+    }
+
   trace ("Queing notify on '%s', %d pending already", key,
          client->pending_notify_count);
   
   if (client->notify_handler == 0)
     client->notify_handler = g_idle_add (notify_idle_callback, client);
-  
-  client->notify_list = g_slist_prepend (client->notify_list, g_strdup (key));
+
+  /* Most recent first; flushing reverses it */
+  copy = g_strdup (key);
+  client->notify_list = g_slist_prepend (client->notify_list, copy);
+  g_hash_table_insert (priv->notify_hash, copy, copy);
   client->pending_notify_count += 1;
 }
 
@@ -2842,43 +3810,88 @@ notify_one_entry (GConfClient *client,
   g_object_unref (G_OBJECT (client));
 }
 
+/* Puts keys we didn't get to back at the head of the queue, unless
+ * they were queued again meanwhile.
+ */
+static void
+gconf_client_requeue_notifies (GConfClient *client,
+                               GSList      *remaining)
+{
+  GConfClientPrivate *priv = GCONF_CLIENT_GET_PRIVATE (client);
+  GSList *oldest_last = NULL;
+  GSList *tmp;
+
+  for (tmp = remaining; tmp != NULL; tmp = tmp->next)
+    {
+      char *key = tmp->data;
+
+      if (g_hash_table_lookup (priv->notify_hash, key) != NULL)
+        {
+          g_free (key);
+          continue;
+        }
+
+      g_hash_table_insert (priv->notify_hash, key, key);
+      oldest_last = g_slist_prepend (oldest_last, key);
+      client->pending_notify_count += 1;
+    }
+
+  client->notify_list = g_slist_concat (client->notify_list, oldest_last);
+
+  if (client->notify_list != NULL && client->notify_handler == 0)
+    client->notify_handler = g_idle_add (notify_idle_callback, client);
+}
+
 static void
 gconf_client_flush_notifies (GConfClient *client)
 {
+  GConfClientPrivate *priv = GCONF_CLIENT_GET_PRIVATE (client);
   GSList *tmp;
   GSList *to_notify;
-  GConfEntry *last_entry;
+  gint64 start;
 
   trace ("Flushing notify queue");
   
   /* Adopt notify list and clear it, to avoid reentrancy concerns.
-   * Sort it to compress duplicates, and keep people from relying on
-   * the notify order.
+   * Dispatch in the order the keys were first queued.
    */
-  to_notify = g_slist_sort (client->notify_list, (GCompareFunc) strcmp);
+  to_notify = g_slist_reverse (client->notify_list);
   client->notify_list = NULL;
   client->pending_notify_count = 0;
+  g_hash_table_remove_all (priv->notify_hash);
 
   gconf_client_unqueue_notifies (client);
 
-  last_entry = NULL;
+  start = g_get_monotonic_time ();
+
   tmp = to_notify;
   while (tmp != NULL)
     {
       GConfEntry *entry = NULL;
+      gpointer unset_key;
+      gchar *unset_origin = NULL;
+
+      if (tmp != to_notify &&
+          g_get_monotonic_time () - start > NOTIFY_FLUSH_BUDGET_USEC)
+        {
+          trace ("Notify budget used up, deferring the rest of the queue");
+          break;
+        }
+
+      /* Taken out first, a listener may unset the key again */
+      if (g_hash_table_lookup_extended (priv->unset_origins, tmp->data,
+                                        &unset_key, (gpointer *) &unset_origin))
+        {
+          g_hash_table_steal (priv->unset_origins, tmp->data);
+          g_free (unset_key);
+        }
 
       if (gconf_client_lookup (client, tmp->data, &entry) && entry != NULL)
         {
-          if (entry != last_entry)
-            {
-              trace ("Doing notification for '%s'", entry->key);
-              notify_one_entry (client, entry);
-              last_entry = entry;
-            }
-          else
-            {
-              trace ("Ignoring duplicate notify for '%s'", entry->key);
-            }
+          trace ("Doing notification for '%s'", entry->key);
+          if (unset_origin != NULL && gconf_entry_get_origin (entry) == NULL)
+            gconf_entry_set_origin (entry, unset_origin);
+          notify_one_entry (client, entry);
         }
       else
         {
@@ -2896,9 +3909,10 @@ gconf_client_flush_notifies (GConfClient *client)
               entry = gconf_client_get_entry (client, tmp->data, NULL, TRUE, NULL);
               if (entry != NULL)
                 {
+                  if (unset_origin != NULL)
+                    gconf_entry_set_origin (entry, unset_origin);
                   notify_one_entry (client, entry);
                   gconf_entry_unref (entry);
-                  last_entry = NULL;
                 }
             }
           else
@@ -2911,11 +3925,17 @@ gconf_client_flush_notifies (GConfClient *client)
                      tmp->data);
 #endif
         }
+
+      g_free (unset_origin);
       
+      g_free (tmp->data);
       tmp = tmp->next;
     }
+
+  /* Takes over the keys still in the list */
+  if (tmp != NULL)
+    gconf_client_requeue_notifies (client, tmp);
   
-  g_slist_foreach (to_notify, (GFunc) g_free, NULL);
   g_slist_free (to_notify);
 }
 
@@ -2930,6 +3950,7 @@ gconf_client_unqueue_notifies (GConfClient *client)
   
   if (client->notify_list != NULL)
     {
+      g_hash_table_remove_all (GCONF_CLIENT_GET_PRIVATE (client)->notify_hash);
       g_slist_foreach (client->notify_list, (GFunc) g_free, NULL);
       g_slist_free (client->notify_list);
       client->notify_list = NULL;
@@ -214,6 +214,20 @@ void              gconf_client_set_global_default_error_handler(GConfClientError
  */
 void              gconf_client_clear_cache(GConfClient* client);
 
+/*
+ * Limit the memory used by cached values to roughly max_bytes (0, the
+ * default, means no limit). When over the limit, the values of the
+ * least recently used directories are dropped.
+ */
+void              gconf_client_set_cache_limit (GConfClient* client,
+                                                gsize        max_bytes);
+
+void              gconf_client_get_cache_stats (GConfClient* client,
+                                                guint*       hits,
+                                                guint*       misses,
+                                                guint*       evictions,
+                                                gsize*       size);
+
 /*
  * Preload a directory; the directory must have been added already.
  * This is only useful as an optimization if you clear the cache,
@@ -342,6 +356,16 @@ gboolean     gconf_client_set_pair    (GConfClient* client, const gchar* key,
                                        gconstpointer address_of_cdr,
                                        GError** err);
 
+/*
+ * Pipelined writes: the setters above update the client-side cache and
+ * return without waiting for the server to acknowledge the change.
+ * Failures are reported later through the unreturned_error signal,
+ * and gconf_client_suggest_sync() waits for all outstanding writes.
+ * Off by default; only has an effect with the D-Bus transport.
+ */
+void         gconf_client_set_pipelined_writes (GConfClient* client,
+                                                gboolean     setting);
+
 /*
  * Functions to emit signals
  */
@@ -368,6 +392,17 @@ gboolean        gconf_client_commit_change_set   (GConfClient* client,
                                                   gboolean remove_committed,
                                                   GError** err);
 
+/* Commit all of the set or none of it, in one request where the server
+   supports it; notifications about the changes carry origin, see
+   gconf_entry_get_origin().  Servers that can't do that get the keys
+   one by one, and *tagged is set to FALSE as the notifications won't
+   carry origin then */
+gboolean        gconf_client_commit_change_set_with_origin (GConfClient* client,
+                                                            GConfChangeSet* cs,
+                                                            const gchar* origin,
+                                                            gboolean* tagged,
+                                                            GError** err);
+
 /* Create a change set that would revert the given change set
    for the given GConfClient */
 GConfChangeSet* gconf_client_reverse_change_set  (GConfClient* client,
@@ -29,6 +29,9 @@
 
 static gint object_nr = 0;
 
+/* object path -> database, for dispatching on peer connections */
+static GHashTable *databases_by_path = NULL;
+
 typedef struct {
   char  *namespace_section;
   GList *clients;
@@ -50,6 +53,8 @@ static DBusHandlerResult database_filter_func               (DBusConnection   *c
 static DBusHandlerResult database_handle_name_owner_changed (DBusConnection   *connection,
 							     DBusMessage      *message,
 							     GConfDatabase    *db);
+static void              database_forget_client             (GConfDatabase    *db,
+							     const gchar      *service);
 
 static void     database_handle_lookup            (DBusConnection   *conn,
 						   DBusMessage      *message,
@@ -69,6 +74,9 @@ static void     database_handle_unset             (DBusConnection   *conn,
 static void     database_handle_recursive_unset   (DBusConnection   *conn,
 						   DBusMessage      *message,
 						   GConfDatabase    *db);
+static void     database_handle_commit            (DBusConnection   *conn,
+						   DBusMessage      *message,
+						   GConfDatabase    *db);
 static void     database_handle_dir_exists        (DBusConnection   *conn,
 						   DBusMessage      *message,
 						   GConfDatabase    *db);
@@ -78,6 +86,9 @@ static void     database_handle_get_all_entries   (DBusConnection   *conn,
 static void     database_handle_get_all_dirs      (DBusConnection   *conn,
 						   DBusMessage      *message,
 						   GConfDatabase    *db);
+static void     database_handle_search            (DBusConnection   *conn,
+						   DBusMessage      *message,
+						   GConfDatabase    *db);
 static void     database_handle_set_schema        (DBusConnection   *conn,
 						   DBusMessage      *message,
 						   GConfDatabase    *db);
@@ -100,11 +111,21 @@ static void                 database_remove_listening_client   (GConfDatabase
 								ListeningClientData *client);
 
 
+static DBusHandlerResult peer_database_message_func (DBusConnection *connection,
+						      DBusMessage    *message,
+						      void           *user_data);
+
 static DBusObjectPathVTable database_vtable = {
   (DBusObjectPathUnregisterFunction) database_unregistered_func,
   (DBusObjectPathMessageFunction)    database_message_func,
   NULL,
 };
+
+static DBusObjectPathVTable peer_database_vtable = {
+  NULL,
+  peer_database_message_func,
+  NULL,
+};
  
 static void
 database_unregistered_func (DBusConnection *connection, GConfDatabase *db)
@@ -149,6 +170,11 @@ database_message_func (DBusConnection *connection,
 					GCONF_DBUS_DATABASE_RECURSIVE_UNSET)) {
     database_handle_recursive_unset (connection, message, db);
   }
+  else if (dbus_message_is_method_call (message,
+					GCONF_DBUS_DATABASE_INTERFACE,
+					GCONF_DBUS_DATABASE_COMMIT)) {
+    database_handle_commit (connection, message, db);
+  }
   else if (dbus_message_is_method_call (message,
 					GCONF_DBUS_DATABASE_INTERFACE,
 					GCONF_DBUS_DATABASE_DIR_EXISTS)) {
@@ -164,6 +190,11 @@ database_message_func (DBusConnection *connection,
 					GCONF_DBUS_DATABASE_GET_ALL_DIRS)) {
     database_handle_get_all_dirs (connection, message, db);
   }
+  else if (dbus_message_is_method_call (message,
+					GCONF_DBUS_DATABASE_INTERFACE,
+					GCONF_DBUS_DATABASE_SEARCH)) {
+    database_handle_search (connection, message, db);
+  }
   else if (dbus_message_is_method_call (message,
 					GCONF_DBUS_DATABASE_INTERFACE,
 					GCONF_DBUS_DATABASE_SET_SCHEMA)) {
@@ -190,6 +221,23 @@ database_message_func (DBusConnection *connection,
   return DBUS_HANDLER_RESULT_HANDLED;
 }
 
+static DBusHandlerResult
+peer_database_message_func (DBusConnection *connection,
+			    DBusMessage    *message,
+			    void           *user_data)
+{
+  GConfDatabase *db = NULL;
+
+  if (databases_by_path != NULL)
+    db = g_hash_table_lookup (databases_by_path,
+			      dbus_message_get_path (message));
+
+  if (db == NULL)
+    return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+  return database_message_func (connection, message, db);
+}
+
 static void
 get_all_notifications_func (gpointer key,
 			    gpointer value,
@@ -228,9 +276,6 @@ database_handle_name_owner_changed (DBusConnection *connection,
   gchar               *service;
   gchar               *old_owner;
   gchar               *new_owner;
-  GList               *notifications = NULL, *l;
-  NotificationData    *notification;
-  ListeningClientData *client;
   
   dbus_message_get_args (message,
 			 NULL,
@@ -245,6 +290,19 @@ database_handle_name_owner_changed (DBusConnection *connection,
       return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
     }
 
+  database_forget_client (db, service);
+
+  return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+}
+
+static void
+database_forget_client (GConfDatabase *db,
+			const gchar   *service)
+{
+  GList               *notifications = NULL, *l;
+  NotificationData    *notification;
+  ListeningClientData *client;
+
   g_hash_table_foreach (db->notifications, get_all_notifications_func,
 			&notifications);
   
@@ -264,8 +322,6 @@ database_handle_name_owner_changed (DBusConnection *connection,
     database_remove_listening_client (db, client);
 
   g_list_free (notifications);
-
-  return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
 }
     
 static void
@@ -505,6 +561,40 @@ database_handle_recursive_unset  (DBusConnection *conn,
   dbus_connection_send (conn, reply, NULL);
   dbus_message_unref (reply);
 }
+
+/* Applies a change set atomically; a NULL value in an entry means
+ * unset.  Notifications for the changes carry the caller's origin.
+ */
+static void
+database_handle_commit (DBusConnection *conn,
+			DBusMessage    *message,
+			GConfDatabase  *db)
+{
+  gchar *origin;
+  GSList *entries;
+  GError *gerror = NULL;
+  DBusMessage *reply;
+  DBusMessageIter iter;
+
+  dbus_message_iter_init (message, &iter);
+  dbus_message_iter_get_basic (&iter, &origin);
+
+  dbus_message_iter_next (&iter);
+  entries = g_slist_reverse (gconf_dbus_utils_get_entries (&iter, "/"));
+
+  gconf_database_commit (db, entries, origin[0] != '\0' ? origin : NULL,
+			 &gerror);
+
+  g_slist_foreach (entries, (GFunc) gconf_entry_free, NULL);
+  g_slist_free (entries);
+
+  if (gconfd_dbus_set_exception (conn, message, &gerror))
+    return;
+
+  reply = dbus_message_new_method_return (message);
+  dbus_connection_send (conn, reply, NULL);
+  dbus_message_unref (reply);
+}
                                                                                 
 static void
 database_handle_dir_exists (DBusConnection *conn,
@@ -630,6 +720,53 @@ database_handle_get_all_dirs (DBusConnection *conn,
   dbus_message_unref (reply);
 }
                                                                                 
+static void
+database_handle_search (DBusConnection *conn,
+                        DBusMessage    *message,
+                        GConfDatabase  *db)
+{
+  GSList *entries, *l;
+  gchar  *dir;
+  guint32 type;
+  gchar  *pattern;
+  gchar  *locale;
+  GError *gerror = NULL;
+  GConfLocaleList* locales;
+  DBusMessage *reply;
+  DBusMessageIter iter;
+
+  if (!gconfd_dbus_get_message_args (conn, message, 
+				     DBUS_TYPE_STRING, &dir,
+				     DBUS_TYPE_UINT32, &type,
+				     DBUS_TYPE_STRING, &pattern,
+				     DBUS_TYPE_STRING, &locale,
+				     DBUS_TYPE_INVALID)) 
+    return;
+
+  locales = gconfd_locale_cache_lookup (locale);
+
+  entries = gconf_database_search (db, dir, type, pattern,
+				   locales->list, &gerror);
+
+  if (gconfd_dbus_set_exception (conn, message, &gerror))
+    return;
+
+  reply = dbus_message_new_method_return (message);
+
+  dbus_message_iter_init_append (reply, &iter);
+
+  /* Keys are absolute */
+  gconf_dbus_utils_append_entries (&iter, entries);
+
+  for (l = entries; l; l = l->next)
+    gconf_entry_free (l->data);
+
+  dbus_connection_send (conn, reply, NULL);
+  dbus_message_unref (reply);
+
+  g_slist_free (entries);
+}
+                                                                                
 static void
 database_handle_set_schema (DBusConnection *conn,
                             DBusMessage    *message,
@@ -694,7 +831,7 @@ database_handle_add_notify (DBusConnection    *conn,
 				     DBUS_TYPE_INVALID)) 
     return;
 
-  sender = dbus_message_get_sender (message);
+  sender = gconfd_dbus_get_sender (conn, message);
   
   client = g_hash_table_lookup (db->listening_clients, sender);
   if (!client)
@@ -769,7 +906,7 @@ database_handle_remove_notify (DBusConnection    *conn,
 				     DBUS_TYPE_INVALID)) 
     return;
 
-  sender = dbus_message_get_sender (message);
+  sender = gconfd_dbus_get_sender (conn, message);
   
   notification = g_hash_table_lookup (db->notifications, namespace_section);
 
@@ -817,9 +954,13 @@ database_add_listening_client (GConfDatabase *db,
 
   g_hash_table_insert (db->listening_clients, client->service, client);
   
-  rule = get_rule_for_service (service);
-  dbus_bus_add_match (gconfd_dbus_get_connection (), rule, NULL);
-  g_free (rule);
+  /* Peers are tracked by their connection instead */
+  if (!gconfd_dbus_client_is_peer (service))
+    {
+      rule = get_rule_for_service (service);
+      dbus_bus_add_match (gconfd_dbus_get_connection (), rule, NULL);
+      g_free (rule);
+    }
 
   return client;
 }
@@ -830,9 +971,12 @@ database_remove_listening_client (GConfDatabase       *db,
 {
   gchar *rule;
 
-  rule = get_rule_for_service (client->service);
-  dbus_bus_remove_match (gconfd_dbus_get_connection (), rule, NULL);
-  g_free (rule);
+  if (!gconfd_dbus_client_is_peer (client->service))
+    {
+      rule = get_rule_for_service (client->service);
+      dbus_bus_remove_match (gconfd_dbus_get_connection (), rule, NULL);
+      g_free (rule);
+    }
 
   g_hash_table_remove (db->listening_clients, client->service);
   g_free (client->service);
@@ -859,6 +1003,11 @@ gconf_database_dbus_setup (GConfDatabase *db)
 
   db->notifications = g_hash_table_new (g_str_hash, g_str_equal);
   db->listening_clients = g_hash_table_new (g_str_hash, g_str_equal);
+
+  if (databases_by_path == NULL)
+    databases_by_path = g_hash_table_new (g_str_hash, g_str_equal);
+
+  g_hash_table_insert (databases_by_path, db->object_path, db);
  
   dbus_connection_add_filter (conn,
 			      (DBusHandleMessageFunction)database_filter_func,
@@ -879,6 +1028,9 @@ gconf_database_dbus_teardown (GConfDatabase *db)
   dbus_connection_remove_filter (conn,
 				 (DBusHandleMessageFunction)database_filter_func,
 				 db);
+
+  g_hash_table_remove (databases_by_path, db->object_path);
+
   g_free (db->object_path);
   db->object_path = NULL;
 
@@ -895,6 +1047,35 @@ gconf_database_dbus_get_path (GConfDatabase *db)
   return db->object_path;
 }
 
+/* Databases come and go independently of peer connections, so peers
+ * get a fallback handler that looks the database up by path.
+ */
+void
+gconf_database_dbus_register_peer (DBusConnection *connection)
+{
+  dbus_connection_register_fallback (connection,
+				     DATABASE_OBJECT_PATH,
+				     &peer_database_vtable,
+				     NULL);
+}
+
+static void
+forget_client_foreach (gpointer key,
+		       gpointer value,
+		       gpointer user_data)
+{
+  database_forget_client (value, user_data);
+}
+
+void
+gconf_database_dbus_forget_client (const gchar *client)
+{
+  if (databases_by_path != NULL)
+    g_hash_table_foreach (databases_by_path,
+			  forget_client_foreach,
+			  (gpointer) client);
+}
+
 void
 gconf_database_dbus_notify_listeners (GConfDatabase    *db,
 				      GConfSources     *modified_sources,
@@ -909,9 +1090,12 @@ gconf_database_dbus_notify_listeners (GConfDatabase    *db,
   NotificationData *notification;
   DBusMessage      *message;
   gboolean          last;
+  const gchar      *origin;
   
   dir = g_strdup (key);
 
+  origin = db->notify_origin ? db->notify_origin : "";
+
   /* Lookup the key in the namespace hierarchy, start with the full key and then
    * remove the leaf, lookup again, remove the leaf, and so on until a match is
    * found. Notify the clients (identified by their base service) that
@@ -929,7 +1113,9 @@ gconf_database_dbus_notify_listeners (GConfDatabase    *db,
 	      const char *base_service = l->data;
 	      DBusMessageIter iter;
 	      
-	      message = dbus_message_new_method_call (base_service,
+	      /* Peer connections have no bus to route on */
+	      message = dbus_message_new_method_call (gconfd_dbus_client_is_peer (base_service) ?
+						      NULL : base_service,
 						      GCONF_DBUS_CLIENT_OBJECT,
 						      GCONF_DBUS_CLIENT_INTERFACE,
 						      "Notify");
@@ -947,10 +1133,14 @@ gconf_database_dbus_notify_listeners (GConfDatabase    *db,
 						    is_default,
 						    is_writable,
 						    NULL);
+
+	      /* Trailing, so older clients can ignore it */
+	      dbus_message_iter_append_basic (&iter, DBUS_TYPE_STRING, &origin);
 	      
 	      dbus_message_set_no_reply (message, TRUE);
 	      
-	      dbus_connection_send (gconfd_dbus_get_connection (), message, NULL);
+	      dbus_connection_send (gconfd_dbus_get_connection_for_client (base_service),
+				    message, NULL);
 	      dbus_message_unref (message);
 	    }
 	}
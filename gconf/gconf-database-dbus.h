@@ -34,4 +34,7 @@ void         gconf_database_dbus_notify_listeners (GConfDatabase    *db,
 						   gboolean          is_writable,
 						   gboolean          notify_others);
 
+void         gconf_database_dbus_register_peer    (DBusConnection   *connection);
+void         gconf_database_dbus_forget_client    (const gchar      *client);
+
 #endif
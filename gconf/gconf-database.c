@@ -24,6 +24,7 @@
 #endif
 #include "gconf-listeners.h"
 #include "gconf-sources.h"
+#include "gconf-backend.h"
 #include "gconf-locale.h"
 #include "gconfd.h"
 #ifdef HAVE_DBUS
@@ -33,6 +34,9 @@
 #include <unistd.h>
 #include <time.h>
 #include <stdlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <glib/gstdio.h>
 
 /*
  * Forward decls
@@ -806,6 +810,10 @@ gconf_database_set_sources (GConfDatabase *db,
 
       gconf_sources_clear_cache(db->sources);
       gconf_sources_free(db->sources);
+
+#ifdef HAVE_DBUS
+      gconf_snapshot_writer_forget_all (db->snapshot);
+#endif
     }
 
   db->sources = sources;
@@ -893,6 +901,9 @@ gconf_database_free (GConfDatabase *db)
 
 #ifdef HAVE_DBUS
   gconf_database_dbus_teardown (db);
+
+  gconf_snapshot_writer_free (db->snapshot);
+  db->snapshot = NULL;
 #endif
 
   if (db->listeners != NULL)
@@ -1077,6 +1088,10 @@ source_notify_cb (GConfSource   *source,
       gboolean     is_default;
       gboolean     is_writable;
 
+#ifdef HAVE_DBUS
+      gconf_snapshot_writer_forget (db->snapshot, location);
+#endif
+
       error = NULL;
       is_default = is_writable = FALSE;
 
@@ -1349,6 +1364,20 @@ gconf_database_query_value (GConfDatabase  *db,
   g_assert(db->listeners != NULL);
   
   db->last_access = time(NULL);
+
+#ifdef HAVE_DBUS
+  /* Published entries are never defaults, so they answer any lookup
+   * regardless of locale or use_schema_default.
+   */
+  if (gconf_snapshot_writer_lookup (db->snapshot, key, &val,
+                                    value_is_writable, schema_name))
+    {
+      if (value_is_default)
+        *value_is_default = FALSE;
+
+      return val;
+    }
+#endif
   
   val = gconf_sources_query_value(db->sources, key, locales,
                                   use_schema_default,
@@ -1362,6 +1391,15 @@ gconf_database_query_value (GConfDatabase  *db,
       gconf_log(GCL_ERR, _("Error getting value for `%s': %s"),
                 key, (*err)->message);
     }
+#ifdef HAVE_DBUS
+  else if (val != NULL && schema_name != NULL &&
+           value_is_default != NULL && !*value_is_default &&
+           value_is_writable != NULL)
+    {
+      gconf_snapshot_writer_record (db->snapshot, key, val,
+                                    *schema_name, *value_is_writable);
+    }
+#endif
   
   return val;
 }
@@ -1404,6 +1442,10 @@ gconf_database_set   (GConfDatabase      *db,
   /* this really churns the logfile, so we avoid it */
   gconf_log(GCL_DEBUG, "Received request to set key `%s'", key);
 #endif
+
+#ifdef HAVE_DBUS
+  gconf_snapshot_writer_forget (db->snapshot, key);
+#endif
   
   gconf_sources_set_value(db->sources, key, value, &modified_sources, &error);
 
@@ -1466,6 +1508,10 @@ gconf_database_unset (GConfDatabase      *db,
   
   gconf_log(GCL_DEBUG, "Received request to unset key `%s'", key);
 
+#ifdef HAVE_DBUS
+  gconf_snapshot_writer_forget (db->snapshot, key);
+#endif
+
   gconf_sources_unset_value(db->sources, key, locale, &modified_sources, &error);
 
   if (error != NULL)
@@ -1565,6 +1611,10 @@ gconf_database_recursive_unset (GConfDatabase      *db,
   
   gconf_log (GCL_DEBUG, "Received request to recursively unset key \"%s\"", key);
 
+#ifdef HAVE_DBUS
+  gconf_snapshot_writer_forget (db->snapshot, key);
+#endif
+
   notifies = NULL;
   gconf_sources_recursive_unset (db->sources, key, locale,
                                  flags, &notifies, &error);
@@ -1660,6 +1710,105 @@ gconf_database_recursive_unset (GConfDatabase      *db,
   g_slist_free (notifies);
 }
 
+#ifdef HAVE_DBUS
+static void
+commit_one (GConfDatabase *db,
+            const gchar   *key,
+            GConfValue    *value,
+            GError       **err)
+{
+  if (value != NULL)
+    gconf_database_set (db, key, value, err);
+  else
+    gconf_database_unset (db, key, NULL, err);
+}
+
+/* Applies all of entries, a NULL value meaning unset, or none of
+ * them: once one fails, those already applied are put back.  The
+ * notifications for the changes, undoing included, carry origin.
+ */
+gboolean
+gconf_database_commit (GConfDatabase  *db,
+                       GSList         *entries,
+                       const gchar    *origin,
+                       GError        **err)
+{
+  GSList *undo = NULL;
+  GSList *tmp;
+  GError *error = NULL;
+
+  g_return_val_if_fail (err == NULL || *err == NULL, FALSE);
+
+  gconf_log (GCL_DEBUG, "Received request to commit %u changes",
+             g_slist_length (entries));
+
+  g_free (db->notify_origin);
+  db->notify_origin = g_strdup (origin);
+
+  for (tmp = entries; tmp != NULL; tmp = tmp->next)
+    {
+      GConfEntry *entry = tmp->data;
+      GConfValue *old_value;
+
+      /* Only what the change overwrites; a value from a lower source
+       * such as the defaults must not be copied up when undoing, so
+       * the key is unset again instead.
+       */
+      old_value = gconf_sources_query_writable_value (db->sources,
+                                                      entry->key, &error);
+
+      if (error != NULL)
+        break;
+
+      commit_one (db, entry->key, gconf_entry_get_value (entry), &error);
+
+      if (error != NULL)
+        {
+          if (old_value != NULL)
+            gconf_value_free (old_value);
+          break;
+        }
+
+      undo = g_slist_prepend (undo,
+                              gconf_entry_new_nocopy (g_strdup (entry->key),
+                                                      old_value));
+    }
+
+  if (error != NULL)
+    {
+      /* Most recent change first */
+      for (tmp = undo; tmp != NULL; tmp = tmp->next)
+        {
+          GConfEntry *old = tmp->data;
+          GError *undo_error = NULL;
+
+          commit_one (db, old->key, gconf_entry_get_value (old), &undo_error);
+
+          if (undo_error != NULL)
+            {
+              gconf_log (GCL_ERR, _("Failed to restore `%s' after a failed commit: %s"),
+                         old->key, undo_error->message);
+              g_error_free (undo_error);
+            }
+        }
+    }
+
+  g_slist_foreach (undo, (GFunc) gconf_entry_free, NULL);
+  g_slist_free (undo);
+
+  g_free (db->notify_origin);
+  db->notify_origin = NULL;
+
+  if (error != NULL)
+    {
+      g_propagate_error (err, error);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+#endif
+
 gboolean
 gconf_database_dir_exists  (GConfDatabase  *db,
                             const gchar    *dir,
@@ -1698,6 +1847,10 @@ gconf_database_remove_dir  (GConfDatabase  *db,
   db->last_access = time(NULL);
   
   gconf_log (GCL_DEBUG, "Received request to remove directory \"%s\"", dir);
+
+#ifdef HAVE_DBUS
+  gconf_snapshot_writer_forget (db->snapshot, dir);
+#endif
   
   gconf_sources_remove_dir(db->sources, dir, err);
 
@@ -1762,6 +1915,35 @@ gconf_database_all_dirs (GConfDatabase  *db,
   return subdirs;
 }
 
+GSList*
+gconf_database_search (GConfDatabase  *db,
+                       const gchar    *dir,
+                       GConfSearchType type,
+                       const gchar    *pattern,
+                       const gchar   **locales,
+                       GError        **err)
+{
+  GSList* entries;
+
+  g_return_val_if_fail (err == NULL || *err == NULL, NULL);
+
+  g_assert (db->listeners != NULL);
+
+  db->last_access = time (NULL);
+
+  gconf_log (GCL_DEBUG, "Received request to search `%s' for `%s'", dir, pattern);
+
+  entries = gconf_sources_search (db->sources, dir, type, pattern, locales, err);
+
+  if (err && *err != NULL)
+    {
+      gconf_log (GCL_ERR, _("Error searching `%s': %s"),
+                 dir, (*err)->message);
+    }
+
+  return entries;
+}
+
 void
 gconf_database_set_schema (GConfDatabase  *db,
                            const gchar    *key,
@@ -1772,6 +1954,10 @@ gconf_database_set_schema (GConfDatabase  *db,
   g_assert (db->listeners != NULL);
   
   db->last_access = time (NULL);
+
+#ifdef HAVE_DBUS
+  gconf_snapshot_writer_forget (db->snapshot, key);
+#endif
   
   gconf_sources_set_schema (db->sources, key, schema_key, err);
 
@@ -1830,6 +2016,36 @@ gconf_database_clear_cache (GConfDatabase  *db,
   db->last_access = time(NULL);
 
   gconf_sources_clear_cache(db->sources);
+
+#ifdef HAVE_DBUS
+  gconf_snapshot_writer_forget_all (db->snapshot);
+#endif
+}
+
+gsize
+gconf_database_get_cache_size (GConfDatabase *db)
+{
+  if (db->listeners == NULL)
+    return 0;
+
+  return gconf_sources_get_cache_size (db->sources);
+}
+
+/* Drops what the backends have loaded, unlike clear_cache without
+ * touching last_access, listeners or the read snapshot: the data is
+ * unchanged, it just gets read back in on the next access.  Databases
+ * with a sync pending are left alone until they're clean.
+ */
+gboolean
+gconf_database_evict_cache (GConfDatabase *db)
+{
+  if (db->listeners == NULL ||
+      db->sync_idle != 0 || db->sync_timeout != 0)
+    return FALSE;
+
+  gconf_sources_clear_cache (db->sources);
+
+  return TRUE;
 }
 
 void
@@ -1842,8 +2058,188 @@ gconf_database_clear_cache_for_sources (GConfDatabase  *db,
   db->last_access = time(NULL);
 
   gconf_sources_clear_cache_for_sources(db->sources, sources);
+
+#ifdef HAVE_DBUS
+  gconf_snapshot_writer_forget_all (db->snapshot);
+#endif
+}
+
+#ifdef HAVE_DBUS
+#ifdef HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC
+#define STAT_MTIME_NSEC(st) ((st)->st_mtim.tv_nsec)
+#define STAT_CTIME_NSEC(st) ((st)->st_ctim.tv_nsec)
+#else
+#define STAT_MTIME_NSEC(st) 0
+#define STAT_CTIME_NSEC(st) 0
+#endif
+
+static int
+compare_names (gconstpointer a,
+               gconstpointer b)
+{
+  return strcmp (*(const gchar **) a, *(const gchar **) b);
+}
+
+static void
+stamp_tree (GChecksum   *checksum,
+            const gchar *path,
+            time_t       now,
+            gboolean    *ambiguous)
+{
+  struct stat st;
+  GDir *dir;
+  GPtrArray *names;
+  const gchar *name;
+  gchar *buf;
+  guint i;
+
+  if (g_lstat (path, &st) < 0)
+    return;
+
+  buf = g_strdup_printf ("%s\n%lu %" G_GINT64_FORMAT " %ld.%09ld %ld.%09ld\n",
+                         path, (gulong) st.st_ino, (gint64) st.st_size,
+                         (long) st.st_mtime, (long) STAT_MTIME_NSEC (&st),
+                         (long) st.st_ctime, (long) STAT_CTIME_NSEC (&st));
+  g_checksum_update (checksum, (const guchar *) buf, -1);
+  g_free (buf);
+
+  /* Another change within the timestamp granularity of this one
+   * might leave everything above as it is.
+   */
+  if (st.st_mtime >= now - 1 || st.st_ctime >= now - 1)
+    *ambiguous = TRUE;
+
+  if (!S_ISDIR (st.st_mode))
+    return;
+
+  dir = g_dir_open (path, 0, NULL);
+  if (dir == NULL)
+    return;
+
+  names = g_ptr_array_new ();
+  while ((name = g_dir_read_name (dir)) != NULL)
+    g_ptr_array_add (names, g_strdup (name));
+  g_dir_close (dir);
+
+  g_ptr_array_sort (names, compare_names);
+
+  for (i = 0; i < names->len; i++)
+    {
+      gchar *child = g_build_filename (path, g_ptr_array_index (names, i), NULL);
+
+      stamp_tree (checksum, child, now, ambiguous);
+      g_free (child);
+      g_free (g_ptr_array_index (names, i));
+    }
+
+  g_ptr_array_free (names, TRUE);
 }
 
+/* Describes the on-disk state of the database's sources: their
+ * addresses, plus a checksum of the inode, size and timestamps of
+ * every file under each.  Any edit to a source, by us or anyone
+ * else, changes it.  Stat'ing the trees is much cheaper than parsing
+ * them.
+ *
+ * Returns NULL if something changed too recently for the timestamps
+ * to tell it apart from a further change, in which case there is
+ * nothing safe to compare against.
+ */
+static gchar*
+database_sources_stamp (GConfDatabase *db)
+{
+  GString *stamp;
+  GList *tmp;
+  gboolean ambiguous = FALSE;
+  time_t now;
+
+  stamp = g_string_new (NULL);
+  now = time (NULL);
+
+  for (tmp = db->sources->sources; tmp != NULL; tmp = tmp->next)
+    {
+      GConfSource *source = tmp->data;
+      GChecksum *checksum;
+      gchar *resource;
+
+      checksum = g_checksum_new (G_CHECKSUM_SHA256);
+
+      resource = gconf_address_resource (source->address);
+      if (resource != NULL)
+        stamp_tree (checksum, resource, now, &ambiguous);
+
+      g_string_append_printf (stamp, "%s %s\n",
+                              source->address,
+                              g_checksum_get_string (checksum));
+      g_checksum_free (checksum);
+      g_free (resource);
+    }
+
+  if (ambiguous)
+    {
+      gconf_log (GCL_DEBUG, "Sources changed too recently to stamp them");
+      g_string_free (stamp, TRUE);
+      return NULL;
+    }
+
+  return g_string_free (stamp, FALSE);
+}
+
+void
+gconf_database_publish_snapshot (GConfDatabase *db,
+                                 const gchar   *instance,
+                                 const gchar   *name)
+{
+  g_return_if_fail (db->snapshot == NULL);
+
+  db->snapshot = gconf_snapshot_writer_new (instance, name);
+
+  /* The stamp walks every source, which a cold start can skip */
+  if (gconf_snapshot_writer_has_warm (db->snapshot))
+    {
+      gchar *stamp;
+
+      stamp = database_sources_stamp (db);
+      gconf_snapshot_writer_load_warm (db->snapshot, stamp);
+      g_free (stamp);
+    }
+}
+
+/* Called when the daemon exits or hibernates the database, so the
+ * next one can start answering from where we left off.
+ */
+void
+gconf_database_save_warm_snapshot (GConfDatabase *db)
+{
+  gchar *stamp;
+
+  if (db->snapshot == NULL || db->listeners == NULL)
+    return;
+
+  /* The stamp has to describe the sources with our changes in them */
+  if (db->sync_idle != 0 || db->sync_timeout != 0)
+    {
+      if (db->sync_idle != 0)
+        {
+          g_source_remove (db->sync_idle);
+          db->sync_idle = 0;
+        }
+
+      if (db->sync_timeout != 0)
+        {
+          g_source_remove (db->sync_timeout);
+          db->sync_timeout = 0;
+        }
+
+      gconf_database_really_sync (db);
+    }
+
+  stamp = database_sources_stamp (db);
+  gconf_snapshot_writer_save_warm (db->snapshot, stamp);
+  g_free (stamp);
+}
+#endif
+
 const gchar *
 gconf_database_get_persistent_name (GConfDatabase *db)
 {
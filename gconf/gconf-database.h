@@ -34,6 +34,7 @@ G_BEGIN_DECLS
 
 #ifdef HAVE_DBUS
 #include <dbus/dbus.h>
+#include "gconf-snapshot.h"
 #endif
 
 #include "gconf-locale.h"
@@ -56,6 +57,12 @@ struct _GConfDatabase
   /* Information about clients that want notification. */
   GHashTable     *notifications;
   GHashTable     *listening_clients;
+
+  /* Resolved values published for clients to read without IPC */
+  GConfSnapshotWriter *snapshot;
+
+  /* Origin of the commit being applied, passed on with its notifications */
+  gchar          *notify_origin;
 #endif
 
   GConfListeners* listeners;
@@ -132,6 +139,13 @@ void gconf_database_recursive_unset (GConfDatabase      *db,
                                      GConfUnsetFlags     flags,
                                      GError            **err);
 
+#ifdef HAVE_DBUS
+gboolean gconf_database_commit (GConfDatabase  *db,
+                                GSList         *entries,
+                                const gchar    *origin,
+                                GError        **err);
+#endif
+
 
 gboolean gconf_database_dir_exists  (GConfDatabase  *db,
                                      const gchar    *dir,
@@ -146,6 +160,12 @@ GSList*  gconf_database_all_entries (GConfDatabase  *db,
 GSList*  gconf_database_all_dirs    (GConfDatabase  *db,
                                      const gchar    *dir,
                                      GError    **err);
+GSList*  gconf_database_search      (GConfDatabase  *db,
+                                     const gchar    *dir,
+                                     GConfSearchType type,
+                                     const gchar    *pattern,
+                                     const gchar   **locales,
+                                     GError        **err);
 void     gconf_database_set_schema  (GConfDatabase  *db,
                                      const gchar    *key,
                                      const gchar    *schema_key,
@@ -169,6 +189,16 @@ void gconfd_locale_cache_drop  (void);
 
 const gchar* gconf_database_get_persistent_name (GConfDatabase *db);
 
+gsize    gconf_database_get_cache_size (GConfDatabase *db);
+gboolean gconf_database_evict_cache    (GConfDatabase *db);
+
+#ifdef HAVE_DBUS
+void gconf_database_publish_snapshot (GConfDatabase *db,
+                                      const gchar   *instance,
+                                      const gchar   *name);
+void gconf_database_save_warm_snapshot (GConfDatabase *db);
+#endif
+
 #ifdef HAVE_CORBA
 void gconf_database_log_listeners_to_string (GConfDatabase *db,
                                              gboolean is_default,
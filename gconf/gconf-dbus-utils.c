@@ -185,7 +185,7 @@ utils_append_value_helper_fundamental (DBusMessageIter  *iter,
       break;
 
     case GCONF_VALUE_SCHEMA:
-      utils_append_schema (iter, gconf_value_get_schema (value));
+      utils_append_schema (iter, gconf_value_peek_schema (value));
       break;
 
     default:
@@ -213,8 +213,8 @@ utils_append_value_helper_pair (DBusMessageIter  *main_iter,
 				    NULL, /* for struct */
 				    &struct_iter);
 
-  car = gconf_value_get_car (value);
-  cdr = gconf_value_get_cdr (value);
+  car = gconf_value_peek_car (value);
+  cdr = gconf_value_peek_cdr (value);
   
   /* The pair types. */
   if (car)
@@ -298,7 +298,7 @@ utils_append_value_helper_list (DBusMessageIter  *main_iter,
 				    array_type,
 				    &array_iter);
   
-  list = gconf_value_get_list (value);
+  list = gconf_value_peek_list (value);
   
   switch (list_type)
     {
@@ -363,7 +363,7 @@ utils_append_value_helper_list (DBusMessageIter  *main_iter,
 	{
 	  GConfSchema *schema;
 
-	  schema = gconf_value_get_schema (list->data);
+	  schema = gconf_value_peek_schema (list->data);
 	  utils_append_schema (&array_iter, schema);
 	  
 	  list = list->next;
@@ -35,6 +35,8 @@
 #define GCONF_DBUS_SERVER_GET_DEFAULT_DB    "GetDefaultDatabase"
 #define GCONF_DBUS_SERVER_GET_DB            "GetDatabase"
 #define GCONF_DBUS_SERVER_SHUTDOWN          "Shutdown"
+#define GCONF_DBUS_SERVER_GET_PEER_ADDRESS  "GetPeerAddress"
+#define GCONF_DBUS_SERVER_GET_SNAPSHOT_INSTANCE "GetSnapshotInstance"
 #define GCONF_DBUS_SERVER_BYE_SIGNAL        "Bye"
 
 #define GCONF_DBUS_DATABASE_LOOKUP          "Lookup"
@@ -46,6 +48,8 @@
 #define GCONF_DBUS_DATABASE_DIR_EXISTS      "DirExists"
 #define GCONF_DBUS_DATABASE_GET_ALL_ENTRIES "AllEntries"
 #define GCONF_DBUS_DATABASE_GET_ALL_DIRS    "AllDirs"
+#define GCONF_DBUS_DATABASE_SEARCH          "Search"
+#define GCONF_DBUS_DATABASE_COMMIT          "Commit"
 #define GCONF_DBUS_DATABASE_SET_SCHEMA      "SetSchema"
 #define GCONF_DBUS_DATABASE_SUGGEST_SYNC    "SuggestSync"
 
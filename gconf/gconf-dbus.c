@@ -24,8 +24,10 @@
 
 #include "gconf.h"
 #include "gconf-dbus-utils.h"
+#include "gconf-snapshot.h"
 #include "gconf-internals.h"
 #include "gconf-sources.h"
+#include "gconf-backend.h"
 #include "gconf-locale.h"
 #include <string.h>
 #include <stdio.h>
@@ -77,6 +79,13 @@ struct _GConfEngine {
   gpointer owner;
   int owner_use_count;
 
+  /* Pipelined Set calls still waiting for their reply */
+  GSList *pending_sets;
+
+  /* Read snapshot published by gconfd, opened on first use */
+  GConfSnapshot *snapshot;
+  guint snapshot_opened : 1;
+
   /* If TRUE, this is a local engine (and therefore
    * has no ctable and no notifications)
    */
@@ -105,9 +114,23 @@ static GHashTable     *engines_by_db = NULL;
 static GHashTable     *engines_by_address = NULL;
 static gboolean        dbus_disconnected = FALSE;
 
+/* Private connection straight to gconfd, bypassing the bus daemon
+ * for database calls.  peer_tried is reset whenever gconfd goes away.
+ */
+static DBusConnection *peer_conn = NULL;
+static gboolean        peer_tried = FALSE;
+
+/* Names the read snapshots of the gconfd we talk to; asked for once
+ * per daemon.
+ */
+static gchar          *snapshot_instance = NULL;
+static gboolean        snapshot_instance_tried = FALSE;
+
 static gboolean     ensure_dbus_connection      (void);
 static gboolean     ensure_service              (gboolean          start_if_not_found,
 						 GError          **err);
+static void         ensure_peer_connection      (void);
+static void         drop_peer_connection        (void);
 static gboolean     ensure_database             (GConfEngine      *conf,
 						 gboolean          start_if_not_found,
 						 GError          **err);
@@ -483,6 +506,141 @@ ensure_service (gboolean  start_if_not_found,
   return FALSE;
 }
 
+static void
+ensure_peer_connection (void)
+{
+  DBusMessage *message, *reply;
+  DBusError error;
+  const gchar *address;
+
+  if (peer_conn != NULL || peer_tried)
+    return;
+
+  peer_tried = TRUE;
+
+  if (g_getenv ("GCONF_DISABLE_PEER_CONNECTIONS") != NULL)
+    return;
+
+  message = dbus_message_new_method_call (GCONF_DBUS_SERVICE,
+					  GCONF_DBUS_SERVER_OBJECT,
+					  GCONF_DBUS_SERVER_INTERFACE,
+					  GCONF_DBUS_SERVER_GET_PEER_ADDRESS);
+
+  dbus_error_init (&error);
+  reply = dbus_connection_send_with_reply_and_block (global_conn,
+						     message, -1, &error);
+  dbus_message_unref (message);
+
+  if (reply == NULL)
+    {
+      /* Older daemon, or private connections disabled; stay on the bus. */
+      d(g_print ("* no peer address: %s\n", error.message));
+      dbus_error_free (&error);
+      return;
+    }
+
+  if (!dbus_message_get_args (reply,
+			      NULL,
+			      DBUS_TYPE_STRING, &address,
+			      DBUS_TYPE_INVALID))
+    {
+      dbus_message_unref (reply);
+      return;
+    }
+
+  peer_conn = dbus_connection_open_private (address, &error);
+
+  if (peer_conn == NULL)
+    {
+      d(g_print ("* failed to open peer connection: %s\n", error.message));
+      dbus_error_free (&error);
+      dbus_message_unref (reply);
+      return;
+    }
+
+  d(g_print ("* using peer connection %s\n", address));
+  dbus_message_unref (reply);
+
+  dbus_connection_setup_with_g_main (peer_conn, NULL);
+
+  dbus_connection_set_exit_on_disconnect (peer_conn, FALSE);
+
+  dbus_connection_add_filter (peer_conn, gconf_dbus_message_filter,
+			      NULL, NULL);
+}
+
+static void
+drop_peer_connection (void)
+{
+  if (peer_conn != NULL)
+    {
+      dbus_connection_close (peer_conn);
+      dbus_connection_unref (peer_conn);
+      peer_conn = NULL;
+    }
+
+  peer_tried = FALSE;
+}
+
+/* The connection database calls go over; notifications registered on
+ * one connection are only delivered there, so everything has to agree.
+ */
+static DBusConnection *
+get_database_connection (void)
+{
+  return peer_conn != NULL ? peer_conn : global_conn;
+}
+
+static const gchar *
+get_snapshot_instance (void)
+{
+  DBusMessage *message, *reply;
+  DBusError error;
+  const gchar *instance;
+
+  if (snapshot_instance != NULL || snapshot_instance_tried)
+    return snapshot_instance;
+
+  snapshot_instance_tried = TRUE;
+
+  message = dbus_message_new_method_call (GCONF_DBUS_SERVICE,
+					  GCONF_DBUS_SERVER_OBJECT,
+					  GCONF_DBUS_SERVER_INTERFACE,
+					  GCONF_DBUS_SERVER_GET_SNAPSHOT_INSTANCE);
+
+  dbus_error_init (&error);
+  reply = dbus_connection_send_with_reply_and_block (get_database_connection (),
+						     message, -1, &error);
+  dbus_message_unref (message);
+
+  if (reply == NULL)
+    {
+      /* Older daemon; it doesn't publish snapshots we could find */
+      d(g_print ("* no snapshot instance: %s\n", error.message));
+      dbus_error_free (&error);
+      return NULL;
+    }
+
+  if (dbus_message_get_args (reply,
+			     NULL,
+			     DBUS_TYPE_STRING, &instance,
+			     DBUS_TYPE_INVALID))
+    snapshot_instance = g_strdup (instance);
+
+  dbus_message_unref (reply);
+
+  return snapshot_instance;
+}
+
+/* The next gconfd publishes under a different instance name */
+static void
+forget_snapshot_instance (void)
+{
+  g_free (snapshot_instance);
+  snapshot_instance = NULL;
+  snapshot_instance_tried = FALSE;
+}
+
 static gboolean
 ensure_database (GConfEngine  *conf,
 		 gboolean      start_if_not_found,
@@ -497,6 +655,8 @@ ensure_database (GConfEngine  *conf,
   if (!ensure_service (start_if_not_found, err))
     return FALSE;
 
+  ensure_peer_connection ();
+
   if (needs_reconnect)
     {
       /* Re-connect notifications and re-get database names from the previous
@@ -534,7 +694,7 @@ ensure_database (GConfEngine  *conf,
     }
 
   dbus_error_init (&error);
-  reply = dbus_connection_send_with_reply_and_block (global_conn,
+  reply = dbus_connection_send_with_reply_and_block (get_database_connection (),
 						     message, -1, &error);
   
   dbus_message_unref (message);
@@ -803,6 +963,30 @@ gconf_engine_get_local_for_addresses (GSList  *addresses,
   return conf;
 }
 
+GConfEngine *
+gconf_engine_get_local_readonly_for_addresses (GSList  *addresses,
+                                               GError **err)
+{
+  GConfEngine *conf;
+  GSList *readonly;
+  GSList *tmp;
+
+  g_return_val_if_fail (addresses != NULL, NULL);
+  g_return_val_if_fail (err == NULL || *err == NULL, NULL);
+
+  readonly = NULL;
+  for (tmp = addresses; tmp != NULL; tmp = tmp->next)
+    readonly = g_slist_prepend (readonly,
+                                gconf_address_add_flags (tmp->data, "readonly,lazy"));
+  readonly = g_slist_reverse (readonly);
+
+  conf = gconf_engine_get_local_for_addresses (readonly, err);
+
+  gconf_address_list_free (readonly);
+
+  return conf;
+}
+
 GConfEngine*
 gconf_engine_get_default (void)
 {
@@ -966,6 +1150,8 @@ gconf_engine_unref (GConfEngine* conf)
 	    g_hash_table_destroy (conf->notify_ids);
           if (conf->notify_dirs)
 	    g_hash_table_destroy (conf->notify_dirs);
+
+          gconf_snapshot_close (conf->snapshot);
         }
       
       if (conf == default_engine)
@@ -1023,7 +1209,7 @@ send_notify_add (GConfEngine *conf,
 			    DBUS_TYPE_INVALID);
 
   dbus_error_init (&error);
-  reply = dbus_connection_send_with_reply_and_block (global_conn,
+  reply = dbus_connection_send_with_reply_and_block (get_database_connection (),
 						     message, -1, &error);
   dbus_message_unref (message);
   
@@ -1110,7 +1296,7 @@ gconf_engine_notify_remove (GConfEngine* conf,
 			    DBUS_TYPE_INVALID);
 
   dbus_error_init (&error);
-  reply = dbus_connection_send_with_reply_and_block (global_conn, message, -1, &error);
+  reply = dbus_connection_send_with_reply_and_block (get_database_connection (), message, -1, &error);
   dbus_message_unref (message);
   
   if (dbus_error_is_set (&error))
@@ -1122,6 +1308,45 @@ gconf_engine_notify_remove (GConfEngine* conf,
     dbus_message_unref (reply);
 }
 
+/* Serves a lookup from gconfd's read snapshot if it is current and
+ * has the key.  Only non-default values are published, so a hit is
+ * never a default.
+ */
+static gboolean
+lookup_snapshot (GConfEngine  *conf,
+		 const gchar  *key,
+		 GConfValue  **value,
+		 gboolean     *is_writable,
+		 gchar       **schema_name)
+{
+  /* Our own pipelined writes may not have landed yet */
+  if (conf->pending_sets != NULL)
+    return FALSE;
+
+  if (!conf->snapshot_opened)
+    {
+      const gchar *instance;
+
+      instance = get_snapshot_instance ();
+      if (instance != NULL)
+        {
+          gchar *name;
+
+          name = gconf_snapshot_name (conf->addresses ? conf->persistent_address : NULL);
+          conf->snapshot = gconf_snapshot_open (instance, name);
+          g_free (name);
+        }
+
+      conf->snapshot_opened = TRUE;
+    }
+
+  if (conf->snapshot == NULL)
+    return FALSE;
+
+  return gconf_snapshot_lookup (conf->snapshot, key, value,
+				is_writable, schema_name);
+}
+
 GConfValue *
 gconf_engine_get_fuller (GConfEngine *conf,
                          const gchar *key,
@@ -1196,6 +1421,29 @@ gconf_engine_get_fuller (GConfEngine *conf,
   if (schema_name_p)
     *schema_name_p = NULL;
 
+  if (lookup_snapshot (conf, key, &val, &is_writable,
+		       schema_name_p ? &schema_name : NULL))
+    {
+      d(g_print ("* snapshot hit for %s\n", key));
+
+      if (is_default_p)
+        *is_default_p = FALSE;
+
+      if (is_writable_p)
+        *is_writable_p = is_writable;
+
+      if (schema_name && schema_name[0] != '/')
+        {
+          g_free (schema_name);
+          schema_name = NULL;
+        }
+
+      if (schema_name_p)
+        *schema_name_p = schema_name;
+
+      return val;
+    }
+
   message = dbus_message_new_method_call (GCONF_DBUS_SERVICE,
 					  db,
 					  GCONF_DBUS_DATABASE_INTERFACE,
@@ -1210,7 +1458,7 @@ gconf_engine_get_fuller (GConfEngine *conf,
 			    DBUS_TYPE_INVALID);
 
   dbus_error_init (&error);
-  reply = dbus_connection_send_with_reply_and_block (global_conn, message, -1, &error);
+  reply = dbus_connection_send_with_reply_and_block (get_database_connection (), message, -1, &error);
   dbus_message_unref (message);
 
   if (gconf_handle_dbus_exception (reply, &error, err))
@@ -1398,7 +1646,7 @@ gconf_engine_get_default_from_schema (GConfEngine* conf,
 			    DBUS_TYPE_INVALID);
 
   dbus_error_init (&error);
-  reply = dbus_connection_send_with_reply_and_block (global_conn, message, -1, &error);
+  reply = dbus_connection_send_with_reply_and_block (get_database_connection (), message, -1, &error);
   dbus_message_unref (message);
 
   if (gconf_handle_dbus_exception (reply, &error, err))
@@ -1430,6 +1678,29 @@ gconf_engine_get_default_from_schema (GConfEngine* conf,
   return val;
 }
 
+static DBusMessage *
+set_message_new (const gchar      *db,
+		 const gchar      *key,
+		 const GConfValue *value)
+{
+  DBusMessage *message;
+  DBusMessageIter iter;
+
+  message = dbus_message_new_method_call (GCONF_DBUS_SERVICE,
+					  db,
+					  GCONF_DBUS_DATABASE_INTERFACE,
+					  GCONF_DBUS_DATABASE_SET);
+  
+  dbus_message_append_args (message,
+			    DBUS_TYPE_STRING, &key,
+			    DBUS_TYPE_INVALID);
+
+  dbus_message_iter_init_append (message, &iter);
+  gconf_dbus_utils_append_value (&iter, value);
+
+  return message;
+}
+
 gboolean
 gconf_engine_set (GConfEngine* conf, const gchar* key,
                   const GConfValue* value, GError** err)
@@ -1437,7 +1708,6 @@ gconf_engine_set (GConfEngine* conf, const gchar* key,
   const gchar *db;
   DBusMessage *message, *reply;
   DBusError error;
-  DBusMessageIter iter;
 
   g_return_val_if_fail(conf != NULL, FALSE);
   g_return_val_if_fail(key != NULL, FALSE);
@@ -1488,20 +1758,10 @@ gconf_engine_set (GConfEngine* conf, const gchar* key,
       return FALSE;
     }
 
-  message = dbus_message_new_method_call (GCONF_DBUS_SERVICE,
-					  db,
-					  GCONF_DBUS_DATABASE_INTERFACE,
-					  GCONF_DBUS_DATABASE_SET);
-  
-  dbus_message_append_args (message,
-			    DBUS_TYPE_STRING, &key,
-			    DBUS_TYPE_INVALID);
-
-  dbus_message_iter_init_append (message, &iter);
-  gconf_dbus_utils_append_value (&iter, value);
+  message = set_message_new (db, key, value);
 
   dbus_error_init (&error);
-  reply = dbus_connection_send_with_reply_and_block (global_conn, message, -1, &error);
+  reply = dbus_connection_send_with_reply_and_block (get_database_connection (), message, -1, &error);
   dbus_message_unref (message);
 
   if (gconf_handle_dbus_exception (reply, &error, err))
@@ -1514,6 +1774,172 @@ gconf_engine_set (GConfEngine* conf, const gchar* key,
   return TRUE;
 }
 
+typedef struct {
+  GConfEngine          *conf;
+  gchar                *key;
+  DBusPendingCall      *pending;
+  GConfEngineSetNotify  func;
+  gpointer              user_data;
+  GDestroyNotify        destroy_notify;
+} PendingSet;
+
+static void
+pending_set_free (PendingSet *ps)
+{
+  if (ps->destroy_notify)
+    (* ps->destroy_notify) (ps->user_data);
+
+  gconf_engine_unref (ps->conf);
+  g_free (ps->key);
+  g_free (ps);
+}
+
+static void
+pending_set_reply_cb (DBusPendingCall *pending,
+		      PendingSet      *ps)
+{
+  DBusMessage *reply;
+  GError *error = NULL;
+
+  ps->conf->pending_sets = g_slist_remove (ps->conf->pending_sets, ps);
+
+  reply = dbus_pending_call_steal_reply (pending);
+
+  if (!gconf_handle_dbus_exception (reply, NULL, &error))
+    dbus_message_unref (reply);
+
+  d(g_print ("pipelined set of %s done: %s\n", ps->key,
+	     error ? error->message : "ok"));
+
+  if (ps->func)
+    (* ps->func) (ps->conf, ps->key, error, ps->user_data);
+  else if (error != NULL)
+    g_error_free (error);
+}
+
+/**
+ * gconf_engine_set_async:
+ *
+ * Like gconf_engine_set(), but only queues the Set call on the bus
+ * instead of blocking for the reply. Key and value are validated up
+ * front; errors coming back from the server are handed to @func.
+ * Local engines have nothing to pipeline and set synchronously, in
+ * which case @func is never called.
+ *
+ * Return value: %FALSE if the set failed immediately.
+ */
+gboolean
+gconf_engine_set_async (GConfEngine          *conf,
+			const gchar          *key,
+			const GConfValue     *value,
+			GConfEngineSetNotify  func,
+			gpointer              user_data,
+			GDestroyNotify        destroy_notify,
+			GError              **err)
+{
+  const gchar *db;
+  DBusMessage *message;
+  DBusPendingCall *pending;
+  PendingSet *ps;
+
+  g_return_val_if_fail (conf != NULL, FALSE);
+  g_return_val_if_fail (key != NULL, FALSE);
+  g_return_val_if_fail (value != NULL, FALSE);
+  g_return_val_if_fail (err == NULL || *err == NULL, FALSE);
+
+  CHECK_OWNER_USE (conf);
+
+  if (gconf_engine_is_local (conf))
+    {
+      gboolean retval;
+
+      retval = gconf_engine_set (conf, key, value, err);
+
+      if (destroy_notify)
+        (* destroy_notify) (user_data);
+
+      return retval;
+    }
+
+  if (!gconf_key_check (key, err))
+    goto fail;
+
+  if (!gconf_value_validate (value, err))
+    goto fail;
+
+  db = gconf_engine_get_database (conf, TRUE, err);
+
+  if (db == NULL)
+    goto fail;
+
+  message = set_message_new (db, key, value);
+
+  if (!dbus_connection_send_with_reply (get_database_connection (), message, &pending, -1) ||
+      pending == NULL)
+    {
+      dbus_message_unref (message);
+      gconf_set_error (err, GCONF_ERROR_NO_SERVER,
+                       _("Failed to send Set request for `%s'"), key);
+      goto fail;
+    }
+
+  dbus_message_unref (message);
+
+  ps = g_new0 (PendingSet, 1);
+  ps->conf = conf;
+  ps->key = g_strdup (key);
+  ps->pending = pending;
+  ps->func = func;
+  ps->user_data = user_data;
+  ps->destroy_notify = destroy_notify;
+
+  gconf_engine_ref (conf);
+  conf->pending_sets = g_slist_prepend (conf->pending_sets, ps);
+
+  dbus_pending_call_set_notify (pending,
+				(DBusPendingCallNotifyFunction) pending_set_reply_cb,
+				ps,
+				(DBusFreeFunction) pending_set_free);
+  dbus_pending_call_unref (pending);
+
+  return TRUE;
+
+ fail:
+  if (destroy_notify)
+    (* destroy_notify) (user_data);
+
+  return FALSE;
+}
+
+/**
+ * gconf_engine_flush_pending_sets:
+ *
+ * Blocks until every pipelined set issued with gconf_engine_set_async()
+ * has been answered and its notify function has run.
+ */
+void
+gconf_engine_flush_pending_sets (GConfEngine *conf)
+{
+  g_return_if_fail (conf != NULL);
+
+  while (conf->pending_sets != NULL)
+    {
+      PendingSet *ps = conf->pending_sets->data;
+      DBusPendingCall *pending;
+
+      pending = dbus_pending_call_ref (ps->pending);
+      dbus_pending_call_block (pending);
+
+      /* Completing the call runs pending_set_reply_cb(), which takes
+       * it off the list; make sure we can't spin if it didn't.
+       */
+      if (conf->pending_sets != NULL && conf->pending_sets->data == ps)
+        conf->pending_sets = g_slist_remove (conf->pending_sets, ps);
+
+      dbus_pending_call_unref (pending);
+    }
+}
+
 gboolean
 gconf_engine_unset (GConfEngine* conf, const gchar* key, GError** err)
 {
@@ -1574,7 +2000,7 @@ gconf_engine_unset (GConfEngine* conf, const gchar* key, GError** err)
 			    DBUS_TYPE_INVALID);
 
   dbus_error_init (&error);
-  reply = dbus_connection_send_with_reply_and_block (global_conn, message, -1, &error);
+  reply = dbus_connection_send_with_reply_and_block (get_database_connection (), message, -1, &error);
   dbus_message_unref (message);
   
   if (gconf_handle_dbus_exception (reply, &error, err))
@@ -1670,7 +2096,7 @@ gconf_engine_recursive_unset (GConfEngine    *conf,
 			    DBUS_TYPE_INVALID);
 
   dbus_error_init (&error);
-  reply = dbus_connection_send_with_reply_and_block (global_conn, message, -1, &error);
+  reply = dbus_connection_send_with_reply_and_block (get_database_connection (), message, -1, &error);
   dbus_message_unref (message);
   
   if (gconf_handle_dbus_exception (reply, &error, err))
@@ -1746,7 +2172,7 @@ gconf_engine_associate_schema  (GConfEngine* conf, const gchar* key,
 			    DBUS_TYPE_INVALID);
 
   dbus_error_init (&error);
-  reply = dbus_connection_send_with_reply_and_block (global_conn, message, -1, &error);
+  reply = dbus_connection_send_with_reply_and_block (get_database_connection (), message, -1, &error);
   dbus_message_unref (message);
   
   if (gconf_handle_dbus_exception (reply, &error, err))
@@ -1855,7 +2281,7 @@ gconf_engine_all_entries (GConfEngine* conf, const gchar* dir, GError** err)
 			    DBUS_TYPE_INVALID);
   
   dbus_error_init (&error);
-  reply = dbus_connection_send_with_reply_and_block (global_conn, message, -1, &error);
+  reply = dbus_connection_send_with_reply_and_block (get_database_connection (), message, -1, &error);
   dbus_message_unref (message);
   
   if (gconf_handle_dbus_exception (reply, &error, err))
@@ -1890,6 +2316,34 @@ qualify_keys (GSList *keys, const char *dir)
     }
 }
 
+static GSList*
+dirs_from_reply (DBusMessage *reply,
+                 const gchar *dir)
+{
+  GSList *subdirs = NULL;
+  DBusMessageIter iter;
+  DBusMessageIter array_iter;
+
+  dbus_message_iter_init (reply, &iter);
+
+  dbus_message_iter_recurse (&iter, &array_iter);
+  while (dbus_message_iter_get_arg_type (&array_iter) == DBUS_TYPE_STRING)
+    {
+      const gchar *key;
+      gchar       *s;
+      
+      dbus_message_iter_get_basic (&array_iter, &key);
+      
+      s = gconf_concat_dir_and_key (dir, key);
+      subdirs = g_slist_prepend (subdirs, s);
+      
+      if (!dbus_message_iter_next (&array_iter))
+	break;
+    }
+
+  return subdirs;
+}
+
 GSList*      
 gconf_engine_all_dirs(GConfEngine* conf, const gchar* dir, GError** err)
 {
@@ -1897,8 +2351,6 @@ gconf_engine_all_dirs(GConfEngine* conf, const gchar* dir, GError** err)
   const gchar *db;
   DBusMessage *message, *reply;
   DBusError error;
-  DBusMessageIter iter;
-  DBusMessageIter array_iter;
   
   g_return_val_if_fail(conf != NULL, NULL);
   g_return_val_if_fail(dir != NULL, NULL);
@@ -1958,7 +2410,7 @@ gconf_engine_all_dirs(GConfEngine* conf, const gchar* dir, GError** err)
 			    DBUS_TYPE_INVALID);
   
   dbus_error_init (&error);
-  reply = dbus_connection_send_with_reply_and_block (global_conn, message, -1, &error);
+  reply = dbus_connection_send_with_reply_and_block (get_database_connection (), message, -1, &error);
   dbus_message_unref (message);
   
   if (gconf_handle_dbus_exception (reply, &error, err))
@@ -1966,26 +2418,372 @@ gconf_engine_all_dirs(GConfEngine* conf, const gchar* dir, GError** err)
 
   g_return_val_if_fail (err == NULL || *err == NULL, NULL);
 
+  subdirs = dirs_from_reply (reply, dir);
+  
+  dbus_message_unref (reply);
+
+  return subdirs;
+}
+
+/*
+ * Pipelined directory listings
+ */
+
+struct _GConfDirListing {
+  gchar           *dir;
+  DBusPendingCall *entries_call;
+  DBusPendingCall *dirs_call;
+
+  /* For engines that listed synchronously */
+  GSList          *entries;
+  GSList          *subdirs;
+  GError          *error;
+};
+
+static DBusPendingCall*
+list_dir_send (const gchar *db,
+               const gchar *method,
+               const gchar *dir,
+               gboolean     with_locale)
+{
+  DBusMessage *message;
+  DBusPendingCall *pending = NULL;
+  const gchar *locale;
+
+  message = dbus_message_new_method_call (GCONF_DBUS_SERVICE,
+					  db,
+					  GCONF_DBUS_DATABASE_INTERFACE,
+					  method);
+
+  locale = gconf_current_locale ();
+  if (with_locale)
+    dbus_message_append_args (message,
+			      DBUS_TYPE_STRING, &dir,
+			      DBUS_TYPE_STRING, &locale,
+			      DBUS_TYPE_INVALID);
+  else
+    dbus_message_append_args (message,
+			      DBUS_TYPE_STRING, &dir,
+			      DBUS_TYPE_INVALID);
+
+  if (!dbus_connection_send_with_reply (get_database_connection (), message,
+					&pending, -1))
+    pending = NULL;
+
+  dbus_message_unref (message);
+
+  return pending;
+}
+
+static DBusMessage*
+list_dir_wait (DBusPendingCall *pending)
+{
+  DBusMessage *reply;
+
+  dbus_pending_call_block (pending);
+  reply = dbus_pending_call_steal_reply (pending);
+  dbus_pending_call_unref (pending);
+
+  return reply;
+}
+
+/**
+ * gconf_engine_list_dir_async:
+ *
+ * Sends the GetAllEntries and GetAllDirs calls for @dir without
+ * waiting for them, so a tree walk can keep several directories in
+ * flight.  Collect the answer with gconf_engine_list_dir_finish().
+ *
+ * Return value: the pending listing, never %NULL.
+ */
+GConfDirListing*
+gconf_engine_list_dir_async (GConfEngine *conf,
+                             const gchar *dir)
+{
+  GConfDirListing *listing;
+  const gchar *db;
+
+  g_return_val_if_fail (conf != NULL, NULL);
+  g_return_val_if_fail (dir != NULL, NULL);
+
+  CHECK_OWNER_USE (conf);
+
+  listing = g_new0 (GConfDirListing, 1);
+  listing->dir = g_strdup (dir);
+
+  if (gconf_engine_is_local (conf) || !gconf_key_check (dir, NULL))
+    goto sync;
+
+  db = gconf_engine_get_database (conf, TRUE, NULL);
+  if (db == NULL)
+    goto sync;
+
+  listing->entries_call = list_dir_send (db, GCONF_DBUS_DATABASE_GET_ALL_ENTRIES,
+                                         dir, TRUE);
+  listing->dirs_call = list_dir_send (db, GCONF_DBUS_DATABASE_GET_ALL_DIRS,
+                                      dir, FALSE);
+
+  if (listing->entries_call != NULL && listing->dirs_call != NULL)
+    return listing;
+
+  if (listing->entries_call)
+    {
+      dbus_pending_call_cancel (listing->entries_call);
+      dbus_pending_call_unref (listing->entries_call);
+      listing->entries_call = NULL;
+    }
+
+  if (listing->dirs_call)
+    {
+      dbus_pending_call_cancel (listing->dirs_call);
+      dbus_pending_call_unref (listing->dirs_call);
+      listing->dirs_call = NULL;
+    }
+
+ sync:
+  /* Also reports any error the way the blocking calls do */
+  listing->entries = gconf_engine_all_entries (conf, dir, &listing->error);
+  listing->subdirs = gconf_engine_all_dirs (conf, dir, NULL);
+
+  return listing;
+}
+
+/**
+ * gconf_engine_list_dir_finish:
+ *
+ * Waits for a listing started with gconf_engine_list_dir_async() and
+ * frees it.
+ *
+ * Return value: the entries in the directory, like
+ * gconf_engine_all_entries().
+ */
+GSList*
+gconf_engine_list_dir_finish (GConfDirListing  *listing,
+                              GSList          **subdirs,
+                              GError          **err)
+{
+  GSList *entries;
+  GSList *dirs;
+
+  g_return_val_if_fail (listing != NULL, NULL);
+
+  if (listing->entries_call != NULL)
+    {
+      DBusMessage *reply;
+      DBusMessageIter iter;
+      GError *error = NULL;
+
+      reply = list_dir_wait (listing->entries_call);
+      if (!gconf_handle_dbus_exception (reply, NULL, &error))
+        {
+          dbus_message_iter_init (reply, &iter);
+          listing->entries = gconf_dbus_utils_get_entries (&iter, listing->dir);
+          dbus_message_unref (reply);
+        }
+      else
+        listing->error = error;
+
+      reply = list_dir_wait (listing->dirs_call);
+      if (!gconf_handle_dbus_exception (reply, NULL, NULL))
+        {
+          listing->subdirs = dirs_from_reply (reply, listing->dir);
+          dbus_message_unref (reply);
+        }
+    }
+
+  entries = listing->entries;
+  dirs = listing->subdirs;
+
+  if (subdirs)
+    *subdirs = dirs;
+  else
+    {
+      g_slist_foreach (dirs, (GFunc) g_free, NULL);
+      g_slist_free (dirs);
+    }
+
+  if (listing->error)
+    g_propagate_error (err, listing->error);
+
+  g_free (listing->dir);
+  g_free (listing);
+
+  return entries;
+}
+
+gboolean
+gconf_engine_search (GConfEngine     *conf,
+                     const gchar     *dir,
+                     GConfSearchType  type,
+                     const gchar     *pattern,
+                     GSList         **entries,
+                     GError         **err)
+{
+  const gchar *db;
+  const gchar *locale;
+  guint32 type_arg;
+  DBusMessage *message;
+  DBusMessage *reply;
+  DBusError error;
+  DBusMessageIter iter;
+
+  g_return_val_if_fail (conf != NULL, FALSE);
+  g_return_val_if_fail (dir != NULL, FALSE);
+  g_return_val_if_fail (pattern != NULL, FALSE);
+  g_return_val_if_fail (entries != NULL, FALSE);
+  g_return_val_if_fail (err == NULL || *err == NULL, FALSE);
+
+  CHECK_OWNER_USE (conf);
+
+  *entries = NULL;
+
+  if (!gconf_key_check (dir, err))
+    return FALSE;
+
+  if (gconf_engine_is_local (conf))
+    {
+      GError* error = NULL;
+      gchar** locale_list;
+
+      locale_list = gconf_split_locale (gconf_current_locale ());
+
+      *entries = gconf_sources_search (conf->local_sources, dir, type, pattern,
+                                       (const gchar**) locale_list, &error);
+
+      if (locale_list)
+        g_strfreev (locale_list);
+
+      if (error != NULL)
+        {
+          g_propagate_error (err, error);
+          return FALSE;
+        }
+
+      return TRUE;
+    }
+
+  db = gconf_engine_get_database (conf, TRUE, err);
+
+  if (db == NULL)
+    {
+      g_return_val_if_fail (err == NULL || *err != NULL, FALSE);
+
+      return FALSE;
+    }
+
+  message = dbus_message_new_method_call (GCONF_DBUS_SERVICE,
+					  db,
+					  GCONF_DBUS_DATABASE_INTERFACE,
+					  GCONF_DBUS_DATABASE_SEARCH);
+
+  type_arg = type;
+  locale = gconf_current_locale ();
+  dbus_message_append_args (message,
+			    DBUS_TYPE_STRING, &dir,
+			    DBUS_TYPE_UINT32, &type_arg,
+			    DBUS_TYPE_STRING, &pattern,
+			    DBUS_TYPE_STRING, &locale,
+			    DBUS_TYPE_INVALID);
+
+  dbus_error_init (&error);
+  reply = dbus_connection_send_with_reply_and_block (get_database_connection (), message, -1, &error);
+  dbus_message_unref (message);
+
+  /* A gconfd that predates Search; the caller walks the tree itself */
+  if (reply == NULL && dbus_error_has_name (&error, DBUS_ERROR_UNKNOWN_METHOD))
+    {
+      dbus_error_free (&error);
+      return FALSE;
+    }
+
+  if (gconf_handle_dbus_exception (reply, &error, err))
+    return FALSE;
+
   dbus_message_iter_init (reply, &iter);
 
-  dbus_message_iter_recurse (&iter, &array_iter);
-  while (dbus_message_iter_get_arg_type (&array_iter) == DBUS_TYPE_STRING)
+  /* Decoding reverses the order gconfd found them in */
+  *entries = g_slist_reverse (gconf_dbus_utils_get_entries (&iter, "/"));
+
+  dbus_message_unref (reply);
+
+  return TRUE;
+}
+
+gboolean
+gconf_engine_commit (GConfEngine     *conf,
+                     GSList          *entries,
+                     const gchar     *origin,
+                     GError         **err)
+{
+  const gchar *db;
+  DBusMessage *message;
+  DBusMessage *reply;
+  DBusError error;
+  DBusMessageIter iter;
+  GSList *tmp;
+
+  g_return_val_if_fail (conf != NULL, FALSE);
+  g_return_val_if_fail (err == NULL || *err == NULL, FALSE);
+
+  CHECK_OWNER_USE (conf);
+
+  /* The sources can't undo a partial commit */
+  if (gconf_engine_is_local (conf))
+    return FALSE;
+
+  for (tmp = entries; tmp != NULL; tmp = tmp->next)
     {
-      const gchar *key;
-      gchar       *s;
-      
-      dbus_message_iter_get_basic (&array_iter, &key);
-      
-      s = gconf_concat_dir_and_key (dir, key);
-      subdirs = g_slist_prepend (subdirs, s);
-      
-      if (!dbus_message_iter_next (&array_iter))
-	break;
+      GConfEntry *entry = tmp->data;
+
+      if (!gconf_key_check (entry->key, err))
+        return FALSE;
+
+      if (entry->value != NULL &&
+          !gconf_value_validate (entry->value, err))
+        return FALSE;
     }
-  
+
+  db = gconf_engine_get_database (conf, TRUE, err);
+
+  if (db == NULL)
+    {
+      g_return_val_if_fail (err == NULL || *err != NULL, FALSE);
+
+      return FALSE;
+    }
+
+  /* Pipelined sets were issued first, so they must land first */
+  gconf_engine_flush_pending_sets (conf);
+
+  message = dbus_message_new_method_call (GCONF_DBUS_SERVICE,
+					  db,
+					  GCONF_DBUS_DATABASE_INTERFACE,
+					  GCONF_DBUS_DATABASE_COMMIT);
+
+  if (origin == NULL)
+    origin = "";
+
+  dbus_message_iter_init_append (message, &iter);
+  dbus_message_iter_append_basic (&iter, DBUS_TYPE_STRING, &origin);
+  gconf_dbus_utils_append_entries (&iter, entries);
+
+  dbus_error_init (&error);
+  reply = dbus_connection_send_with_reply_and_block (get_database_connection (), message, -1, &error);
+  dbus_message_unref (message);
+
+  /* A gconfd that predates Commit */
+  if (reply == NULL && dbus_error_has_name (&error, DBUS_ERROR_UNKNOWN_METHOD))
+    {
+      dbus_error_free (&error);
+      return FALSE;
+    }
+
+  if (gconf_handle_dbus_exception (reply, &error, err))
+    return FALSE;
+
   dbus_message_unref (reply);
 
-  return subdirs;
+  return TRUE;
 }
 
 /* annoyingly, this is REQUIRED for local sources */
@@ -2001,6 +2799,9 @@ gconf_engine_suggest_sync(GConfEngine* conf, GError** err)
   g_return_if_fail(err == NULL || *err == NULL);
 
   CHECK_OWNER_USE (conf);
+
+  /* Make sure pipelined sets reach the server before it syncs */
+  gconf_engine_flush_pending_sets (conf);
   
   if (gconf_engine_is_local(conf))
     {
@@ -2039,7 +2840,7 @@ gconf_engine_suggest_sync(GConfEngine* conf, GError** err)
 					  GCONF_DBUS_DATABASE_SUGGEST_SYNC);
 
   dbus_error_init (&error);
-  reply = dbus_connection_send_with_reply_and_block (global_conn, message, -1, &error);
+  reply = dbus_connection_send_with_reply_and_block (get_database_connection (), message, -1, &error);
   dbus_message_unref (message);
 
   if (!gconf_handle_dbus_exception (reply, &error, err))
@@ -2154,7 +2955,7 @@ gconf_engine_dir_exists (GConfEngine *conf, const gchar *dir, GError** err)
 			    DBUS_TYPE_INVALID);
   
   dbus_error_init (&error);
-  reply = dbus_connection_send_with_reply_and_block (global_conn, message, -1, &error);
+  reply = dbus_connection_send_with_reply_and_block (get_database_connection (), message, -1, &error);
   dbus_message_unref (message);
  
   if (gconf_handle_dbus_exception (reply, &error, err))
@@ -2234,6 +3035,11 @@ reinitialize_databases (void)
 
       g_hash_table_remove (engines_by_db, conf->database);  
       ensure_database (conf, FALSE, NULL);
+
+      /* The old daemon's snapshot is gone, look for the new one */
+      gconf_snapshot_close (conf->snapshot);
+      conf->snapshot = NULL;
+      conf->snapshot_opened = FALSE;
     }
   
   /* Re-add notifications. */
@@ -2274,6 +3080,26 @@ gconf_dbus_message_filter (DBusConnection    *dbus_conn,
 				   DBUS_INTERFACE_LOCAL,
 				   "Disconnected"))
     {
+      if (dbus_conn == peer_conn)
+	{
+	  /* Only the private connection went away; fall back to the
+	   * bus and re-register our notifications there.
+	   */
+	  dbus_connection_unref (peer_conn);
+	  peer_conn = NULL;
+	  needs_reconnect = TRUE;
+
+	  d(g_print ("*** Lost peer connection\n"));
+
+	  return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+	}
+
+      if (dbus_conn != global_conn)
+	return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+      drop_peer_connection ();
+      forget_snapshot_instance ();
+
       dbus_connection_unref (global_conn);
       global_conn = NULL;
       service_running = FALSE;
@@ -2311,6 +3137,7 @@ gconf_dbus_message_filter (DBusConnection    *dbus_conn,
 	  if (needs_reconnect)
 	    {
 	      needs_reconnect = FALSE;
+	      ensure_peer_connection ();
 	      reinitialize_databases ();
 	    }
 	  
@@ -2322,6 +3149,10 @@ gconf_dbus_message_filter (DBusConnection    *dbus_conn,
 	  /* GConfd is gone, set the state so we can detect that we're down. */
 	  service_running = FALSE;
 	  needs_reconnect = TRUE;
+
+	  /* The peer connection may not have noticed yet */
+	  drop_peer_connection ();
+	  forget_snapshot_instance ();
   
 	  d(g_print ("*** GConf Service deleted\n"));
 	}
@@ -2404,6 +3235,7 @@ handle_notify (DBusConnection *connection,
 {
   GConfEngine *conf;
   gchar *key = NULL, *schema_name = NULL;
+  const gchar *origin = NULL;
   gboolean is_default, is_writable;
   DBusMessageIter iter;
   GConfValue *value;
@@ -2444,6 +3276,15 @@ handle_notify (DBusConnection *connection,
       return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
     }
   
+  /* Only sent by a gconfd that knows about commit origins */
+  if (dbus_message_iter_next (&iter) &&
+      dbus_message_iter_get_arg_type (&iter) == DBUS_TYPE_STRING)
+    {
+      dbus_message_iter_get_basic (&iter, &origin);
+      if (origin[0] == '\0')
+        origin = NULL;
+    }
+
   d(g_print ("Got notify on %s (%s)\n", key, namespace_section));
 
   list = gconf_cnxn_lookup_dir (conf, namespace_section);
@@ -2458,6 +3299,7 @@ handle_notify (DBusConnection *connection,
 	  d(g_print ("yes: %s\n", key));
 	  
 	  entry = gconf_entry_new (key, value);
+	  gconf_entry_set_origin (entry, origin);
 	  gconf_cnxn_notify (cnxn, entry);
 	  gconf_entry_free (entry);
 	  
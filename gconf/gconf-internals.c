@@ -114,6 +114,64 @@ gconf_key_directory  (const gchar* key)
   return retval;
 }
 
+/* Copies @len bytes of @str, nul-terminated, into @buf when they fit
+ * and into newly allocated memory otherwise.  *to_free is set to the
+ * allocated copy, or NULL if @buf was used; either way the caller
+ * frees *to_free when done with the result.  Lets hot paths avoid an
+ * allocation for the usual short key without a length limit.
+ */
+gchar*
+gconf_strndup_r (const gchar *str,
+                 gsize        len,
+                 gchar       *buf,
+                 gsize        buf_size,
+                 gchar      **to_free)
+{
+  gchar *retval;
+
+  if (len < buf_size)
+    {
+      retval = buf;
+      *to_free = NULL;
+    }
+  else
+    {
+      retval = g_malloc (len + 1);
+      *to_free = retval;
+    }
+
+  memcpy (retval, str, len);
+  retval[len] = '\0';
+
+  return retval;
+}
+
+/* gconf_key_directory() without the allocation, see gconf_strndup_r() */
+const gchar*
+gconf_key_directory_r (const gchar *key,
+                       gchar       *buf,
+                       gsize        buf_size,
+                       gchar      **to_free)
+{
+  const gchar* end;
+
+  *to_free = NULL;
+
+  end = strrchr(key, '/');
+
+  if (end == NULL)
+    {
+      gconf_log(GCL_ERR, _("No '/' in key \"%s\""), key);
+      return NULL;
+    }
+
+  /* Root directory */
+  if (end == key)
+    return "/";
+
+  return gconf_strndup_r (key, end - key, buf, buf_size, to_free);
+}
+
 const gchar*
 gconf_key_key        (const gchar* key)
 {
@@ -307,7 +365,7 @@ gconf_fill_corba_value_from_gconf_value(const GConfValue *value,
       break;
     case GCONF_VALUE_SCHEMA:
       cv->_d = SchemaVal;
-      gconf_fill_corba_schema_from_gconf_schema (gconf_value_get_schema(value),
+      gconf_fill_corba_schema_from_gconf_schema (gconf_value_peek_schema(value),
                                                  &cv->_u.schema_value);
       break;
     case GCONF_VALUE_LIST:
@@ -317,7 +375,7 @@ gconf_fill_corba_value_from_gconf_value(const GConfValue *value,
         
         cv->_d = ListVal;
 
-        list = gconf_value_get_list(value);
+        list = gconf_value_peek_list(value);
 
         n = g_slist_length(list);
 
@@ -378,9 +436,9 @@ gconf_fill_corba_value_from_gconf_value(const GConfValue *value,
         CORBA_sequence_set_release(&cv->_u.pair_value, TRUE);
         
         /* dubious cast */
-        gconf_fill_corba_value_from_gconf_value (gconf_value_get_car(value),
+        gconf_fill_corba_value_from_gconf_value (gconf_value_peek_car(value),
                                                  (ConfigValue*)&cv->_u.pair_value._buffer[0]);
-        gconf_fill_corba_value_from_gconf_value(gconf_value_get_cdr(value),
+        gconf_fill_corba_value_from_gconf_value(gconf_value_peek_cdr(value),
                                                 (ConfigValue*)&cv->_u.pair_value._buffer[1]);
       }
       break;
@@ -1087,6 +1145,61 @@ gconf_concat_dir_and_key(const gchar* dir, const gchar* key)
   return retval;
 }
 
+/* gconf_concat_dir_and_key() without the allocation, see
+ * gconf_strndup_r()
+ */
+gchar*
+gconf_concat_dir_and_key_r (const gchar *dir,
+                            const gchar *key,
+                            gchar       *buf,
+                            gsize        buf_size,
+                            gchar      **to_free)
+{
+  gsize dirlen;
+  gsize keylen;
+  gsize slash;
+  gchar *retval;
+
+  g_return_val_if_fail(dir != NULL, NULL);
+  g_return_val_if_fail(key != NULL, NULL);
+  g_return_val_if_fail(*dir == '/', NULL);
+
+  dirlen = strlen(dir);
+
+  if (dir[dirlen-1] == '/')
+    {
+      /* dir ends in slash, strip key slash if needed */
+      if (*key == '/')
+        ++key;
+      slash = 0;
+    }
+  else
+    {
+      /* Dir doesn't end in slash, add slash if key lacks one. */
+      slash = (*key != '/') ? 1 : 0;
+    }
+
+  keylen = strlen(key);
+
+  if (dirlen + slash + keylen < buf_size)
+    {
+      retval = buf;
+      *to_free = NULL;
+    }
+  else
+    {
+      retval = g_malloc(dirlen + slash + keylen + 1);
+      *to_free = retval;
+    }
+
+  memcpy(retval, dir, dirlen);
+  if (slash)
+    retval[dirlen] = '/';
+  memcpy(retval + dirlen + slash, key, keylen + 1);
+
+  return retval;
+}
+
 gulong
 gconf_string_to_gulong(const gchar* str)
 {
@@ -1522,8 +1635,8 @@ gconf_value_pair_to_primitive_pair_destructive(GConfValue* val,
       return FALSE;
     }
 
-  car = gconf_value_get_car(val);
-  cdr = gconf_value_get_cdr(val);
+  car = gconf_value_peek_car(val);
+  cdr = gconf_value_peek_cdr(val);
       
   if (car == NULL ||
       cdr == NULL)
@@ -2062,7 +2175,7 @@ gconf_value_encode (GConfValue* val)
         gchar* encoded;
         GConfSchema* sc;
 
-        sc = gconf_value_get_schema(val);
+        sc = gconf_value_peek_schema(val);
         
         tmp = g_strdup_printf("c%c%c%c%c,",
 			      type_byte(gconf_schema_get_type(sc)),
@@ -2120,7 +2233,7 @@ gconf_value_encode (GConfValue* val)
 
         retval = g_strdup_printf("l%c", type_byte(gconf_value_get_list_type(val)));
         
-        tmp = gconf_value_get_list(val);
+        tmp = gconf_value_peek_list(val);
 
         while (tmp != NULL)
           {
@@ -2158,8 +2271,8 @@ gconf_value_encode (GConfValue* val)
         gchar* car_quoted;
         gchar* cdr_quoted;
 
-        car_encoded = gconf_value_encode(gconf_value_get_car(val));
-        cdr_encoded = gconf_value_encode(gconf_value_get_cdr(val));
+        car_encoded = gconf_value_encode(gconf_value_peek_car(val));
+        cdr_encoded = gconf_value_encode(gconf_value_peek_cdr(val));
 
         car_quoted = gconf_quote_string(car_encoded);
         cdr_quoted = gconf_quote_string(cdr_encoded);
@@ -2182,6 +2295,505 @@ gconf_value_encode (GConfValue* val)
   return retval;
 }
 
+/*
+ * Binary encoding
+ *
+ * A version byte followed by the value.  Each value is its type byte
+ * (as in the text encoding) and then:
+ *
+ *   int     guint32
+ *   bool    one byte, 0 or 1
+ *   float   IEEE 754 double as guint64
+ *   string  string
+ *   schema  a byte saying whether a schema follows (a schema value
+ *           may have none); type, list type, car type and cdr type
+ *           bytes; locale, short desc, long desc and owner strings;
+ *           a byte saying whether a default follows; the default
+ *           value
+ *   list    element type byte; guint32 count; the elements
+ *   pair    for car and then cdr, a byte saying whether the value
+ *           follows; the value
+ *
+ * Integers are little-endian.  A string is a guint32 byte count
+ * followed by that many bytes of UTF-8, without a nul; a count of
+ * G_MAXUINT32 stands for NULL.  Unlike the text encoding nothing is
+ * quoted, so the decoder reads each field exactly once.
+ */
+
+/* Schema defaults can't legitimately nest deeper than this */
+#define BINARY_MAX_DEPTH 4
+
+static void
+binary_put_uint32 (GString *out,
+                   guint32  v)
+{
+  v = GUINT32_TO_LE (v);
+  g_string_append_len (out, (const gchar *) &v, sizeof (v));
+}
+
+static void
+binary_put_string (GString     *out,
+                   const gchar *s)
+{
+  gsize len;
+
+  if (s == NULL)
+    {
+      binary_put_uint32 (out, G_MAXUINT32);
+      return;
+    }
+
+  len = strlen (s);
+  binary_put_uint32 (out, len);
+  g_string_append_len (out, s, len);
+}
+
+static void binary_put_value (GString          *out,
+                              const GConfValue *val);
+
+static void
+binary_put_optional_value (GString          *out,
+                           const GConfValue *val)
+{
+  g_string_append_c (out, val != NULL);
+  if (val != NULL)
+    binary_put_value (out, val);
+}
+
+static void
+binary_put_value (GString          *out,
+                  const GConfValue *val)
+{
+  g_string_append_c (out, type_byte (val->type));
+
+  switch (val->type)
+    {
+    case GCONF_VALUE_INT:
+      binary_put_uint32 (out, (guint32) gconf_value_get_int (val));
+      break;
+
+    case GCONF_VALUE_BOOL:
+      g_string_append_c (out, gconf_value_get_bool (val) ? 1 : 0);
+      break;
+
+    case GCONF_VALUE_FLOAT:
+      {
+        gdouble d;
+        guint64 bits;
+
+        d = gconf_value_get_float (val);
+        memcpy (&bits, &d, sizeof (bits));
+        bits = GUINT64_TO_LE (bits);
+        g_string_append_len (out, (const gchar *) &bits, sizeof (bits));
+      }
+      break;
+
+    case GCONF_VALUE_STRING:
+      binary_put_string (out, gconf_value_get_string (val));
+      break;
+
+    case GCONF_VALUE_SCHEMA:
+      {
+        GConfSchema *sc;
+
+        sc = gconf_value_peek_schema (val);
+
+        g_string_append_c (out, sc != NULL);
+        if (sc == NULL)
+          break;
+
+        g_string_append_c (out, type_byte (gconf_schema_get_type (sc)));
+        g_string_append_c (out, type_byte (gconf_schema_get_list_type (sc)));
+        g_string_append_c (out, type_byte (gconf_schema_get_car_type (sc)));
+        g_string_append_c (out, type_byte (gconf_schema_get_cdr_type (sc)));
+
+        binary_put_string (out, gconf_schema_get_locale (sc));
+        binary_put_string (out, gconf_schema_get_short_desc (sc));
+        binary_put_string (out, gconf_schema_get_long_desc (sc));
+        binary_put_string (out, gconf_schema_get_owner (sc));
+
+        binary_put_optional_value (out, gconf_schema_get_default_value (sc));
+      }
+      break;
+
+    case GCONF_VALUE_LIST:
+      {
+        GSList *tmp;
+
+        g_string_append_c (out, type_byte (gconf_value_get_list_type (val)));
+        binary_put_uint32 (out, gconf_value_get_list_length (val));
+
+        for (tmp = gconf_value_peek_list (val); tmp != NULL; tmp = tmp->next)
+          binary_put_value (out, tmp->data);
+      }
+      break;
+
+    case GCONF_VALUE_PAIR:
+      binary_put_optional_value (out, gconf_value_peek_car (val));
+      binary_put_optional_value (out, gconf_value_peek_cdr (val));
+      break;
+
+    case GCONF_VALUE_INVALID:
+      break;
+
+    default:
+      g_assert_not_reached ();
+      break;
+    }
+}
+
+/**
+ * gconf_value_encode_binary:
+ * @val: value to encode
+ * @len: return location for the length of the encoding
+ *
+ * Encodes @val in the versioned binary format, which is faster to
+ * produce and to parse than the gconf_value_encode() text format but
+ * may contain nul bytes.  Only use it where both ends are known to
+ * understand it.
+ *
+ * Return value: newly allocated encoding, @len bytes long
+ */
+gchar*
+gconf_value_encode_binary (const GConfValue *val,
+                           gsize            *len)
+{
+  GString *out;
+
+  g_return_val_if_fail (val != NULL, NULL);
+  g_return_val_if_fail (len != NULL, NULL);
+
+  out = g_string_sized_new (32);
+
+  g_string_append_c (out, GCONF_BINARY_ENCODING_VERSION);
+  binary_put_value (out, val);
+
+  *len = out->len;
+
+  return g_string_free (out, FALSE);
+}
+
+typedef struct {
+  const guchar *p;
+  const guchar *end;
+} BinaryReader;
+
+static gboolean
+binary_get_byte (BinaryReader *r,
+                 guchar       *byte)
+{
+  if (r->p >= r->end)
+    return FALSE;
+
+  *byte = *r->p++;
+
+  return TRUE;
+}
+
+static gboolean
+binary_get_uint32 (BinaryReader *r,
+                   guint32      *v)
+{
+  if (r->end - r->p < (gssize) sizeof (*v))
+    return FALSE;
+
+  memcpy (v, r->p, sizeof (*v));
+  *v = GUINT32_FROM_LE (*v);
+  r->p += sizeof (*v);
+
+  return TRUE;
+}
+
+static gboolean
+binary_get_string (BinaryReader *r,
+                   gchar       **s)
+{
+  guint32 len;
+
+  if (!binary_get_uint32 (r, &len))
+    return FALSE;
+
+  if (len == G_MAXUINT32)
+    {
+      *s = NULL;
+      return TRUE;
+    }
+
+  if ((gsize) (r->end - r->p) < len ||
+      !g_utf8_validate ((const gchar *) r->p, len, NULL))
+    return FALSE;
+
+  *s = g_strndup ((const gchar *) r->p, len);
+  r->p += len;
+
+  return TRUE;
+}
+
+static gboolean
+binary_get_type (BinaryReader   *r,
+                 GConfValueType *type)
+{
+  guchar byte;
+
+  if (!binary_get_byte (r, &byte))
+    return FALSE;
+
+  *type = byte_type (byte);
+
+  /* byte_type() maps anything unknown to invalid */
+  return *type != GCONF_VALUE_INVALID || byte == 'v';
+}
+
+static GConfValue* binary_get_value (BinaryReader *r,
+                                     guint         depth);
+
+static gboolean
+binary_get_optional_value (BinaryReader *r,
+                           guint         depth,
+                           GConfValue  **val)
+{
+  guchar present;
+
+  if (!binary_get_byte (r, &present) || present > 1)
+    return FALSE;
+
+  if (!present)
+    {
+      *val = NULL;
+      return TRUE;
+    }
+
+  *val = binary_get_value (r, depth);
+
+  return *val != NULL;
+}
+
+static GConfValue*
+binary_get_value (BinaryReader *r,
+                  guint         depth)
+{
+  GConfValueType type;
+  GConfValue *val;
+
+  if (depth > BINARY_MAX_DEPTH)
+    return NULL;
+
+  if (!binary_get_type (r, &type) || type == GCONF_VALUE_INVALID)
+    return NULL;
+
+  val = gconf_value_new (type);
+
+  switch (type)
+    {
+    case GCONF_VALUE_INT:
+      {
+        guint32 v;
+
+        if (!binary_get_uint32 (r, &v))
+          goto failed;
+
+        gconf_value_set_int (val, (gint32) v);
+      }
+      break;
+
+    case GCONF_VALUE_BOOL:
+      {
+        guchar b;
+
+        if (!binary_get_byte (r, &b) || b > 1)
+          goto failed;
+
+        gconf_value_set_bool (val, b);
+      }
+      break;
+
+    case GCONF_VALUE_FLOAT:
+      {
+        guint64 bits;
+        gdouble d;
+
+        if (r->end - r->p < (gssize) sizeof (bits))
+          goto failed;
+
+        memcpy (&bits, r->p, sizeof (bits));
+        r->p += sizeof (bits);
+        bits = GUINT64_FROM_LE (bits);
+        memcpy (&d, &bits, sizeof (d));
+
+        gconf_value_set_float (val, d);
+      }
+      break;
+
+    case GCONF_VALUE_STRING:
+      {
+        gchar *s;
+
+        if (!binary_get_string (r, &s))
+          goto failed;
+
+        gconf_value_set_string_nocopy (val, s);
+      }
+      break;
+
+    case GCONF_VALUE_SCHEMA:
+      {
+        GConfSchema *sc;
+        GConfValueType types[4];
+        gchar *s;
+        GConfValue *default_value;
+        guchar present;
+        int i;
+
+        if (!binary_get_byte (r, &present) || present > 1)
+          goto failed;
+
+        if (!present)
+          break;
+
+        sc = gconf_schema_new ();
+        gconf_value_set_schema_nocopy (val, sc);
+
+        for (i = 0; i < 4; i++)
+          if (!binary_get_type (r, &types[i]))
+            goto failed;
+
+        gconf_schema_set_type (sc, types[0]);
+        gconf_schema_set_list_type (sc, types[1]);
+        gconf_schema_set_car_type (sc, types[2]);
+        gconf_schema_set_cdr_type (sc, types[3]);
+
+        if (!binary_get_string (r, &s))
+          goto failed;
+        gconf_schema_set_locale (sc, s);
+        g_free (s);
+
+        if (!binary_get_string (r, &s))
+          goto failed;
+        gconf_schema_set_short_desc (sc, s);
+        g_free (s);
+
+        if (!binary_get_string (r, &s))
+          goto failed;
+        gconf_schema_set_long_desc (sc, s);
+        g_free (s);
+
+        if (!binary_get_string (r, &s))
+          goto failed;
+        gconf_schema_set_owner (sc, s);
+        g_free (s);
+
+        if (!binary_get_optional_value (r, depth + 1, &default_value))
+          goto failed;
+
+        if (default_value != NULL)
+          gconf_schema_set_default_value_nocopy (sc, default_value);
+      }
+      break;
+
+    case GCONF_VALUE_LIST:
+      {
+        GConfValueType list_type;
+        GSList *value_list = NULL;
+        guint32 n, i;
+
+        if (!binary_get_type (r, &list_type) ||
+            list_type == GCONF_VALUE_INVALID ||
+            list_type == GCONF_VALUE_LIST ||
+            list_type == GCONF_VALUE_PAIR ||
+            !binary_get_uint32 (r, &n))
+          goto failed;
+
+        gconf_value_set_list_type (val, list_type);
+
+        for (i = 0; i < n; i++)
+          {
+            GConfValue *elem;
+
+            elem = binary_get_value (r, depth + 1);
+            if (elem == NULL || elem->type != list_type)
+              {
+                if (elem != NULL)
+                  gconf_value_free (elem);
+                g_slist_foreach (value_list, (GFunc) gconf_value_free, NULL);
+                g_slist_free (value_list);
+                goto failed;
+              }
+
+            value_list = g_slist_prepend (value_list, elem);
+          }
+
+        gconf_value_set_list_nocopy (val, g_slist_reverse (value_list));
+      }
+      break;
+
+    case GCONF_VALUE_PAIR:
+      {
+        GConfValue *car, *cdr;
+
+        if (!binary_get_optional_value (r, depth + 1, &car))
+          goto failed;
+
+        if (!binary_get_optional_value (r, depth + 1, &cdr))
+          {
+            if (car != NULL)
+              gconf_value_free (car);
+            goto failed;
+          }
+
+        gconf_value_set_car_nocopy (val, car);
+        gconf_value_set_cdr_nocopy (val, cdr);
+      }
+      break;
+
+    default:
+      g_assert_not_reached ();
+      break;
+    }
+
+  return val;
+
+ failed:
+  gconf_value_free (val);
+  return NULL;
+}
+
+/**
+ * gconf_value_decode_binary:
+ * @encoded: data from gconf_value_encode_binary()
+ * @len: length of @encoded
+ *
+ * Decodes a value encoded with gconf_value_encode_binary().  Returns
+ * NULL if the data is truncated, malformed, has trailing bytes or was
+ * produced by a newer version of the encoding.
+ *
+ * Return value: newly allocated value, or NULL
+ */
+GConfValue*
+gconf_value_decode_binary (const gchar *encoded,
+                           gsize        len)
+{
+  BinaryReader r;
+  GConfValue *val;
+
+  g_return_val_if_fail (encoded != NULL || len == 0, NULL);
+
+  if (len < 1 || (guchar) encoded[0] != GCONF_BINARY_ENCODING_VERSION)
+    return NULL;
+
+  r.p = (const guchar *) encoded + 1;
+  r.end = (const guchar *) encoded + len;
+
+  val = binary_get_value (&r, 0);
+
+  if (val != NULL && r.p != r.end)
+    {
+      gconf_value_free (val);
+      return NULL;
+    }
+
+  return val;
+}
+
 #ifdef HAVE_CORBA
 
 /*
@@ -2826,45 +3438,6 @@ gconf_orb_release (void)
   return ret;
 }
 
-char*
-gconf_get_daemon_dir (void)
-{  
-  if (gconf_use_local_locks ())
-    {
-      char *s;
-      char *subdir;
-      const char *tmpdir;
-
-      subdir = g_strconcat ("gconfd-", g_get_user_name (), NULL);
-
-      if (g_getenv ("GCONF_TMPDIR"))
-        tmpdir = g_getenv ("GCONF_TMPDIR");
-      else if (g_getenv ("XDG_RUNTIME_DIR"))
-        {
-          g_free (subdir);
-          subdir = g_strdup ("gconfd");
-          tmpdir = g_getenv ("XDG_RUNTIME_DIR");
-        }
-      else
-        tmpdir = g_get_tmp_dir ();
-
-      s = g_build_filename (tmpdir, subdir, NULL);
-
-      g_free (subdir);
-
-      return s;
-    }
-  else
-    {
-#ifndef G_OS_WIN32
-      const char *home = g_get_home_dir ();
-#else
-      const char *home = _gconf_win32_get_home_dir ();
-#endif
-      return g_strconcat (home, "/.gconfd", NULL);
-    }
-}
-
 ConfigServer
 gconf_activate_server (gboolean  start_if_not_found,
                        GError  **error)
@@ -2948,6 +3521,45 @@ gconf_CORBA_Object_hash (gconstpointer key)
 
 #endif /* HAVE_CORBA */
 
+char*
+gconf_get_daemon_dir (void)
+{  
+  if (gconf_use_local_locks ())
+    {
+      char *s;
+      char *subdir;
+      const char *tmpdir;
+
+      subdir = g_strconcat ("gconfd-", g_get_user_name (), NULL);
+
+      if (g_getenv ("GCONF_TMPDIR"))
+        tmpdir = g_getenv ("GCONF_TMPDIR");
+      else if (g_getenv ("XDG_RUNTIME_DIR"))
+        {
+          g_free (subdir);
+          subdir = g_strdup ("gconfd");
+          tmpdir = g_getenv ("XDG_RUNTIME_DIR");
+        }
+      else
+        tmpdir = g_get_tmp_dir ();
+
+      s = g_build_filename (tmpdir, subdir, NULL);
+
+      g_free (subdir);
+
+      return s;
+    }
+  else
+    {
+#ifndef G_OS_WIN32
+      const char *home = g_get_home_dir ();
+#else
+      const char *home = _gconf_win32_get_home_dir ();
+#endif
+      return g_strconcat (home, "/.gconfd", NULL);
+    }
+}
+
 void
 _gconf_init_i18n (void)
 {
@@ -91,6 +91,26 @@ const char *_gconf_win32_get_home_dir (void);
 gchar*       gconf_key_directory  (const gchar* key);
 const gchar* gconf_key_key        (const gchar* key);
 
+/* Size of the stack buffers the _r variants below are usually given;
+ * longer results are allocated.
+ */
+#define GCONF_KEY_BUF_SIZE 256
+
+gchar*       gconf_strndup_r            (const gchar  *str,
+                                         gsize         len,
+                                         gchar        *buf,
+                                         gsize         buf_size,
+                                         gchar       **to_free);
+const gchar* gconf_key_directory_r      (const gchar  *key,
+                                         gchar        *buf,
+                                         gsize         buf_size,
+                                         gchar       **to_free);
+gchar*       gconf_concat_dir_and_key_r (const gchar  *dir,
+                                         const gchar  *key,
+                                         gchar        *buf,
+                                         gsize         buf_size,
+                                         gchar       **to_free);
+
 #ifdef HAVE_CORBA
 GConfValue*  gconf_value_from_corba_value            (const ConfigValue *value);
 ConfigValue* gconf_corba_value_from_gconf_value      (const GConfValue  *value);
@@ -168,6 +188,15 @@ GConfValue* gconf_value_new_pair_from_string (GConfValueType car_type,
 
 GSList*      gconf_value_steal_list   (GConfValue *value);
 GConfSchema* gconf_value_steal_schema (GConfValue *value);
+GConfSchema* gconf_value_get_schema_writable (GConfValue *value);
+/* The public getters clone contents shared with copies of the value,
+ * since callers may modify what they return; these don't, for callers
+ * that only read.
+ */
+GConfSchema* gconf_value_peek_schema  (const GConfValue *value);
+GSList*      gconf_value_peek_list    (const GConfValue *value);
+GConfValue*  gconf_value_peek_car     (const GConfValue *value);
+GConfValue*  gconf_value_peek_cdr     (const GConfValue *value);
 char*        gconf_value_steal_string (GConfValue *value);
 
 /* These are a hack to encode values into strings and ship them over CORBA,
@@ -197,6 +226,18 @@ GConfValue* gconf_value_pair_from_primitive_pair (GConfValueType  car_type,
                                                   gconstpointer   address_of_cdr,
                                                   GError        **err);
 
+guint       gconf_value_get_list_length (const GConfValue *value);
+GConfValue* gconf_value_get_list_nth    (const GConfValue *value,
+                                         guint             n);
+
+/* Bumped whenever the binary encoding changes incompatibly */
+#define GCONF_BINARY_ENCODING_VERSION 2
+
+gchar*      gconf_value_encode_binary (const GConfValue *val,
+                                       gsize            *len);
+GConfValue* gconf_value_decode_binary (const gchar      *encoded,
+                                       gsize             len);
+
 GSList*  gconf_value_list_to_primitive_list_destructive (GConfValue      *val,
                                                          GConfValueType   list_type,
                                                          GError         **err);
@@ -238,14 +279,14 @@ CORBA_ORB gconf_orb_get (void);
 ConfigServer gconf_activate_server (gboolean  start_if_not_found,
                                     GError  **error);
 
-char*     gconf_get_daemon_dir (void);
-
 GConfLock* gconf_get_lock     (const gchar  *lock_directory,
                                GError      **err);
 gboolean   gconf_release_lock (GConfLock    *lock,
                                GError      **err);
 #endif
 
+char*     gconf_get_daemon_dir (void);
+
 gboolean gconf_schema_validate (const GConfSchema  *sc,
                                 GError            **err);
 gboolean gconf_value_validate  (const GConfValue   *value,
@@ -264,6 +305,71 @@ gboolean gconf_engine_recursive_unset (GConfEngine      *engine,
                                        GConfUnsetFlags   flags,
                                        GError          **err);
 
+/* Pipelined set; the reply is not waited for. Invalid keys/values and
+ * local engines fail (or complete) immediately, otherwise @func is
+ * invoked once the server has answered, with an error that it owns or
+ * NULL on success.
+ */
+typedef void (*GConfEngineSetNotify) (GConfEngine *engine,
+                                      const gchar *key,
+                                      GError      *error,
+                                      gpointer     user_data);
+
+gboolean gconf_engine_set_async         (GConfEngine           *engine,
+                                         const gchar           *key,
+                                         const GConfValue      *value,
+                                         GConfEngineSetNotify   func,
+                                         gpointer               user_data,
+                                         GDestroyNotify         destroy_notify,
+                                         GError               **err);
+void     gconf_engine_flush_pending_sets (GConfEngine          *engine);
+
+/* Pipelined directory listing for tree walks: the request for a
+ * directory's entries and subdirectories goes out right away, and
+ * finishing it blocks for the answer.  Subdirectories are returned
+ * as full keys; a failure to list them just yields none.  Local and
+ * ORBit engines list synchronously when the listing is started.
+ */
+typedef struct _GConfDirListing GConfDirListing;
+
+GConfDirListing* gconf_engine_list_dir_async  (GConfEngine      *engine,
+                                               const gchar      *dir);
+GSList*          gconf_engine_list_dir_finish (GConfDirListing  *listing,
+                                               GSList          **subdirs,
+                                               GError          **err);
+
+/* A local engine for one-off reads: the sources are opened read-only
+ * and, where the backend supports it, parse only the directories
+ * that get looked at.  Nothing is created, locked or written.
+ */
+GConfEngine* gconf_engine_get_local_readonly_for_addresses (GSList  *addresses,
+                                                            GError **err);
+
+/* Runs a search below @dir where the data lives: inside gconfd over
+ * D-Bus, or against the sources of a local engine.  On success,
+ * @entries holds the matching entries with full keys.  Returns FALSE
+ * without setting @err when the server can't search (ORBit, or a
+ * gconfd without the method), so the caller can walk the tree itself.
+ */
+gboolean gconf_engine_search (GConfEngine     *engine,
+                              const gchar     *dir,
+                              GConfSearchType  type,
+                              const gchar     *pattern,
+                              GSList         **entries,
+                              GError         **err);
+
+/* Applies @entries, where a NULL value means unset, in one request
+ * to gconfd: either all of them take effect or none does.
+ * Notifications for the changes carry @origin.  Returns FALSE without
+ * setting @err when the engine can't do that (ORBit, local engines,
+ * or a gconfd without the method), so the caller can apply them one
+ * at a time.
+ */
+gboolean gconf_engine_commit (GConfEngine     *engine,
+                              GSList          *entries,
+                              const gchar     *origin,
+                              GError         **err);
+
 #ifdef HAVE_CORBA
 gboolean gconf_CORBA_Object_equal (gconstpointer a,
                                    gconstpointer b);
@@ -0,0 +1,1119 @@
+/* GConf
+ * Copyright (C) 2012 Free Software Foundation, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <config.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+#include <glib/gstdio.h>
+
+#include "gconf-internals.h"
+#include "gconf-snapshot.h"
+
+/*
+ * File layout, all integers in host order (the files never leave the
+ * machine):
+ *
+ *   snapshot-INSTANCE-NAME.gen:
+ *                       GenHeader, mapped shared by daemon and clients
+ *
+ *   snapshot-INSTANCE-NAME:
+ *                       SnapshotHeader
+ *                       guint32 offsets[n_entries], sorted by key
+ *                       records: guint32 flags, key\0, schema\0,
+ *                       guint32 length, value in the binary encoding
+ *                       (each record 4-byte aligned, empty schema = none)
+ *
+ *   snapshot-NAME.warm: the same, with WARM_MAGIC, no generation, and
+ *                       guint32 length, stamp (4-byte aligned) between
+ *                       the header and the offsets.  Written when the
+ *                       daemon exits, read back by the next one if the
+ *                       stamp of the sources still matches; not tied to
+ *                       an instance, since it outlives the daemon.
+ *
+ * INSTANCE comes from gconf_snapshot_new_instance(), so daemons that
+ * share the directory never touch each other's files.
+ */
+
+#define GEN_MAGIC      "GConfGen"
+#define SNAPSHOT_MAGIC "GConfSn2"
+#define WARM_MAGIC     "GConfWm1"
+
+#define RECORD_WRITABLE (1 << 0)
+
+/* Don't let the daemon's memory grow without bound */
+#define MAX_ENTRIES 4096
+
+/* Batch republishing after a burst of changes */
+#define PUBLISH_DELAY_MS 500
+
+/* How often a client retries to find a generation file */
+#define GEN_RETRY_SECONDS 5
+
+typedef struct {
+  gchar            magic[8];
+  volatile guint32 generation;
+  guint32          reserved;
+} GenHeader;
+
+typedef struct {
+  gchar   magic[8];
+  guint32 generation;
+  guint32 n_entries;
+} SnapshotHeader;
+
+gchar*
+gconf_snapshot_name (const gchar *persistent_name)
+{
+  if (persistent_name == NULL)
+    return g_strdup ("default");
+
+  return g_compute_checksum_for_string (G_CHECKSUM_MD5, persistent_name, -1);
+}
+
+gchar*
+gconf_snapshot_new_instance (void)
+{
+  /* The host name tells apart daemons on a shared home directory,
+   * the random part a recycled pid.
+   */
+  return g_strdup_printf ("%s-%lu-%08x", g_get_host_name (),
+                          (gulong) getpid (), g_random_int ());
+}
+
+#if defined (HAVE_MMAP) && defined (HAVE_SYS_MMAN_H)
+
+static void
+snapshot_paths (const gchar  *instance,
+                const gchar  *name,
+                gchar       **path,
+                gchar       **gen_path)
+{
+  gchar *dir;
+  gchar *base;
+
+  dir = gconf_get_daemon_dir ();
+  base = g_strconcat ("snapshot-", instance, "-", name, NULL);
+
+  *path = g_build_filename (dir, base, NULL);
+  *gen_path = g_strconcat (*path, ".gen", NULL);
+
+  g_free (base);
+  g_free (dir);
+}
+
+static gboolean
+snapshots_disabled (void)
+{
+  return g_getenv ("GCONF_DISABLE_SNAPSHOTS") != NULL;
+}
+
+/*
+ * Client side
+ */
+
+struct _GConfSnapshot {
+  gchar           *path;
+  gchar           *gen_path;
+
+  const GenHeader *gen;
+  time_t           gen_attempt;
+
+  GMappedFile     *file;
+  const gchar     *data;
+  gsize            length;
+
+  /* Don't reopen the file over and over while the daemon catches up */
+  guint32          failed_generation;
+  guint            have_failed : 1;
+};
+
+GConfSnapshot*
+gconf_snapshot_open (const gchar *instance,
+                     const gchar *name)
+{
+  GConfSnapshot *snapshot;
+
+  g_return_val_if_fail (instance != NULL, NULL);
+  g_return_val_if_fail (name != NULL, NULL);
+
+  if (snapshots_disabled ())
+    return NULL;
+
+  snapshot = g_new0 (GConfSnapshot, 1);
+  snapshot_paths (instance, name, &snapshot->path, &snapshot->gen_path);
+
+  return snapshot;
+}
+
+void
+gconf_snapshot_close (GConfSnapshot *snapshot)
+{
+  if (snapshot == NULL)
+    return;
+
+  if (snapshot->file != NULL)
+    g_mapped_file_unref (snapshot->file);
+
+  if (snapshot->gen != NULL)
+    munmap ((void *) snapshot->gen, sizeof (GenHeader));
+
+  g_free (snapshot->path);
+  g_free (snapshot->gen_path);
+  g_free (snapshot);
+}
+
+static gboolean
+snapshot_map_gen (GConfSnapshot *snapshot)
+{
+  struct stat st;
+  void *map;
+  time_t now;
+  int fd;
+
+  if (snapshot->gen != NULL)
+    return TRUE;
+
+  now = time (NULL);
+  if (snapshot->gen_attempt != 0 &&
+      now - snapshot->gen_attempt < GEN_RETRY_SECONDS)
+    return FALSE;
+
+  snapshot->gen_attempt = now;
+
+  fd = open (snapshot->gen_path, O_RDONLY);
+  if (fd < 0)
+    return FALSE;
+
+  if (fstat (fd, &st) < 0 || st.st_size < (off_t) sizeof (GenHeader))
+    {
+      close (fd);
+      return FALSE;
+    }
+
+  map = mmap (NULL, sizeof (GenHeader), PROT_READ, MAP_SHARED, fd, 0);
+  close (fd);
+
+  if (map == MAP_FAILED)
+    return FALSE;
+
+  if (memcmp (((GenHeader *) map)->magic, GEN_MAGIC, 8) != 0)
+    {
+      munmap (map, sizeof (GenHeader));
+      return FALSE;
+    }
+
+  snapshot->gen = map;
+
+  return TRUE;
+}
+
+static guint32
+snapshot_current_generation (GConfSnapshot *snapshot)
+{
+  return (guint32) g_atomic_int_get ((volatile gint *) &snapshot->gen->generation);
+}
+
+static gboolean
+snapshot_reload (GConfSnapshot *snapshot,
+                 guint32        generation)
+{
+  const SnapshotHeader *header;
+
+  if (snapshot->have_failed && snapshot->failed_generation == generation)
+    return FALSE;
+
+  if (snapshot->file != NULL)
+    {
+      g_mapped_file_unref (snapshot->file);
+      snapshot->file = NULL;
+      snapshot->data = NULL;
+      snapshot->length = 0;
+    }
+
+  snapshot->file = g_mapped_file_new (snapshot->path, FALSE, NULL);
+  if (snapshot->file == NULL)
+    goto failed;
+
+  snapshot->data = g_mapped_file_get_contents (snapshot->file);
+  snapshot->length = g_mapped_file_get_length (snapshot->file);
+
+  if (snapshot->length < sizeof (SnapshotHeader))
+    goto failed;
+
+  header = (const SnapshotHeader *) snapshot->data;
+
+  if (memcmp (header->magic, SNAPSHOT_MAGIC, 8) != 0 ||
+      header->generation != generation ||
+      header->n_entries > (snapshot->length - sizeof (SnapshotHeader)) / sizeof (guint32))
+    goto failed;
+
+  snapshot->have_failed = FALSE;
+
+  return TRUE;
+
+ failed:
+  if (snapshot->file != NULL)
+    {
+      g_mapped_file_unref (snapshot->file);
+      snapshot->file = NULL;
+      snapshot->data = NULL;
+      snapshot->length = 0;
+    }
+
+  snapshot->failed_generation = generation;
+  snapshot->have_failed = TRUE;
+
+  return FALSE;
+}
+
+/* Returns the NUL-terminated string at offset, or NULL if it runs off
+ * the end of the file; *next is set to the byte after the NUL.
+ */
+static const gchar*
+string_at (const gchar *data,
+           gsize        length,
+           gsize        offset,
+           gsize       *next)
+{
+  const gchar *end;
+
+  if (offset >= length)
+    return NULL;
+
+  end = memchr (data + offset, '\0', length - offset);
+  if (end == NULL)
+    return NULL;
+
+  *next = (end - data) + 1;
+
+  return data + offset;
+}
+
+static const gchar*
+snapshot_string_at (GConfSnapshot *snapshot,
+                    gsize          offset,
+                    gsize         *next)
+{
+  return string_at (snapshot->data, snapshot->length, offset, next);
+}
+
+/* Splits the record at offset into its fields, checking that all of
+ * them lie inside the file.
+ */
+static gboolean
+parse_record (const gchar  *data,
+              gsize         length,
+              gsize         record,
+              guint32      *flags,
+              const gchar **key,
+              const gchar **schema,
+              const gchar **encoded,
+              guint32      *encoded_len)
+{
+  gsize next;
+
+  if (record > length || length - record < sizeof (guint32))
+    return FALSE;
+
+  memcpy (flags, data + record, sizeof (guint32));
+
+  *key = string_at (data, length, record + sizeof (guint32), &next);
+  if (*key == NULL)
+    return FALSE;
+
+  *schema = string_at (data, length, next, &next);
+  if (*schema == NULL)
+    return FALSE;
+
+  if (next + sizeof (guint32) > length)
+    return FALSE;
+
+  memcpy (encoded_len, data + next, sizeof (guint32));
+  next += sizeof (guint32);
+
+  if (*encoded_len > length - next)
+    return FALSE;
+
+  *encoded = data + next;
+
+  return TRUE;
+}
+
+static gboolean
+snapshot_find (GConfSnapshot *snapshot,
+               const gchar   *key,
+               gsize         *record)
+{
+  const SnapshotHeader *header;
+  const guint32 *offsets;
+  guint32 lo, hi;
+
+  header = (const SnapshotHeader *) snapshot->data;
+  offsets = (const guint32 *) (snapshot->data + sizeof (SnapshotHeader));
+
+  lo = 0;
+  hi = header->n_entries;
+
+  while (lo < hi)
+    {
+      guint32 mid = lo + (hi - lo) / 2;
+      const gchar *mid_key;
+      gsize next;
+      int cmp;
+
+      mid_key = snapshot_string_at (snapshot, offsets[mid] + sizeof (guint32), &next);
+      if (mid_key == NULL)
+        return FALSE;
+
+      cmp = strcmp (key, mid_key);
+      if (cmp == 0)
+        {
+          *record = offsets[mid];
+          return TRUE;
+        }
+      else if (cmp < 0)
+        hi = mid;
+      else
+        lo = mid + 1;
+    }
+
+  return FALSE;
+}
+
+gboolean
+gconf_snapshot_lookup (GConfSnapshot  *snapshot,
+                       const gchar    *key,
+                       GConfValue    **value,
+                       gboolean       *is_writable,
+                       gchar         **schema_name)
+{
+  const gchar *record_key;
+  const gchar *schema;
+  const gchar *encoded;
+  GConfValue *val;
+  guint32 generation;
+  guint32 flags;
+  guint32 encoded_len;
+  gsize record;
+
+  g_return_val_if_fail (snapshot != NULL, FALSE);
+  g_return_val_if_fail (key != NULL, FALSE);
+
+  if (!snapshot_map_gen (snapshot))
+    return FALSE;
+
+  generation = snapshot_current_generation (snapshot);
+
+  if (snapshot->file == NULL ||
+      ((const SnapshotHeader *) snapshot->data)->generation != generation)
+    {
+      if (!snapshot_reload (snapshot, generation))
+        return FALSE;
+    }
+
+  if (!snapshot_find (snapshot, key, &record))
+    return FALSE;
+
+  if (!parse_record (snapshot->data, snapshot->length, record,
+                     &flags, &record_key, &schema, &encoded, &encoded_len))
+    return FALSE;
+
+  val = gconf_value_decode_binary (encoded, encoded_len);
+  if (val == NULL)
+    return FALSE;
+
+  /* The daemon may have changed something while we were reading */
+  if (snapshot_current_generation (snapshot) != generation)
+    {
+      gconf_value_free (val);
+      return FALSE;
+    }
+
+  *value = val;
+
+  if (is_writable)
+    *is_writable = (flags & RECORD_WRITABLE) != 0;
+
+  if (schema_name)
+    *schema_name = *schema != '\0' ? g_strdup (schema) : NULL;
+
+  return TRUE;
+}
+
+/*
+ * Daemon side
+ */
+
+typedef struct {
+  gchar    *encoded;
+  gsize     encoded_len;
+  gchar    *schema_name;
+  gboolean  is_writable;
+} SnapshotEntry;
+
+struct _GConfSnapshotWriter {
+  gchar      *path;
+  gchar      *gen_path;
+  gchar      *warm_path;
+
+  GenHeader  *gen;
+
+  /* key -> SnapshotEntry */
+  GHashTable *entries;
+
+  guint       publish_timeout;
+};
+
+static void
+snapshot_entry_free (SnapshotEntry *entry)
+{
+  g_free (entry->encoded);
+  g_free (entry->schema_name);
+  g_free (entry);
+}
+
+static void
+writer_bump (GConfSnapshotWriter *writer)
+{
+  g_atomic_int_inc ((volatile gint *) &writer->gen->generation);
+}
+
+GConfSnapshotWriter*
+gconf_snapshot_writer_new (const gchar *instance,
+                           const gchar *name)
+{
+  GConfSnapshotWriter *writer;
+  gchar *dir;
+  gchar *base;
+  void *map;
+  int fd;
+
+  g_return_val_if_fail (instance != NULL, NULL);
+  g_return_val_if_fail (name != NULL, NULL);
+
+  if (snapshots_disabled ())
+    return NULL;
+
+  writer = g_new0 (GConfSnapshotWriter, 1);
+  snapshot_paths (instance, name, &writer->path, &writer->gen_path);
+
+  dir = g_path_get_dirname (writer->path);
+  g_mkdir_with_parents (dir, 0700);
+
+  base = g_strconcat ("snapshot-", name, ".warm", NULL);
+  writer->warm_path = g_build_filename (dir, base, NULL);
+  g_free (base);
+  g_free (dir);
+
+  /* The generation file is never replaced, only updated in place,
+   * since clients keep it mapped.  It belongs to this instance alone.
+   */
+  g_unlink (writer->path);
+  g_unlink (writer->gen_path);
+
+  fd = open (writer->gen_path, O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd < 0)
+    goto failed;
+
+  if (ftruncate (fd, sizeof (GenHeader)) < 0)
+    {
+      close (fd);
+      goto failed;
+    }
+
+  map = mmap (NULL, sizeof (GenHeader), PROT_READ | PROT_WRITE,
+              MAP_SHARED, fd, 0);
+  close (fd);
+
+  if (map == MAP_FAILED)
+    goto failed;
+
+  writer->gen = map;
+
+  /* Nothing is published until the first snapshot is written */
+  writer->gen->generation = g_random_int ();
+  memcpy (writer->gen->magic, GEN_MAGIC, 8);
+
+  writer->entries = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                           g_free,
+                                           (GDestroyNotify) snapshot_entry_free);
+
+  return writer;
+
+ failed:
+  gconf_log (GCL_DEBUG, "Not publishing read snapshot %s: %s",
+             writer->gen_path, g_strerror (errno));
+
+  g_free (writer->path);
+  g_free (writer->gen_path);
+  g_free (writer->warm_path);
+  g_free (writer);
+
+  return NULL;
+}
+
+void
+gconf_snapshot_writer_free (GConfSnapshotWriter *writer)
+{
+  if (writer == NULL)
+    return;
+
+  if (writer->publish_timeout != 0)
+    g_source_remove (writer->publish_timeout);
+
+  /* Clients that still have the generation mapped fall back to
+   * D-Bus until they learn about the next daemon.
+   */
+  writer_bump (writer);
+  g_unlink (writer->path);
+  g_unlink (writer->gen_path);
+
+  munmap (writer->gen, sizeof (GenHeader));
+
+  g_hash_table_destroy (writer->entries);
+
+  g_free (writer->path);
+  g_free (writer->gen_path);
+  g_free (writer->warm_path);
+  g_free (writer);
+}
+
+static int
+compare_keys (gconstpointer a,
+              gconstpointer b)
+{
+  return strcmp (*(const gchar **) a, *(const gchar **) b);
+}
+
+static void
+append_uint32 (GString *str,
+               guint32  value)
+{
+  g_string_append_len (str, (const gchar *) &value, sizeof (guint32));
+}
+
+/* Lays out the entries as described at the top of the file; the
+ * header is left for the caller to fill in.
+ */
+static GString*
+writer_serialize (GConfSnapshotWriter *writer,
+                  const gchar         *stamp)
+{
+  SnapshotHeader header;
+  GHashTableIter iter;
+  GPtrArray *keys;
+  GString *buf;
+  gpointer key;
+  gsize offsets_start;
+  guint i;
+
+  keys = g_ptr_array_sized_new (g_hash_table_size (writer->entries));
+
+  g_hash_table_iter_init (&iter, writer->entries);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    g_ptr_array_add (keys, key);
+
+  g_ptr_array_sort (keys, compare_keys);
+
+  buf = g_string_new (NULL);
+
+  memset (&header, 0, sizeof (header));
+  g_string_append_len (buf, (const gchar *) &header, sizeof (header));
+
+  if (stamp != NULL)
+    {
+      append_uint32 (buf, strlen (stamp));
+      g_string_append (buf, stamp);
+
+      while (buf->len % sizeof (guint32) != 0)
+        g_string_append_c (buf, '\0');
+    }
+
+  /* offsets, filled in below */
+  offsets_start = buf->len;
+  for (i = 0; i < keys->len; i++)
+    append_uint32 (buf, 0);
+
+  for (i = 0; i < keys->len; i++)
+    {
+      const gchar *k = g_ptr_array_index (keys, i);
+      SnapshotEntry *entry = g_hash_table_lookup (writer->entries, k);
+      guint32 offset = buf->len;
+
+      memcpy (buf->str + offsets_start + i * sizeof (guint32),
+              &offset, sizeof (guint32));
+
+      append_uint32 (buf, entry->is_writable ? RECORD_WRITABLE : 0);
+      g_string_append_len (buf, k, strlen (k) + 1);
+      g_string_append_len (buf, entry->schema_name ? entry->schema_name : "",
+                           (entry->schema_name ? strlen (entry->schema_name) : 0) + 1);
+      append_uint32 (buf, entry->encoded_len);
+      g_string_append_len (buf, entry->encoded, entry->encoded_len);
+
+      while (buf->len % sizeof (guint32) != 0)
+        g_string_append_c (buf, '\0');
+    }
+
+  g_ptr_array_free (keys, TRUE);
+
+  return buf;
+}
+
+static void
+writer_publish (GConfSnapshotWriter *writer)
+{
+  SnapshotHeader header;
+  GString *buf;
+  GError *error = NULL;
+
+  buf = writer_serialize (writer, NULL);
+
+  /* The file has to be in place before the generation announces it,
+   * or a client reading in between would give up on that generation
+   * until the next publish.
+   */
+  memcpy (header.magic, SNAPSHOT_MAGIC, 8);
+  header.generation = writer->gen->generation + 1;
+  header.n_entries = g_hash_table_size (writer->entries);
+  memcpy (buf->str, &header, sizeof (header));
+
+  /* Writes a temporary file and renames it over the old one, so
+   * clients that have the previous snapshot mapped are unaffected.
+   */
+  if (!g_file_set_contents (writer->path, buf->str, buf->len, &error))
+    {
+      gconf_log (GCL_WARNING, _("Failed to publish read snapshot: %s"),
+                 error->message);
+      g_error_free (error);
+    }
+
+  writer_bump (writer);
+
+  g_string_free (buf, TRUE);
+}
+
+static gboolean
+publish_timeout_cb (gpointer data)
+{
+  GConfSnapshotWriter *writer = data;
+
+  writer->publish_timeout = 0;
+
+  writer_publish (writer);
+
+  return FALSE;
+}
+
+static void
+writer_schedule_publish (GConfSnapshotWriter *writer)
+{
+  if (writer->publish_timeout == 0)
+    writer->publish_timeout = g_timeout_add (PUBLISH_DELAY_MS,
+                                             publish_timeout_cb,
+                                             writer);
+}
+
+void
+gconf_snapshot_writer_record (GConfSnapshotWriter *writer,
+                              const gchar         *key,
+                              const GConfValue    *value,
+                              const gchar         *schema_name,
+                              gboolean             is_writable)
+{
+  SnapshotEntry *entry;
+  gchar *encoded;
+  gsize encoded_len;
+
+  if (writer == NULL || value == NULL)
+    return;
+
+  /* Schemas carry localized strings */
+  if (value->type == GCONF_VALUE_SCHEMA)
+    return;
+
+  entry = g_hash_table_lookup (writer->entries, key);
+
+  if (entry == NULL && g_hash_table_size (writer->entries) >= MAX_ENTRIES)
+    return;
+
+  encoded = gconf_value_encode_binary (value, &encoded_len);
+
+  if (entry != NULL &&
+      entry->is_writable == is_writable &&
+      entry->encoded_len == encoded_len &&
+      memcmp (entry->encoded, encoded, encoded_len) == 0 &&
+      g_strcmp0 (entry->schema_name, schema_name) == 0)
+    {
+      g_free (encoded);
+      return;
+    }
+
+  entry = g_new0 (SnapshotEntry, 1);
+  entry->encoded = encoded;
+  entry->encoded_len = encoded_len;
+  entry->schema_name = g_strdup (schema_name);
+  entry->is_writable = is_writable;
+
+  g_hash_table_replace (writer->entries, g_strdup (key), entry);
+
+  writer_schedule_publish (writer);
+}
+
+/* Forgets key and everything below it.  Only keys that were actually
+ * published invalidate the snapshot; clients already fall back for
+ * anything that isn't in it.
+ */
+void
+gconf_snapshot_writer_forget (GConfSnapshotWriter *writer,
+                              const gchar         *key)
+{
+  GHashTableIter iter;
+  gpointer k;
+  gboolean removed;
+  gsize len;
+
+  if (writer == NULL)
+    return;
+
+  removed = g_hash_table_remove (writer->entries, key);
+
+  len = strlen (key);
+
+  g_hash_table_iter_init (&iter, writer->entries);
+  while (g_hash_table_iter_next (&iter, &k, NULL))
+    {
+      const gchar *entry_key = k;
+
+      if (strcmp (key, "/") == 0 ||
+          (strncmp (entry_key, key, len) == 0 && entry_key[len] == '/'))
+        {
+          g_hash_table_iter_remove (&iter);
+          removed = TRUE;
+        }
+    }
+
+  if (removed)
+    {
+      /* Before the change is acknowledged to anyone */
+      writer_bump (writer);
+      writer_schedule_publish (writer);
+    }
+}
+
+void
+gconf_snapshot_writer_forget_all (GConfSnapshotWriter *writer)
+{
+  if (writer == NULL)
+    return;
+
+  g_hash_table_remove_all (writer->entries);
+
+  writer_bump (writer);
+  writer_schedule_publish (writer);
+}
+
+/* Entries are only ever recorded from a lookup and dropped on any
+ * change below them, so the daemon can answer from them too.
+ */
+gboolean
+gconf_snapshot_writer_lookup (GConfSnapshotWriter  *writer,
+                              const gchar          *key,
+                              GConfValue          **value,
+                              gboolean             *is_writable,
+                              gchar               **schema_name)
+{
+  SnapshotEntry *entry;
+  GConfValue *val;
+
+  if (writer == NULL)
+    return FALSE;
+
+  entry = g_hash_table_lookup (writer->entries, key);
+  if (entry == NULL)
+    return FALSE;
+
+  val = gconf_value_decode_binary (entry->encoded, entry->encoded_len);
+  if (val == NULL)
+    return FALSE;
+
+  *value = val;
+
+  if (is_writable)
+    *is_writable = entry->is_writable;
+
+  if (schema_name)
+    *schema_name = g_strdup (entry->schema_name);
+
+  return TRUE;
+}
+
+/* Saves the entries for the next daemon to pick up with
+ * gconf_snapshot_writer_load_warm(); stamp describes the state of
+ * the sources they were read from.  A NULL stamp means that state
+ * can't be described reliably, so nothing is saved.
+ */
+void
+gconf_snapshot_writer_save_warm (GConfSnapshotWriter *writer,
+                                 const gchar         *stamp)
+{
+  SnapshotHeader header;
+  GString *buf;
+  GError *error = NULL;
+
+  if (writer == NULL)
+    return;
+
+  if (stamp == NULL || g_hash_table_size (writer->entries) == 0)
+    {
+      g_unlink (writer->warm_path);
+      return;
+    }
+
+  buf = writer_serialize (writer, stamp);
+
+  memset (&header, 0, sizeof (header));
+  memcpy (header.magic, WARM_MAGIC, 8);
+  header.n_entries = g_hash_table_size (writer->entries);
+  memcpy (buf->str, &header, sizeof (header));
+
+  if (!g_file_set_contents (writer->warm_path, buf->str, buf->len, &error))
+    {
+      gconf_log (GCL_DEBUG, "Failed to save warm restart snapshot: %s",
+                 error->message);
+      g_error_free (error);
+    }
+  else
+    gconf_log (GCL_DEBUG, "Saved %u entries for warm restart to %s",
+               header.n_entries, writer->warm_path);
+
+  g_string_free (buf, TRUE);
+}
+
+/* Whether a previous daemon left a warm file, so that computing the
+ * stamp for gconf_snapshot_writer_load_warm() is worth it.
+ */
+gboolean
+gconf_snapshot_writer_has_warm (GConfSnapshotWriter *writer)
+{
+  if (writer == NULL)
+    return FALSE;
+
+  return g_file_test (writer->warm_path, G_FILE_TEST_IS_REGULAR);
+}
+
+/* Seeds the writer with the entries a previous daemon saved, if they
+ * were saved against the same stamp, and publishes them right away.
+ * The file is consumed either way; once we have run, the sources are
+ * the authority again.  A NULL stamp matches nothing.
+ */
+gboolean
+gconf_snapshot_writer_load_warm (GConfSnapshotWriter *writer,
+                                 const gchar         *stamp)
+{
+  const SnapshotHeader *header;
+  const guint32 *offsets;
+  GMappedFile *file = NULL;
+  const gchar *data;
+  gsize length;
+  gsize pos;
+  guint32 stamp_len;
+  gboolean retval = FALSE;
+  guint i;
+
+  if (writer == NULL)
+    return FALSE;
+
+  if (stamp == NULL)
+    goto out;
+
+  file = g_mapped_file_new (writer->warm_path, FALSE, NULL);
+  if (file == NULL)
+    goto out;
+
+  data = g_mapped_file_get_contents (file);
+  length = g_mapped_file_get_length (file);
+
+  if (length < sizeof (SnapshotHeader) + sizeof (guint32))
+    goto out;
+
+  header = (const SnapshotHeader *) data;
+  if (memcmp (header->magic, WARM_MAGIC, 8) != 0)
+    goto out;
+
+  pos = sizeof (SnapshotHeader);
+  memcpy (&stamp_len, data + pos, sizeof (guint32));
+  pos += sizeof (guint32);
+
+  if (stamp_len != strlen (stamp) || stamp_len > length - pos ||
+      memcmp (data + pos, stamp, stamp_len) != 0)
+    {
+      gconf_log (GCL_DEBUG, "Sources changed since %s was saved, not using it",
+                 writer->warm_path);
+      goto out;
+    }
+
+  pos += stamp_len;
+  pos += (sizeof (guint32) - pos % sizeof (guint32)) % sizeof (guint32);
+
+  if (pos > length ||
+      header->n_entries > (length - pos) / sizeof (guint32) ||
+      header->n_entries > MAX_ENTRIES)
+    goto out;
+
+  offsets = (const guint32 *) (data + pos);
+
+  for (i = 0; i < header->n_entries; i++)
+    {
+      SnapshotEntry *entry;
+      const gchar *key;
+      const gchar *schema;
+      const gchar *encoded;
+      guint32 flags;
+      guint32 encoded_len;
+
+      if (!parse_record (data, length, offsets[i],
+                         &flags, &key, &schema, &encoded, &encoded_len))
+        {
+          g_hash_table_remove_all (writer->entries);
+          goto out;
+        }
+
+      entry = g_new0 (SnapshotEntry, 1);
+      entry->encoded = g_malloc (encoded_len);
+      memcpy (entry->encoded, encoded, encoded_len);
+      entry->encoded_len = encoded_len;
+      entry->schema_name = *schema != '\0' ? g_strdup (schema) : NULL;
+      entry->is_writable = (flags & RECORD_WRITABLE) != 0;
+
+      g_hash_table_replace (writer->entries, g_strdup (key), entry);
+    }
+
+  gconf_log (GCL_DEBUG, "Restored %u entries from %s",
+             header->n_entries, writer->warm_path);
+
+  /* Clients can use them before anyone has asked us anything */
+  writer_publish (writer);
+
+  retval = TRUE;
+
+ out:
+  if (file != NULL)
+    g_mapped_file_unref (file);
+
+  g_unlink (writer->warm_path);
+
+  return retval;
+}
+
+#else /* !HAVE_MMAP */
+
+GConfSnapshot*
+gconf_snapshot_open (const gchar *instance,
+                     const gchar *name)
+{
+  return NULL;
+}
+
+void
+gconf_snapshot_close (GConfSnapshot *snapshot)
+{
+}
+
+gboolean
+gconf_snapshot_lookup (GConfSnapshot  *snapshot,
+                       const gchar    *key,
+                       GConfValue    **value,
+                       gboolean       *is_writable,
+                       gchar         **schema_name)
+{
+  return FALSE;
+}
+
+GConfSnapshotWriter*
+gconf_snapshot_writer_new (const gchar *instance,
+                           const gchar *name)
+{
+  return NULL;
+}
+
+void
+gconf_snapshot_writer_free (GConfSnapshotWriter *writer)
+{
+}
+
+void
+gconf_snapshot_writer_record (GConfSnapshotWriter *writer,
+                              const gchar         *key,
+                              const GConfValue    *value,
+                              const gchar         *schema_name,
+                              gboolean             is_writable)
+{
+}
+
+void
+gconf_snapshot_writer_forget (GConfSnapshotWriter *writer,
+                              const gchar         *key)
+{
+}
+
+void
+gconf_snapshot_writer_forget_all (GConfSnapshotWriter *writer)
+{
+}
+
+gboolean
+gconf_snapshot_writer_lookup (GConfSnapshotWriter  *writer,
+                              const gchar          *key,
+                              GConfValue          **value,
+                              gboolean             *is_writable,
+                              gchar               **schema_name)
+{
+  return FALSE;
+}
+
+void
+gconf_snapshot_writer_save_warm (GConfSnapshotWriter *writer,
+                                 const gchar         *stamp)
+{
+}
+
+gboolean
+gconf_snapshot_writer_has_warm (GConfSnapshotWriter *writer)
+{
+  return FALSE;
+}
+
+gboolean
+gconf_snapshot_writer_load_warm (GConfSnapshotWriter *writer,
+                                 const gchar         *stamp)
+{
+  return FALSE;
+}
+
+#endif /* HAVE_MMAP */
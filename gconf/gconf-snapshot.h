@@ -0,0 +1,98 @@
+/* GConf
+ * Copyright (C) 2012 Free Software Foundation, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef GCONF_GCONF_SNAPSHOT_H
+#define GCONF_GCONF_SNAPSHOT_H
+
+#include <glib.h>
+#include "gconf-value.h"
+
+G_BEGIN_DECLS
+
+/*
+ * Read snapshots.
+ *
+ * gconfd publishes the values it has resolved for a database in a
+ * read-only file in the daemon directory, next to a small shared
+ * generation file.  Both are named after the daemon instance as well
+ * as the database, since several daemons can share the directory
+ * (one per session bus, or an NFS home); clients ask gconfd for its
+ * instance name first.  Any change to the database bumps the generation
+ * before the change is acknowledged, and the snapshot file is
+ * republished (atomically replaced) shortly after.  A client only
+ * trusts a snapshot whose generation matches the current one; on a
+ * mismatch or a missing key it asks gconfd over D-Bus as usual.
+ *
+ * Only non-default, non-schema values are published, since those
+ * don't depend on the locale or schema_default arguments of a lookup.
+ *
+ * When the daemon exits it can also save its entries for the next
+ * one (a "warm restart"), tagged with a caller-supplied stamp of the
+ * sources; they are only picked up again if the stamp still matches.
+ */
+
+typedef struct _GConfSnapshot       GConfSnapshot;
+typedef struct _GConfSnapshotWriter GConfSnapshotWriter;
+
+/* File name stem for the database with the given persistent name,
+ * NULL meaning the default database.
+ */
+gchar*               gconf_snapshot_name           (const gchar         *persistent_name);
+
+/* A name for this daemon instance, unique among those sharing the
+ * daemon directory.
+ */
+gchar*               gconf_snapshot_new_instance   (void);
+
+/* Client side */
+GConfSnapshot*       gconf_snapshot_open           (const gchar         *instance,
+                                                    const gchar         *name);
+void                 gconf_snapshot_close          (GConfSnapshot       *snapshot);
+gboolean             gconf_snapshot_lookup         (GConfSnapshot       *snapshot,
+                                                    const gchar         *key,
+                                                    GConfValue         **value,
+                                                    gboolean            *is_writable,
+                                                    gchar              **schema_name);
+
+/* Daemon side */
+GConfSnapshotWriter* gconf_snapshot_writer_new     (const gchar         *instance,
+                                                    const gchar         *name);
+void                 gconf_snapshot_writer_free    (GConfSnapshotWriter *writer);
+void                 gconf_snapshot_writer_record  (GConfSnapshotWriter *writer,
+                                                    const gchar         *key,
+                                                    const GConfValue    *value,
+                                                    const gchar         *schema_name,
+                                                    gboolean             is_writable);
+void                 gconf_snapshot_writer_forget  (GConfSnapshotWriter *writer,
+                                                    const gchar         *key);
+void                 gconf_snapshot_writer_forget_all (GConfSnapshotWriter *writer);
+gboolean             gconf_snapshot_writer_lookup  (GConfSnapshotWriter *writer,
+                                                    const gchar         *key,
+                                                    GConfValue         **value,
+                                                    gboolean            *is_writable,
+                                                    gchar              **schema_name);
+void                 gconf_snapshot_writer_save_warm (GConfSnapshotWriter *writer,
+                                                      const gchar         *stamp);
+gboolean             gconf_snapshot_writer_has_warm  (GConfSnapshotWriter *writer);
+gboolean             gconf_snapshot_writer_load_warm (GConfSnapshotWriter *writer,
+                                                      const gchar         *stamp);
+
+G_END_DECLS
+
+#endif
@@ -482,6 +482,26 @@ gconf_sources_clear_cache        (GConfSources  *sources)
     }
 }
 
+/* Sum of what the backends report; sources whose backend can't tell
+ * count as empty.
+ */
+gsize
+gconf_sources_get_cache_size (GConfSources  *sources)
+{
+  GList* tmp;
+  gsize size = 0;
+
+  for (tmp = sources->sources; tmp != NULL; tmp = g_list_next (tmp))
+    {
+      GConfSource* source = tmp->data;
+
+      if (source->backend->vtable.cache_size)
+        size += (*source->backend->vtable.cache_size)(source);
+    }
+
+  return size;
+}
+
 void
 gconf_sources_clear_cache_for_sources (GConfSources  *sources,
 				       GConfSources  *affected)
@@ -693,7 +713,7 @@ gconf_sources_query_value (GConfSources* sources,
         {
           GConfValue* retval;
 
-          retval = gconf_schema_steal_default_value (gconf_value_get_schema (val));          
+          retval = gconf_schema_steal_default_value (gconf_value_get_schema_writable (val));
 
           gconf_value_free (val);
 
@@ -718,6 +738,35 @@ gconf_sources_query_value (GConfSources* sources,
   return NULL;
 }
 
+/* The value of key in the source gconf_sources_set_value() would
+ * write it to, ignoring whatever lower sources or schemas provide;
+ * NULL if it isn't set there.
+ */
+GConfValue*
+gconf_sources_query_writable_value (GConfSources *sources,
+                                    const gchar  *key,
+                                    GError      **err)
+{
+  GList* tmp;
+
+  g_return_val_if_fail (sources != NULL, NULL);
+  g_return_val_if_fail (key != NULL, NULL);
+  g_return_val_if_fail ((err == NULL) || (*err == NULL), NULL);
+
+  if (!gconf_key_check (key, err))
+    return NULL;
+
+  for (tmp = sources->sources; tmp != NULL; tmp = g_list_next (tmp))
+    {
+      GConfSource* src = tmp->data;
+
+      if (source_is_writable (src, key, NULL)) /* ignore errors */
+        return gconf_source_query_value (src, key, NULL, NULL, err);
+    }
+
+  return NULL;
+}
+
 void
 gconf_sources_set_value   (GConfSources* sources,
                            const gchar* key,
@@ -906,13 +955,16 @@ recursive_unset_helper (GConfSources   *sources,
       while (tmp != NULL)
         {
           char *s = tmp->data;
-          char *full = gconf_concat_dir_and_key (key, s);
+          char buf[GCONF_KEY_BUF_SIZE];
+          char *full, *to_free;
+
+          full = gconf_concat_dir_and_key_r (key, s, buf, sizeof (buf), &to_free);
           
           recursive_unset_helper (sources, full, locale, flags,
                                   notifies, first_error);
           
           g_free (s);
-          g_free (full);
+          g_free (to_free);
 
           tmp = g_slist_next (tmp);
         }
@@ -1234,7 +1286,7 @@ hash_lookup_defaults_func(gpointer key, gpointer value, gpointer user_data)
             {
               GConfValue* defval;
 
-              defval = gconf_schema_steal_default_value (gconf_value_get_schema(val));
+              defval = gconf_schema_steal_default_value (gconf_value_get_schema_writable (val));
 
               gconf_entry_set_value_nocopy (entry, defval);
               gconf_entry_set_is_default (entry, TRUE);
@@ -1342,7 +1394,8 @@ gconf_sources_all_entries   (GConfSources* sources,
         {
           GConfEntry* pair = iter->data;
           GConfEntry* previous;
-          gchar *full;
+          gchar buf[GCONF_KEY_BUF_SIZE];
+          gchar *full, *to_free;
           
           if (first_pass)
             previous = NULL; /* Can't possibly be there. */
@@ -1364,7 +1417,9 @@ gconf_sources_all_entries   (GConfSources* sources,
                    * entry->key is relative not absolute on the
                    * gconfd side
                    */
-                  full = gconf_concat_dir_and_key (dir, previous->key);
+                  full = gconf_concat_dir_and_key_r (dir, previous->key,
+                                                     buf, sizeof (buf),
+                                                     &to_free);
 
                   gconf_entry_set_is_writable (previous,
                                                key_is_writable (sources,
@@ -1372,7 +1427,7 @@ gconf_sources_all_entries   (GConfSources* sources,
                                                                 full,
                                                                 NULL));
 
-                  g_free (full);
+                  g_free (to_free);
                 }
               
               if (gconf_entry_get_schema_name (previous) != NULL)
@@ -1399,7 +1454,9 @@ gconf_sources_all_entries   (GConfSources* sources,
                * entry->key is relative not absolute on the
                * gconfd side
                */
-              full = gconf_concat_dir_and_key (dir, pair->key);
+              full = gconf_concat_dir_and_key_r (dir, pair->key,
+                                                 buf, sizeof (buf),
+                                                 &to_free);
 
               gconf_entry_set_is_writable (pair,
                                            key_is_writable (sources,
@@ -1407,7 +1464,7 @@ gconf_sources_all_entries   (GConfSources* sources,
                                                             full,
                                                             NULL));
               
-              g_free (full);
+              g_free (to_free);
             }
 
           iter = g_slist_next(iter);
@@ -1537,6 +1594,178 @@ gconf_sources_all_dirs   (GConfSources* sources,
   return flattened;
 }
 
+typedef struct {
+  GConfSearchType type;
+  const gchar *pattern;
+  gsize pattern_len;
+  GPatternSpec *glob;
+  GRegex *regex;
+  const gchar **locales;
+  GSList *found;
+} SearchState;
+
+static gboolean
+search_matches (SearchState *state, const gchar *key)
+{
+  const gchar *name;
+
+  switch (state->type)
+    {
+    case GCONF_SEARCH_GLOB:
+      name = strrchr (key, '/') + 1;
+      return g_pattern_match_string (state->glob, name);
+    case GCONF_SEARCH_REGEX:
+      name = strrchr (key, '/') + 1;
+      return g_regex_match (state->regex, name, 0, NULL);
+    case GCONF_SEARCH_PREFIX:
+      return strncmp (key, state->pattern, state->pattern_len) == 0;
+    }
+
+  return FALSE;
+}
+
+/* For prefix searches, skip directories that can't hold a match */
+static gboolean
+search_wants_dir (SearchState *state, const gchar *dir)
+{
+  gsize len;
+
+  if (state->type != GCONF_SEARCH_PREFIX)
+    return TRUE;
+
+  len = strlen (dir);
+
+  if (len >= state->pattern_len)
+    return strncmp (dir, state->pattern, state->pattern_len) == 0;
+
+  return strncmp (dir, state->pattern, len) == 0 &&
+    (dir[len - 1] == '/' || state->pattern[len] == '/');
+}
+
+static void
+search_dir (GConfSources *sources, SearchState *state, const gchar *dir)
+{
+  GSList *entries;
+  GSList *subdirs;
+  GSList *tmp;
+  GError *error = NULL;
+
+  entries = gconf_sources_all_entries (sources, dir, state->locales, &error);
+
+  if (error != NULL)
+    {
+      gconf_log (GCL_WARNING, _("Failed to get all entries in `%s': %s"),
+                 dir, error->message);
+      g_error_free (error);
+      error = NULL;
+    }
+
+  for (tmp = entries; tmp != NULL; tmp = tmp->next)
+    {
+      GConfEntry *entry = tmp->data;
+      gchar *full;
+
+      full = gconf_concat_dir_and_key (dir, entry->key);
+
+      if (search_matches (state, full))
+        {
+          g_free (entry->key);
+          entry->key = full;
+          state->found = g_slist_prepend (state->found, entry);
+        }
+      else
+        {
+          g_free (full);
+          gconf_entry_free (entry);
+        }
+    }
+
+  g_slist_free (entries);
+
+  subdirs = gconf_sources_all_dirs (sources, dir, &error);
+
+  if (error != NULL)
+    {
+      gconf_log (GCL_WARNING, _("Error listing dirs in `%s': %s"),
+                 dir, error->message);
+      g_error_free (error);
+    }
+
+  for (tmp = subdirs; tmp != NULL; tmp = tmp->next)
+    {
+      gchar *full;
+
+      full = gconf_concat_dir_and_key (dir, tmp->data);
+
+      if (search_wants_dir (state, full))
+        search_dir (sources, state, full);
+
+      g_free (full);
+      g_free (tmp->data);
+    }
+
+  g_slist_free (subdirs);
+}
+
+/* Returns the entries below @dir whose key matches @pattern, with
+ * full keys, in the order a depth-first walk of the tree visits them.
+ * Directories that fail to list are logged and skipped.
+ */
+GSList*
+gconf_sources_search (GConfSources   *sources,
+                      const gchar    *dir,
+                      GConfSearchType type,
+                      const gchar    *pattern,
+                      const gchar   **locales,
+                      GError        **err)
+{
+  SearchState state;
+  GError *error = NULL;
+
+  g_return_val_if_fail (sources != NULL, NULL);
+  g_return_val_if_fail (dir != NULL, NULL);
+  g_return_val_if_fail (pattern != NULL, NULL);
+
+  memset (&state, 0, sizeof (state));
+  state.type = type;
+  state.pattern = pattern;
+  state.pattern_len = strlen (pattern);
+  state.locales = locales;
+
+  switch (type)
+    {
+    case GCONF_SEARCH_GLOB:
+      state.glob = g_pattern_spec_new (pattern);
+      break;
+    case GCONF_SEARCH_REGEX:
+      state.regex = g_regex_new (pattern, G_REGEX_OPTIMIZE, 0, &error);
+      if (state.regex == NULL)
+        {
+          gconf_set_error (err, GCONF_ERROR_PARSE_ERROR,
+                           _("Error compiling regex: %s"), error->message);
+          g_error_free (error);
+          return NULL;
+        }
+      break;
+    case GCONF_SEARCH_PREFIX:
+      break;
+    default:
+      gconf_set_error (err, GCONF_ERROR_FAILED,
+                       _("Unknown search type %d"), type);
+      return NULL;
+    }
+
+  if (search_wants_dir (&state, dir))
+    search_dir (sources, &state, dir);
+
+  if (state.glob)
+    g_pattern_spec_free (state.glob);
+  if (state.regex)
+    g_regex_unref (state.regex);
+
+  return g_slist_reverse (state.found);
+}
+
 gboolean
 gconf_sources_sync_all    (GConfSources* sources, GError** err)
 {
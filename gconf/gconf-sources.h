@@ -51,6 +51,16 @@ typedef enum {
   GCONF_SOURCE_ALL_FLAGS = ((1 << 0) | (1 << 1))
 } GConfSourceFlags;
 
+/* How gconf_sources_search() matches keys: glob and regex patterns
+ * are matched against the last component of each key, a prefix
+ * against the whole key.
+ */
+typedef enum {
+  GCONF_SEARCH_GLOB,
+  GCONF_SEARCH_REGEX,
+  GCONF_SEARCH_PREFIX
+} GConfSearchType;
+
 typedef void (* GConfSourceNotifyFunc) (GConfSource *source,
 					const gchar *location,
 					gpointer     user_data);
@@ -82,6 +92,7 @@ GConfSources* gconf_sources_new_from_addresses (GSList* addresses,
 GConfSources* gconf_sources_new_from_source    (GConfSource   *source);
 void          gconf_sources_free               (GConfSources  *sources);
 void          gconf_sources_clear_cache        (GConfSources  *sources);
+gsize         gconf_sources_get_cache_size     (GConfSources  *sources);
 void          gconf_sources_clear_cache_for_sources (GConfSources  *sources,
 						     GConfSources  *affected);
 GConfValue*   gconf_sources_query_value        (GConfSources  *sources,
@@ -92,6 +103,9 @@ GConfValue*   gconf_sources_query_value        (GConfSources  *sources,
                                                 gboolean      *value_is_writable,
                                                 gchar        **schema_name,
                                                 GError   **err);
+GConfValue*   gconf_sources_query_writable_value (GConfSources *sources,
+                                                const gchar   *key,
+                                                GError   **err);
 void          gconf_sources_set_value          (GConfSources  *sources,
                                                 const gchar   *key,
                                                 const GConfValue *value,
@@ -115,6 +129,12 @@ GSList*       gconf_sources_all_entries        (GConfSources  *sources,
 GSList*       gconf_sources_all_dirs           (GConfSources  *sources,
                                                 const gchar   *dir,
                                                 GError   **err);
+GSList*       gconf_sources_search             (GConfSources   *sources,
+                                                const gchar    *dir,
+                                                GConfSearchType type,
+                                                const gchar    *pattern,
+                                                const gchar   **locales,
+                                                GError        **err);
 gboolean      gconf_sources_dir_exists         (GConfSources  *sources,
                                                 const gchar   *dir,
                                                 GError   **err);
@@ -26,27 +26,75 @@
 #include <string.h>
 #include <stdlib.h>
 
+/* Strings, schemas, lists and pairs keep their contents in a
+ * refcounted payload.  gconf_value_copy() shares the payload with the
+ * new value instead of duplicating it, and the first mutation of a
+ * shared payload clones it, so copies still behave as independent
+ * values.  Scalars and short strings are stored inline.
+ */
 typedef struct {
-  GConfValueType type;
+  gint refcount;
   union {
     gchar* string_data;
-    gint int_data;
-    gboolean bool_data;
-    gdouble float_data;
     GConfSchema* schema_data;
     struct {
-      GConfValueType type;
       GSList* list;
+      guint length;
+      /* built on demand by gconf_value_get_list_nth() */
+      GConfValue** index;
     } list_data;
     struct {
       GConfValue* car;
       GConfValue* cdr;
     } pair_data;
   } d;
+} GConfValueData;
+
+/* Strings shorter than this, counting the nul, need no payload;
+ * sized so the value stays three words on 64-bit platforms.
+ */
+#define INLINE_STRING_SIZE 16
+
+typedef struct {
+  GConfValueType type;
+  /* string kept in d.inline_string rather than a payload */
+  guint is_inline : 1;
+  union {
+    gint int_data;
+    gboolean bool_data;
+    gdouble float_data;
+    gchar inline_string[INLINE_STRING_SIZE];
+    struct {
+      /* NULL until the value is first given contents */
+      GConfValueData *shared;
+      GConfValueType list_type;
+    } ref;
+  } d;
 } GConfRealValue;
 
 #define REAL_VALUE(x) ((GConfRealValue*)(x))
 
+static inline GConfValueData*
+value_shared (const GConfRealValue *real)
+{
+  switch (real->type)
+    {
+    case GCONF_VALUE_STRING:
+      return real->is_inline ? NULL : real->d.ref.shared;
+    case GCONF_VALUE_SCHEMA:
+    case GCONF_VALUE_LIST:
+    case GCONF_VALUE_PAIR:
+      return real->d.ref.shared;
+    default:
+      return NULL;
+    }
+}
+
+#define SHARED_SCHEMA(real) (value_shared (real) ? value_shared (real)->d.schema_data : NULL)
+#define SHARED_LIST(real)   (value_shared (real) ? value_shared (real)->d.list_data.list : NULL)
+#define SHARED_CAR(real)    (value_shared (real) ? value_shared (real)->d.pair_data.car : NULL)
+#define SHARED_CDR(real)    (value_shared (real) ? value_shared (real)->d.pair_data.cdr : NULL)
+
 static void
 set_string(gchar** dest, const gchar* src)
 {
@@ -569,7 +617,7 @@ gconf_value_to_string(const GConfValue* value)
       {
         GSList* list;
 
-        list = gconf_value_get_list(value);
+        list = gconf_value_peek_list(value);
 
         if (list == NULL)
           retval = g_strdup("[]");
@@ -642,15 +690,15 @@ gconf_value_to_string(const GConfValue* value)
         gchar* car;
         gchar* cdr;
 
-        if (gconf_value_get_car (value))
-          tmp = gconf_value_to_string(gconf_value_get_car(value));
+        if (gconf_value_peek_car (value))
+          tmp = gconf_value_to_string(gconf_value_peek_car(value));
         else
           tmp = g_strdup ("nil");
 	car = escape_string(tmp, ",)");
 	g_free(tmp);
 
-        if (gconf_value_get_cdr (value))
-          tmp = gconf_value_to_string(gconf_value_get_cdr(value));
+        if (gconf_value_peek_cdr (value))
+          tmp = gconf_value_to_string(gconf_value_peek_cdr(value));
         else
           tmp = g_strdup ("nil");
 	cdr = escape_string(tmp, ",)");
@@ -672,11 +720,11 @@ gconf_value_to_string(const GConfValue* value)
         const gchar* car_type;
         const gchar* cdr_type;
         
-        locale = gconf_schema_get_locale(gconf_value_get_schema(value));
-        type = gconf_value_type_to_string(gconf_schema_get_type(gconf_value_get_schema(value)));
-        list_type = gconf_value_type_to_string(gconf_schema_get_list_type(gconf_value_get_schema(value)));
-        car_type = gconf_value_type_to_string(gconf_schema_get_car_type(gconf_value_get_schema(value)));
-        cdr_type = gconf_value_type_to_string(gconf_schema_get_cdr_type(gconf_value_get_schema(value)));
+        locale = gconf_schema_get_locale(gconf_value_peek_schema(value));
+        type = gconf_value_type_to_string(gconf_schema_get_type(gconf_value_peek_schema(value)));
+        list_type = gconf_value_type_to_string(gconf_schema_get_list_type(gconf_value_peek_schema(value)));
+        car_type = gconf_value_type_to_string(gconf_schema_get_car_type(gconf_value_peek_schema(value)));
+        cdr_type = gconf_value_type_to_string(gconf_schema_get_cdr_type(gconf_value_peek_schema(value)));
         
         retval = g_strdup_printf("Schema (type: `%s' list_type: '%s' "
 				 "car_type: '%s' cdr_type: '%s' locale: `%s')",
@@ -710,134 +758,271 @@ copy_value_list(GSList* list)
   return copy;
 }
 
-GType
-gconf_value_get_type ()
+static GConfValueData*
+value_data_new (void)
 {
-  static GType type = 0;
+  GConfValueData *data;
 
-  if (type == 0)
-    type = g_boxed_type_register_static (g_intern_static_string ("GConfValue"),
-                                         (GBoxedCopyFunc) gconf_value_copy,
-                                         (GBoxedFreeFunc) gconf_value_free);
-  return type;
+  data = g_slice_new0 (GConfValueData);
+  data->refcount = 1;
+
+  return data;
 }
 
-GConfValue* 
-gconf_value_copy (const GConfValue* src)
+static GConfValueData*
+value_data_ref (GConfValueData *data)
 {
-  GConfRealValue *dest;
-  GConfRealValue *real;
-  
-  g_return_val_if_fail(src != NULL, NULL);
+  g_atomic_int_inc (&data->refcount);
 
-  real = REAL_VALUE (src);
-  dest = REAL_VALUE (gconf_value_new (src->type));
+  return data;
+}
 
-  switch (real->type)
+static void
+value_data_free_list (GConfValueData *data)
+{
+  g_slist_foreach (data->d.list_data.list, (GFunc) gconf_value_free, NULL);
+  g_slist_free (data->d.list_data.list);
+  g_free (data->d.list_data.index);
+
+  data->d.list_data.list = NULL;
+  data->d.list_data.length = 0;
+  data->d.list_data.index = NULL;
+}
+
+static void
+value_data_unref (GConfValueType  type,
+                  GConfValueData *data)
+{
+  if (!g_atomic_int_dec_and_test (&data->refcount))
+    return;
+
+  switch (type)
     {
-    case GCONF_VALUE_INT:
-    case GCONF_VALUE_FLOAT:
-    case GCONF_VALUE_BOOL:
-    case GCONF_VALUE_INVALID:
-      dest->d = real->d;
-      break;
     case GCONF_VALUE_STRING:
-      set_string(&dest->d.string_data, real->d.string_data);
+      g_free (data->d.string_data);
       break;
     case GCONF_VALUE_SCHEMA:
-      if (real->d.schema_data)
-        dest->d.schema_data = gconf_schema_copy(real->d.schema_data);
-      else
-        dest->d.schema_data = NULL;
+      if (data->d.schema_data != NULL)
+        gconf_schema_free (data->d.schema_data);
       break;
-      
     case GCONF_VALUE_LIST:
-      {
-        GSList* copy;
-
-        copy = copy_value_list(real->d.list_data.list);
-
-        dest->d.list_data.list = copy;
-        dest->d.list_data.type = real->d.list_data.type;
-      }
+      value_data_free_list (data);
       break;
-      
     case GCONF_VALUE_PAIR:
+      if (data->d.pair_data.car != NULL)
+        gconf_value_free (data->d.pair_data.car);
+      if (data->d.pair_data.cdr != NULL)
+        gconf_value_free (data->d.pair_data.cdr);
+      break;
+    default:
+      break;
+    }
 
-      if (real->d.pair_data.car)
-        dest->d.pair_data.car = gconf_value_copy(real->d.pair_data.car);
-      else
-        dest->d.pair_data.car = NULL;
+  g_slice_free (GConfValueData, data);
+}
 
-      if (real->d.pair_data.cdr)
-        dest->d.pair_data.cdr = gconf_value_copy(real->d.pair_data.cdr);
-      else
-        dest->d.pair_data.cdr = NULL;
+/* Returns a payload owned by @real alone, cloning the shared one if
+ * needed; for setters that only change part of the contents.
+ */
+static GConfValueData*
+value_data_writable (GConfRealValue *real)
+{
+  GConfValueData *old;
+  GConfValueData *data;
+
+  g_assert (!real->is_inline);
 
+  old = real->d.ref.shared;
+
+  if (old == NULL)
+    {
+      real->d.ref.shared = value_data_new ();
+      return real->d.ref.shared;
+    }
+
+  if (g_atomic_int_get (&old->refcount) == 1)
+    return old;
+
+  data = value_data_new ();
+
+  switch (real->type)
+    {
+    case GCONF_VALUE_STRING:
+      data->d.string_data = g_strdup (old->d.string_data);
+      break;
+    case GCONF_VALUE_SCHEMA:
+      if (old->d.schema_data != NULL)
+        data->d.schema_data = gconf_schema_copy (old->d.schema_data);
+      break;
+    case GCONF_VALUE_LIST:
+      data->d.list_data.list = copy_value_list (old->d.list_data.list);
+      data->d.list_data.length = old->d.list_data.length;
+      break;
+    case GCONF_VALUE_PAIR:
+      if (old->d.pair_data.car != NULL)
+        data->d.pair_data.car = gconf_value_copy (old->d.pair_data.car);
+      if (old->d.pair_data.cdr != NULL)
+        data->d.pair_data.cdr = gconf_value_copy (old->d.pair_data.cdr);
       break;
-      
     default:
-      g_assert_not_reached();
+      g_assert_not_reached ();
     }
-  
-  return (GConfValue*) dest;
+
+  value_data_unref (real->type, old);
+  real->d.ref.shared = data;
+
+  return data;
+}
+
+/* For the public getters, which hand out contents the caller may
+ * modify: gives @real a payload of its own before any is returned.
+ * Returns the payload, or NULL if @real has no contents yet.
+ */
+static GConfValueData*
+value_data_unshare (GConfRealValue *real)
+{
+  if (real->d.ref.shared == NULL)
+    return NULL;
+
+  return value_data_writable (real);
+}
+
+/* Like value_data_writable(), but for setters that replace the whole
+ * contents: a shared payload is dropped rather than cloned.
+ */
+static GConfValueData*
+value_data_replace (GConfRealValue *real)
+{
+  GConfValueData *data;
+
+  g_assert (!real->is_inline);
+
+  data = real->d.ref.shared;
+
+  if (data != NULL &&
+      g_atomic_int_get (&data->refcount) > 1)
+    {
+      value_data_unref (real->type, data);
+      data = NULL;
+    }
+
+  if (data == NULL)
+    {
+      data = value_data_new ();
+      real->d.ref.shared = data;
+    }
+
+  return data;
 }
 
+/* Drops whatever string @real holds, leaving it NULL */
 static void
-gconf_value_free_list(GConfValue* value)
+value_clear_string (GConfRealValue *real)
 {
-  GSList* tmp;
-  GConfRealValue *real;
-  
-  g_return_if_fail(value != NULL);
-  g_return_if_fail(value->type == GCONF_VALUE_LIST);
+  if (!real->is_inline && real->d.ref.shared != NULL)
+    value_data_unref (real->type, real->d.ref.shared);
 
-  real = REAL_VALUE (value);
-  
-  tmp = real->d.list_data.list;
+  real->is_inline = FALSE;
+  real->d.ref.shared = NULL;
+}
 
-  while (tmp != NULL)
+/* Stores @str in @real, taking ownership of @owned (which is either
+ * NULL or the same string as @str) and copying @str otherwise.
+ */
+static void
+value_set_string (GConfRealValue *real,
+                  const gchar    *str,
+                  gchar          *owned)
+{
+  gsize len;
+  gchar *copy;
+  GConfValueData *data;
+
+  len = str ? strlen (str) : 0;
+
+  if (str != NULL && len < INLINE_STRING_SIZE)
     {
-      gconf_value_free(tmp->data);
-      
-      tmp = g_slist_next(tmp);
+      gchar buf[INLINE_STRING_SIZE];
+
+      /* @str may point into the contents being replaced */
+      memcpy (buf, str, len + 1);
+      g_free (owned);
+
+      value_clear_string (real);
+      memcpy (real->d.inline_string, buf, len + 1);
+      real->is_inline = TRUE;
+      return;
     }
-  g_slist_free(real->d.list_data.list);
 
-  real->d.list_data.list = NULL;
+  copy = owned ? owned : g_strdup (str);
+
+  if (real->is_inline)
+    value_clear_string (real);
+
+  data = value_data_replace (real);
+  g_free (data->d.string_data);
+  data->d.string_data = copy;
+}
+
+GType
+gconf_value_get_type ()
+{
+  static GType type = 0;
+
+  if (type == 0)
+    type = g_boxed_type_register_static (g_intern_static_string ("GConfValue"),
+                                         (GBoxedCopyFunc) gconf_value_copy,
+                                         (GBoxedFreeFunc) gconf_value_free);
+  return type;
+}
+
+/**
+ * gconf_value_copy:
+ * @src: a #GConfValue.
+ *
+ * Copies @src.  The copy shares its string, schema, list or pair
+ * contents with @src until either of them is modified or handed out by
+ * gconf_value_get_schema(), gconf_value_get_list(),
+ * gconf_value_get_car() or gconf_value_get_cdr(), so copying is cheap
+ * regardless of the size of the value.
+ *
+ * Return value: a new #GConfValue.
+ */
+GConfValue* 
+gconf_value_copy (const GConfValue* src)
+{
+  GConfRealValue *dest;
+  GConfRealValue *real;
+  GConfValueData *data;
+  
+  g_return_val_if_fail(src != NULL, NULL);
+
+  real = REAL_VALUE (src);
+  dest = REAL_VALUE (gconf_value_new (src->type));
+
+  dest->is_inline = real->is_inline;
+  dest->d = real->d;
+
+  data = value_shared (real);
+  if (data != NULL)
+    value_data_ref (data);
+  
+  return (GConfValue*) dest;
 }
 
 void 
 gconf_value_free(GConfValue* value)
 {
   GConfRealValue *real;
+  GConfValueData *data;
   
   g_return_if_fail(value != NULL);
 
   real = REAL_VALUE (value);
-  
-  switch (real->type)
-    {
-    case GCONF_VALUE_STRING:
-      g_free(real->d.string_data);
-      break;
-    case GCONF_VALUE_SCHEMA:
-      if (real->d.schema_data != NULL)
-        gconf_schema_free(real->d.schema_data);
-      break;
-    case GCONF_VALUE_LIST:
-      gconf_value_free_list(value);
-      break;
-    case GCONF_VALUE_PAIR:
-      if (real->d.pair_data.car != NULL)
-        gconf_value_free(real->d.pair_data.car);
 
-      if (real->d.pair_data.cdr != NULL)
-        gconf_value_free(real->d.pair_data.cdr);
-      break;
-    default:
-      break;
-    }
+  data = value_shared (real);
+  if (data != NULL)
+    value_data_unref (real->type, data);
   
   g_slice_free(GConfRealValue, real);
 }
@@ -845,10 +1030,17 @@ gconf_value_free(GConfValue* value)
 const char*
 gconf_value_get_string (const GConfValue *value)
 {
+  GConfRealValue *real;
+
   g_return_val_if_fail (value != NULL, NULL);
   g_return_val_if_fail (value->type == GCONF_VALUE_STRING, NULL);
-  
-  return REAL_VALUE (value)->d.string_data;
+
+  real = REAL_VALUE (value);
+
+  if (real->is_inline)
+    return real->d.inline_string;
+
+  return real->d.ref.shared ? real->d.ref.shared->d.string_data : NULL;
 }
 
 char*
@@ -856,14 +1048,34 @@ gconf_value_steal_string (GConfValue *value)
 {
   char *string;
   GConfRealValue *real;
+  GConfValueData *data;
   
   g_return_val_if_fail (value != NULL, NULL);
   g_return_val_if_fail (value->type == GCONF_VALUE_STRING, NULL);
 
   real = REAL_VALUE (value);
 
-  string = real->d.string_data;
-  real->d.string_data = NULL;
+  if (real->is_inline)
+    {
+      string = g_strdup (real->d.inline_string);
+      value_clear_string (real);
+      return string;
+    }
+
+  data = real->d.ref.shared;
+  if (data == NULL)
+    return NULL;
+
+  if (g_atomic_int_get (&data->refcount) > 1)
+    {
+      string = g_strdup (data->d.string_data);
+      value_clear_string (real);
+    }
+  else
+    {
+      string = data->d.string_data;
+      data->d.string_data = NULL;
+    }
 
   return string;
 }
@@ -892,7 +1104,7 @@ gconf_value_get_list_type (const GConfValue *value)
   g_return_val_if_fail (value != NULL, GCONF_VALUE_INVALID);
   g_return_val_if_fail (value->type == GCONF_VALUE_LIST, GCONF_VALUE_INVALID);
   
-  return REAL_VALUE (value)->d.list_data.type;
+  return REAL_VALUE (value)->d.ref.list_type;
 }
 
 /**
@@ -904,16 +1116,91 @@ gconf_value_get_list_type (const GConfValue *value)
  * gconf_value_get_list_type(). Remember that the empty #GSList is equal to
  * <symbol>NULL</symbol>.  The list is not a copy; it is "owned" by the
  * #GConfValue and will be destroyed when the #GConfValue is destroyed.
+ * The values in the list belong to @value alone and may be modified,
+ * but the list itself must not be.
  *
  * Return value: (element-type GConfValue) (transfer none): a #GList.
  */
 GSList*
 gconf_value_get_list (const GConfValue *value)
 {
+  GConfValueData *data;
+
   g_return_val_if_fail (value != NULL, NULL);
   g_return_val_if_fail (value->type == GCONF_VALUE_LIST, NULL);
 
-  return REAL_VALUE (value)->d.list_data.list;
+  data = value_data_unshare (REAL_VALUE (value));
+
+  return data ? data->d.list_data.list : NULL;
+}
+
+/* gconf_value_get_list() for callers that only read: the list isn't
+ * cloned, so it may be shared with copies of @value.
+ */
+GSList*
+gconf_value_peek_list (const GConfValue *value)
+{
+  g_return_val_if_fail (value != NULL, NULL);
+  g_return_val_if_fail (value->type == GCONF_VALUE_LIST, NULL);
+
+  return SHARED_LIST (REAL_VALUE (value));
+}
+
+guint
+gconf_value_get_list_length (const GConfValue *value)
+{
+  GConfValueData *data;
+
+  g_return_val_if_fail (value != NULL, 0);
+  g_return_val_if_fail (value->type == GCONF_VALUE_LIST, 0);
+
+  data = value_shared (REAL_VALUE (value));
+
+  return data ? data->d.list_data.length : 0;
+}
+
+/* Returns element @n of a list value, or NULL if the list is shorter.
+ * The first call builds an index of the elements, so repeated lookups
+ * in the same list are O(1).
+ */
+GConfValue*
+gconf_value_get_list_nth (const GConfValue *value,
+                          guint             n)
+{
+  GConfValueData *data;
+  GConfValue **index;
+
+  g_return_val_if_fail (value != NULL, NULL);
+  g_return_val_if_fail (value->type == GCONF_VALUE_LIST, NULL);
+
+  data = value_shared (REAL_VALUE (value));
+
+  if (data == NULL || n >= data->d.list_data.length)
+    return NULL;
+
+  index = g_atomic_pointer_get (&data->d.list_data.index);
+
+  if (index == NULL)
+    {
+      GSList *tmp;
+      guint i;
+
+      /* A shared payload may be read from several threads at once;
+       * whoever loses the race to publish the index frees theirs.
+       */
+      index = g_new (GConfValue*, data->d.list_data.length);
+      for (tmp = data->d.list_data.list, i = 0; tmp != NULL; tmp = tmp->next, ++i)
+        index[i] = tmp->data;
+
+      if (!g_atomic_pointer_compare_and_exchange (&data->d.list_data.index,
+                                                  NULL, index))
+        {
+          g_free (index);
+          index = g_atomic_pointer_get (&data->d.list_data.index);
+        }
+    }
+
+  return index[n];
 }
 
 GSList*
@@ -921,33 +1208,78 @@ gconf_value_steal_list (GConfValue *value)
 {
   GSList *list;
   GConfRealValue *real;
+  GConfValueData *data;
   
   g_return_val_if_fail (value != NULL, NULL);
   g_return_val_if_fail (value->type == GCONF_VALUE_LIST, NULL);
 
   real = REAL_VALUE (value);
+  data = real->d.ref.shared;
+
+  if (data == NULL)
+    return NULL;
+
+  if (g_atomic_int_get (&data->refcount) > 1)
+    {
+      list = copy_value_list (data->d.list_data.list);
+      value_data_unref (real->type, data);
+      real->d.ref.shared = NULL;
+    }
+  else
+    {
+      list = data->d.list_data.list;
+      data->d.list_data.list = NULL;
+      value_data_free_list (data);
+    }
 
-  list = real->d.list_data.list;
-  real->d.list_data.list = NULL;
   return list;
 }
 
 GConfValue*
 gconf_value_get_car (const GConfValue *value)
 {
+  GConfValueData *data;
+
   g_return_val_if_fail (value != NULL, NULL);
   g_return_val_if_fail (value->type == GCONF_VALUE_PAIR, NULL);
   
-  return REAL_VALUE (value)->d.pair_data.car;
+  data = value_data_unshare (REAL_VALUE (value));
+
+  return data ? data->d.pair_data.car : NULL;
 }
 
 GConfValue*
 gconf_value_get_cdr (const GConfValue *value)
+{
+  GConfValueData *data;
+
+  g_return_val_if_fail (value != NULL, NULL);
+  g_return_val_if_fail (value->type == GCONF_VALUE_PAIR, NULL);
+  
+  data = value_data_unshare (REAL_VALUE (value));
+
+  return data ? data->d.pair_data.cdr : NULL;
+}
+
+/* Read-only gconf_value_get_car() and gconf_value_get_cdr(), which
+ * don't clone a pair shared with copies of @value.
+ */
+GConfValue*
+gconf_value_peek_car (const GConfValue *value)
 {
   g_return_val_if_fail (value != NULL, NULL);
   g_return_val_if_fail (value->type == GCONF_VALUE_PAIR, NULL);
   
-  return REAL_VALUE (value)->d.pair_data.cdr;
+  return SHARED_CAR (REAL_VALUE (value));
+}
+
+GConfValue*
+gconf_value_peek_cdr (const GConfValue *value)
+{
+  g_return_val_if_fail (value != NULL, NULL);
+  g_return_val_if_fail (value->type == GCONF_VALUE_PAIR, NULL);
+  
+  return SHARED_CDR (REAL_VALUE (value));
 }
 
 
@@ -962,11 +1294,41 @@ gconf_value_get_bool (const GConfValue *value)
 
 GConfSchema*
 gconf_value_get_schema (const GConfValue *value)
+{
+  GConfValueData *data;
+
+  g_return_val_if_fail (value != NULL, NULL);
+  g_return_val_if_fail (value->type == GCONF_VALUE_SCHEMA, NULL);
+  
+  data = value_data_unshare (REAL_VALUE (value));
+
+  return data ? data->d.schema_data : NULL;
+}
+
+/* gconf_value_get_schema() for callers that only read: the schema
+ * isn't cloned, so it may be shared with copies of @value.
+ */
+GConfSchema*
+gconf_value_peek_schema (const GConfValue *value)
 {
   g_return_val_if_fail (value != NULL, NULL);
   g_return_val_if_fail (value->type == GCONF_VALUE_SCHEMA, NULL);
   
-  return REAL_VALUE (value)->d.schema_data;
+  return SHARED_SCHEMA (REAL_VALUE (value));
+}
+
+/* gconf_value_get_schema() for callers that modify the schema */
+GConfSchema*
+gconf_value_get_schema_writable (GConfValue *value)
+{
+  GConfValueData *data;
+
+  g_return_val_if_fail (value != NULL, NULL);
+  g_return_val_if_fail (value->type == GCONF_VALUE_SCHEMA, NULL);
+
+  data = value_data_unshare (REAL_VALUE (value));
+
+  return data ? data->d.schema_data : NULL;
 }
 
 GConfSchema*
@@ -974,14 +1336,29 @@ gconf_value_steal_schema (GConfValue *value)
 {
   GConfSchema *schema;
   GConfRealValue *real;
+  GConfValueData *data;
   
   g_return_val_if_fail (value != NULL, NULL);
   g_return_val_if_fail (value->type == GCONF_VALUE_SCHEMA, NULL);
 
   real = REAL_VALUE (value);
+  data = real->d.ref.shared;
+
+  if (data == NULL)
+    return NULL;
 
-  schema = real->d.schema_data;
-  real->d.schema_data = NULL;
+  if (g_atomic_int_get (&data->refcount) > 1)
+    {
+      schema = data->d.schema_data ?
+        gconf_schema_copy (data->d.schema_data) : NULL;
+      value_data_unref (real->type, data);
+      real->d.ref.shared = NULL;
+    }
+  else
+    {
+      schema = data->d.schema_data;
+      data->d.schema_data = NULL;
+    }
 
   return schema;
 }
@@ -998,23 +1375,23 @@ gconf_value_set_int(GConfValue* value, gint the_int)
 void        
 gconf_value_set_string(GConfValue* value, const gchar* the_str)
 {  
-  gconf_value_set_string_nocopy (value,
-                                 g_strdup (the_str));
+  g_return_if_fail(value != NULL);
+  g_return_if_fail(value->type == GCONF_VALUE_STRING);
+
+  value_set_string (REAL_VALUE (value), the_str, NULL);
 }
 
 void
 gconf_value_set_string_nocopy (GConfValue *value,
                                char       *str)
 {
-  GConfRealValue *real;
-
   g_return_if_fail(value != NULL);
   g_return_if_fail(value->type == GCONF_VALUE_STRING);
 
-  real = REAL_VALUE (value);
-
-  g_free (real->d.string_data);
-  real->d.string_data = str;
+  if (str == NULL)
+    value_clear_string (REAL_VALUE (value));
+  else
+    value_set_string (REAL_VALUE (value), str, str);
 }
 
 void        
@@ -1038,34 +1415,34 @@ gconf_value_set_bool(GConfValue* value, gboolean the_bool)
 void       
 gconf_value_set_schema(GConfValue* value, const GConfSchema* sc)
 {
-  GConfRealValue *real;
+  GConfValueData *data;
   
   g_return_if_fail(value != NULL);
   g_return_if_fail(value->type == GCONF_VALUE_SCHEMA);
 
-  real = REAL_VALUE (value);
+  data = value_data_replace (REAL_VALUE (value));
   
-  if (real->d.schema_data != NULL)
-    gconf_schema_free (real->d.schema_data);
+  if (data->d.schema_data != NULL)
+    gconf_schema_free (data->d.schema_data);
 
-  real->d.schema_data = gconf_schema_copy (sc);
+  data->d.schema_data = gconf_schema_copy (sc);
 }
 
 void        
 gconf_value_set_schema_nocopy(GConfValue* value, GConfSchema* sc)
 {
-  GConfRealValue *real;
+  GConfValueData *data;
   
   g_return_if_fail(value != NULL);
   g_return_if_fail(value->type == GCONF_VALUE_SCHEMA);
   g_return_if_fail(sc != NULL);
 
-  real = REAL_VALUE (value);
+  data = value_data_replace (REAL_VALUE (value));
   
-  if (real->d.schema_data != NULL)
-    gconf_schema_free (real->d.schema_data);
+  if (data->d.schema_data != NULL)
+    gconf_schema_free (data->d.schema_data);
 
-  real->d.schema_data = sc;
+  data->d.schema_data = sc;
 }
 
 void
@@ -1077,17 +1454,17 @@ gconf_value_set_car(GConfValue* value, const GConfValue* car)
 void
 gconf_value_set_car_nocopy(GConfValue* value, GConfValue* car)
 {
-  GConfRealValue *real;
+  GConfValueData *data;
   
   g_return_if_fail(value != NULL);
   g_return_if_fail(value->type == GCONF_VALUE_PAIR);
 
-  real = REAL_VALUE (value);
+  data = value_data_writable (REAL_VALUE (value));
   
-  if (real->d.pair_data.car != NULL)
-    gconf_value_free (real->d.pair_data.car);
+  if (data->d.pair_data.car != NULL)
+    gconf_value_free (data->d.pair_data.car);
 
-  real->d.pair_data.car = car;
+  data->d.pair_data.car = car;
 }
 
 void
@@ -1099,17 +1476,17 @@ gconf_value_set_cdr(GConfValue* value, const GConfValue* cdr)
 void
 gconf_value_set_cdr_nocopy(GConfValue* value, GConfValue* cdr)
 {
-  GConfRealValue *real;
+  GConfValueData *data;
   
   g_return_if_fail(value != NULL);
   g_return_if_fail(value->type == GCONF_VALUE_PAIR);
 
-  real = REAL_VALUE (value);
+  data = value_data_writable (REAL_VALUE (value));
   
-  if (real->d.pair_data.cdr != NULL)
-    gconf_value_free (real->d.pair_data.cdr);
+  if (data->d.pair_data.cdr != NULL)
+    gconf_value_free (data->d.pair_data.cdr);
 
-  real->d.pair_data.cdr = cdr;
+  data->d.pair_data.cdr = cdr;
 }
 
 void
@@ -1129,9 +1506,23 @@ gconf_value_set_list_type (GConfValue    *value,
    * type, or we shouldn't be changing it without deleting
    * the list first.
    */
-  g_return_if_fail (real->d.list_data.list == NULL);
+  g_return_if_fail (SHARED_LIST (real) == NULL);
+
+  real->d.ref.list_type = type;
+}
 
-  real->d.list_data.type = type;
+static void
+gconf_value_replace_list (GConfValue *value,
+                          GSList     *list)
+{
+  GConfValueData *data;
+
+  data = value_data_replace (REAL_VALUE (value));
+
+  value_data_free_list (data);
+
+  data->d.list_data.list = list;
+  data->d.list_data.length = g_slist_length (list);
 }
 
 void
@@ -1145,12 +1536,9 @@ gconf_value_set_list_nocopy (GConfValue* value,
 
   real = REAL_VALUE (value);
   
-  g_return_if_fail (real->d.list_data.type != GCONF_VALUE_INVALID);
-  
-  if (real->d.list_data.list)
-    gconf_value_free_list (value);
+  g_return_if_fail (real->d.ref.list_type != GCONF_VALUE_INVALID);
 
-  real->d.list_data.list = list;
+  gconf_value_replace_list (value, list);
 }
 
 void
@@ -1164,18 +1552,16 @@ gconf_value_set_list       (GConfValue* value,
 
   real = REAL_VALUE (value);
 
-  g_return_if_fail (real->d.list_data.type != GCONF_VALUE_INVALID);
+  g_return_if_fail (real->d.ref.list_type != GCONF_VALUE_INVALID);
   g_return_if_fail ((list == NULL) ||
                     ((list->data != NULL) &&
-                     (((GConfValue*)list->data)->type == real->d.list_data.type)));
-  
-  if (real->d.list_data.list)
-    gconf_value_free_list (value);
+                     (((GConfValue*)list->data)->type == real->d.ref.list_type)));
 
-  real->d.list_data.list = copy_value_list (list);
+  gconf_value_replace_list (value, copy_value_list (list));
 }
 
 
+
 static int
 null_safe_strcmp (const char *lhs,
                   const char *rhs)
@@ -1237,8 +1623,8 @@ gconf_value_compare (const GConfValue *value_a,
         GSList *list_a;
         GSList *list_b;
 
-        list_a = gconf_value_get_list (value_a);
-        list_b = gconf_value_get_list (value_b);
+        list_a = gconf_value_peek_list (value_a);
+        list_b = gconf_value_peek_list (value_b);
         
         while (list_a != NULL && list_b != NULL)
           {
@@ -1265,10 +1651,10 @@ gconf_value_compare (const GConfValue *value_a,
         GConfValue *a_car, *b_car, *a_cdr, *b_cdr;
         int result;
         
-        a_car = gconf_value_get_car (value_a);
-        b_car = gconf_value_get_car (value_b);
-        a_cdr = gconf_value_get_cdr (value_a);
-        b_cdr = gconf_value_get_cdr (value_b);
+        a_car = gconf_value_peek_car (value_a);
+        b_car = gconf_value_peek_car (value_b);
+        a_cdr = gconf_value_peek_cdr (value_a);
+        b_cdr = gconf_value_peek_cdr (value_b);
 
         if (a_car == NULL && b_car != NULL)
           return -1;
@@ -1309,32 +1695,32 @@ gconf_value_compare (const GConfValue *value_a,
         const char *long_desc_a, *long_desc_b;
         int result;
         
-        type_a = gconf_schema_get_type (gconf_value_get_schema (value_a));
-        type_b = gconf_schema_get_type (gconf_value_get_schema (value_b));
+        type_a = gconf_schema_get_type (gconf_value_peek_schema (value_a));
+        type_b = gconf_schema_get_type (gconf_value_peek_schema (value_b));
 
         if (type_a < type_b)
           return -1;
         else if (type_a > type_b)
           return 1;
 
-        short_desc_a = gconf_schema_get_short_desc (gconf_value_get_schema (value_a));
-        short_desc_b = gconf_schema_get_short_desc (gconf_value_get_schema (value_b));
+        short_desc_a = gconf_schema_get_short_desc (gconf_value_peek_schema (value_a));
+        short_desc_b = gconf_schema_get_short_desc (gconf_value_peek_schema (value_b));
 
         result = null_safe_strcmp (short_desc_a, short_desc_b);
         if (result != 0)
           return result;
         
-        long_desc_a = gconf_schema_get_long_desc (gconf_value_get_schema (value_a));
+        long_desc_a = gconf_schema_get_long_desc (gconf_value_peek_schema (value_a));
 
 
-        long_desc_b = gconf_schema_get_long_desc (gconf_value_get_schema (value_b));
+        long_desc_b = gconf_schema_get_long_desc (gconf_value_peek_schema (value_b));
 
         result = null_safe_strcmp (long_desc_a, long_desc_b);
         if (result != 0)
           return result;
         
-        locale_a = gconf_schema_get_locale (gconf_value_get_schema (value_a));
-        locale_b = gconf_schema_get_locale (gconf_value_get_schema (value_b));
+        locale_a = gconf_schema_get_locale (gconf_value_peek_schema (value_a));
+        locale_b = gconf_schema_get_locale (gconf_value_peek_schema (value_b));
 
         result = null_safe_strcmp (locale_a, locale_b);
         if (result != 0)
@@ -1342,8 +1728,8 @@ gconf_value_compare (const GConfValue *value_a,
 
         if (type_a == GCONF_VALUE_LIST)
           {
-            list_type_a = gconf_schema_get_list_type (gconf_value_get_schema (value_a));
-            list_type_b = gconf_schema_get_list_type (gconf_value_get_schema (value_b));
+            list_type_a = gconf_schema_get_list_type (gconf_value_peek_schema (value_a));
+            list_type_b = gconf_schema_get_list_type (gconf_value_peek_schema (value_b));
             
             if (list_type_a < list_type_b)
               return -1;
@@ -1353,16 +1739,16 @@ gconf_value_compare (const GConfValue *value_a,
 
         if (type_a == GCONF_VALUE_PAIR)
           {
-            car_type_a = gconf_schema_get_car_type (gconf_value_get_schema (value_a));
-            car_type_b = gconf_schema_get_car_type (gconf_value_get_schema (value_b));
+            car_type_a = gconf_schema_get_car_type (gconf_value_peek_schema (value_a));
+            car_type_b = gconf_schema_get_car_type (gconf_value_peek_schema (value_b));
             
             if (car_type_a < car_type_b)
               return -1;
             else if (car_type_a > car_type_b)
               return 1;
             
-            cdr_type_a = gconf_schema_get_cdr_type (gconf_value_get_schema (value_a));
-            cdr_type_b = gconf_schema_get_cdr_type (gconf_value_get_schema (value_b));
+            cdr_type_a = gconf_schema_get_cdr_type (gconf_value_peek_schema (value_a));
+            cdr_type_b = gconf_schema_get_cdr_type (gconf_value_peek_schema (value_b));
             
             if (cdr_type_a < cdr_type_b)
               return -1;
@@ -1456,6 +1842,7 @@ typedef struct {
   char *key;
   GConfValue *value;
   char *schema_name;
+  char *origin;
   int refcount;
   guint is_default : 1;
   guint is_writable : 1;
@@ -1496,6 +1883,7 @@ gconf_entry_new_nocopy (char* key, GConfValue* val)
   real->schema_name = NULL;
   real->is_default = FALSE;
   real->is_writable = TRUE;
+  real->origin = NULL;
   real->refcount = 1;
   
   return (GConfEntry*) real;
@@ -1529,6 +1917,7 @@ gconf_entry_unref (GConfEntry *entry)
       if (real->value)
         gconf_value_free (real->value);
       g_free (real->schema_name);
+      g_free (real->origin);
       g_slice_free (GConfRealEntry, real);
     }
 }
@@ -1552,6 +1941,7 @@ gconf_entry_copy (const GConfEntry *src)
   real->schema_name = g_strdup (REAL_ENTRY (src)->schema_name);
   real->is_default = REAL_ENTRY (src)->is_default;
   real->is_writable = REAL_ENTRY (src)->is_writable;
+  real->origin = g_strdup (REAL_ENTRY (src)->origin);
 
   return entry;
 }
@@ -1642,6 +2032,17 @@ gconf_entry_get_is_writable (const GConfEntry *entry)
   return REAL_ENTRY (entry)->is_writable;
 }
 
+/* The tag passed to gconf_client_commit_change_set_with_origin() for
+ * the change that produced this entry, or NULL if it isn't known.
+ */
+const char*
+gconf_entry_get_origin (const GConfEntry *entry)
+{
+  g_return_val_if_fail (entry != NULL, NULL);
+
+  return REAL_ENTRY (entry)->origin;
+}
+
 
 void
 gconf_entry_set_value (GConfEntry  *entry,
@@ -1684,6 +2085,17 @@ gconf_entry_set_is_writable (GConfEntry  *entry,
   REAL_ENTRY (entry)->is_writable = is_writable;
 }
 
+void
+gconf_entry_set_origin (GConfEntry  *entry,
+                        const gchar *origin)
+{
+  char *copy;
+
+  copy = g_strdup (origin);
+  g_free (REAL_ENTRY (entry)->origin);
+  REAL_ENTRY (entry)->origin = copy;
+}
+
 
 gboolean
 gconf_value_validate (const GConfValue *value,
@@ -1698,8 +2110,8 @@ gconf_value_validate (const GConfValue *value,
   switch (value->type)
     {
     case GCONF_VALUE_STRING:
-      if (real->d.string_data &&
-          !g_utf8_validate (real->d.string_data, -1, NULL))
+      if (gconf_value_get_string (value) &&
+          !g_utf8_validate (gconf_value_get_string (value), -1, NULL))
         {
           g_set_error (err, GCONF_ERROR,
                        GCONF_ERROR_FAILED,
@@ -1709,8 +2121,8 @@ gconf_value_validate (const GConfValue *value,
       break;
 
     case GCONF_VALUE_SCHEMA:
-      if (real->d.schema_data)
-        return gconf_schema_validate (real->d.schema_data,
+      if (SHARED_SCHEMA (real))
+        return gconf_schema_validate (SHARED_SCHEMA (real),
                                       err);
       break;
 
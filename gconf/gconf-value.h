@@ -176,6 +176,7 @@ GConfValue* gconf_entry_get_value       (const GConfEntry *entry);
 const char* gconf_entry_get_schema_name (const GConfEntry *entry);
 gboolean    gconf_entry_get_is_default  (const GConfEntry *entry);
 gboolean    gconf_entry_get_is_writable (const GConfEntry *entry);
+const char* gconf_entry_get_origin      (const GConfEntry *entry);
 
 GConfEntry* gconf_entry_new              (const gchar *key,
                                           const GConfValue  *val);
@@ -201,6 +202,8 @@ void        gconf_entry_set_is_default   (GConfEntry  *entry,
                                           gboolean     is_default);
 void        gconf_entry_set_is_writable  (GConfEntry  *entry,
                                           gboolean     is_writable);
+void        gconf_entry_set_origin       (GConfEntry  *entry,
+                                          const gchar *origin);
 
 gboolean    gconf_entry_equal            (const GConfEntry *a,
                                           const GConfEntry *b);
@@ -24,6 +24,7 @@
 #include "gconf.h"
 #include "gconf-internals.h"
 #include "gconf-sources.h"
+#include "gconf-backend.h"
 #include "gconf-locale.h"
 #include <string.h>
 #include <stdio.h>
@@ -564,6 +565,30 @@ gconf_engine_get_local_for_addresses (GSList  *addresses,
   return conf;
 }
 
+GConfEngine *
+gconf_engine_get_local_readonly_for_addresses (GSList  *addresses,
+                                               GError **err)
+{
+  GConfEngine *conf;
+  GSList *readonly;
+  GSList *tmp;
+
+  g_return_val_if_fail (addresses != NULL, NULL);
+  g_return_val_if_fail (err == NULL || *err == NULL, NULL);
+
+  readonly = NULL;
+  for (tmp = addresses; tmp != NULL; tmp = tmp->next)
+    readonly = g_slist_prepend (readonly,
+                                gconf_address_add_flags (tmp->data, "readonly,lazy"));
+  readonly = g_slist_reverse (readonly);
+
+  conf = gconf_engine_get_local_for_addresses (readonly, err);
+
+  gconf_address_list_free (readonly);
+
+  return conf;
+}
+
 /**
  * gconf_engine_get_default: (skip)
  *
@@ -1380,6 +1405,143 @@ gconf_engine_set (GConfEngine* conf, const gchar* key,
   return TRUE;
 }
 
+/* ORBit has no cheap way to pipeline requests, so this is just a
+ * synchronous set; @func is never called.
+ */
+gboolean
+gconf_engine_set_async (GConfEngine          *conf,
+                        const gchar          *key,
+                        const GConfValue     *value,
+                        GConfEngineSetNotify  func,
+                        gpointer              user_data,
+                        GDestroyNotify        destroy_notify,
+                        GError              **err)
+{
+  gboolean retval;
+
+  retval = gconf_engine_set (conf, key, value, err);
+
+  if (destroy_notify)
+    (* destroy_notify) (user_data);
+
+  return retval;
+}
+
+void
+gconf_engine_flush_pending_sets (GConfEngine *conf)
+{
+  /* nothing is ever pending */
+}
+
+struct _GConfDirListing {
+  GSList *entries;
+  GSList *subdirs;
+  GError *error;
+};
+
+GConfDirListing*
+gconf_engine_list_dir_async (GConfEngine *conf,
+                             const gchar *dir)
+{
+  GConfDirListing *listing;
+
+  g_return_val_if_fail (conf != NULL, NULL);
+  g_return_val_if_fail (dir != NULL, NULL);
+
+  listing = g_new0 (GConfDirListing, 1);
+  listing->entries = gconf_engine_all_entries (conf, dir, &listing->error);
+  listing->subdirs = gconf_engine_all_dirs (conf, dir, NULL);
+
+  return listing;
+}
+
+GSList*
+gconf_engine_list_dir_finish (GConfDirListing  *listing,
+                              GSList          **subdirs,
+                              GError          **err)
+{
+  GSList *entries;
+
+  g_return_val_if_fail (listing != NULL, NULL);
+
+  entries = listing->entries;
+
+  if (subdirs)
+    *subdirs = listing->subdirs;
+  else
+    {
+      g_slist_foreach (listing->subdirs, (GFunc) g_free, NULL);
+      g_slist_free (listing->subdirs);
+    }
+
+  if (listing->error)
+    g_propagate_error (err, listing->error);
+
+  g_free (listing);
+
+  return entries;
+}
+
+gboolean
+gconf_engine_commit (GConfEngine     *conf,
+                     GSList          *entries,
+                     const gchar     *origin,
+                     GError         **err)
+{
+  g_return_val_if_fail (conf != NULL, FALSE);
+  g_return_val_if_fail (err == NULL || *err == NULL, FALSE);
+
+  /* Neither the CORBA interface nor the sources can apply changes
+   * atomically
+   */
+  return FALSE;
+}
+
+gboolean
+gconf_engine_search (GConfEngine     *conf,
+                     const gchar     *dir,
+                     GConfSearchType  type,
+                     const gchar     *pattern,
+                     GSList         **entries,
+                     GError         **err)
+{
+  GError* error = NULL;
+  gchar** locale_list;
+
+  g_return_val_if_fail (conf != NULL, FALSE);
+  g_return_val_if_fail (dir != NULL, FALSE);
+  g_return_val_if_fail (pattern != NULL, FALSE);
+  g_return_val_if_fail (entries != NULL, FALSE);
+  g_return_val_if_fail (err == NULL || *err == NULL, FALSE);
+
+  CHECK_OWNER_USE (conf);
+
+  *entries = NULL;
+
+  /* The CORBA interface has no search method */
+  if (!gconf_engine_is_local (conf))
+    return FALSE;
+
+  if (!gconf_key_check (dir, err))
+    return FALSE;
+
+  locale_list = gconf_split_locale (gconf_current_locale ());
+
+  *entries = gconf_sources_search (conf->local_sources, dir, type, pattern,
+                                   (const gchar**) locale_list, &error);
+
+  if (locale_list)
+    g_strfreev (locale_list);
+
+  if (error != NULL)
+    {
+      g_propagate_error (err, error);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
 gboolean
 gconf_engine_unset (GConfEngine* conf, const gchar* key, GError** err)
 {
@@ -2698,11 +2860,47 @@ gconf_is_initialized (void)
 
 static const gchar invalid_chars[] = " \t\r\n\"$&<>,+=#!()'|{}[]?~`;%\\";
 
+/* Character classes for gconf_valid_key(); anything not listed is
+ * allowed, including the period, which is only special right after a
+ * slash.
+ */
+enum {
+  KEY_CHAR_OK = 0,
+  KEY_CHAR_SLASH,
+  KEY_CHAR_END,
+  KEY_CHAR_INVALID,
+  KEY_CHAR_NON_ASCII
+};
+
+static guint8 key_char_class[256];
+
+static void
+init_key_char_class (void)
+{
+  static gsize initted = 0;
+
+  if (g_once_init_enter (&initted))
+    {
+      const gchar *inv;
+      int c;
+
+      for (c = 128; c < 256; ++c)
+        key_char_class[c] = KEY_CHAR_NON_ASCII;
+
+      for (inv = invalid_chars; *inv; ++inv)
+        key_char_class[(guchar) *inv] = KEY_CHAR_INVALID;
+
+      key_char_class['/'] = KEY_CHAR_SLASH;
+      key_char_class['\0'] = KEY_CHAR_END;
+
+      g_once_init_leave (&initted, 1);
+    }
+}
+
 gboolean     
 gconf_valid_key      (const gchar* key, gchar** why_invalid)
 {
   const gchar* s = key;
-  gboolean just_saw_slash = FALSE;
 
   /* Key must start with the root */
   if (*key != '/')
@@ -2713,74 +2911,60 @@ gconf_valid_key      (const gchar* key, gchar** why_invalid)
     }
   
   /* Root key is a valid dir */
-  if (*key == '/' && key[1] == '\0')
+  if (key[1] == '\0')
     return TRUE;
 
-  while (*s)
+  init_key_char_class ();
+
+  /* Each time round, s points at a slash */
+  while (TRUE)
     {
-      if (just_saw_slash)
+      ++s;
+
+      /* Can't have two slashes in a row, since it would mean
+       * an empty spot.
+       * Can't have a period right after a slash,
+       * because it would be a pain for filesystem-based backends.
+       * Can't end with slash.
+       */
+      if (*s == '/' || *s == '.' || *s == '\0')
         {
-          /* Can't have two slashes in a row, since it would mean
-           * an empty spot.
-           * Can't have a period right after a slash,
-           * because it would be a pain for filesystem-based backends.
-           */
-          if (*s == '/' || *s == '.')
+          if (why_invalid != NULL)
             {
-              if (why_invalid != NULL)
-                {
-                  if (*s == '/')
-                    *why_invalid = g_strdup(_("Can't have two slashes '/' in a row"));
-                  else
-                    *why_invalid = g_strdup(_("Can't have a period '.' right after a slash '/'"));
-                }
-              return FALSE;
+              if (*s == '/')
+                *why_invalid = g_strdup(_("Can't have two slashes '/' in a row"));
+              else if (*s == '.')
+                *why_invalid = g_strdup(_("Can't have a period '.' right after a slash '/'"));
+              else
+                *why_invalid = g_strdup(_("Key/directory may not end with a slash '/'"));
             }
+          return FALSE;
         }
 
-      if (*s == '/')
-        {
-          just_saw_slash = TRUE;
-        }
-      else
+      /* Skip the ordinary characters of this component in one go */
+      while (key_char_class[(guchar) *s] == KEY_CHAR_OK)
+        ++s;
+
+      switch (key_char_class[(guchar) *s])
         {
-          const gchar* inv = invalid_chars;
-          guchar c = (unsigned char) *s;
+        case KEY_CHAR_SLASH:
+          break;
 
-          just_saw_slash = FALSE;
-          
-          if (c > 127)
-            {
-              if (why_invalid != NULL)
-                *why_invalid = g_strdup_printf (_("'\\%o' is not an ASCII character and thus isn't allowed in key names"),
-                                                (guint) c);
-              return FALSE;
-            }
-          
-          while (*inv)
-            {
-              if (*inv == *s)
-                {
-                  if (why_invalid != NULL)
-                    *why_invalid = g_strdup_printf(_("`%c' is an invalid character in key/directory names"), *s);
-                  return FALSE;
-                }
-              ++inv;
-            }
-        }
+        case KEY_CHAR_END:
+          return TRUE;
 
-      ++s;
-    }
+        case KEY_CHAR_NON_ASCII:
+          if (why_invalid != NULL)
+            *why_invalid = g_strdup_printf (_("'\\%o' is not an ASCII character and thus isn't allowed in key names"),
+                                            (guint) (guchar) *s);
+          return FALSE;
 
-  /* Can't end with slash */
-  if (just_saw_slash)
-    {
-      if (why_invalid != NULL)
-        *why_invalid = g_strdup(_("Key/directory may not end with a slash '/'"));
-      return FALSE;
+        default:
+          if (why_invalid != NULL)
+            *why_invalid = g_strdup_printf(_("`%c' is an invalid character in key/directory names"), *s);
+          return FALSE;
+        }
     }
-  else
-    return TRUE;
 }
 
 /**
@@ -31,6 +31,14 @@ static DBusConnection *bus_conn;
 static const char *server_path = "/org/gnome/GConf/Server";
 static gint nr_of_connections = 0;
 
+/* Private server that clients can connect to directly instead of
+ * going through the bus daemon.
+ */
+static DBusServer *peer_server = NULL;
+static GHashTable *peers_by_name = NULL;
+static dbus_int32_t peer_name_slot = -1;
+static guint peer_serial = 0;
+
 static void              server_unregistered_func (DBusConnection *connection,
 						   void           *user_data);
 static DBusHandlerResult server_message_func      (DBusConnection  *connection,
@@ -45,6 +53,10 @@ static void              server_handle_shutdown   (DBusConnection  *connection,
                                                    DBusMessage     *message);
 static void          server_handle_get_default_db (DBusConnection  *connection,
                                                    DBusMessage     *message);
+static void       server_handle_get_peer_address (DBusConnection  *connection,
+                                                   DBusMessage     *message);
+static void       server_handle_get_snapshot_instance (DBusConnection  *connection,
+                                                        DBusMessage     *message);
 
 
 static DBusObjectPathVTable
@@ -54,6 +66,16 @@ server_vtable = {
   NULL,
 };
 
+/* Peer connections come and go; losing one must not look like losing
+ * the bus, so no unregister function here.
+ */
+static DBusObjectPathVTable
+peer_server_vtable = {
+  NULL,
+  server_message_func,
+  NULL,
+};
+
 static void
 server_unregistered_func (DBusConnection *connection, void *user_data)
 {
@@ -95,6 +117,14 @@ server_message_func (DBusConnection *connection,
 					GCONF_DBUS_SERVER_INTERFACE,
 					GCONF_DBUS_SERVER_SHUTDOWN)) 
     server_handle_shutdown (connection, message);
+  else if (dbus_message_is_method_call (message,
+					GCONF_DBUS_SERVER_INTERFACE,
+					GCONF_DBUS_SERVER_GET_PEER_ADDRESS))
+    server_handle_get_peer_address (connection, message);
+  else if (dbus_message_is_method_call (message,
+					GCONF_DBUS_SERVER_INTERFACE,
+					GCONF_DBUS_SERVER_GET_SNAPSHOT_INSTANCE))
+    server_handle_get_snapshot_instance (connection, message);
   else 
     return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
   
@@ -194,6 +224,161 @@ server_handle_shutdown (DBusConnection *connection, DBusMessage *message)
   gconfd_main_quit();
 }
 
+static void
+server_handle_get_peer_address (DBusConnection *connection,
+				DBusMessage    *message)
+{
+  DBusMessage *reply;
+  char        *address;
+
+  if (gconfd_dbus_check_in_shutdown (connection, message))
+    return;
+
+  if (peer_server == NULL || !dbus_server_get_is_connected (peer_server))
+    {
+      reply = dbus_message_new_error (message, GCONF_DBUS_ERROR_FAILED,
+				      _("No private server available"));
+      dbus_connection_send (connection, reply, NULL);
+      dbus_message_unref (reply);
+      return;
+    }
+
+  address = dbus_server_get_address (peer_server);
+
+  reply = dbus_message_new_method_return (message);
+  dbus_message_append_args (reply,
+			    DBUS_TYPE_STRING, &address,
+			    DBUS_TYPE_INVALID);
+  dbus_connection_send (connection, reply, NULL);
+  dbus_message_unref (reply);
+
+  dbus_free (address);
+}
+
+static void
+server_handle_get_snapshot_instance (DBusConnection *connection,
+				     DBusMessage    *message)
+{
+  DBusMessage *reply;
+  const char  *instance;
+
+  if (gconfd_dbus_check_in_shutdown (connection, message))
+    return;
+
+  instance = gconfd_get_snapshot_instance ();
+
+  reply = dbus_message_new_method_return (message);
+  dbus_message_append_args (reply,
+			    DBUS_TYPE_STRING, &instance,
+			    DBUS_TYPE_INVALID);
+  dbus_connection_send (connection, reply, NULL);
+  dbus_message_unref (reply);
+}
+
+static DBusHandlerResult
+peer_filter_func (DBusConnection *connection,
+		  DBusMessage    *message,
+		  void           *user_data)
+{
+  if (dbus_message_is_signal (message,
+			      DBUS_INTERFACE_LOCAL,
+			      "Disconnected"))
+    {
+      const char *name;
+
+      name = dbus_connection_get_data (connection, peer_name_slot);
+
+      gconf_log (GCL_DEBUG, "Peer %s disconnected", name);
+
+      /* Drop the notifications it had, like a NameOwnerChanged on the bus */
+      gconf_database_dbus_forget_client (name);
+
+      g_hash_table_remove (peers_by_name, name);
+      dbus_connection_unref (connection);
+    }
+
+  return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+}
+
+static void
+peer_new_connection_func (DBusServer     *server,
+			  DBusConnection *connection,
+			  void           *user_data)
+{
+  char *name;
+
+  if (gconfd_in_shutdown ())
+    return; /* not referencing it closes it again */
+
+  name = g_strdup_printf (":gconfd-peer.%u", ++peer_serial);
+
+  gconf_log (GCL_DEBUG, "New peer connection %s", name);
+
+  dbus_connection_ref (connection);
+  dbus_connection_set_data (connection, peer_name_slot, name, g_free);
+  dbus_connection_set_exit_on_disconnect (connection, FALSE);
+
+  dbus_connection_add_filter (connection, peer_filter_func, NULL, NULL);
+  dbus_connection_register_object_path (connection,
+					server_path,
+					&peer_server_vtable,
+					NULL);
+  gconf_database_dbus_register_peer (connection);
+
+  g_hash_table_insert (peers_by_name, name, connection);
+
+  dbus_connection_setup_with_g_main (connection, NULL);
+}
+
+static void
+peer_server_init (void)
+{
+  static const char *mechanisms[] = { "EXTERNAL", NULL };
+  DBusError  error;
+  char      *dir;
+  char      *address;
+
+  if (g_getenv ("GCONF_DISABLE_PEER_CONNECTIONS") != NULL)
+    return;
+
+  if (!dbus_connection_allocate_data_slot (&peer_name_slot))
+    return;
+
+  dir = gconf_get_daemon_dir ();
+
+  /* ignore failure, we'll catch it when listening */
+  g_mkdir_with_parents (dir, 0700);
+
+  address = g_strconcat ("unix:tmpdir=", dir, NULL);
+
+  dbus_error_init (&error);
+  peer_server = dbus_server_listen (address, &error);
+
+  if (peer_server == NULL)
+    {
+      gconf_log (GCL_WARNING,
+		 _("Failed to listen for direct connections in %s: %s"),
+		 dir, error.message);
+      dbus_error_free (&error);
+    }
+  else
+    {
+      /* Only the credentials check; the default unix user function
+       * already restricts this to our own user.
+       */
+      dbus_server_set_auth_mechanisms (peer_server, mechanisms);
+      dbus_server_set_new_connection_function (peer_server,
+					       peer_new_connection_func,
+					       NULL, NULL);
+      dbus_server_setup_with_g_main (peer_server, NULL);
+
+      peers_by_name = g_hash_table_new (g_str_hash, g_str_equal);
+    }
+
+  g_free (address);
+  g_free (dir);
+}
+
 gboolean
 gconfd_dbus_init (void)
 {
@@ -251,10 +436,24 @@ gconfd_dbus_init (void)
   
   nr_of_connections = 1;
   dbus_connection_setup_with_g_main (bus_conn, NULL);
+
+  peer_server_init ();
   
   return TRUE;
 }
 
+void
+gconfd_dbus_shutdown (void)
+{
+  if (peer_server == NULL)
+    return;
+
+  /* Removes the socket, if it isn't an abstract one */
+  dbus_server_disconnect (peer_server);
+  dbus_server_unref (peer_server);
+  peer_server = NULL;
+}
+
 guint
 gconfd_dbus_client_count (void)
 {
@@ -390,6 +589,46 @@ gconfd_dbus_get_connection (void)
   return bus_conn;
 }
 
+const char *
+gconfd_dbus_get_sender (DBusConnection *connection,
+			DBusMessage    *message)
+{
+  const char *sender;
+
+  sender = dbus_message_get_sender (message);
+
+  if (sender == NULL && peer_name_slot != -1)
+    sender = dbus_connection_get_data (connection, peer_name_slot);
+
+  return sender;
+}
+
+DBusConnection *
+gconfd_dbus_get_connection_for_client (const char *client)
+{
+  DBusConnection *connection = NULL;
+
+  if (peers_by_name != NULL)
+    connection = g_hash_table_lookup (peers_by_name, client);
+
+  return connection ? connection : bus_conn;
+}
+
+gboolean
+gconfd_dbus_client_is_peer (const char *client)
+{
+  return peers_by_name != NULL &&
+    g_hash_table_lookup (peers_by_name, client) != NULL;
+}
+
+static void
+send_to_peer_foreach (gpointer key,
+		      gpointer value,
+		      gpointer user_data)
+{
+  dbus_connection_send (value, user_data, NULL);
+}
+
 void
 gconfd_emit_db_gone (const char *object_path)
 {
@@ -404,5 +643,9 @@ gconfd_emit_db_gone (const char *object_path)
 			    DBUS_TYPE_INVALID);
 
   dbus_connection_send (bus_conn, signal, NULL);
+
+  if (peers_by_name != NULL)
+    g_hash_table_foreach (peers_by_name, send_to_peer_foreach, signal);
+
   dbus_message_unref (signal);
 }
@@ -41,4 +41,14 @@ DBusConnection *gconfd_dbus_get_connection    (void);
 
 void gconfd_emit_db_gone (const char *object_path);
 
+/* Clients connected directly to our private server have no bus name;
+ * these map them to a name of their own and back to the connection.
+ */
+const char     *gconfd_dbus_get_sender                 (DBusConnection *connection,
+							DBusMessage    *message);
+DBusConnection *gconfd_dbus_get_connection_for_client  (const char     *client);
+gboolean        gconfd_dbus_client_is_peer             (const char     *client);
+
+void            gconfd_dbus_shutdown                   (void);
+
 #endif
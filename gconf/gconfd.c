@@ -136,6 +136,7 @@ static gboolean gconf_main_is_running (void);
 #ifdef HAVE_CORBA
 static void logfile_save (void);
 static void logfile_read (void);
+static gboolean logfile_compaction_needed (void);
 static void log_client_add (const ConfigListener client);
 static void log_client_remove (const ConfigListener client);
 
@@ -152,6 +153,7 @@ static void    enter_shutdown          (void);
 static void                 init_databases (void);
 static void                 shutdown_databases (void);
 #ifdef HAVE_DBUS
+static void                 save_warm_databases (void);
 static void                 reload_databases (void);
 #endif
 static void                 set_default_database (GConfDatabase* db);
@@ -159,6 +161,7 @@ static void                 register_database (GConfDatabase* db);
 static void                 unregister_database (GConfDatabase* db);
 static GConfDatabase*       lookup_database (GSList *addresses);
 static void                 drop_old_databases (void);
+static void                 evict_database_caches (void);
 static gboolean             no_databases_in_use (void);
 
 /*
@@ -1013,9 +1016,22 @@ main(int argc, char** argv)
   else
     logfile_save ();
 #endif
+
+#ifdef HAVE_DBUS
+  /* Likewise, leave our resolved values for a daemon activated later
+   * in the same session.
+   */
+  if (!clean_shutdown_requested)
+    save_warm_databases ();
+#endif
   
   shutdown_databases ();
 
+#ifdef HAVE_DBUS
+  /* After the databases, so peers still see the Bye */
+  gconfd_dbus_shutdown ();
+#endif
+
   gconfd_locale_cache_drop ();
 
 #ifdef HAVE_CORBA
@@ -1075,6 +1091,7 @@ periodic_cleanup_timeout(gpointer data)
   drop_old_clients ();
 #endif
   drop_old_databases ();
+  evict_database_caches ();
 
 #ifdef HAVE_DBUS
   if (no_databases_in_use () && gconfd_dbus_client_count () == 0)
@@ -1096,6 +1113,16 @@ periodic_cleanup_timeout(gpointer data)
       gconf_log (GCL_DEBUG, "No log file saving needed in periodic cleanup handler");
       return TRUE;
     }
+
+  /* Changes are appended to the running state file as they happen,
+   * so only compact it once the appended records start to outweigh
+   * the live state.
+   */
+  if (!logfile_compaction_needed ())
+    {
+      gconf_log (GCL_DEBUG, "Saved state file doesn't need compacting yet");
+      return TRUE;
+    }
   
   /* Compress the running state file */
   logfile_save ();
@@ -1168,6 +1195,20 @@ static GList* db_list = NULL;
 static GHashTable* dbs_by_addresses = NULL;
 static GConfDatabase *default_db = NULL;
 
+#ifdef HAVE_DBUS
+/* Names this daemon's read snapshots; clients ask for it over D-Bus */
+const gchar*
+gconfd_get_snapshot_instance (void)
+{
+  static gchar *instance = NULL;
+
+  if (instance == NULL)
+    instance = gconf_snapshot_new_instance ();
+
+  return instance;
+}
+#endif
+
 static void
 init_databases (void)
 {
@@ -1200,6 +1241,18 @@ register_database (GConfDatabase *db)
 			      db);
   
   db_list = g_list_prepend (db_list, db);
+
+#ifdef HAVE_DBUS
+  {
+    gchar *name;
+
+    name = gconf_snapshot_name (db == default_db ? NULL :
+                                gconf_database_get_persistent_name (db));
+    gconf_database_publish_snapshot (db, gconfd_get_snapshot_instance (),
+                                     name);
+    g_free (name);
+  }
+#endif
 }
 
 static void
@@ -1315,6 +1368,9 @@ drop_old_databases(void)
     {
       GConfDatabase* db = tmp_list->data;
 
+#ifdef HAVE_DBUS
+      gconf_database_save_warm_snapshot (db);
+#endif
       unregister_database (db);
             
       tmp_list = g_list_next (tmp_list);
@@ -1323,6 +1379,98 @@ drop_old_databases(void)
   g_list_free (dead);
 }
 
+#ifdef HAVE_DBUS
+static void
+save_warm_databases (void)
+{
+  GList *tmp_list;
+
+  for (tmp_list = db_list; tmp_list != NULL; tmp_list = tmp_list->next)
+    gconf_database_save_warm_snapshot (tmp_list->data);
+}
+#endif
+
+/* Backend caches of databases nobody has used for this long are
+ * dropped, and read back in on the next access.
+ */
+#define CACHE_IDLE_SECONDS (60*5)
+
+/* Above this many bytes of backend caches in total, drop them least
+ * recently used first, sparing only databases in use right now.
+ */
+#define CACHE_BUDGET (8*1024*1024)
+#define CACHE_BUSY_SECONDS 30
+
+typedef struct {
+  GConfDatabase *db;
+  gsize size;
+} CacheUsage;
+
+static int
+compare_cache_usage (gconstpointer a,
+                     gconstpointer b)
+{
+  const CacheUsage *ua = a;
+  const CacheUsage *ub = b;
+
+  if (ua->db->last_access < ub->db->last_access)
+    return -1;
+  else if (ua->db->last_access > ub->db->last_access)
+    return 1;
+  else
+    return 0;
+}
+
+static void
+evict_database_caches (void)
+{
+  GArray *usage;
+  GList *tmp_list;
+  gsize total = 0;
+  GTime now;
+  guint i;
+
+  now = time (NULL);
+
+  usage = g_array_new (FALSE, FALSE, sizeof (CacheUsage));
+
+  for (tmp_list = db_list; tmp_list != NULL; tmp_list = tmp_list->next)
+    {
+      CacheUsage u;
+
+      u.db = tmp_list->data;
+      u.size = gconf_database_get_cache_size (u.db);
+
+      if (u.size == 0)
+        continue;
+
+      total += u.size;
+      g_array_append_val (usage, u);
+    }
+
+  g_array_sort (usage, compare_cache_usage);
+
+  for (i = 0; i < usage->len; i++)
+    {
+      CacheUsage *u = &g_array_index (usage, CacheUsage, i);
+      GTime idle = now - u->db->last_access;
+
+      if (idle < CACHE_IDLE_SECONDS &&
+          (total <= CACHE_BUDGET || idle < CACHE_BUSY_SECONDS))
+        continue;
+
+      if (gconf_database_evict_cache (u->db))
+        {
+          gconf_log (GCL_DEBUG,
+                     "Dropped %lu bytes of cached data for database idle %d seconds",
+                     (gulong) u->size, (int) idle);
+          total -= u->size;
+        }
+    }
+
+  g_array_free (usage, TRUE);
+}
+
 static void
 shutdown_databases (void)
 {
@@ -1731,6 +1879,57 @@ static void close_append_handle (void);
 static FILE* append_handle = NULL;
 static guint append_handle_timeout = 0;
 
+/* The saved state file is a log: the state written by the last
+ * logfile_save(), followed by ADD/REMOVE records appended as
+ * clients and listeners come and go.  Track how much of it is
+ * appended records so the periodic cleanup only rewrites the whole
+ * file when replaying the log would cost noticeably more than
+ * reading the live state.
+ */
+#define LOG_COMPACT_MIN_RECORDS 256
+
+static guint log_compacted_records = 0;
+static guint log_appended_records = 0;
+static gboolean log_append_failed = FALSE;
+
+/* While restoring from the saved state file we append two records
+ * per listener; don't flush each of them separately.
+ */
+static gboolean log_batching = FALSE;
+
+static gboolean
+logfile_compaction_needed (void)
+{
+  if (log_append_failed)
+    return TRUE;
+
+  return log_appended_records > MAX (LOG_COMPACT_MIN_RECORDS,
+                                     log_compacted_records);
+}
+
+static gboolean
+logfile_flush (void)
+{
+  if (log_batching)
+    return TRUE;
+
+  return fflush (append_handle) >= 0;
+}
+
+static guint
+count_records (const gchar *str)
+{
+  guint n = 0;
+
+  while ((str = strchr (str, '\n')) != NULL)
+    {
+      ++n;
+      ++str;
+    }
+
+  return n;
+}
+
 static gboolean
 close_append_handle_timeout(gpointer data)
 {
@@ -1933,6 +2132,13 @@ logfile_save (void)
   /* Get rid of original saved state file if everything succeeded */
   if (tmpfile2)
     g_unlink (tmpfile2);
+
+  log_compacted_records = count_records (saveme->str);
+  log_appended_records = 0;
+  log_append_failed = FALSE;
+
+  gconf_log (GCL_DEBUG, "Compacted saved state file to %u records",
+             log_compacted_records);
   
  out:
   if (saveme)
@@ -2391,36 +2597,56 @@ restore_listener (GConfDatabase* db,
   CORBA_exception_free (&ev);
 }
 
-static void
-listener_logentry_restore_and_destroy_foreach (gpointer key,
-                                               gpointer value,
-                                               gpointer data)
+/* Databases already resolved while restoring listeners, keyed by
+ * the address in the saved state file.  Failed lookups are cached
+ * as NULL so we only warn (and only hit the sources) once per
+ * address, however many listeners it had.
+ */
+static GConfDatabase*
+restore_lookup_database (GHashTable  *resolved,
+                         const gchar *address)
 {
-  ListenerLogEntry *lle = key;
   GConfDatabase *db = NULL;
+  gpointer cached;
   
-  if (strcmp (lle->address, "def") == 0)
-    db = default_db;
-  else
-    {
-      GSList *addresses;
+  if (strcmp (address, "def") == 0)
+    return default_db;
 
-      addresses = gconf_persistent_name_get_address_list (lle->address);
+  if (g_hash_table_lookup_extended (resolved, address, NULL, &cached))
+    return cached;
 
-      db = gconfd_obtain_database (addresses, NULL);
+  {
+    GSList *addresses;
+
+    addresses = gconf_persistent_name_get_address_list (address);
+
+    db = gconfd_obtain_database (addresses, NULL);
+
+    gconf_address_list_free (addresses);
+  }
 
-      gconf_address_list_free (addresses);
-    }
-  
   if (db == NULL)
-    {
-      gconf_log (GCL_WARNING,
-                 _("Unable to restore a listener on address '%s', couldn't resolve the database"),
-                 lle->address);
-      return;
-    }
+    gconf_log (GCL_WARNING,
+               _("Unable to restore a listener on address '%s', couldn't resolve the database"),
+               address);
+
+  g_hash_table_insert (resolved, (gchar *) address, db);
 
-  restore_listener (db, lle);
+  return db;
+}
+
+static void
+listener_logentry_restore_and_destroy_foreach (gpointer key,
+                                               gpointer value,
+                                               gpointer data)
+{
+  ListenerLogEntry *lle = key;
+  GConfDatabase *db;
+
+  db = restore_lookup_database (data, lle->address);
+
+  if (db != NULL)
+    restore_listener (db, lle);
 
   /* We don't need it anymore */
   g_free (lle);
@@ -2435,51 +2661,6 @@ restore_client_foreach (gpointer key,
 }
 
 
-static gchar*
-read_line (FILE *f)
-{
-#define BUF_SIZE 2048
-
-  char  buf[BUF_SIZE] = { '\0' };
-  char *retval = NULL;
-  int   len = 0;
-
-  do
-    {
-      if (fgets (buf, BUF_SIZE, f) == NULL)
-        {
-          if (ferror (f))
-            {
-              gconf_log (GCL_ERR,
-                         _("Error reading saved state file: %s"),
-                         g_strerror (errno));
-            }
-          break;
-        }
-
-      len = strlen (buf);
-      if (len > 0 && buf[len - 1] == '\n')
-	buf[--len] = '\0';
-
-      if (retval == NULL)
-	{
-	  retval = g_strndup (buf, len);
-	}
-      else
-	{
-	  char *freeme = retval;
-
-	  retval = g_strconcat (retval, buf, NULL);
-	  g_free (freeme);
-	}
-    }
-  while (len == BUF_SIZE - 1);
-
-  return retval;
-
-#undef BUF_SIZE
-}
-
 static void
 logfile_read (void)
 {
@@ -2487,49 +2668,58 @@ logfile_read (void)
   gchar *logdir;
   GHashTable *entries;
   GHashTable *clients;
-  FILE *f;
+  GHashTable *resolved;
+  gchar *contents = NULL;
+  gsize length;
   gchar *line;
-  GSList *lines = NULL;
+  gchar *end;
+  guint n_records = 0;
+  GError *err = NULL;
   
   /* Just for good form */
   close_append_handle ();
   
   get_log_names (&logdir, &logfile);
 
-  f = g_fopen (logfile, "r");
-  
-  if (f == NULL)
+  /* Slurp the whole log and parse it in place; the entries keep
+   * pointers into the buffer, so it stays around until we're done.
+   */
+  if (!g_file_get_contents (logfile, &contents, &length, &err))
     {
-      if (errno != ENOENT)
+      if (!g_error_matches (err, G_FILE_ERROR, G_FILE_ERROR_NOENT))
           gconf_log (GCL_ERR, _("Unable to open saved state file '%s': %s"),
-                     logfile, g_strerror (errno));
+                     logfile, err->message);
 
+      g_error_free (err);
       goto finished;
     }
 
   entries = g_hash_table_new (listener_logentry_hash, listener_logentry_equal);
   clients = g_hash_table_new (g_str_hash, g_str_equal);
 
-  line = read_line (f);
-  while (line)
+  line = contents;
+  while (line < contents + length)
     {
-      if (!parse_listener_entry (entries, line))
-        {
-          if (!parse_client_entry (clients, line))
-            {
-              gconf_log (GCL_DEBUG,
-                         "Didn't understand line in saved state file: '%s'", 
-                         line);
-              g_free (line);
-              line = NULL;
-            }
-        }
+      end = memchr (line, '\n', contents + length - line);
+      if (end != NULL)
+        *end = '\0';
+      else
+        end = contents + length;
 
-      if (line)
-        lines = g_slist_prepend (lines, line);
-      
-      line = read_line (f);
+      ++n_records;
+
+      if (*line != '\0' &&
+          !parse_listener_entry (entries, line) &&
+          !parse_client_entry (clients, line))
+        gconf_log (GCL_DEBUG,
+                   "Didn't understand line in saved state file: '%s'", 
+                   line);
+
+      line = end + 1;
     }
+
+  log_compacted_records = n_records;
+  log_appended_records = 0;
   
   /* Restore clients first */
   g_hash_table_foreach (clients,
@@ -2538,26 +2728,39 @@ logfile_read (void)
   
   /* Entries that still remain in the listener hash table were added
    * but not removed, so add them in this daemon instantiation and
-   * update their listeners with the new connection ID etc.
+   * update their listeners with the new connection ID etc.  Each
+   * database is resolved once, and the records this appends are
+   * flushed together at the end.
    */
+  resolved = g_hash_table_new (g_str_hash, g_str_equal);
+  log_batching = TRUE;
+  
   g_hash_table_foreach (entries, 
                         listener_logentry_restore_and_destroy_foreach,
-                        NULL);
+                        resolved);
+
+  log_batching = FALSE;
+  g_hash_table_destroy (resolved);
+
+  if (append_handle != NULL && fflush (append_handle) < 0)
+    {
+      gconf_log (GCL_WARNING,
+                 _("Failed to flush restored listeners to saved state file: %s"),
+                 g_strerror (errno));
+      log_append_failed = TRUE;
+    }
 
   g_hash_table_destroy (entries);
   g_hash_table_destroy (clients);
 
-  /* Note that we need the strings to remain valid until we are totally
-   * finished, because we store pointers to them in the log entry
-   * hash.
+  /* Restoring rewrote every listener's record; if that made the log
+   * mostly garbage, compact it now rather than replaying it again.
    */
-  g_slist_foreach (lines, (GFunc)g_free, NULL);
-  g_slist_free (lines);
+  if (logfile_compaction_needed ())
+    logfile_save ();
   
  finished:
-  if (f != NULL)
-    fclose (f);
-  
+  g_free (contents);
   g_free (logfile);
   g_free (logdir);
 }
@@ -2606,9 +2809,11 @@ gconfd_logfile_change_listener (GConfDatabase *db,
                quoted_db_name, quoted_where, quoted_ior) < 0)
     goto error;
 
-  if (fflush (append_handle) < 0)
+  if (!logfile_flush ())
     goto error;
 
+  ++log_appended_records;
+
   g_free (quoted_db_name);
   g_free (quoted_ior);
   g_free (quoted_where);
@@ -2617,6 +2822,11 @@ gconfd_logfile_change_listener (GConfDatabase *db,
 
  error:
 
+  /* The log may now be missing this change; rewrite it from the
+   * live state at the next cleanup.
+   */
+  log_append_failed = TRUE;
+
   if (add)
     gconf_set_error (err,
                      GCONF_ERROR_FAILED,
@@ -2667,6 +2877,7 @@ log_client_change (const ConfigListener client,
                  err->message);
 
       g_error_free (err);
+      log_append_failed = TRUE;
       
       goto error;
     }
@@ -2678,17 +2889,21 @@ log_client_change (const ConfigListener client,
       gconf_log (GCL_WARNING,
                  _("Failed to write client add to saved state file: %s"),
                  g_strerror (errno));
+      log_append_failed = TRUE;
       goto error;
     }
 
-  if (fflush (append_handle) < 0)
+  if (!logfile_flush ())
     {
       gconf_log (GCL_WARNING,
                  _("Failed to flush client add to saved state file: %s"),
                  g_strerror (errno));
+      log_append_failed = TRUE;
       goto error;
     }
 
+  ++log_appended_records;
+
  error:
   g_free (ior);
   g_free (quoted_ior);
@@ -63,6 +63,10 @@ gboolean gconfd_in_shutdown      (void);
 GConfDatabase* gconfd_obtain_database (GSList  *addresses,
                                        GError **err);
 
+#ifdef HAVE_DBUS
+const gchar*   gconfd_get_snapshot_instance (void);
+#endif
+
 G_END_DECLS
 
 #endif
@@ -21,10 +21,12 @@
 #include "gconf.h"
 #include "gconf-internals.h"
 #include <stdio.h>
+#include <stdarg.h>
 #include <unistd.h>
 #include <string.h>
 #include <libxml/tree.h>
 #include <libxml/parser.h>
+#include <libxml/xmlreader.h>
 #include <libxml/globals.h>
 #include <stdlib.h>
 #include <errno.h>
@@ -78,6 +80,7 @@ static int schema_name_mode = FALSE;
 static int associate_schema_mode = FALSE;
 static int dissociate_schema_mode = FALSE;
 static int ignore_schema_defaults = FALSE;
+static int max_dir_requests = 16;
 static int default_source_mode = FALSE;
 static int recursive_unset_mode = FALSE;
 static int do_version = FALSE;
@@ -211,6 +214,15 @@ static const GOptionEntry client_entries[] = {
     N_("Ignore schema defaults when reading values."),
     NULL
   },
+  {
+    "max-requests",
+    '\0',
+    0,
+    G_OPTION_ARG_INT,
+    &max_dir_requests,
+    N_("Number of directories --dump and --recursive-list request from the server at once (default 16)."),
+    N_("N")
+  },
   {
     NULL
   }
@@ -532,6 +544,7 @@ static int do_break_key(GConfEngine* conf, const gchar** args);
 static int do_break_directory(GConfEngine* conf, const gchar** args);
 static int do_makefile_install(GConfEngine* conf, const gchar** args, gboolean unload);
 static int do_recursive_list(GConfEngine* conf, const gchar** args);
+static gboolean key_query_only (void);
 static int do_search_key(GConfEngine* conf, const gchar** args);
 static int do_search_key_regex(GConfEngine* conf, const gchar** args);
 static int do_dump_values(GConfEngine* conf, const gchar** args);
@@ -540,7 +553,8 @@ static void list_pairs_in_dir(GConfEngine* conf, const gchar* dir, guint depth);
 static int get_schema_from_xml(xmlNodePtr node, gchar **schema_key, GHashTable** schemas_hash, GSList **applyto_list);
 static int get_first_value_from_xml(xmlNodePtr node, GConfValue** ret_value);
 static void print_value_in_xml(GConfValue* value, int indent);
-static void dump_entries_in_dir(GConfEngine* conf, const gchar* dir, const gchar *base_dir);
+static void dump_entries(const gchar* dir, GSList* entries, GError* err, const gchar *base_dir);
+static void print_pairs(const gchar* dir, GSList* pairs, GError* err, guint depth);
 static gboolean do_dir_exists(GConfEngine* conf, const gchar* dir);
 static void do_spawn_daemon(GConfEngine* conf);
 static int do_get(GConfEngine* conf, const gchar** args);
@@ -948,7 +962,9 @@ main (int argc, char** argv)
 
       addresses = gconf_persistent_name_get_address_list (config_source);
 
-      if (use_local_source)
+      if (use_local_source && key_query_only ())
+        conf = gconf_engine_get_local_readonly_for_addresses (addresses, &err);
+      else if (use_local_source)
         conf = gconf_engine_get_local_for_addresses (addresses, &err);
       else
         conf = gconf_engine_get_for_addresses (addresses, &err);
@@ -1273,33 +1289,94 @@ main (int argc, char** argv)
   return 0;
 }
 
-static void 
-recurse_subdir_list(GConfEngine* conf, GSList* subdirs, const gchar* parent, guint depth)
+/*
+ * Tree walks.  Listing a directory takes two round trips to the
+ * server, so rather than waiting for each directory in turn, keep
+ * the listings for the next few directories in flight.  Directories
+ * are still visited depth-first in the usual order.
+ */
+
+typedef void (* DirVisitFunc) (const gchar* dir, GSList* entries, GError* err, guint depth, gpointer data);
+
+typedef struct {
+  gchar* dir;
+  GConfDirListing* listing;
+} DirNode;
+
+static guint dir_requests_in_flight = 0;
+
+static void
+walk_request (GConfEngine* conf, DirNode* node)
 {
+  node->listing = gconf_engine_list_dir_async (conf, node->dir);
+  ++dir_requests_in_flight;
+}
+
+/* Takes ownership of dirs */
+static void
+walk_dirs (GConfEngine* conf, GSList* dirs, gboolean sort, guint depth, DirVisitFunc func, gpointer data)
+{
+  DirNode* nodes;
   GSList* tmp;
-  gchar* whitespace;
+  guint n, i, j;
 
-  whitespace = g_strnfill(depth, ' ');
+  n = g_slist_length (dirs);
+  nodes = g_new0 (DirNode, n);
 
-  tmp = subdirs;
-  
-  while (tmp != NULL)
+  for (tmp = dirs, i = 0; tmp != NULL; tmp = tmp->next, i++)
+    nodes[i].dir = tmp->data;
+  g_slist_free (dirs);
+
+  for (i = 0; i < n; i++)
     {
-      gchar* s = tmp->data;
-      
-      g_print ("%s%s:\n", whitespace, s);
-      
-      list_pairs_in_dir(conf, s, depth);
+      GSList* entries;
+      GSList* subdirs = NULL;
+      GError* err = NULL;
 
-      recurse_subdir_list(conf, gconf_engine_all_dirs(conf, s, NULL), s, depth+1);
+      /* Fill the window with the siblings that come next; their
+       * children are requested as soon as we know about them.
+       */
+      for (j = i; j < n && dir_requests_in_flight < (guint) MAX (max_dir_requests, 1); j++)
+        if (nodes[j].listing == NULL)
+          walk_request (conf, &nodes[j]);
 
-      g_free(s);
-      
-      tmp = g_slist_next(tmp);
+      if (nodes[i].listing == NULL)
+        walk_request (conf, &nodes[i]);
+
+      entries = gconf_engine_list_dir_finish (nodes[i].listing, &subdirs, &err);
+      --dir_requests_in_flight;
+
+      (* func) (nodes[i].dir, entries, err, depth, data);
+
+      if (sort)
+        subdirs = g_slist_sort (subdirs, (GCompareFunc) strcmp);
+
+      walk_dirs (conf, subdirs, sort, depth + 1, func, data);
+
+      g_free (nodes[i].dir);
     }
-  
-  g_slist_free(subdirs);
-  g_free(whitespace);
+
+  g_free (nodes);
+}
+
+static void
+walk_tree (GConfEngine* conf, const gchar* dir, gboolean sort, DirVisitFunc func, gpointer data)
+{
+  walk_dirs (conf, g_slist_prepend (NULL, g_strdup (dir)), sort, 0, func, data);
+}
+
+static void
+recursive_list_visit (const gchar* dir, GSList* entries, GError* err, guint depth, gpointer data)
+{
+  if (depth > 0)
+    {
+      gchar* whitespace = g_strnfill (depth, ' ');
+
+      g_print ("%s%s:\n", whitespace, dir);
+      g_free (whitespace);
+    }
+
+  print_pairs (dir, entries, err, depth);
 }
 
 static int
@@ -1313,13 +1390,7 @@ do_recursive_list(GConfEngine* conf, const gchar** args)
 
   while (*args)
     {
-      GSList* subdirs;
-
-      subdirs = gconf_engine_all_dirs(conf, *args, NULL);
-
-      list_pairs_in_dir(conf, *args, 0);
-          
-      recurse_subdir_list(conf, subdirs, *args, 1);
+      walk_tree (conf, *args, FALSE, recursive_list_visit, NULL);
  
       ++args;
     }
@@ -1327,6 +1398,26 @@ do_recursive_list(GConfEngine* conf, const gchar** args)
   return 0;
 }
 
+/* Whether this run only reads a few keys, so a --direct engine
+ * doesn't need to load whole sources or be able to write them.
+ */
+static gboolean
+key_query_only (void)
+{
+  if (!(get_mode || get_type_mode || get_list_size_mode ||
+        get_list_element_mode || dir_exists != NULL ||
+        short_docs_mode || long_docs_mode || schema_name_mode))
+    return FALSE;
+
+  return !(set_mode || unset_mode || toggle_mode || set_schema_mode ||
+           recursive_unset_mode || associate_schema_mode ||
+           dissociate_schema_mode || break_key_mode || break_dir_mode ||
+           all_entries_mode || all_subdirs_mode || recursive_list ||
+           search_key || search_key_regex || dump_values ||
+           schema_file || entry_file || unload_entry_file ||
+           makefile_install_mode || makefile_uninstall_mode);
+}
+
 static gboolean
 match_pattern (gpointer pattern, const char *key)
 {
@@ -1341,6 +1432,22 @@ match_regex (gpointer regex, const char *key)
     
 typedef gboolean (* MatchFunc) (gpointer match_data, const char *key);
 
+static void
+print_search_hit (const gchar* dir, GConfEntry* pair)
+{
+  gchar* s;
+
+  if (gconf_entry_get_value (pair) && 
+      (!ignore_schema_defaults || !gconf_entry_get_is_default (pair)))
+    s = gconf_value_to_string (gconf_entry_get_value (pair));
+  else
+    s = g_strdup(_("(no value set)"));
+
+  g_print (" %s/%s = %s\n", dir, gconf_key_key (gconf_entry_get_key (pair)), s);
+
+  g_free(s);
+}
+
 static void 
 search_key_in_dir(GConfEngine* conf, const gchar* dir, MatchFunc match_func, gpointer match_data)
 {
@@ -1365,21 +1472,9 @@ search_key_in_dir(GConfEngine* conf, const gchar* dir, MatchFunc match_func, gpo
       while (tmp != NULL)
         {
           GConfEntry* pair = tmp->data;
-          gchar* s;
-	  const gchar *k;
 
-          if (gconf_entry_get_value (pair) && 
-	      (!ignore_schema_defaults || !gconf_entry_get_is_default (pair)))
-            s = gconf_value_to_string (gconf_entry_get_value (pair));
-          else
-            s = g_strdup(_("(no value set)"));
-
-	  k = gconf_key_key (gconf_entry_get_key (pair));
-
-	  if (match_func(match_data, k))
-	    g_print (" %s/%s = %s\n", dir, k, s);
-
-          g_free(s);
+	  if (match_func(match_data, gconf_key_key (gconf_entry_get_key (pair))))
+	    print_search_hit (dir, pair);
                   
           gconf_entry_free(pair);
 
@@ -1414,6 +1509,44 @@ recurse_subdir_search(GConfEngine* conf, GSList* subdirs, const gchar* parent,
   g_slist_free(subdirs);
 }
 
+/* Searching inside gconfd saves listing every directory over the bus;
+ * fall back to walking the tree for servers that can't.
+ */
+static gboolean
+search_on_server (GConfEngine* conf, GConfSearchType type, const gchar* pattern)
+{
+  GSList* entries;
+  GSList* tmp;
+  GError* err = NULL;
+
+  if (!gconf_engine_search (conf, "/", type, pattern, &entries, &err))
+    {
+      if (err == NULL)
+        return FALSE;
+
+      g_printerr (_("Failure searching for `%s': %s\n"),
+                  pattern, err->message);
+      g_error_free (err);
+      return TRUE;
+    }
+
+  for (tmp = entries; tmp != NULL; tmp = tmp->next)
+    {
+      GConfEntry* pair = tmp->data;
+      gchar* dir;
+
+      dir = gconf_key_directory (gconf_entry_get_key (pair));
+      print_search_hit (dir, pair);
+      g_free (dir);
+
+      gconf_entry_free (pair);
+    }
+
+  g_slist_free (entries);
+
+  return TRUE;
+}
+
 static int
 do_search(GConfEngine* conf, MatchFunc match_func, gpointer match_data)
 {
@@ -1439,6 +1572,9 @@ do_search_key(GConfEngine* conf, const gchar** args)
       return 1;
     }
 
+  if (search_on_server (conf, GCONF_SEARCH_GLOB, *args))
+    return 0;
+
   pattern = g_pattern_spec_new (*args);
   do_search(conf, match_pattern, pattern);
   g_pattern_spec_free (pattern);
@@ -1466,37 +1602,43 @@ do_search_key_regex(GConfEngine* conf, const gchar** args)
       return 1;
     }
 
-  do_search(conf, match_regex, regex);
+  if (!search_on_server (conf, GCONF_SEARCH_REGEX, args[0]))
+    do_search(conf, match_regex, regex);
   g_regex_unref(regex);
 
   return 0;
 }
 
-static void 
-recurse_subdir_dump(GConfEngine* conf, GSList* dirs, const gchar* base_dir)
+/* g_print() flushes stdout after every call, which is one write per
+ * line of a dump; go through stdio's buffer instead when no charset
+ * conversion is needed, and flush once per directory.
+ */
+static void
+dump_print (const gchar *format, ...)
 {
-  GSList* tmp;
+  va_list args;
 
-  tmp = dirs;
-  
-  while (tmp != NULL)
+  va_start (args, format);
+
+  if (g_get_charset (NULL))
+    vfprintf (stdout, format, args);
+  else
     {
-      gchar* s = tmp->data;
-      GSList* subdirs;
-      
-      dump_entries_in_dir(conf, s, base_dir);
+      gchar *str = g_strdup_vprintf (format, args);
 
-      subdirs = g_slist_sort(gconf_engine_all_dirs(conf, s, NULL),
-			     (GCompareFunc)strcmp);
+      g_print ("%s", str);
+      g_free (str);
+    }
 
-      recurse_subdir_dump(conf, subdirs, base_dir);
+  va_end (args);
+}
 
-      g_free(s);
-      
-      tmp = tmp->next;
-    }
-  
-  g_slist_free(dirs);
+static void
+dump_visit (const gchar* dir, GSList* entries, GError* err, guint depth, gpointer data)
+{
+  const gchar* base_dir = data;
+
+  dump_entries (dir, entries, err, base_dir);
 }
 
 static int
@@ -1508,42 +1650,33 @@ do_dump_values(GConfEngine* conf, const gchar** args)
       return 1;
     }
 
-  g_print ("<gconfentryfile>\n");
+  dump_print ("<gconfentryfile>\n");
 
   while (*args)
     {
-      GSList* subdirs;
-
-      g_print ("  <entrylist base=\"%s\">\n", *args);
+      dump_print ("  <entrylist base=\"%s\">\n", *args);
 
-      subdirs = g_slist_sort(gconf_engine_all_dirs(conf, *args, NULL),
-			     (GCompareFunc)strcmp);
+      walk_tree (conf, *args, TRUE, dump_visit, (gpointer) *args);
 
-      dump_entries_in_dir(conf, *args, *args);
-
-      recurse_subdir_dump(conf, subdirs, *args);
-
-      g_print ("  </entrylist>\n");
+      dump_print ("  </entrylist>\n");
  
       ++args;
     }
 
-  g_print ("</gconfentryfile>\n");
+  dump_print ("</gconfentryfile>\n");
+  fflush (stdout);
   return 0;
 }
 
-static void 
-list_pairs_in_dir(GConfEngine* conf, const gchar* dir, guint depth)
+/* Takes ownership of pairs and err */
+static void
+print_pairs(const gchar* dir, GSList* pairs, GError* err, guint depth)
 {
-  GSList* pairs;
   GSList* tmp;
   gchar* whitespace;
-  GError* err = NULL;
   
   whitespace = g_strnfill(depth, ' ');
 
-  pairs = gconf_engine_all_entries(conf, dir, &err);
-          
   if (err != NULL)
     {
       g_printerr (_("Failure listing entries in `%s': %s\n"),
@@ -1584,6 +1717,17 @@ list_pairs_in_dir(GConfEngine* conf, const gchar* dir, guint depth)
   g_free(whitespace);
 }
 
+static void 
+list_pairs_in_dir(GConfEngine* conf, const gchar* dir, guint depth)
+{
+  GSList* pairs;
+  GError* err = NULL;
+
+  pairs = gconf_engine_all_entries(conf, dir, &err);
+
+  print_pairs (dir, pairs, err, depth);
+}
+
 static int
 do_all_pairs(GConfEngine* conf, const gchar** args)
 {      
@@ -1614,7 +1758,7 @@ print_schema_in_xml(GConfValue* value, int indent)
 
   whitespace = g_strnfill(indent, ' ');
 
-  schema = gconf_value_get_schema(value);
+  schema = gconf_value_peek_schema(value);
 
   type = gconf_schema_get_type(schema);
   list_type = gconf_schema_get_list_type(schema);
@@ -1626,47 +1770,47 @@ print_schema_in_xml(GConfValue* value, int indent)
   short_desc = gconf_schema_get_short_desc(schema);
   long_desc = gconf_schema_get_long_desc(schema);
 
-  g_print ("%s<schema>\n", whitespace);
+  dump_print ("%s<schema>\n", whitespace);
 
   if (owner)
-    g_print ("%s  <owner>%s</owner>\n", whitespace, owner);
+    dump_print ("%s  <owner>%s</owner>\n", whitespace, owner);
 
-  g_print ("%s  <type>%s</type>\n", whitespace, gconf_value_type_to_string(type));
+  dump_print ("%s  <type>%s</type>\n", whitespace, gconf_value_type_to_string(type));
 
   if (type == GCONF_VALUE_LIST)
-    g_print ("%s  <list_type>%s</list_type>\n", whitespace, gconf_value_type_to_string(list_type));
+    dump_print ("%s  <list_type>%s</list_type>\n", whitespace, gconf_value_type_to_string(list_type));
   else if (type == GCONF_VALUE_PAIR)
     {
-      g_print ("%s  <car_type>%s</car_type>\n", whitespace, gconf_value_type_to_string(car_type));
-      g_print ("%s  <cdr_type>%s</cdr_type>\n", whitespace, gconf_value_type_to_string(cdr_type));
+      dump_print ("%s  <car_type>%s</car_type>\n", whitespace, gconf_value_type_to_string(car_type));
+      dump_print ("%s  <cdr_type>%s</cdr_type>\n", whitespace, gconf_value_type_to_string(cdr_type));
     }
 
-  g_print ("%s  <locale name=\"%s\">\n", whitespace, gconf_schema_get_locale (schema));
+  dump_print ("%s  <locale name=\"%s\">\n", whitespace, gconf_schema_get_locale (schema));
 
   if (default_value)
     {
-      g_print ("%s    <default_value>\n", whitespace);
+      dump_print ("%s    <default_value>\n", whitespace);
       print_value_in_xml(default_value, indent + 6);
-      g_print ("%s    </default_value>\n", whitespace);
+      dump_print ("%s    </default_value>\n", whitespace);
     }
 
   if (short_desc)
     {
       gchar* tmp = g_markup_escape_text(short_desc, -1);
-      g_print ("%s    <short>%s</short>\n", whitespace, tmp);
+      dump_print ("%s    <short>%s</short>\n", whitespace, tmp);
       g_free(tmp);
     }
 
   if (long_desc)
     {
       gchar* tmp = g_markup_escape_text(long_desc, -1);
-      g_print ("%s    <long>%s</long>\n", whitespace, tmp);
+      dump_print ("%s    <long>%s</long>\n", whitespace, tmp);
       g_free(tmp);
     }
 
-  g_print ("%s  </locale>\n", whitespace);
+  dump_print ("%s  </locale>\n", whitespace);
 
-  g_print ("%s</schema>\n", whitespace);
+  dump_print ("%s</schema>\n", whitespace);
 
   g_free(whitespace);
 }
@@ -1678,17 +1822,17 @@ print_pair_in_xml(GConfValue* value, int indent)
 
   whitespace = g_strnfill(indent, ' ');
 
-  g_print ("%s<pair>\n", whitespace);
+  dump_print ("%s<pair>\n", whitespace);
 
-  g_print ("%s  <car>\n", whitespace);
-  print_value_in_xml(gconf_value_get_car(value), indent + 4);
-  g_print ("%s  </car>\n", whitespace);
+  dump_print ("%s  <car>\n", whitespace);
+  print_value_in_xml(gconf_value_peek_car(value), indent + 4);
+  dump_print ("%s  </car>\n", whitespace);
 
-  g_print ("%s  <cdr>\n", whitespace);
-  print_value_in_xml(gconf_value_get_cdr(value), indent + 4);
-  g_print ("%s  </cdr>\n", whitespace);
+  dump_print ("%s  <cdr>\n", whitespace);
+  print_value_in_xml(gconf_value_peek_cdr(value), indent + 4);
+  dump_print ("%s  </cdr>\n", whitespace);
 
-  g_print ("%s</pair>\n", whitespace);
+  dump_print ("%s</pair>\n", whitespace);
 
   g_free(whitespace);
 }
@@ -1704,9 +1848,9 @@ print_list_in_xml(GConfValue* value, int indent)
 
   list_type = gconf_value_get_list_type(value);
 
-  g_print ("%s<list type=\"%s\">\n", whitespace, gconf_value_type_to_string(list_type));
+  dump_print ("%s<list type=\"%s\">\n", whitespace, gconf_value_type_to_string(list_type));
 
-  tmp = gconf_value_get_list(value);
+  tmp = gconf_value_peek_list(value);
   while (tmp)
     {
       print_value_in_xml(tmp->data, indent + 4);
@@ -1714,7 +1858,7 @@ print_list_in_xml(GConfValue* value, int indent)
       tmp = tmp->next;
     }
 
-  g_print ("%s</list>\n", whitespace);
+  dump_print ("%s</list>\n", whitespace);
 
   g_free(whitespace);
 }
@@ -1727,28 +1871,28 @@ print_value_in_xml(GConfValue* value, int indent)
 
   whitespace = g_strnfill(indent, ' ');
 
-  g_print ("%s<value>\n", whitespace);
+  dump_print ("%s<value>\n", whitespace);
 
   switch (value->type)
     {
     case GCONF_VALUE_INT:
       tmp = gconf_value_to_string(value);
-      g_print ("%s  <int>%s</int>\n", whitespace, tmp);
+      dump_print ("%s  <int>%s</int>\n", whitespace, tmp);
       g_free(tmp);
       break;
     case GCONF_VALUE_FLOAT:
       tmp = gconf_value_to_string(value);
-      g_print ("%s  <float>%s</float>\n", whitespace, tmp);
+      dump_print ("%s  <float>%s</float>\n", whitespace, tmp);
       g_free(tmp);
       break;
     case GCONF_VALUE_STRING:
       tmp = g_markup_escape_text(gconf_value_get_string(value), -1);
-      g_print ("%s  <string>%s</string>\n", whitespace, (tmp[0] == ' ' && tmp[1] == '\0') ? "" : tmp);
+      dump_print ("%s  <string>%s</string>\n", whitespace, (tmp[0] == ' ' && tmp[1] == '\0') ? "" : tmp);
       g_free(tmp);
       break;
     case GCONF_VALUE_BOOL:
       tmp = gconf_value_to_string(value);
-      g_print ("%s  <bool>%s</bool>\n", whitespace, tmp);
+      dump_print ("%s  <bool>%s</bool>\n", whitespace, tmp);
       g_free(tmp);
       break;
     case GCONF_VALUE_LIST:
@@ -1765,7 +1909,7 @@ print_value_in_xml(GConfValue* value, int indent)
       break;
     }
 
-  g_print ("%s</value>\n", whitespace);
+  dump_print ("%s</value>\n", whitespace);
 
   g_free(whitespace);
 }
@@ -1800,15 +1944,13 @@ compare_entries (GConfEntry* a, GConfEntry *b)
   return strcmp(gconf_entry_get_key(a), gconf_entry_get_key(b));
 }
 
+/* Takes ownership of entries and err */
 static void 
-dump_entries_in_dir(GConfEngine* conf, const gchar* dir, const gchar* base_dir)
+dump_entries(const gchar* dir, GSList* entries, GError* err, const gchar* base_dir)
 {
-  GSList* entries;
   GSList* tmp;
-  GError* err = NULL;
   
-  entries = g_slist_sort(gconf_engine_all_entries(conf, dir, &err),
-			 (GCompareFunc)compare_entries);
+  entries = g_slist_sort(entries, (GCompareFunc)compare_entries);
           
   if (err != NULL)
     {
@@ -1823,27 +1965,29 @@ dump_entries_in_dir(GConfEngine* conf, const gchar* dir, const gchar* base_dir)
     {
       GConfEntry* entry = tmp->data;
 
-      g_print ("    <entry>\n");
+      dump_print ("    <entry>\n");
 
-      g_print ("      <key>%s</key>\n",
+      dump_print ("      <key>%s</key>\n",
 	       get_key_relative(gconf_entry_get_key(entry), base_dir));
 
       /* <schema_key> will only be relative if its under the base dir */
       if (gconf_entry_get_schema_name(entry))
-        g_print ("      <schema_key>%s</schema_key>\n",
+        dump_print ("      <schema_key>%s</schema_key>\n",
 		 get_key_relative(gconf_entry_get_schema_name(entry), base_dir));
 
       if (entry->value && 
 	  (!ignore_schema_defaults || !gconf_entry_get_is_default(entry)))
         print_value_in_xml(entry->value, 6);
 
-      g_print ("    </entry>\n");
+      dump_print ("    </entry>\n");
 
       gconf_entry_free(entry);
 
       tmp = tmp->next;
     }
   g_slist_free(entries);
+
+  fflush (stdout);
 }
 
 static gboolean
@@ -1925,7 +2069,7 @@ do_get(GConfEngine* conf, const gchar** args)
             }
           else
             {
-              GConfSchema* sc = gconf_value_get_schema(value);
+              GConfSchema* sc = gconf_value_peek_schema(value);
               GConfValueType stype = gconf_schema_get_type(sc);
               GConfValueType slist_type = gconf_schema_get_list_type(sc);
               GConfValueType scar_type = gconf_schema_get_car_type(sc);
@@ -2286,7 +2430,7 @@ do_get_list_size(GConfEngine* conf, const gchar** args)
       return 1;
     }
 
-  g_print ("%u\n", g_slist_length (gconf_value_get_list (list)));
+  g_print ("%u\n", gconf_value_get_list_length (list));
 
   return 0;
 }
@@ -2296,7 +2440,6 @@ do_get_list_element(GConfEngine* conf, const gchar** args)
 {
   GError* err = NULL;
   GConfValue *list = NULL, *element = NULL;
-  GSList *iter = NULL;
   gchar* s = NULL;
   int idx = 0;
 
@@ -2344,8 +2487,7 @@ do_get_list_element(GConfEngine* conf, const gchar** args)
       return 1;
     }
 
-  iter = gconf_value_get_list (list);
-  element = g_slist_nth_data (iter, idx);
+  element = gconf_value_get_list_nth (list, idx);
 
   if (element == NULL)
     {
@@ -2415,7 +2557,7 @@ do_schema_info (GConfEngine *conf, const gchar **args,
                   const char *docs;
 
                   docs = NULL;
-                  schema = gconf_value_get_schema (val);
+                  schema = gconf_value_peek_schema (val);
 
                   if (schema)
                     {
@@ -3163,6 +3305,26 @@ typedef struct {
   GConfValue* value;
 } EntryInfo;
 
+/* Sets made while loading an entry file are pipelined, but never
+ * more than this many at once.
+ */
+#define LOAD_BATCH_SIZE 256
+
+static guint load_sets_in_flight = 0;
+
+static void
+load_set_notify (GConfEngine *conf,
+                 const gchar *key,
+                 GError      *error,
+                 gpointer     user_data)
+{
+  if (error != NULL)
+    {
+      g_printerr (_("Error setting value: %s\n"), error->message);
+      g_error_free (error);
+    }
+}
+
 static void
 set_values(GConfEngine* conf, gboolean unload, const gchar* base_dir, const gchar* key, const char* schema_key, GSList* values)
 {
@@ -3207,7 +3369,17 @@ set_values(GConfEngine* conf, gboolean unload, const gchar* base_dir, const gcha
 
       error = NULL;
       if (!unload)
-        gconf_engine_set(conf, full_key, value, &error);
+        {
+          if (load_sets_in_flight >= LOAD_BATCH_SIZE)
+            {
+              gconf_engine_flush_pending_sets (conf);
+              load_sets_in_flight = 0;
+            }
+
+          if (gconf_engine_set_async (conf, full_key, value,
+                                      load_set_notify, NULL, NULL, &error))
+            ++load_sets_in_flight;
+        }
       else
         gconf_engine_unset(conf, full_key, &error);
       if (error != NULL)
@@ -3297,6 +3469,30 @@ struct _SchemaInfo {
   GHashTable* hash;
 };
 
+/* While installing with --makefile-install-rule, schemas from all
+ * files are collected here first and written out in one go.
+ */
+typedef struct _SchemaBatch SchemaBatch;
+typedef struct _BatchSchema BatchSchema;
+
+struct _SchemaBatch {
+  /* "key\nlocale" -> BatchSchema, the last file to define a
+   * schema for a locale wins
+   */
+  GHashTable* schemas;
+  /* applyto key -> schema key */
+  GHashTable* associations;
+};
+
+struct _BatchSchema {
+  gchar* key;
+  GConfSchema* schema;
+  guint queued : 1;
+  guint reported : 1;
+};
+
+static SchemaBatch* schema_batch = NULL;
+
 static int
 fill_default_from_string(SchemaInfo* info, const gchar* default_value,
                          GConfValue** retloc)
@@ -3884,6 +4080,30 @@ hash_install_foreach(gpointer key, gpointer value, gpointer user_data)
   gconf_schema_free(schema);
 }
 
+static void
+batch_schema_free (BatchSchema *bs)
+{
+  g_free (bs->key);
+  gconf_schema_free (bs->schema);
+  g_free (bs);
+}
+
+static void
+batch_add_schema (gpointer key, gpointer value, gpointer user_data)
+{
+  BatchSchema* bs;
+
+  bs = g_new0 (BatchSchema, 1);
+  bs->key = g_strdup (user_data);
+  bs->schema = value;
+
+  g_hash_table_replace (schema_batch->schemas,
+                        g_strconcat (bs->key, "\n",
+                                     gconf_schema_get_locale (bs->schema),
+                                     NULL),
+                        bs);
+}
+
 static int
 process_schema(GConfEngine* conf, gboolean unload, xmlNodePtr node)
 {
@@ -3903,7 +4123,16 @@ process_schema(GConfEngine* conf, gboolean unload, xmlNodePtr node)
 
   g_assert(schemas_hash != NULL);
 
-  if (schema_key != NULL)
+  if (schema_key != NULL && schema_batch != NULL)
+    {
+      for (tmp = applyto_list; tmp != NULL; tmp = tmp->next)
+        g_hash_table_replace (schema_batch->associations,
+                              g_strdup (tmp->data), g_strdup (schema_key));
+
+      /* the batch owns the schemas now */
+      g_hash_table_foreach (schemas_hash, batch_add_schema, schema_key);
+    }
+  else if (schema_key != NULL)
     {
       process_key_list(conf, unload, schema_key, applyto_list);
 
@@ -3970,25 +4199,24 @@ process_list(GConfEngine* conf, LoadType load_type, gboolean unload, xmlNodePtr
 #undef LOAD_TYPE_TO_LIST
 }
 
+/* Processes an already parsed file; parse_errno is errno after
+ * xmlParseFile() returned doc.
+ */
 static int
-do_load_file(GConfEngine* conf, LoadType load_type, gboolean unload, const gchar* file, const gchar** base_dirs)
+process_doc(GConfEngine* conf, LoadType load_type, gboolean unload, const gchar* file, xmlDocPtr doc, int parse_errno, const gchar** base_dirs)
 {
 #define LOAD_TYPE_TO_ROOT(t) ((t == LOAD_SCHEMA_FILE) ? "gconfschemafile" : "gconfentryfile")
 #define LOAD_TYPE_TO_LIST(t) ((t == LOAD_SCHEMA_FILE) ? "schemalist" : "entrylist")
 
-  xmlDocPtr doc;
   xmlNodePtr iter;
   /* file comes from the command line, is thus in locale charset */
   gchar *utf8_file = g_locale_to_utf8 (file, -1, NULL, NULL, NULL);;
 
-  errno = 0;
-  doc = xmlParseFile(file);
-
   if (doc == NULL)
     {
-      if (errno != 0)
+      if (parse_errno != 0)
         g_printerr (_("Failed to open `%s': %s\n"),
-		    utf8_file, g_strerror(errno));
+		    utf8_file, g_strerror(parse_errno));
       return 1;
     }
 
@@ -4045,6 +4273,257 @@ do_load_file(GConfEngine* conf, LoadType load_type, gboolean unload, const gchar
 #undef LOAD_TYPE_TO_ROOT
 }
 
+/* Entry files can describe whole trees, so rather than building the
+ * document, walk it with a reader and expand one <entry> at a time.
+ */
+static int
+load_entry_file_streaming(GConfEngine* conf, gboolean unload, const gchar* file, const gchar** base_dirs)
+{
+  xmlTextReaderPtr reader;
+  char* orig_base = NULL;
+  gboolean seen_root = FALSE;
+  int retval = 0;
+  int ret;
+  /* file comes from the command line, is thus in locale charset */
+  gchar *utf8_file = g_locale_to_utf8 (file, -1, NULL, NULL, NULL);
+
+  errno = 0;
+  reader = xmlReaderForFile (file, NULL, 0);
+
+  if (reader == NULL)
+    {
+      if (errno != 0)
+        g_printerr (_("Failed to open `%s': %s\n"),
+		    utf8_file, g_strerror(errno));
+      g_free (utf8_file);
+      return 1;
+    }
+
+  ret = xmlTextReaderRead (reader);
+  while (ret == 1)
+    {
+      const char* name;
+      int depth;
+
+      if (xmlTextReaderNodeType (reader) != XML_READER_TYPE_ELEMENT)
+        {
+          ret = xmlTextReaderRead (reader);
+          continue;
+        }
+
+      name = (const char *) xmlTextReaderConstName (reader);
+      depth = xmlTextReaderDepth (reader);
+
+      if (depth == 0)
+        {
+          if (strcmp (name, "gconfentryfile") != 0)
+            {
+              g_printerr (_("Document `%s' has the wrong type of root node (<%s>, should be <%s>)\n"),
+			  utf8_file, name, "gconfentryfile");
+              retval = 1;
+              break;
+            }
+
+          seen_root = TRUE;
+          ret = xmlTextReaderRead (reader);
+        }
+      else if (depth == 1)
+        {
+          if (strcmp (name, "entrylist") == 0)
+            {
+              if (orig_base)
+                xmlFree (orig_base);
+              orig_base = (char *) xmlTextReaderGetAttribute (reader, (xmlChar *) "base");
+
+              ret = xmlTextReaderRead (reader);
+            }
+          else
+            {
+              g_printerr (_("WARNING: node <%s> below <%s> not understood\n"),
+			  name, "gconfentryfile");
+              ret = xmlTextReaderNext (reader);
+            }
+        }
+      else if (depth == 2 && strcmp (name, "entry") == 0)
+        {
+          xmlNodePtr node;
+
+          /* Only valid until the reader moves on */
+          node = xmlTextReaderExpand (reader);
+          if (node != NULL)
+            process_entry (conf, unload, node, base_dirs, orig_base);
+
+          ret = xmlTextReaderNext (reader);
+        }
+      else
+        {
+          if (depth == 2)
+            g_printerr (_("WARNING: node <%s> not understood below <%s>\n"),
+			name, "entrylist");
+          ret = xmlTextReaderNext (reader);
+        }
+    }
+
+  if (ret < 0)
+    retval = 1;
+  else if (retval == 0 && !seen_root)
+    {
+      g_printerr (_("Document `%s' has no top level <%s> node\n"),
+		  utf8_file, "gconfentryfile");
+      retval = 1;
+    }
+
+  if (orig_base)
+    xmlFree (orig_base);
+
+  xmlFreeTextReader (reader);
+  g_free (utf8_file);
+
+  /* Errors from the last batch are reported before we return */
+  gconf_engine_flush_pending_sets (conf);
+  load_sets_in_flight = 0;
+
+  return retval;
+}
+
+static int
+do_load_file(GConfEngine* conf, LoadType load_type, gboolean unload, const gchar* file, const gchar** base_dirs)
+{
+  xmlDocPtr doc;
+
+  if (load_type == LOAD_ENTRY_FILE)
+    return load_entry_file_streaming (conf, unload, file, base_dirs);
+
+  errno = 0;
+  doc = xmlParseFile(file);
+
+  return process_doc (conf, load_type, unload, file, doc, errno, base_dirs);
+}
+
+/*
+ * Parsing several files at once.  libxml2 does the parsing on a
+ * thread pool, a few files ahead of the main thread, which processes
+ * the documents strictly in command line order so output and the
+ * resulting database don't depend on scheduling.
+ */
+
+typedef struct {
+  const gchar* file;
+  xmlDocPtr doc;
+  int parse_errno;
+  gboolean done;
+} ParsedFile;
+
+typedef struct {
+  GMutex lock;
+  GCond done_cond;
+} ParseSync;
+
+static void
+parse_file_thread (gpointer data, gpointer user_data)
+{
+  ParsedFile* pf = data;
+  ParseSync* state = user_data;
+  xmlDocPtr doc;
+  int parse_errno;
+
+  errno = 0;
+  doc = xmlParseFile (pf->file);
+  parse_errno = errno;
+
+  g_mutex_lock (&state->lock);
+  pf->doc = doc;
+  pf->parse_errno = parse_errno;
+  pf->done = TRUE;
+  g_cond_broadcast (&state->done_cond);
+  g_mutex_unlock (&state->lock);
+}
+
+static guint
+parse_thread_count (void)
+{
+  long n = 1;
+
+#ifdef _SC_NPROCESSORS_ONLN
+  n = sysconf (_SC_NPROCESSORS_ONLN);
+#endif
+
+  return CLAMP (n, 1, 16);
+}
+
+static int
+load_files_parallel (GConfEngine* conf, LoadType load_type, gboolean unload, const gchar** files)
+{
+  GThreadPool* pool;
+  ParsedFile* parsed;
+  ParseSync state;
+  guint n_files, n_threads, next, i;
+  int retval = 0;
+
+  n_files = g_strv_length ((gchar **) files);
+  n_threads = parse_thread_count ();
+
+  if (n_files < 2 || n_threads < 2)
+    {
+      for (i = 0; i < n_files; i++)
+        if (do_load_file (conf, load_type, unload, files[i], NULL) != 0)
+          retval |= 1;
+
+      return retval;
+    }
+
+  pool = g_thread_pool_new (parse_file_thread, &state, n_threads, FALSE, NULL);
+  if (pool == NULL)
+    {
+      for (i = 0; i < n_files; i++)
+        if (do_load_file (conf, load_type, unload, files[i], NULL) != 0)
+          retval |= 1;
+
+      return retval;
+    }
+
+  /* Must happen before any thread parses */
+  xmlInitParser ();
+
+  g_mutex_init (&state.lock);
+  g_cond_init (&state.done_cond);
+
+  parsed = g_new0 (ParsedFile, n_files);
+  for (i = 0; i < n_files; i++)
+    parsed[i].file = files[i];
+
+  /* Keep at most a couple of documents per thread in memory */
+  next = 0;
+  while (next < n_files && next < 2 * n_threads)
+    g_thread_pool_push (pool, &parsed[next++], NULL);
+
+  for (i = 0; i < n_files; i++)
+    {
+      g_mutex_lock (&state.lock);
+      while (!parsed[i].done)
+        g_cond_wait (&state.done_cond, &state.lock);
+      g_mutex_unlock (&state.lock);
+
+      if (next < n_files)
+        g_thread_pool_push (pool, &parsed[next++], NULL);
+
+      if (process_doc (conf, load_type, unload, parsed[i].file,
+                       parsed[i].doc, parsed[i].parse_errno, NULL) != 0)
+        retval |= 1;
+
+      if (parsed[i].doc != NULL)
+        xmlFreeDoc (parsed[i].doc);
+    }
+
+  g_thread_pool_free (pool, FALSE, TRUE);
+
+  g_mutex_clear (&state.lock);
+  g_cond_clear (&state.done_cond);
+  g_free (parsed);
+
+  return retval;
+}
+
 static int
 do_sync(GConfEngine* conf)
 {
@@ -4063,9 +4542,160 @@ do_sync(GConfEngine* conf)
   return 0;
 }
 
+static int
+compare_strings (gconstpointer a, gconstpointer b)
+{
+  return strcmp (*(const gchar**) a, *(const gchar**) b);
+}
+
+/* Hash table keys, sorted so that neighbouring writes land in the
+ * same directory of the target tree.
+ */
+static GPtrArray*
+sorted_keys (GHashTable *hash)
+{
+  GHashTableIter iter;
+  GPtrArray* keys;
+  gpointer key;
+
+  keys = g_ptr_array_sized_new (g_hash_table_size (hash));
+
+  g_hash_table_iter_init (&iter, hash);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    g_ptr_array_add (keys, key);
+
+  g_ptr_array_sort (keys, compare_strings);
+
+  return keys;
+}
+
+static void
+batch_set_notify (GConfEngine *conf,
+                  const gchar *key,
+                  GError      *error,
+                  gpointer     user_data)
+{
+  BatchSchema* bs = user_data;
+
+  bs->reported = TRUE;
+
+  if (error != NULL)
+    {
+      g_printerr (_("WARNING: failed to install schema `%s', locale `%s': %s\n"),
+                  bs->key, gconf_schema_get_locale (bs->schema), error->message);
+      g_error_free (error);
+    }
+  else
+    g_print (_("Installed schema `%s' for locale `%s'\n"),
+             bs->key, gconf_schema_get_locale (bs->schema));
+}
+
+/* Returns the schema keys in the order they were installed, owned by
+ * batch->schemas.
+ */
+static GPtrArray*
+batch_install (GConfEngine* conf, SchemaBatch* batch, gboolean unload)
+{
+  GPtrArray* keys;
+  guint i;
+
+  keys = sorted_keys (batch->associations);
+
+  for (i = 0; i < keys->len; i++)
+    {
+      const gchar* key = g_ptr_array_index (keys, i);
+      GSList list = { (gpointer) key, NULL };
+
+      process_key_list (conf, unload,
+                        g_hash_table_lookup (batch->associations, key),
+                        &list);
+    }
+
+  g_ptr_array_free (keys, TRUE);
+
+  keys = sorted_keys (batch->schemas);
+
+  for (i = 0; i < keys->len; i++)
+    {
+      BatchSchema* bs = g_hash_table_lookup (batch->schemas,
+                                             g_ptr_array_index (keys, i));
+      GError* error = NULL;
+
+      if (unload)
+        {
+          BatchSchema* prev = NULL;
+
+          /* Unsetting a schema removes all of its locales at once */
+          if (i > 0)
+            prev = g_hash_table_lookup (batch->schemas,
+                                        g_ptr_array_index (keys, i - 1));
+
+          if (prev == NULL || strcmp (prev->key, bs->key) != 0)
+            {
+              if (!gconf_engine_unset (conf, bs->key, &error))
+                {
+                  g_printerr (_("WARNING: failed to uninstall schema `%s', locale `%s': %s\n"),
+                              bs->key, gconf_schema_get_locale (bs->schema),
+                              error->message);
+                  g_error_free (error);
+                  continue;
+                }
+            }
+
+          g_print (_("Uninstalled schema `%s' from locale `%s'\n"),
+                   bs->key, gconf_schema_get_locale (bs->schema));
+        }
+      else
+        {
+          GConfValue* value;
+
+          value = gconf_value_new (GCONF_VALUE_SCHEMA);
+          gconf_value_set_schema (value, bs->schema);
+
+          /* Pipelined when talking to gconfd; local engines write
+           * straight into the tree, and nothing is synced until
+           * everything is in.
+           */
+          if (!gconf_engine_set_async (conf, bs->key, value,
+                                       batch_set_notify, bs, NULL, &error))
+            {
+              g_printerr (_("WARNING: failed to install schema `%s', locale `%s': %s\n"),
+                          bs->key, gconf_schema_get_locale (bs->schema),
+                          error->message);
+              g_error_free (error);
+            }
+          else
+            bs->queued = TRUE;
+
+          gconf_value_free (value);
+        }
+    }
+
+  return keys;
+}
+
+static void
+batch_report_local (SchemaBatch* batch, GPtrArray* keys)
+{
+  guint i;
+
+  for (i = 0; i < keys->len; i++)
+    {
+      BatchSchema* bs = g_hash_table_lookup (batch->schemas,
+                                             g_ptr_array_index (keys, i));
+
+      /* Local engines set synchronously and never call back */
+      if (bs->queued && !bs->reported)
+        g_print (_("Installed schema `%s' for locale `%s'\n"),
+                 bs->key, gconf_schema_get_locale (bs->schema));
+    }
+}
+
 static int
 do_makefile_install(GConfEngine* conf, const gchar** args, gboolean unload)
 {
+  SchemaBatch batch;
+  GPtrArray* keys;
   int retval = 0;
 
   if (args == NULL)
@@ -4074,15 +4704,30 @@ do_makefile_install(GConfEngine* conf, const gchar** args, gboolean unload)
       return 1;
     }
 
-  while (*args)
-    {
-      if (do_load_file(conf, LOAD_SCHEMA_FILE, unload, *args, NULL) != 0)
-        retval |= 1;
+  /* Parse everything first, so schemas defined more than once are
+   * only written once and the writes can go out back to back.
+   */
+  batch.schemas = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                         (GDestroyNotify) batch_schema_free);
+  batch.associations = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                              g_free, g_free);
+  schema_batch = &batch;
 
-      ++args;
-    }
+  retval |= load_files_parallel (conf, LOAD_SCHEMA_FILE, unload, args);
+
+  schema_batch = NULL;
+
+  keys = batch_install (conf, &batch, unload);
 
+  /* Also waits for the pipelined sets */
   retval |= do_sync (conf);
+
+  batch_report_local (&batch, keys);
+  g_ptr_array_free (keys, TRUE);
+
+  g_hash_table_destroy (batch.schemas);
+  g_hash_table_destroy (batch.associations);
+
   return retval;
 }
 
@@ -36,12 +36,19 @@ typedef struct _GConfSettingsBackendNotifier GConfSettingsBackendNotifier;
 struct _GConfSettingsBackendPrivate
 {
   GConfClient *client;
-  GSList      *notifiers;
+  /* Root of the trie of subscribed paths, for "/" */
+  GConfSettingsBackendNotifier *notifiers;
   /* By definition, with GSettings, we can't write to a key if we're not
    * subscribed to it or its parent. This means we'll be monitoring it, and
-   * that we'll get a change notification for the write. That's something that
-   * should get ignored. */
+   * that we'll get a change notification for the write. We tag our own
+   * commits with this token, and ignore notifications carrying it. */
+  gchar       *origin;
+  /* Keys written through a server that can't tag commits, whose next
+   * notification should get ignored instead. */
   GHashTable  *ignore_notifications;
+  /* Paths whose whole tree we've already fetched into the GConfClient
+   * cache, so that reads of their keys don't go to gconfd one by one. */
+  GHashTable  *prefetched;
 };
 
 /* The rationale behind the non-trivial handling of notifiers here is that we
@@ -50,14 +57,22 @@ struct _GConfSettingsBackendPrivate
  * notificiations for all keys living below the path. So subscribing to
  * /apps/panel and /apps/panel/general will lead to two notifications for a key
  * living under /apps/panel/general. We want to avoid that, so we will only
- * have a notifier for /apps/panel in such a case. */
+ * have a notifier for /apps/panel in such a case.
+ *
+ * Notifiers are kept in a trie with one node per path component, so finding
+ * the node for a path, or whether one of its parents is subscribed, only
+ * walks down the components of that path. Nodes that aren't subscribed
+ * themselves only exist to lead to subscribed ones. */
 struct _GConfSettingsBackendNotifier
 {
   GConfSettingsBackendNotifier *parent;
-  gchar  *path;
-  guint   refcount;
-  guint   notify_id;
-  GSList *subpaths;
+  gchar      *path;
+  /* Number of subscriptions to this exact path */
+  guint       refcount;
+  /* Only set for subscribed paths with no subscribed parent */
+  guint       notify_id;
+  /* Path component => GConfSettingsBackendNotifier */
+  GHashTable *children;
 };
 
 static void
@@ -65,130 +80,211 @@ gconf_settings_backend_notified (GConfClient          *client,
                                  guint                 cnxn_id,
                                  GConfEntry           *entry,
                                  GConfSettingsBackend *gconf);
+static char *
+gconf_settings_backend_get_gconf_path_from_name (const gchar *name);
 
 /**********************\
  * Notifiers handling *
 \**********************/
 
 static GConfSettingsBackendNotifier *
-gconf_settings_backend_find_notifier_or_parent (GConfSettingsBackend *gconf,
-                                                const gchar          *path)
+gconf_settings_backend_new_notifier (GConfSettingsBackendNotifier *parent,
+                                     const gchar                  *path)
 {
-  GConfSettingsBackendNotifier *parent;
-  GSList *l;
-
-  l = gconf->priv->notifiers;
-  parent = NULL;
-
-  while (l != NULL)
-    {
-      GConfSettingsBackendNotifier *notifier;
-      notifier = l->data;
-      if (g_str_equal (path, notifier->path))
-        return notifier;
-      if (g_str_has_prefix (path, notifier->path))
-        {
-          parent = notifier;
-          l = parent->subpaths;
-          continue;
-        }
-      if (g_str_has_prefix (notifier->path, path))
-        break;
+  GConfSettingsBackendNotifier *notifier;
 
-      l = l->next;
-    }
+  notifier = g_slice_new0 (GConfSettingsBackendNotifier);
+  notifier->parent = parent;
+  notifier->path = g_strdup (path);
+  notifier->children = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                              g_free, NULL);
 
-  return parent;
+  return notifier;
 }
 
 static void
 gconf_settings_backend_free_notifier (GConfSettingsBackendNotifier *notifier,
                                       GConfSettingsBackend         *gconf)
 {
-  if (notifier->path)
-    g_free (notifier->path);
-  notifier->path = NULL;
+  GHashTableIter iter;
+  gpointer child;
 
   if (notifier->notify_id)
     gconf_client_notify_remove (gconf->priv->client, notifier->notify_id);
   notifier->notify_id = 0;
 
-  g_slist_foreach (notifier->subpaths, (GFunc) gconf_settings_backend_free_notifier, gconf);
-  g_slist_free (notifier->subpaths);
-  notifier->subpaths = NULL;
+  g_hash_table_iter_init (&iter, notifier->children);
+  while (g_hash_table_iter_next (&iter, NULL, &child))
+    gconf_settings_backend_free_notifier (child, gconf);
+  g_hash_table_unref (notifier->children);
+
+  g_free (notifier->path);
 
   g_slice_free (GConfSettingsBackendNotifier, notifier);
 }
 
-/* Returns: TRUE if the notifier was created, FALSE if it was already existing. */
-static gboolean
-gconf_settings_backend_add_notifier (GConfSettingsBackend *gconf,
-                                     const gchar          *path)
+/* Returns the node for @path, creating it and the nodes leading to it if
+ * @create is TRUE; or NULL. */
+static GConfSettingsBackendNotifier *
+gconf_settings_backend_lookup_notifier (GConfSettingsBackend *gconf,
+                                        const gchar          *path,
+                                        gboolean              create)
 {
-  GConfSettingsBackendNotifier *n_or_p;
   GConfSettingsBackendNotifier *notifier;
-  GSList *siblings;
-  GSList *l;
+  const gchar *component;
 
-  n_or_p = gconf_settings_backend_find_notifier_or_parent (gconf, path);
+  notifier = gconf->priv->notifiers;
+  component = path;
 
-  if (n_or_p && g_str_equal (path, n_or_p->path))
+  while (*component != '\0')
     {
-      n_or_p->refcount += 1;
-      return FALSE;
+      GConfSettingsBackendNotifier *child;
+      const gchar *end;
+      gchar *name;
+
+      while (*component == '/')
+        component++;
+      if (*component == '\0')
+        break;
+
+      end = strchr (component, '/');
+      if (end == NULL)
+        end = component + strlen (component);
+
+      name = g_strndup (component, end - component);
+      child = g_hash_table_lookup (notifier->children, name);
+
+      if (child == NULL)
+        {
+          gchar *child_path;
+
+          if (!create)
+            {
+              g_free (name);
+              return NULL;
+            }
+
+          child_path = g_strndup (path, end - path);
+          child = gconf_settings_backend_new_notifier (notifier, child_path);
+          g_free (child_path);
+
+          g_hash_table_insert (notifier->children, name, child);
+        }
+      else
+        g_free (name);
+
+      notifier = child;
+      component = end;
     }
 
-  notifier = g_slice_new0 (GConfSettingsBackendNotifier);
-  notifier->parent = n_or_p;
-  notifier->path = g_strdup (path);
-  notifier->refcount = 1;
+  return notifier;
+}
 
-  if (notifier->parent == NULL)
-    notifier->notify_id = gconf_client_notify_add (gconf->priv->client, path,
-                                                   (GConfClientNotifyFunc) gconf_settings_backend_notified, gconf,
-                                                   NULL, NULL);
-  else
-    notifier->notify_id = 0;
+/* Whether @path or one of its parents is subscribed. */
+static gboolean
+gconf_settings_backend_is_subscribed (GConfSettingsBackend *gconf,
+                                      const gchar          *path)
+{
+  GConfSettingsBackendNotifier *notifier;
+  const gchar *component;
 
-  /* Move notifiers living at the same level but that are subpaths below this
-   * new notifier, removing their notify handler if necessary. */
-  if (notifier->parent)
-    siblings = notifier->parent->subpaths;
-  else
-    siblings = gconf->priv->notifiers;
+  notifier = gconf->priv->notifiers;
+  component = path;
 
-  l = siblings;
-  while (l != NULL)
+  while (notifier != NULL)
     {
-      GConfSettingsBackendNotifier *sibling;
-      GSList *next;
+      const gchar *end;
+      gchar *name;
 
-      sibling = l->data;
-      next = l->next;
+      if (notifier->refcount > 0)
+        return TRUE;
 
-      if (g_str_has_prefix (sibling->path, notifier->path))
-        {
-          if (sibling->notify_id)
-            {
-              gconf_client_notify_remove (gconf->priv->client,
-                                          sibling->notify_id);
-              sibling->notify_id = 0;
-            }
+      while (*component == '/')
+        component++;
+      if (*component == '\0')
+        break;
+
+      end = strchr (component, '/');
+      if (end == NULL)
+        end = component + strlen (component);
+
+      name = g_strndup (component, end - component);
+      notifier = g_hash_table_lookup (notifier->children, name);
+      g_free (name);
+
+      component = end;
+    }
+
+  return FALSE;
+}
+
+static gboolean
+gconf_settings_backend_has_subscribed_parent (GConfSettingsBackendNotifier *notifier)
+{
+  for (notifier = notifier->parent; notifier != NULL; notifier = notifier->parent)
+    {
+      if (notifier->refcount > 0)
+        return TRUE;
+    }
+
+  return FALSE;
+}
+
+/* Adds or removes the notify handlers of the topmost subscribed paths below
+ * @notifier. */
+static void
+gconf_settings_backend_watch_subpaths (GConfSettingsBackend         *gconf,
+                                       GConfSettingsBackendNotifier *notifier,
+                                       gboolean                      watch)
+{
+  GHashTableIter iter;
+  gpointer value;
+
+  g_hash_table_iter_init (&iter, notifier->children);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      GConfSettingsBackendNotifier *child = value;
 
-          siblings = g_slist_remove_link (siblings, l);
-          l->next = notifier->subpaths;
-          notifier->subpaths = l;
+      if (child->refcount == 0)
+        {
+          gconf_settings_backend_watch_subpaths (gconf, child, watch);
+          continue;
         }
 
-      l = next;
+      if (watch && child->notify_id == 0)
+        child->notify_id = gconf_client_notify_add (gconf->priv->client, child->path,
+                                                    (GConfClientNotifyFunc) gconf_settings_backend_notified, gconf,
+                                                    NULL, NULL);
+      else if (!watch && child->notify_id != 0)
+        {
+          gconf_client_notify_remove (gconf->priv->client, child->notify_id);
+          child->notify_id = 0;
+        }
     }
+}
 
-  siblings = g_slist_prepend (siblings, notifier);
+/* Returns: TRUE if the notifier was created, FALSE if it was already existing. */
+static gboolean
+gconf_settings_backend_add_notifier (GConfSettingsBackend *gconf,
+                                     const gchar          *path)
+{
+  GConfSettingsBackendNotifier *notifier;
 
-  if (notifier->parent)
-    notifier->parent->subpaths = siblings;
-  else
-    gconf->priv->notifiers = siblings;
+  notifier = gconf_settings_backend_lookup_notifier (gconf, path, TRUE);
+
+  notifier->refcount += 1;
+  if (notifier->refcount > 1)
+    return FALSE;
+
+  /* Take over notifications for the subpaths that were watched until now,
+   * removing their notify handler. */
+  if (!gconf_settings_backend_has_subscribed_parent (notifier))
+    {
+      notifier->notify_id = gconf_client_notify_add (gconf->priv->client, path,
+                                                     (GConfClientNotifyFunc) gconf_settings_backend_notified, gconf,
+                                                     NULL, NULL);
+      gconf_settings_backend_watch_subpaths (gconf, notifier, FALSE);
+    }
 
   return TRUE;
 }
@@ -200,56 +296,99 @@ gconf_settings_backend_remove_notifier (GConfSettingsBackend *gconf,
 {
   GConfSettingsBackendNotifier *notifier;
 
-  notifier = gconf_settings_backend_find_notifier_or_parent (gconf, path);
+  notifier = gconf_settings_backend_lookup_notifier (gconf, path, FALSE);
 
-  g_assert (notifier && g_str_equal (path, notifier->path));
+  g_assert (notifier && notifier->refcount > 0);
 
   notifier->refcount -= 1;
 
   if (notifier->refcount > 0)
     return FALSE;
 
-  /* Move subpaths to the parent, and add a notify handler for each of them if
-   * they have no parent anymore. */
-  if (notifier->parent)
+  /* Add a notify handler for each subpath that has no subscribed parent
+   * anymore. */
+  if (notifier->notify_id)
     {
-      GSList *l;
+      gconf_client_notify_remove (gconf->priv->client, notifier->notify_id);
+      notifier->notify_id = 0;
+      gconf_settings_backend_watch_subpaths (gconf, notifier, TRUE);
+    }
 
-      for (l = notifier->subpaths; l != NULL; l = l->next)
-        {
-          GConfSettingsBackendNotifier *child = l->data;
-          child->parent = notifier->parent;
-        }
+  /* Drop the nodes that don't lead anywhere anymore. */
+  while (notifier->parent != NULL &&
+         notifier->refcount == 0 &&
+         g_hash_table_size (notifier->children) == 0)
+    {
+      GConfSettingsBackendNotifier *parent = notifier->parent;
+      const gchar *name;
+
+      name = strrchr (notifier->path, '/') + 1;
+      g_hash_table_remove (parent->children, name);
+      gconf_settings_backend_free_notifier (notifier, gconf);
 
-      notifier->parent->subpaths = g_slist_remove (notifier->parent->subpaths,
-                                                   notifier);
-      notifier->parent->subpaths = g_slist_concat (notifier->parent->subpaths,
-                                                   notifier->subpaths);
+      notifier = parent;
     }
-  else
-    {
-      GSList *l;
 
-      for (l = notifier->subpaths; l != NULL; l = l->next)
-        {
-          GConfSettingsBackendNotifier *child = l->data;
-          child->parent = NULL;
-          child->notify_id = gconf_client_notify_add (gconf->priv->client, child->path,
-                                                      (GConfClientNotifyFunc) gconf_settings_backend_notified, gconf,
-                                                      NULL, NULL);
-        }
+  return TRUE;
+}
+
+
+/***************\
+ * Prefetching *
+\***************/
+
+static gboolean
+gconf_settings_backend_is_prefetched (GConfSettingsBackend *gconf,
+                                      const gchar          *path)
+{
+  GHashTableIter iter;
+  gpointer prefetched;
 
-      gconf->priv->notifiers = g_slist_remove (gconf->priv->notifiers,
-                                               notifier);
-      gconf->priv->notifiers = g_slist_concat (gconf->priv->notifiers,
-                                               notifier->subpaths);
+  g_hash_table_iter_init (&iter, gconf->priv->prefetched);
+  while (g_hash_table_iter_next (&iter, &prefetched, NULL))
+    {
+      if (gconf_key_is_below (prefetched, path))
+        return TRUE;
     }
 
-  notifier->subpaths = NULL;
+  return FALSE;
+}
 
-  gconf_settings_backend_free_notifier (notifier, gconf);
+/* Loads everything below @path into the client cache in one go, unless it's
+ * already there. This is only worth it for monitored paths: the client
+ * doesn't cache anything else. */
+static void
+gconf_settings_backend_prefetch (GConfSettingsBackend *gconf,
+                                 const gchar          *path)
+{
+  if (!gconf_settings_backend_is_subscribed (gconf, path))
+    return;
 
-  return TRUE;
+  if (gconf_settings_backend_is_prefetched (gconf, path))
+    return;
+
+  gconf_client_preload (gconf->priv->client, path,
+                        GCONF_CLIENT_PRELOAD_RECURSIVE, NULL);
+  g_hash_table_replace (gconf->priv->prefetched,
+                        g_strdup (path), GINT_TO_POINTER (1));
+}
+
+static gboolean
+gconf_settings_backend_is_below (gpointer key,
+                                 gpointer value,
+                                 gpointer path)
+{
+  return gconf_key_is_below (path, key);
+}
+
+/* The client drops its cache for paths we stop monitoring. */
+static void
+gconf_settings_backend_forget_prefetched (GConfSettingsBackend *gconf,
+                                          const gchar          *path)
+{
+  g_hash_table_foreach_remove (gconf->priv->prefetched,
+                               gconf_settings_backend_is_below,
+                               (gpointer) path);
 }
 
 
@@ -640,6 +779,11 @@ gconf_settings_backend_read (GSettingsBackend   *backend,
   GConfSettingsBackend *gconf = GCONF_SETTINGS_BACKEND (backend);
   GConfValue *gconf_value;
   GVariant *value;
+  gchar *path;
+
+  path = gconf_settings_backend_get_gconf_path_from_name (key);
+  gconf_settings_backend_prefetch (gconf, path);
+  g_free (path);
 
   gconf_value = gconf_client_get_without_default (gconf->priv->client,
                                                   key, NULL);
@@ -655,6 +799,41 @@ gconf_settings_backend_read (GSettingsBackend   *backend,
   return value;
 }
 
+static void
+gconf_settings_backend_add_ignore_notifications (GConfChangeSet       *changeset,
+                                                 const gchar          *key,
+                                                 GConfValue           *value,
+                                                 GConfSettingsBackend *gconf)
+{
+  g_hash_table_replace (gconf->priv->ignore_notifications,
+                        g_strdup (key), GINT_TO_POINTER (1));
+}
+
+/* Commits @changeset in one go, tagged so that we can recognize the
+ * notifications it causes. */
+static gboolean
+gconf_settings_backend_commit (GConfSettingsBackend *gconf,
+                               GConfChangeSet       *changeset)
+{
+  gboolean success;
+  gboolean tagged;
+
+  success = gconf_client_commit_change_set_with_origin (gconf->priv->client,
+                                                        changeset,
+                                                        gconf->priv->origin,
+                                                        &tagged,
+                                                        NULL);
+
+  /* The server committed key by key and the notifications won't carry
+   * our tag; fall back to ignoring the next one for each key. */
+  if (success && !tagged)
+    gconf_change_set_foreach (changeset,
+                              (GConfChangeSetForeachFunc) gconf_settings_backend_add_ignore_notifications,
+                              gconf);
+
+  return success;
+}
+
 static gboolean
 gconf_settings_backend_write (GSettingsBackend *backend,
                               const gchar      *key,
@@ -662,8 +841,9 @@ gconf_settings_backend_write (GSettingsBackend *backend,
                               gpointer          origin_tag)
 {
   GConfSettingsBackend *gconf = GCONF_SETTINGS_BACKEND (backend);
+  GConfChangeSet       *changeset;
   GConfValue           *gconf_value;
-  GError               *error;
+  gboolean              success;
 
   g_variant_ref_sink (value);
   gconf_value = gconf_settings_backend_gvariant_to_gconf_value (value);
@@ -671,22 +851,17 @@ gconf_settings_backend_write (GSettingsBackend *backend,
   if (gconf_value == NULL)
     return FALSE;
 
-  error = NULL;
-  gconf_client_set (gconf->priv->client, key, gconf_value, &error);
-  gconf_value_free (gconf_value);
+  changeset = gconf_change_set_new ();
+  gconf_change_set_set_nocopy (changeset, key, gconf_value);
 
-  if (error != NULL)
-    {
-      g_error_free (error);
-      return FALSE;
-    }
+  success = gconf_settings_backend_commit (gconf, changeset);
 
-  g_settings_backend_changed (backend, key, origin_tag);
+  gconf_change_set_unref (changeset);
 
-  g_hash_table_replace (gconf->priv->ignore_notifications,
-                        g_strdup (key), GINT_TO_POINTER (1));
+  if (success)
+    g_settings_backend_changed (backend, key, origin_tag);
 
-  return TRUE;
+  return success;
 }
 
 static gboolean
@@ -705,26 +880,6 @@ gconf_settings_backend_write_one_to_changeset (const gchar    *key,
   return FALSE;
 }
 
-static gboolean
-gconf_settings_backend_add_ignore_notifications (const gchar          *key,
-                                                 GVariant             *value,
-                                                 GConfSettingsBackend *gconf)
-{
-  g_hash_table_replace (gconf->priv->ignore_notifications,
-                        g_strdup (key), GINT_TO_POINTER (1));
-  return FALSE;
-}
-
-static gboolean
-gconf_settings_backend_remove_ignore_notifications (GConfChangeSet       *changeset,
-                                                    const gchar          *key,
-                                                    GConfValue           *value,
-                                                    GConfSettingsBackend *gconf)
-{
-  g_hash_table_remove (gconf->priv->ignore_notifications, key);
-  return FALSE;
-}
-
 static gboolean
 gconf_settings_backend_write_tree (GSettingsBackend *backend,
                                    GTree            *tree,
@@ -732,7 +887,6 @@ gconf_settings_backend_write_tree (GSettingsBackend *backend,
 {
   GConfSettingsBackend *gconf = GCONF_SETTINGS_BACKEND (backend);
   GConfChangeSet       *changeset;
-  GConfChangeSet       *reversed;
   gboolean              success;
 
   changeset = gconf_change_set_new ();
@@ -745,29 +899,14 @@ gconf_settings_backend_write_tree (GSettingsBackend *backend,
       return FALSE;
     }
 
-  reversed = gconf_client_reverse_change_set (gconf->priv->client, changeset, NULL);
-  success = gconf_client_commit_change_set (gconf->priv->client, changeset, TRUE, NULL);
-
-  g_tree_foreach (tree, (GTraverseFunc) gconf_settings_backend_add_ignore_notifications, gconf);
+  /* Either all keys are written or none is, so there's nothing to undo
+   * here when this fails. */
+  success = gconf_settings_backend_commit (gconf, changeset);
 
-  if (!success)
-    {
-      /* This is a tricky situation: when committing, some keys will have been
-       * changed, so there will be notifications that we'll want to ignore. But
-       * we can't ignore notifications for what was not committed. Note that
-       * when we'll commit the reversed changeset, it should fail for the same
-       * key, so there'll be no other notifications created. And in the worst
-       * case, it's no big deal... */
-      gconf_change_set_foreach (changeset,
-                                (GConfChangeSetForeachFunc) gconf_settings_backend_remove_ignore_notifications,
-                                gconf);
-      gconf_client_commit_change_set (gconf->priv->client, reversed, FALSE, NULL);
-    }
-  else
+  if (success)
     g_settings_backend_changed_tree (backend, tree, origin_tag);
 
   gconf_change_set_unref (changeset);
-  gconf_change_set_unref (reversed);
 
   return success;
 }
@@ -778,9 +917,15 @@ gconf_settings_backend_reset (GSettingsBackend *backend,
                               gpointer          origin_tag)
 {
   GConfSettingsBackend *gconf = GCONF_SETTINGS_BACKEND (backend);
+  GConfChangeSet       *changeset;
+
+  changeset = gconf_change_set_new ();
+  gconf_change_set_unset (changeset, key);
 
-  if (gconf_client_unset (gconf->priv->client, key, NULL))
+  if (gconf_settings_backend_commit (gconf, changeset))
     g_settings_backend_changed (backend, key, origin_tag);
+
+  gconf_change_set_unref (changeset);
 }
 
 static gboolean
@@ -788,20 +933,28 @@ gconf_settings_backend_get_writable (GSettingsBackend *backend,
                                      const gchar      *name)
 {
   GConfSettingsBackend *gconf = GCONF_SETTINGS_BACKEND (backend);
-  GConfValue *value;
+  GConfEntry *entry;
+  gboolean writable;
 
   /* We don't support checking writabality for a whole subpath, so we just say
    * it's not writable in such a case. */
   if (name[strlen(name) - 1] == '/')
     return FALSE;
 
-  value = gconf_client_get (gconf->priv->client, name, NULL);
-  if (value == NULL)
+  /* The entry knows whether it's writable, and comes from the cache for
+   * subscribed keys, unlike gconf_client_key_is_writable(). */
+  entry = gconf_client_get_entry (gconf->priv->client, name, NULL, TRUE, NULL);
+  if (entry == NULL)
     return TRUE;
+
+  if (gconf_entry_get_value (entry) == NULL)
+    writable = TRUE;
   else
-    gconf_value_free (value);
+    writable = gconf_entry_get_is_writable (entry);
 
-  return gconf_client_key_is_writable (gconf->priv->client, name, NULL);
+  gconf_entry_free (entry);
+
+  return writable;
 }
 
 static char *
@@ -826,6 +979,9 @@ gconf_settings_backend_notified (GConfClient          *client,
                                  GConfEntry           *entry,
                                  GConfSettingsBackend *gconf)
 {
+  if (g_strcmp0 (gconf_entry_get_origin (entry), gconf->priv->origin) == 0)
+    return;
+
   if (g_hash_table_lookup_extended (gconf->priv->ignore_notifications, entry->key,
                                     NULL, NULL))
     {
@@ -845,7 +1001,8 @@ gconf_settings_backend_subscribe (GSettingsBackend *backend,
 
   path = gconf_settings_backend_get_gconf_path_from_name (name);
   if (gconf_settings_backend_add_notifier (gconf, path))
-    gconf_client_add_dir (gconf->priv->client, path, GCONF_CLIENT_PRELOAD_ONELEVEL, NULL);
+    gconf_client_add_dir (gconf->priv->client, path, GCONF_CLIENT_PRELOAD_NONE, NULL);
+  gconf_settings_backend_prefetch (gconf, path);
   g_free (path);
 }
 
@@ -858,7 +1015,10 @@ gconf_settings_backend_unsubscribe (GSettingsBackend *backend,
 
   path = gconf_settings_backend_get_gconf_path_from_name (name);
   if (gconf_settings_backend_remove_notifier (gconf, path))
-    gconf_client_remove_dir (gconf->priv->client, path, NULL);
+    {
+      gconf_client_remove_dir (gconf->priv->client, path, NULL);
+      gconf_settings_backend_forget_prefetched (gconf, path);
+    }
   g_free (path);
 }
 
@@ -867,16 +1027,21 @@ gconf_settings_backend_finalize (GObject *object)
 {
   GConfSettingsBackend *gconf = GCONF_SETTINGS_BACKEND (object);
 
-  g_slist_foreach (gconf->priv->notifiers, (GFunc) gconf_settings_backend_free_notifier, gconf);
-  g_slist_free (gconf->priv->notifiers);
+  gconf_settings_backend_free_notifier (gconf->priv->notifiers, gconf);
   gconf->priv->notifiers = NULL;
 
   g_object_unref (gconf->priv->client);
   gconf->priv->client = NULL;
 
+  g_free (gconf->priv->origin);
+  gconf->priv->origin = NULL;
+
   g_hash_table_unref (gconf->priv->ignore_notifications);
   gconf->priv->ignore_notifications = NULL;
 
+  g_hash_table_unref (gconf->priv->prefetched);
+  gconf->priv->prefetched = NULL;
+
   G_OBJECT_CLASS (gconf_settings_backend_parent_class)
     ->finalize (object);
 }
@@ -888,9 +1053,12 @@ gconf_settings_backend_init (GConfSettingsBackend *gconf)
                                              GCONF_TYPE_SETTINGS_BACKEND,
                                              GConfSettingsBackendPrivate);
   gconf->priv->client = gconf_client_get_default ();
-  gconf->priv->notifiers = NULL;
+  gconf->priv->notifiers = gconf_settings_backend_new_notifier (NULL, "");
+  gconf->priv->origin = gconf_unique_key ();
   gconf->priv->ignore_notifications = g_hash_table_new_full (g_str_hash, g_str_equal,
                                                              g_free, NULL);
+  gconf->priv->prefetched = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                   g_free, NULL);
 }
 
 static void
@@ -19,6 +19,8 @@
  * Author: Matthias Clasen <mclasen@redhat.com>
  */
 
+#include "config.h"
+
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -32,6 +34,7 @@
 #include <gconf/gconf-client.h>
 
 static gboolean changed = FALSE;
+static gboolean failed = FALSE;
 static gboolean verbose = FALSE;
 static gboolean dry_run = FALSE;
 
@@ -110,22 +113,243 @@ type_uint32 (GSettings   *settings,
   return g_variant_type_equal (type, G_VARIANT_TYPE_UINT32);
 }
 
+/* The client is only set up once a file actually needs converting, so
+ * that a run with nothing to do doesn't touch the GConf sources at all.
+ */
+static GConfClient *client = NULL;
+
+/* GConf directory => (key => GConfEntry) of its user values */
+static GHashTable *user_values = NULL;
+
+/* Returns the user value of a GConf key, reading all of the values in
+ * its directory the first time one of them is asked for.
+ */
+static GConfValue *
+get_user_value (const gchar  *key,
+                GError      **error)
+{
+  GHashTable *entries;
+  gchar *dir;
+  GConfEntry *entry;
+
+  if (client == NULL)
+    {
+      client = get_writable_client ();
+      user_values = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                           g_free,
+                                           (GDestroyNotify) g_hash_table_unref);
+    }
+
+  dir = g_path_get_dirname (key);
+  entries = g_hash_table_lookup (user_values, dir);
+
+  if (entries == NULL)
+    {
+      GSList *list, *l;
+
+      list = gconf_client_all_entries (client, dir, error);
+      if (error && *error)
+        {
+          g_free (dir);
+          return NULL;
+        }
+
+      entries = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                       NULL, (GDestroyNotify) gconf_entry_unref);
+
+      for (l = list; l; l = l->next)
+        {
+          GConfEntry *e = l->data;
+
+          if (gconf_entry_get_value (e) != NULL && !gconf_entry_get_is_default (e))
+            g_hash_table_insert (entries, e->key, e);
+          else
+            gconf_entry_unref (e);
+        }
+      g_slist_free (list);
+
+      g_hash_table_insert (user_values, dir, entries);
+    }
+  else
+    g_free (dir);
+
+  entry = g_hash_table_lookup (entries, key);
+  if (entry == NULL)
+    return NULL;
+
+  return gconf_value_copy (gconf_entry_get_value (entry));
+}
+
+static void
+convert_value (GSettings   *settings,
+               const gchar *key,
+               GConfValue  *value)
+{
+  GVariantBuilder *builder;
+  GVariant *v;
+  const gchar *s;
+  gchar *str;
+  gint ii;
+  GSList *list, *l;
+
+  switch (value->type)
+    {
+    case GCONF_VALUE_STRING:
+      if (dry_run)
+        g_print ("Set key '%s' to string '%s'\n", key,
+                 gconf_value_get_string (value));
+      else
+        g_settings_set (settings, key, "s",
+                        gconf_value_get_string (value));
+      break;
+
+    case GCONF_VALUE_INT:
+      if (dry_run)
+        g_print ("Set key '%s' to integer '%d'\n",
+                 key, gconf_value_get_int (value));
+      else
+        {
+          GVariant *range;
+          gchar *type;
+
+          range = g_settings_get_range (settings, key);
+          g_variant_get (range, "(&sv)", &type, NULL);
+
+          if (strcmp (type, "enum") == 0)
+            g_settings_set_enum (settings, key, gconf_value_get_int (value));
+          else if (strcmp (type, "flags") == 0)
+            g_settings_set_flags (settings, key, gconf_value_get_int (value));
+          else if (type_uint32 (settings, key))
+            g_settings_set (settings, key, "u",
+                            gconf_value_get_int (value));
+          else
+            g_settings_set (settings, key, "i",
+                            gconf_value_get_int (value));
+
+          g_variant_unref (range);
+        }
+      break;
+
+    case GCONF_VALUE_BOOL:
+      if (dry_run)
+        g_print ("Set key '%s' to boolean '%d'\n",
+                 key, gconf_value_get_bool (value));
+      else
+        g_settings_set (settings, key, "b",
+                        gconf_value_get_bool (value));
+      break;
+
+    case GCONF_VALUE_FLOAT:
+      if (dry_run)
+        g_print ("Set key '%s' to double '%g'\n",
+                 key, gconf_value_get_float (value));
+      else
+        g_settings_set (settings, key, "d",
+                        gconf_value_get_float (value));
+      break;
+
+    case GCONF_VALUE_LIST:
+      switch (gconf_value_get_list_type (value))
+        {
+        case GCONF_VALUE_STRING:
+          builder = g_variant_builder_new (G_VARIANT_TYPE_ARRAY);
+          list = gconf_value_peek_list (value);
+          if (list != NULL)
+            {
+              for (l = list; l; l = l->next)
+                {
+                  GConfValue *lv = l->data;
+                  s = gconf_value_get_string (lv);
+                  g_variant_builder_add (builder, "s", s);
+                }
+              v = g_variant_new ("as", builder);
+            }
+          else
+            v = g_variant_new_array (G_VARIANT_TYPE_STRING, NULL, 0);
+          g_variant_ref_sink (v);
+
+          if (dry_run)
+            {
+              str = g_variant_print (v, FALSE);
+              g_print ("Set key '%s' to a list of strings: %s\n",
+                       key, str);
+              g_free (str);
+            }
+          else
+            g_settings_set_value (settings, key, v);
+
+          g_variant_unref (v);
+          g_variant_builder_unref (builder);
+          break;
+
+        case GCONF_VALUE_INT:
+          builder = g_variant_builder_new (G_VARIANT_TYPE_ARRAY);
+          list = gconf_value_peek_list (value);
+          if (list != NULL)
+            {
+              for (l = list; l; l = l->next)
+                {
+                  GConfValue *lv = l->data;
+                  ii = gconf_value_get_int (lv);
+                  g_variant_builder_add (builder, "i", ii);
+                }
+              v = g_variant_new ("ai", builder);
+            }
+          else
+            v = g_variant_new_array (G_VARIANT_TYPE_INT32, NULL, 0);
+          g_variant_ref_sink (v);
+
+          if (dry_run)
+            {
+              str = g_variant_print (v, FALSE);
+              g_print ("Set key '%s' to a list of integers: %s\n",
+                       key, str);
+              g_free (str);
+            }
+          else
+            g_settings_set_value (settings, key, v);
+
+          g_variant_unref (v);
+          g_variant_builder_unref (builder);
+          break;
+
+        default:
+          g_printerr ("Keys of type 'list of %s' not handled yet\n",
+                      gconf_value_type_to_string (gconf_value_get_list_type (value)));
+          break;
+        }
+      break;
+
+    default:
+      g_printerr ("Keys of type %s not handled yet\n",
+                  gconf_value_type_to_string (value->type));
+      break;
+    }
+}
+
+typedef struct {
+  gchar      *key;
+  GConfValue *value;
+} Conversion;
+
+static void
+conversion_free (Conversion *conversion)
+{
+  g_free (conversion->key);
+  gconf_value_free (conversion->value);
+  g_slice_free (Conversion, conversion);
+}
+
 static gboolean
 handle_file (const gchar *filename)
 {
   GKeyFile *keyfile;
-  GConfClient *client;
   GConfValue *value;
   gint i, j;
   gchar *gconf_key;
   gchar **groups;
   gchar **keys;
-  GVariantBuilder *builder;
-  GVariant *v;
-  const gchar *s;
-  gchar *str;
-  gint ii;
-  GSList *list, *l;
+  GSList *conversions, *l;
   GSettingsSchemaSource *source;
   GSettingsSchema *schema;
   GSettings *settings;
@@ -145,7 +369,6 @@ handle_file (const gchar *filename)
       return FALSE;
     }
 
-  client = get_writable_client ();
   source = g_settings_schema_source_get_default ();
 
   groups = g_key_file_get_groups (keyfile, NULL);
@@ -176,24 +399,22 @@ handle_file (const gchar *filename)
             g_print ("for storage at '%s'\n", schema_path[1]);
         }
 
-      if (schema_path[1] != NULL)
-        settings = g_settings_new_with_path (schema_path[0], schema_path[1]);
-      else
-        settings = g_settings_new (schema_path[0]);
-
-      g_settings_delay (settings);
-
       error = NULL;
       if ((keys = g_key_file_get_keys (keyfile, groups[i], NULL, &error)) == NULL)
         {
           g_printerr ("%s", error->message);
           g_error_free (error);
 
+          g_strfreev (schema_path);
           continue;
         }
 
+      conversions = NULL;
+
       for (j = 0; keys[j]; j++)
         {
+          Conversion *conversion;
+
           if (strchr (keys[j], '/') != 0)
             {
               g_printerr ("Key '%s' contains a '/'\n", keys[j]);
@@ -211,7 +432,7 @@ handle_file (const gchar *filename)
             }
 
           error = NULL;
-          if ((value = gconf_client_get_without_default (client, gconf_key, &error)) == NULL)
+          if ((value = get_user_value (gconf_key, &error)) == NULL)
             {
               if (error)
                 {
@@ -231,156 +452,54 @@ handle_file (const gchar *filename)
               continue;
             }
 
-          switch (value->type)
-            {
-            case GCONF_VALUE_STRING:
-              if (dry_run)
-                g_print ("Set key '%s' to string '%s'\n", keys[j],
-                         gconf_value_get_string (value));
-              else
-                g_settings_set (settings, keys[j], "s",
-                                gconf_value_get_string (value));
-              break;
-
-            case GCONF_VALUE_INT:
-              if (dry_run)
-                g_print ("Set key '%s' to integer '%d'\n",
-                         keys[j], gconf_value_get_int (value));
-              else
-                {
-                  GVariant *range;
-                  gchar *type;
-
-                  range = g_settings_get_range (settings, keys[j]);
-                  g_variant_get (range, "(&sv)", &type, NULL);
-
-                  if (strcmp (type, "enum") == 0)
-                    g_settings_set_enum (settings, keys[j], gconf_value_get_int (value));
-                  else if (strcmp (type, "flags") == 0)
-                    g_settings_set_flags (settings, keys[j], gconf_value_get_int (value));
-                  else if (type_uint32 (settings, keys[j]))
-                    g_settings_set (settings, keys[j], "u",
-                                    gconf_value_get_int (value));
-                  else
-                    g_settings_set (settings, keys[j], "i",
-                                    gconf_value_get_int (value));
-
-                  g_variant_unref (range);
-                }
-              break;
+          conversion = g_slice_new (Conversion);
+          conversion->key = g_strdup (keys[j]);
+          conversion->value = value;
+          conversions = g_slist_prepend (conversions, conversion);
 
-            case GCONF_VALUE_BOOL:
-              if (dry_run)
-                g_print ("Set key '%s' to boolean '%d'\n",
-                         keys[j], gconf_value_get_bool (value));
-              else
-                g_settings_set (settings, keys[j], "b",
-                                gconf_value_get_bool (value));
-              break;
-
-            case GCONF_VALUE_FLOAT:
-              if (dry_run)
-                g_print ("Set key '%s' to double '%g'\n",
-                         keys[j], gconf_value_get_float (value));
-              else
-                g_settings_set (settings, keys[j], "d",
-                                gconf_value_get_float (value));
-              break;
+          g_free (gconf_key);
+        }
 
-            case GCONF_VALUE_LIST:
-              switch (gconf_value_get_list_type (value))
-                {
-                case GCONF_VALUE_STRING:
-                  builder = g_variant_builder_new (G_VARIANT_TYPE_ARRAY);
-                  list = gconf_value_get_list (value);
-                  if (list != NULL)
-                    {
-                      for (l = list; l; l = l->next)
-                        {
-                          GConfValue *lv = l->data;
-                          s = gconf_value_get_string (lv);
-                          g_variant_builder_add (builder, "s", s);
-                        }
-                      v = g_variant_new ("as", builder);
-                    }
-                  else
-                    v = g_variant_new_array (G_VARIANT_TYPE_STRING, NULL, 0);
-                  g_variant_ref_sink (v);
-
-                  if (dry_run)
-                    {
-                      str = g_variant_print (v, FALSE);
-                      g_print ("Set key '%s' to a list of strings: %s\n",
-                               keys[j], str);
-                      g_free (str);
-                    }
-                  else
-                    g_settings_set_value (settings, keys[j], v);
-
-                  g_variant_unref (v);
-                  g_variant_builder_unref (builder);
-                  break;
-
-                case GCONF_VALUE_INT:
-                  builder = g_variant_builder_new (G_VARIANT_TYPE_ARRAY);
-                  list = gconf_value_get_list (value);
-                  if (list != NULL)
-                    {
-                      for (l = list; l; l = l->next)
-                        {
-                          GConfValue *lv = l->data;
-                          ii = gconf_value_get_int (lv);
-                          g_variant_builder_add (builder, "i", ii);
-                        }
-                      v = g_variant_new ("ai", builder);
-                    }
-                  else
-                    v = g_variant_new_array (G_VARIANT_TYPE_INT32, NULL, 0);
-                  g_variant_ref_sink (v);
-
-                  if (dry_run)
-                    {
-                      str = g_variant_print (v, FALSE);
-                      g_print ("Set key '%s' to a list of integers: %s\n",
-                               keys[j], str);
-                      g_free (str);
-                    }
-                  else
-                    g_settings_set_value (settings, keys[j], v);
-
-                  g_variant_unref (v);
-                  g_variant_builder_unref (builder);
-                  break;
-
-                default:
-                  g_printerr ("Keys of type 'list of %s' not handled yet\n",
-                              gconf_value_type_to_string (gconf_value_get_list_type (value)));
-                  break;
-                }
-              break;
+      g_strfreev (keys);
 
-            default:
-              g_printerr ("Keys of type %s not handled yet\n",
-                          gconf_value_type_to_string (value->type));
-              break;
+      /* Only bother GSettings when there is something to write, and then
+       * write it all in one batch.
+       */
+      if (conversions != NULL)
+        {
+          conversions = g_slist_reverse (conversions);
+
+          if (schema_path[1] != NULL)
+            settings = g_settings_new_with_path (schema_path[0], schema_path[1]);
+          else
+            settings = g_settings_new (schema_path[0]);
+
+          g_settings_delay (settings);
+
+          for (l = conversions; l; l = l->next)
+            {
+              Conversion *conversion = l->data;
+
+              convert_value (settings, conversion->key, conversion->value);
             }
 
-          gconf_value_free (value);
-          g_free (gconf_key);
-        }
+          if (!dry_run)
+            g_settings_apply (settings);
 
-      g_strfreev (keys);
+          g_object_unref (settings);
 
-      if (!dry_run)
-        g_settings_apply (settings);
+          g_slist_foreach (conversions, (GFunc) conversion_free, NULL);
+          g_slist_free (conversions);
+        }
+      else if (verbose)
+        g_print ("No user values for schema '%s'\n", schema_path[0]);
 
-      g_object_unref (settings);
       g_strfreev (schema_path);
     }
 
   g_strfreev (groups);
 
-  g_object_unref (client);
+  g_key_file_free (keyfile);
 
   return TRUE;
 }
@@ -441,6 +560,8 @@ handle_dir (const gchar *dirname,
           g_hash_table_insert (converted, myname, myname);
           changed = TRUE;
         }
+      else
+        failed = TRUE;
 
       g_free (filename);
 
@@ -495,8 +616,94 @@ set_string_set (GKeyFile    *keyfile,
   g_string_free (list, TRUE);
 }
 
+static gint
+compare_names (gconstpointer a,
+               gconstpointer b)
+{
+  return strcmp (*(const gchar **) a, *(const gchar **) b);
+}
+
+/* A hash of the names, sizes and modification times of all installed
+ * conversion files.  While it matches the one saved with the state,
+ * there is nothing new to convert and we don't need to look further.
+ */
+static gchar *
+compute_stamp (void)
+{
+  const gchar * const *data_dirs;
+  GChecksum *checksum;
+  gchar *stamp;
+  gint i;
+
+  checksum = g_checksum_new (G_CHECKSUM_SHA256);
+
+  data_dirs = g_get_system_data_dirs ();
+  for (i = 0; data_dirs[i]; i++)
+    {
+      gchar *convert_dir;
+      GDir *dir;
+      GPtrArray *names;
+      const gchar *name;
+      guint j;
+
+      convert_dir = g_build_filename (data_dirs[i], "GConf", "gsettings", NULL);
+
+      dir = g_dir_open (convert_dir, 0, NULL);
+      if (dir == NULL)
+        {
+          g_free (convert_dir);
+          continue;
+        }
+
+      /* Directory order isn't stable */
+      names = g_ptr_array_new_with_free_func (g_free);
+      while ((name = g_dir_read_name (dir)) != NULL)
+        g_ptr_array_add (names, g_strdup (name));
+      g_dir_close (dir);
+
+      g_ptr_array_sort (names, compare_names);
+
+      for (j = 0; j < names->len; j++)
+        {
+          struct stat statbuf;
+          gchar *filename;
+          gchar *str;
+
+          filename = g_build_filename (convert_dir, g_ptr_array_index (names, j), NULL);
+
+          if (stat (filename, &statbuf) == 0)
+            {
+              long mtime_nsec;
+
+#ifdef HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC
+              mtime_nsec = statbuf.st_mtim.tv_nsec;
+#else
+              mtime_nsec = 0;
+#endif
+
+              str = g_strdup_printf ("%s\n%" G_GINT64_FORMAT "\n%ld.%09ld\n", filename,
+                                     (gint64) statbuf.st_size,
+                                     (long) statbuf.st_mtime, mtime_nsec);
+              g_checksum_update (checksum, (const guchar *) str, -1);
+              g_free (str);
+            }
+
+          g_free (filename);
+        }
+
+      g_ptr_array_free (names, TRUE);
+      g_free (convert_dir);
+    }
+
+  stamp = g_strdup (g_checksum_get_string (checksum));
+  g_checksum_free (checksum);
+
+  return stamp;
+}
+
 static GHashTable *
-load_state (time_t *mtime)
+load_state (time_t  *mtime,
+            gchar  **stamp)
 {
   GHashTable *converted;
   GHashTable *tmp;
@@ -507,6 +714,7 @@ load_state (time_t *mtime)
 
   converted = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
   *mtime = 0;
+  *stamp = NULL;
 
   filename = g_build_filename (g_get_user_data_dir (), "gsettings-data-convert", NULL);
   keyfile = g_key_file_new ();
@@ -535,6 +743,9 @@ load_state (time_t *mtime)
       g_free (str);
     }
 
+  /* Not there in state saved by older versions */
+  *stamp = g_key_file_get_string (keyfile, "State", "stamp", NULL);
+
   error = NULL;
   if ((tmp = get_string_set (keyfile, "State", "converted", &error)) == NULL)
     {
@@ -554,7 +765,9 @@ load_state (time_t *mtime)
 }
 
 static gboolean
-save_state (GHashTable *converted)
+save_state (GHashTable  *converted,
+            time_t       mtime,
+            const gchar *stamp)
 {
   gchar *filename;
   GKeyFile *keyfile;
@@ -573,11 +786,14 @@ save_state (GHashTable *converted)
   filename = g_build_filename (g_get_user_data_dir (), "gsettings-data-convert", NULL);
   keyfile = g_key_file_new ();
 
-  str = g_strdup_printf ("%ld", time (NULL));
+  str = g_strdup_printf ("%ld", (long) mtime);
   g_key_file_set_string (keyfile,
                          "State", "timestamp", str);
   g_free (str);
 
+  if (stamp != NULL)
+    g_key_file_set_string (keyfile, "State", "stamp", stamp);
+
   set_string_set (keyfile, "State", "converted", converted);
 
   str = g_key_file_to_data (keyfile, NULL, NULL);
@@ -604,6 +820,8 @@ int
 main (int argc, char *argv[])
 {
   time_t stored_mtime;
+  gchar *stored_stamp;
+  gchar *stamp;
   const gchar * const *data_dirs;
   gint i;
   GError *error;
@@ -633,7 +851,16 @@ main (int argc, char *argv[])
       return 1;
     }
 
-  converted = load_state (&stored_mtime);
+  converted = load_state (&stored_mtime, &stored_stamp);
+
+  stamp = compute_stamp ();
+
+  if (extra_file == NULL && g_strcmp0 (stamp, stored_stamp) == 0)
+    {
+      if (verbose)
+        g_print ("Conversion files unchanged, nothing to do\n");
+      return 0;
+    }
 
   if (extra_file)
     {
@@ -655,6 +882,8 @@ main (int argc, char *argv[])
               g_hash_table_insert (converted, myname, myname);
               changed = TRUE;
             }
+          else
+            failed = TRUE;
         }
 
       g_free (base);
@@ -673,12 +902,29 @@ main (int argc, char *argv[])
       g_free (convert_dir);
     }
 
-  if (changed && !dry_run)
+  /* If a file couldn't be converted, remember what was, but keep the
+   * old timestamp and stamp so that the next run tries it again.
+   * Otherwise also save when only the stamp changed, so the next run
+   * is quick.
+   */
+  if (failed)
+    {
+      if (changed && !dry_run &&
+          !save_state (converted, stored_mtime, stored_stamp))
+        return 1;
+    }
+  else if ((changed || g_strcmp0 (stamp, stored_stamp) != 0) && !dry_run)
     {
-      if (!save_state (converted))
+      if (!save_state (converted, time (NULL), stamp))
         return 1;
     }
 
+  if (client != NULL)
+    {
+      g_hash_table_unref (user_values);
+      g_object_unref (client);
+    }
+
   return 0;
 }
 
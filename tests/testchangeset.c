@@ -45,6 +45,7 @@
 
 #include <gconf/gconf.h>
 #include <gconf/gconf-changeset.h>
+#include <gconf/gconf-client.h>
 #include <stdio.h>
 #include <locale.h>
 #include <unistd.h>
@@ -287,6 +288,77 @@ check_string_storage(GConfEngine* conf)
   check_unset(conf);
 }
 
+static void
+own_unset_notify (GConfClient* client,
+                  guint cnxn_id,
+                  GConfEntry* entry,
+                  gpointer user_data)
+{
+  const gchar* origin = user_data;
+
+  if (strcmp (entry->key, keys[0]) != 0)
+    return;
+
+  check (g_strcmp0 (gconf_entry_get_origin (entry), origin) == 0,
+         "notification for an own unset of `%s' doesn't carry its origin",
+         entry->key);
+}
+
+static gboolean
+quit_loop (gpointer data)
+{
+  g_main_loop_quit (data);
+  return FALSE;
+}
+
+static void
+check_unset_origin (void)
+{
+  GConfClient* client;
+  GConfChangeSet* cs;
+  GMainLoop* loop;
+  GError* err = NULL;
+  gchar* origin;
+  gboolean tagged = FALSE;
+  guint cnxn;
+
+  client = gconf_client_get_default ();
+  origin = gconf_unique_key ();
+  loop = g_main_loop_new (NULL, FALSE);
+
+  gconf_client_add_dir (client, "/testing", GCONF_CLIENT_PRELOAD_NONE, NULL);
+  gconf_client_set_string (client, keys[0], "unset me", &err);
+  check (err == NULL, "set `%s' before unsetting it", keys[0]);
+
+  /* Let the notification for the set go by */
+  g_timeout_add (500, quit_loop, loop);
+  g_main_loop_run (loop);
+
+  cnxn = gconf_client_notify_add (client, "/testing", own_unset_notify,
+                                  origin, NULL, NULL);
+
+  cs = gconf_change_set_new ();
+  gconf_change_set_unset (cs, keys[0]);
+  gconf_client_commit_change_set_with_origin (client, cs, origin, &tagged, &err);
+  gconf_change_set_unref (cs);
+
+  check (err == NULL, "commit unset of `%s' with an origin", keys[0]);
+
+  /* Servers that can't tag commits have nothing to check */
+  if (tagged)
+    {
+      g_timeout_add (500, quit_loop, loop);
+      g_main_loop_run (loop);
+    }
+
+  gconf_client_notify_remove (client, cnxn);
+  gconf_client_remove_dir (client, "/testing", NULL);
+
+  g_main_loop_unref (loop);
+  g_free (origin);
+  g_object_unref (client);
+}
+
 int 
 main (int argc, char** argv)
 {
@@ -294,6 +366,8 @@ main (int argc, char** argv)
   GError* err = NULL;
 
   setlocale (LC_ALL, "");
+
+  g_type_init ();
   
   if (!gconf_init(argc, argv, &err))
     {
@@ -313,6 +387,10 @@ main (int argc, char** argv)
   
   gconf_engine_unref(conf);
 
+  printf("\nChecking that own unsets are notified with their origin:");
+
+  check_unset_origin ();
+
   printf("\n\n");
   
   return 0;
@@ -0,0 +1,149 @@
+/* GConf
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* This isn't an automated test; it times gets that the GConfClient
+ * cache answers, typed getters against gconf_client_get(), which
+ * copies the value out like the typed getters used to.
+ *
+ * Usage: testclientcache [ITERATIONS]
+ */
+
+#include <gconf/gconf.h>
+#include <gconf/gconf-client.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <locale.h>
+
+#define DIR "/testing/clientcache"
+
+static const gchar* int_key = DIR "/int";
+static const gchar* string_key = DIR "/string";
+static const gchar* bool_key = DIR "/bool";
+static const gchar* float_key = DIR "/float";
+
+static void
+report (const gchar* what, gint64 start, guint iterations)
+{
+  gint64 elapsed;
+
+  elapsed = g_get_monotonic_time () - start;
+
+  printf ("%-28s %8.1f ns/op\n", what,
+          (elapsed * 1000.0) / iterations);
+}
+
+int
+main (int argc, char** argv)
+{
+  GConfClient* client;
+  GError* err = NULL;
+  guint iterations = 1000000;
+  guint misses_before, misses_after;
+  gint64 start;
+  guint i;
+
+  setlocale (LC_ALL, "");
+
+  g_type_init ();
+
+  if (!gconf_init (argc, argv, &err))
+    {
+      fprintf (stderr, "Failed to init GConf: %s\n", err->message);
+      g_error_free (err);
+      return 1;
+    }
+
+  if (argc > 1)
+    iterations = MAX (1, atoi (argv[1]));
+
+  client = gconf_client_get_default ();
+
+  gconf_client_add_dir (client, DIR, GCONF_CLIENT_PRELOAD_NONE, NULL);
+
+  gconf_client_set_int (client, int_key, 42, NULL);
+  gconf_client_set_string (client, string_key,
+                           "a string too long to be stored inline", NULL);
+  gconf_client_set_bool (client, bool_key, TRUE, NULL);
+  gconf_client_set_float (client, float_key, 3.5, &err);
+
+  if (err != NULL)
+    {
+      fprintf (stderr, "Failed to set up the keys: %s\n", err->message);
+      g_error_free (err);
+      return 1;
+    }
+
+  /* Fill the cache */
+  gconf_client_preload (client, DIR, GCONF_CLIENT_PRELOAD_ONELEVEL, NULL);
+  gconf_client_get_cache_stats (client, NULL, &misses_before, NULL, NULL);
+
+  printf ("%u cached gets per getter\n", iterations);
+
+  start = g_get_monotonic_time ();
+  for (i = 0; i < iterations; ++i)
+    gconf_client_get_int (client, int_key, NULL);
+  report ("gconf_client_get_int", start, iterations);
+
+  start = g_get_monotonic_time ();
+  for (i = 0; i < iterations; ++i)
+    gconf_client_get_bool (client, bool_key, NULL);
+  report ("gconf_client_get_bool", start, iterations);
+
+  start = g_get_monotonic_time ();
+  for (i = 0; i < iterations; ++i)
+    gconf_client_get_float (client, float_key, NULL);
+  report ("gconf_client_get_float", start, iterations);
+
+  start = g_get_monotonic_time ();
+  for (i = 0; i < iterations; ++i)
+    g_free (gconf_client_get_string (client, string_key, NULL));
+  report ("gconf_client_get_string", start, iterations);
+
+  start = g_get_monotonic_time ();
+  for (i = 0; i < iterations; ++i)
+    {
+      GConfValue* val;
+
+      val = gconf_client_get (client, int_key, NULL);
+      gconf_value_get_int (val);
+      gconf_value_free (val);
+    }
+  report ("gconf_client_get (int)", start, iterations);
+
+  start = g_get_monotonic_time ();
+  for (i = 0; i < iterations; ++i)
+    {
+      GConfValue* val;
+
+      val = gconf_client_get (client, string_key, NULL);
+      g_free (g_strdup (gconf_value_get_string (val)));
+      gconf_value_free (val);
+    }
+  report ("gconf_client_get (string)", start, iterations);
+
+  gconf_client_get_cache_stats (client, NULL, &misses_after, NULL, NULL);
+  if (misses_after != misses_before)
+    printf ("warning: %u gets went to the server, timings include them\n",
+            misses_after - misses_before);
+
+  gconf_client_recursive_unset (client, DIR, 0, NULL);
+  gconf_client_remove_dir (client, DIR, NULL);
+  g_object_unref (client);
+
+  return 0;
+}
@@ -166,6 +166,282 @@ check_quoting(void)
 
 }
 
+static void
+check_value_sharing(void)
+{
+  GConfValue* orig;
+  GConfValue* copy;
+  GConfValue* elem;
+  GConfSchema* sc;
+  GSList* list = NULL;
+  gchar* stolen;
+  guint i;
+
+  /* Copies share contents until one of them is modified */
+  orig = gconf_value_new(GCONF_VALUE_STRING);
+  gconf_value_set_string(orig, "long enough not to be stored inline");
+  copy = gconf_value_copy(orig);
+
+  check (gconf_value_get_string(orig) == gconf_value_get_string(copy),
+         "copied string value does not share its contents");
+
+  stolen = gconf_value_steal_string(copy);
+  check (strcmp(stolen, gconf_value_get_string(orig)) == 0,
+         "stealing from a copy changed the original");
+  g_free(stolen);
+
+  gconf_value_set_string(copy, "changed");
+  check (strcmp(gconf_value_get_string(orig), "long enough not to be stored inline") == 0,
+         "setting a copy changed the original");
+
+  /* Short strings are stored inline */
+  gconf_value_set_string(orig, gconf_value_get_string(copy));
+  check (strcmp(gconf_value_get_string(orig), "changed") == 0,
+         "short string not set");
+  stolen = gconf_value_steal_string(orig);
+  check (strcmp(stolen, "changed") == 0 &&
+         gconf_value_get_string(orig) == NULL,
+         "stealing a short string failed");
+  g_free(stolen);
+
+  gconf_value_free(copy);
+  gconf_value_free(orig);
+
+  for (i = 0; i < n_ints; ++i)
+    {
+      elem = gconf_value_new(GCONF_VALUE_INT);
+      gconf_value_set_int(elem, ints[i]);
+      list = g_slist_prepend(list, elem);
+    }
+
+  orig = gconf_value_new(GCONF_VALUE_LIST);
+  gconf_value_set_list_type(orig, GCONF_VALUE_INT);
+  gconf_value_set_list_nocopy(orig, list);
+  copy = gconf_value_copy(orig);
+
+  check (gconf_value_peek_list(orig) == gconf_value_peek_list(copy),
+         "copied list value does not share its contents");
+
+  check (gconf_value_get_list_length(copy) == n_ints,
+         "list length is %u, expected %u",
+         gconf_value_get_list_length(copy), n_ints);
+
+  for (i = 0; i < n_ints; ++i)
+    {
+      elem = gconf_value_get_list_nth(copy, i);
+      check (elem != NULL &&
+             gconf_value_get_int(elem) == ints[n_ints - i - 1],
+             "list element %u is wrong", i);
+    }
+
+  check (gconf_value_get_list_nth(copy, n_ints) == NULL,
+         "list element past the end is not NULL");
+
+  /* The public getter hands out elements the caller may change */
+  elem = gconf_value_get_list(copy)->data;
+  gconf_value_set_int(elem, ints[n_ints - 1] + 1);
+  check (gconf_value_get_int(gconf_value_peek_list(orig)->data) == ints[n_ints - 1],
+         "changing an element of a copy's list changed the original");
+  check (gconf_value_get_list_nth(copy, 0) == elem,
+         "list index not rebuilt for the unshared list");
+
+  list = gconf_value_steal_list(copy);
+  check (g_slist_length(list) == n_ints &&
+         g_slist_length(gconf_value_get_list(orig)) == n_ints,
+         "stealing a list from a copy changed the original");
+  g_slist_foreach(list, (GFunc) gconf_value_free, NULL);
+  g_slist_free(list);
+
+  gconf_value_free(copy);
+
+  copy = gconf_value_copy(orig);
+  gconf_value_set_list_nocopy(copy, NULL);
+  check (g_slist_length(gconf_value_get_list(orig)) == n_ints,
+         "setting a list on a copy changed the original");
+
+  gconf_value_free(copy);
+  gconf_value_free(orig);
+
+  orig = gconf_value_new(GCONF_VALUE_PAIR);
+  elem = gconf_value_new(GCONF_VALUE_BOOL);
+  gconf_value_set_bool(elem, TRUE);
+  gconf_value_set_car_nocopy(orig, elem);
+  elem = gconf_value_new(GCONF_VALUE_STRING);
+  gconf_value_set_string(elem, "cdr");
+  gconf_value_set_cdr_nocopy(orig, elem);
+
+  copy = gconf_value_copy(orig);
+  elem = gconf_value_new(GCONF_VALUE_BOOL);
+  gconf_value_set_bool(elem, FALSE);
+  gconf_value_set_car_nocopy(copy, elem);
+
+  check (gconf_value_get_bool(gconf_value_get_car(orig)) &&
+         !gconf_value_get_bool(gconf_value_get_car(copy)),
+         "setting the car of a copy changed the original");
+  check (strcmp(gconf_value_get_string(gconf_value_get_cdr(copy)), "cdr") == 0,
+         "setting the car of a copy lost its cdr");
+
+  gconf_value_free(copy);
+  gconf_value_free(orig);
+
+  sc = gconf_schema_new();
+  gconf_schema_set_type(sc, GCONF_VALUE_INT);
+  gconf_schema_set_locale(sc, "C");
+  elem = gconf_value_new(GCONF_VALUE_INT);
+  gconf_value_set_int(elem, 42);
+  gconf_schema_set_default_value_nocopy(sc, elem);
+
+  orig = gconf_value_new(GCONF_VALUE_SCHEMA);
+  gconf_value_set_schema_nocopy(orig, sc);
+  copy = gconf_value_copy(orig);
+
+  check (gconf_value_peek_schema(orig) == gconf_value_peek_schema(copy),
+         "copied schema value does not share its contents");
+
+  /* So does the public getter */
+  gconf_value_free(copy);
+  copy = gconf_value_copy(orig);
+  gconf_schema_set_owner(gconf_value_get_schema(copy), "copy");
+  check (gconf_schema_get_owner(gconf_value_peek_schema(orig)) == NULL,
+         "changing the schema got from a copy changed the original");
+
+  gconf_value_free(copy);
+  copy = gconf_value_copy(orig);
+
+  /* What the backends and sources do to a looked-up schema */
+  sc = gconf_value_get_schema_writable(copy);
+  gconf_schema_set_locale(sc, "de");
+  elem = gconf_schema_steal_default_value(sc);
+  gconf_value_free(elem);
+
+  sc = gconf_value_get_schema(orig);
+  check (strcmp(gconf_schema_get_locale(sc), "C") == 0,
+         "changing the schema of a copy changed the original's locale");
+  check (gconf_schema_get_default_value(sc) != NULL &&
+         gconf_value_get_int(gconf_schema_get_default_value(sc)) == 42,
+         "stealing the default from a copy changed the original");
+  check (gconf_schema_get_default_value(gconf_value_get_schema(copy)) == NULL,
+         "default value not stolen from the copy");
+
+  gconf_value_free(copy);
+  gconf_value_free(orig);
+}
+
+static void
+check_binary_roundtrip(GConfValue* val)
+{
+  gchar* encoded;
+  gchar* s;
+  gsize len;
+  gsize i;
+  GConfValue* decoded;
+
+  s = gconf_value_to_string(val);
+
+  encoded = gconf_value_encode_binary(val, &len);
+  decoded = gconf_value_decode_binary(encoded, len);
+
+  check (decoded != NULL, "failed to decode binary encoding of `%s'", s);
+  check (gconf_value_compare(val, decoded) == 0,
+         "binary encoding of `%s' did not round-trip", s);
+
+  gconf_value_free(decoded);
+
+  /* Every truncation must be rejected, not misread */
+  for (i = 0; i < len; ++i)
+    {
+      decoded = gconf_value_decode_binary(encoded, i);
+      check (decoded == NULL,
+             "truncated binary encoding of `%s' (%u of %u bytes) was accepted",
+             s, (guint) i, (guint) len);
+    }
+
+  encoded[0] = GCONF_BINARY_ENCODING_VERSION + 1;
+  check (gconf_value_decode_binary(encoded, len) == NULL,
+         "binary encoding with an unknown version was accepted");
+
+  g_free(encoded);
+  g_free(s);
+}
+
+static void
+check_binary_encoding(void)
+{
+  GConfValue* val;
+  GConfValue* elem;
+  GConfSchema* sc;
+  GSList* list = NULL;
+  gchar* encoded;
+  gsize len;
+  guint i;
+
+  for (i = 0; i < n_ints; ++i)
+    {
+      val = gconf_value_new(GCONF_VALUE_INT);
+      gconf_value_set_int(val, ints[i]);
+      check_binary_roundtrip(val);
+      list = g_slist_prepend(list, val);
+    }
+
+  val = gconf_value_new(GCONF_VALUE_LIST);
+  gconf_value_set_list_type(val, GCONF_VALUE_INT);
+  gconf_value_set_list_nocopy(val, list);
+  check_binary_roundtrip(val);
+  gconf_value_free(val);
+
+  list = NULL;
+  for (i = 0; quote_success_tests[i] != NULL; ++i)
+    {
+      val = gconf_value_new(GCONF_VALUE_STRING);
+      gconf_value_set_string(val, quote_success_tests[i]);
+      check_binary_roundtrip(val);
+      list = g_slist_prepend(list, val);
+    }
+
+  val = gconf_value_new(GCONF_VALUE_LIST);
+  gconf_value_set_list_type(val, GCONF_VALUE_STRING);
+  gconf_value_set_list_nocopy(val, list);
+  check_binary_roundtrip(val);
+
+  sc = gconf_schema_new();
+  gconf_schema_set_type(sc, GCONF_VALUE_LIST);
+  gconf_schema_set_list_type(sc, GCONF_VALUE_STRING);
+  gconf_schema_set_locale(sc, "C");
+  gconf_schema_set_short_desc(sc, "Short \"description\"");
+  gconf_schema_set_long_desc(sc, "Long description, with a comma");
+  gconf_schema_set_owner(sc, "testencode");
+  gconf_schema_set_default_value_nocopy(sc, val);
+
+  val = gconf_value_new(GCONF_VALUE_SCHEMA);
+  gconf_value_set_schema_nocopy(val, sc);
+  check_binary_roundtrip(val);
+  gconf_value_free(val);
+
+  /* A schema value without a schema; gconf_value_compare() can't
+   * handle those, so check by hand
+   */
+  val = gconf_value_new(GCONF_VALUE_SCHEMA);
+  encoded = gconf_value_encode_binary(val, &len);
+  gconf_value_free(val);
+  val = gconf_value_decode_binary(encoded, len);
+  check (val != NULL && val->type == GCONF_VALUE_SCHEMA &&
+         gconf_value_get_schema(val) == NULL,
+         "schema value without a schema did not round-trip");
+  if (val != NULL)
+    gconf_value_free(val);
+  g_free(encoded);
+
+  val = gconf_value_new(GCONF_VALUE_PAIR);
+  elem = gconf_value_new(GCONF_VALUE_FLOAT);
+  gconf_value_set_float(elem, -3.25);
+  gconf_value_set_car_nocopy(val, elem);
+  elem = gconf_value_new(GCONF_VALUE_BOOL);
+  gconf_value_set_bool(elem, TRUE);
+  gconf_value_set_cdr_nocopy(val, elem);
+  check_binary_roundtrip(val);
+  gconf_value_free(val);
+}
+
 int 
 main (int argc, char** argv)
 {
@@ -176,6 +452,14 @@ main (int argc, char** argv)
   
   check_quoting();
 
+  printf("\nChecking value sharing:");
+
+  check_value_sharing();
+
+  printf("\nChecking binary encoding:");
+
+  check_binary_encoding();
+
   printf("\n\n");
   
   return 0;